@@ -8,58 +8,149 @@
 
 #include  <stdio.h>
 #include  <stdlib.h>
+#include  <string.h>
 #include  "ast.h"
 #include  "util.h"
 
-AST_List *AST_root;
+/* 副種別毎の子の数 */
+static const unsigned char ast_num_child[] = {
+    2,		/* AST_SUB_NONE (AST_KIND_FUNC) */
+    0,		/* AST_STM_LIST        */
+    0,		/* AST_STM_DEC         */
+    1,		/* AST_STM_ASIGN       */
+    3,		/* AST_STM_IF          */
+    2,		/* AST_STM_WHILE       */
+    4,		/* AST_STM_FOR         */
+    2,		/* AST_STM_DOWHILE     */
+    1,		/* AST_STM_RETURN      */
+    2,		/* AST_EXP_ASGN        */
+    0,		/* AST_EXP_IDENT       */
+    0,		/* AST_EXP_CNST_INT    */
+    1,		/* AST_EXP_PRIME       */
+    1,		/* AST_EXP_CALL        */
+    1,		/* AST_EXP_PARAM       */
+    1,		/* AST_EXP_UNARY_PLUS  */
+    1,		/* AST_EXP_UNARY_MINUS */
+    2,		/* AST_EXP_MUL         */
+    2,		/* AST_EXP_DIV         */
+    2,		/* AST_EXP_ADD         */
+    2,		/* AST_EXP_SUB         */
+    2,		/* AST_EXP_LT          */
+    2,		/* AST_EXP_GT          */
+    2,		/* AST_EXP_LTE         */
+    2,		/* AST_EXP_GTE         */
+    2,		/* AST_EXP_EQ          */
+    2		/* AST_EXP_NE          */
+};
 
 AST_Node*
-create_AST_Node(int kind, int sub_kind)
+create_AST_Node(Arena *a, int kind, int sub_kind)
 {
     AST_Node *p;
+    int  n;
 
-    p = xcalloc(1, sizeof(AST_Node));
+    n = ast_num_child[sub_kind];
+    p = arena_alloc(a, sizeof(AST_Node)+n*sizeof(AST_Node*), ALLOC_AST_NODE);
     p->kind = kind;
     p->sub_kind = sub_kind;
+    p->num_child = n;
     return  p;
 }
 
 AST_Node*
-create_AST_Exp(int sub_kind)
+create_AST_Exp(Arena *a, int sub_kind)
 {
-    return create_AST_Node(AST_KIND_EXP, sub_kind);
+    return create_AST_Node(a, AST_KIND_EXP, sub_kind);
 }
 
 AST_Node*
-create_AST_Stm(int sub_kind, int line)
+create_AST_Stm(Arena *a, int sub_kind, int line)
 {
-    AST_Node *s = create_AST_Node(AST_KIND_STM, sub_kind);
+    AST_Node *s = create_AST_Node(a, AST_KIND_STM, sub_kind);
     s->lineno = line;
     return s;
 }
 
-/* リストlにノードnの要素を追加し、追加した要素のポインタを返す。
-   lはリストの先頭要素である。また、lはNULLでも良い。 */
+#define  LIST_MIN_SIZE  4
+
+/* 並びlの末尾にノードnを追加し、追加後の並びを返す。
+   lはNULLでも良い。lの領域は再確保されることがあるので、
+   以降は返された並びを使うこと。並びは領域aから確保する */
 AST_List*
-append_AST_List(AST_List *l, AST_Node *n)
+append_AST_List(Arena *a, AST_List *l, AST_Node *n)
 {
     AST_List *p;
+    int  size;
 
-    p = xcalloc(1, sizeof(AST_List));
-    p->elem = n;
-    if (n != NULL) {
-	n->parent_list = p;
+    if (l == NULL || l->num == l->size) {
+	/* 古い配列は領域ごと解放されるまでそのまま残す */
+	size = (l == NULL) ? LIST_MIN_SIZE : l->size*2;
+	p = arena_alloc(a, sizeof(AST_List)+size*sizeof(AST_Node*), ALLOC_AST_LIST);
+	p->size = size;
+	if (l != NULL) {
+	    p->num = l->num;
+	    memcpy(p->elem, l->elem, l->num*sizeof(AST_Node*));
+	}
+	l = p;
     }
-    if (l != NULL) {
-	l->prev->next = p;
-	p->prev = l->prev;
-	l->prev = p;
-	p->next = l;
-    } else {
-	p->prev = p->next = p;
+    l->elem[l->num++] = n;
+
+    return l;
+}
+
+#define  STACK_MIN_SIZE  64
+
+void
+init_AST_Stack(AST_Stack *s)
+{
+    memset(s, 0, sizeof(AST_Stack));
+}
+
+void
+free_AST_Stack(AST_Stack *s)
+{
+    xfree(s->frame);
+    init_AST_Stack(s);
+}
+
+void
+push_AST_Stack(AST_Stack *s, AST_Node *n)
+{
+    if (s->num == s->size) {
+	s->size = (s->size == 0) ? STACK_MIN_SIZE : s->size*2;
+	s->frame = xrealloc(s->frame, s->size*sizeof(AST_Frame));
     }
+    s->frame[s->num].n = n;
+    s->frame[s->num].state = 0;
+    s->num++;
+}
+
+void
+count_AST(AST_Node *n, long *nodes, long *cells)
+{
+    AST_Stack  st;
+    AST_Node *e;
+    int  i;
 
-    return p;
+    if (n == NULL) {
+	return;
+    }
+    init_AST_Stack(&st);
+    push_AST_Stack(&st, n);
+    while (st.num > 0) {
+	n = st.frame[--st.num].n;
+	(*nodes)++;
+	if (n->list != NULL) {
+	    *cells += n->list->num;
+	    TRAVERSE_AST_LIST(e, n->list, push_AST_Stack(&st, e));
+	}
+	for (i = 0; i < n->num_child; i++) {
+	    if (n->child[i] != NULL) {
+		push_AST_Stack(&st, n->child[i]);
+	    }
+	}
+    }
+    free_AST_Stack(&st);
 }
 
 const char kind_name[][20] = {
@@ -106,40 +197,69 @@ const char sub_name[][20] = {
       -> exp
 */
 
-static void indent();
-static void dump_ast_func(AST_Node *f);
-static void dump_ast_stm(AST_Node *s);
-static void dump_ast_exp(AST_Node *e);
+/* 出力中の状態 */
+typedef struct Dump {
+    Emit  *out;
+    int  indent_count;
+    AST_Stack  stack;		/* 式の巡回用 */
+} Dump;
 
-static int  indent_count;
+static void indent(Dump *d);
+static void dump_ast_func(Dump *d, AST_Node *f);
+static void dump_ast_stm(Dump *d, AST_Node *s);
+static void dump_ast_dec(Dump *d, AST_List *l);
+static void dump_ast_exp(Dump *d, AST_Node *e);
+static void dump_ast_json(Dump *d, AST_Node *n);
+static void dump_ast_json_list(Dump *d, AST_List *l);
 
 void
-indent()
+indent(Dump *d)
 {
     int i;
-    for (i = 0; i < indent_count; i++) {
-	fputs(" ", stderr);
+    for (i = 0; i < d->indent_count; i++) {
+	emit_char(d->out, ' ');
     }
 }
 
+/*
+ * ASTの出力
+ * stageはDUMP_AST（構文解析直後）かDUMP_AST_REG（レジスタ割り付け後）
+ * テキスト形式では区別しない
+ */
 void
-dump_ast()
+dump_ast(AST_List *root, Emit *out, int format, int stage)
 {
-    AST_List *l;
-
-    fputs("root\n", stderr);
+    AST_Node *f;
+    Dump  dd, *d = &dd;
 
-    if (AST_root == NULL) {
+    if (root == NULL) {
 	errexit("Invalid AST root.\n", __FILE__, __LINE__);
     }
-    indent_count++;
-    TRAVERSE_AST_LIST(l, AST_root, dump_ast_func(l->elem));
+    d->out = out;
+    d->indent_count = 0;
+    init_AST_Stack(&d->stack);
+    if (format == DUMP_FORMAT_JSON) {
+	EMIT_LIT(d->out, "{\"dump\":");
+	if (stage == DUMP_AST_REG) {
+	    EMIT_LIT(d->out, "\"ast-reg\"");
+	} else {
+	    EMIT_LIT(d->out, "\"ast\"");
+	}
+	EMIT_LIT(d->out, ",\"funcs\":");
+	dump_ast_json_list(d, root);
+	EMIT_LIT(d->out, "}\n");
+    } else {
+	EMIT_LIT(d->out, "root\n");
+	d->indent_count = 1;
+	TRAVERSE_AST_LIST(f, root, dump_ast_func(d, f));
+    }
+    free_AST_Stack(&d->stack);
 }
 
 void
-dump_ast_func(AST_Node *f)
+dump_ast_func(Dump *d, AST_Node *f)
 {
-    AST_List *l;
+    AST_Node *n;
 
     if (f == NULL) {
 	return;
@@ -147,119 +267,264 @@ dump_ast_func(AST_Node *f)
     if (f->kind != AST_KIND_FUNC) {
 	errexit("function kind is required here.", __FILE__, __LINE__);
     }
-    indent();
-    fputs("func[", stderr);
-    dump_ast_exp(f->child[0]);
-    fputs("] (", stderr);
-    TRAVERSE_AST_LIST(l, f->list, dump_ast_exp(l->elem));
-    fprintf(stderr, ")\n");
-    indent_count++;
-    TRAVERSE_AST_LIST(l, f->child[1]->list, dump_ast_stm(l->elem));
-    indent_count--;
-    fputs("\n", stderr);
+    indent(d);
+    EMIT_LIT(d->out, "func[");
+    dump_ast_exp(d, f->child[0]);
+    EMIT_LIT(d->out, "] (");
+    TRAVERSE_AST_LIST(n, f->list, dump_ast_exp(d, n));
+    EMIT_LIT(d->out, ")\n");
+    d->indent_count++;
+    TRAVERSE_AST_LIST(n, f->child[1]->list, dump_ast_stm(d, n));
+    d->indent_count--;
+    emit_char(d->out, '\n');
 }
 
 void
-dump_ast_stm(AST_Node *s)
+dump_ast_stm(Dump *d, AST_Node *s)
 {
-    AST_List *l;
+    AST_Node *n;
 
     if (s == NULL) {
 	return;
     }
-    indent();
-    fprintf(stderr, "l(%d): %s(", s->lineno, sub_name[s->sub_kind]);
+    indent(d);
+    EMIT_LIT(d->out, "l(");
+    emit_int(d->out, s->lineno);
+    EMIT_LIT(d->out, "): ");
+    emit_str(d->out, sub_name[s->sub_kind]);
+    emit_char(d->out, '(');
 
     switch (s->sub_kind) {
     case  AST_STM_LIST:
-	fputs("\n", stderr);
-	indent_count++;
-	TRAVERSE_AST_LIST(l, s->list, dump_ast_stm(l->elem));
-	indent_count--;
-	indent();
+	emit_char(d->out, '\n');
+	d->indent_count++;
+	TRAVERSE_AST_LIST(n, s->list, dump_ast_stm(d, n));
+	d->indent_count--;
+	indent(d);
 	break;
     case  AST_STM_DEC:
-	dump_ast_exp(s->child[0]);
+	dump_ast_dec(d, s->list);
 	break;
     case  AST_STM_ASIGN:
-	dump_ast_exp(s->child[0]);
-	dump_ast_exp(s->child[1]);
+	dump_ast_exp(d, s->child[0]);
 	break;
     case  AST_STM_IF:
-	dump_ast_exp(s->child[0]);
+	dump_ast_exp(d, s->child[0]);
 	/* then-statement */
-	indent_count++;
-	fputs("\n", stderr);
-	dump_ast_stm(s->child[1]);
+	d->indent_count++;
+	emit_char(d->out, '\n');
+	dump_ast_stm(d, s->child[1]);
 	/* else-statement */
-	dump_ast_stm(s->child[2]);
-	indent_count--;
-	indent();
+	dump_ast_stm(d, s->child[2]);
+	d->indent_count--;
+	indent(d);
 	break;
     case  AST_STM_WHILE:
-	dump_ast_exp(s->child[0]);
-	indent_count++;
-	fputs("\n", stderr);
-	dump_ast_stm(s->child[1]);
-	indent_count--;
-	indent();
+	dump_ast_exp(d, s->child[0]);
+	d->indent_count++;
+	emit_char(d->out, '\n');
+	dump_ast_stm(d, s->child[1]);
+	d->indent_count--;
+	indent(d);
 	break;
     case  AST_STM_FOR:
-	dump_ast_exp(s->child[0]);
-	dump_ast_exp(s->child[1]);
-	dump_ast_exp(s->child[2]);
-	indent_count++;
-	fputs("\n", stderr);
-	dump_ast_stm(s->child[3]);
-	indent_count--;
-	indent();
+	dump_ast_exp(d, s->child[0]);
+	dump_ast_exp(d, s->child[1]);
+	dump_ast_exp(d, s->child[2]);
+	d->indent_count++;
+	emit_char(d->out, '\n');
+	dump_ast_stm(d, s->child[3]);
+	d->indent_count--;
+	indent(d);
 	break;
 	case AST_STM_DOWHILE:
-	indent_count++;
-	fputs("\n", stderr);
-	dump_ast_stm(s->child[0]);
-	indent_count--;
-	dump_ast_exp(s->child[1]);
-	indent();
+	d->indent_count++;
+	emit_char(d->out, '\n');
+	dump_ast_stm(d, s->child[0]);
+	d->indent_count--;
+	dump_ast_exp(d, s->child[1]);
+	indent(d);
 	break;
 	/* REPORT3
 	 * このあたりにdo-whileノード用のダンプ処理を追加する
 	 */
     case  AST_STM_RETURN:
-	dump_ast_exp(s->child[0]);
+	dump_ast_exp(d, s->child[0]);
 	break;
     default:
 	errexit("Invalid statement kind", __FILE__, __LINE__);
     }
-    fputs(")\n", stderr);
+    EMIT_LIT(d->out, ")\n");
 }
 
+/* 宣言された変数の並び
+   各変数を前の変数の子として入れ子にした形で出力する */
 void
-dump_ast_exp(AST_Node *e)
+dump_ast_dec(Dump *d, AST_List *l)
 {
     int  i;
-    AST_List *l;
-    
-    if (e == NULL) {
-	return;
+    AST_Node *n;
+
+    for (i = 0; i < l->num; i++) {
+	n = l->elem[i];
+	emit_char(d->out, ' ');
+	emit_str(d->out, sub_name[n->sub_kind]);
+	EMIT_LIT(d->out, "(r");
+	emit_int(d->out, n->reg);
+	EMIT_LIT(d->out, ")(");
+	emit_str(d->out, n->str);
     }
-    fprintf(stderr, " %s(r%d)(", sub_name[e->sub_kind], e->reg);
+    TRAVERSE_AST_LIST(n, l, emit_char(d->out, ')'));
+}
+
+/* 子を順に出力した後、並び（関数呼び出しの実引数）があれば括弧で囲んで出力する
+   stateは0が自分自身、1からnum_childまでが子、その後が並びの要素 */
+void
+dump_ast_exp(Dump *d, AST_Node *e)
+{
+    AST_Stack *st = &d->stack;
+    AST_Frame *f;
+    int  base, k;
 
-    if (e->sub_kind == AST_EXP_IDENT) {
-	fprintf(stderr, "%s", e->str);
-    } else if (e->sub_kind == AST_EXP_CNST_INT) {
-	fprintf(stderr, "%d", e->val);
+    if (e == NULL) {
+	return;
     }
-    for (i = 0; i < AST_NUM_CHILDLEN; i++) {
-	if (e->child[i] != NULL) {
-	    dump_ast_exp(e->child[i]);
+    base = st->num;
+    push_AST_Stack(st, e);
+    while (st->num > base) {
+	f = AST_STACK_TOP(st);
+	e = f->n;
+	k = f->state++;
+	if (k == 0) {
+	    emit_char(d->out, ' ');
+	    emit_str(d->out, sub_name[e->sub_kind]);
+	    EMIT_LIT(d->out, "(r");
+	    emit_int(d->out, e->reg);
+	    EMIT_LIT(d->out, ")(");
+	    if (e->sub_kind == AST_EXP_IDENT) {
+		emit_str(d->out, e->str);
+	    } else if (e->sub_kind == AST_EXP_CNST_INT) {
+		emit_int(d->out, e->val);
+	    }
+	    continue;
+	}
+	k--;
+	if (k < e->num_child) {
+	    if (e->child[k] != NULL) {
+		push_AST_Stack(st, e->child[k]);
+	    }
+	    continue;
 	}
+	k -= e->num_child;
+	if (e->list != NULL) {
+	    if (k == 0) {
+		EMIT_LIT(d->out, " (");
+	    }
+	    if (k < e->list->num) {
+		push_AST_Stack(st, e->list->elem[k]);
+		continue;
+	    }
+	    emit_char(d->out, ')');
+	}
+	emit_char(d->out, ')');
+	st->num--;
     }
-    if (e->list != NULL) {
-	fputs(" (", stderr);
-	TRAVERSE_AST_LIST(l, e->list, dump_ast_exp(l->elem));
-	fputs(")", stderr);
+}
+
+/*
+ * JSON形式
+ * 各ノードは {"kind":副種別名, "line":行(文のみ), "reg":レジスタ(式のみ),
+ *             "name"/"value":識別子名/定数値, "child":[子], "list":[並び]}
+ * 関数ノードのkindは"func"。存在しない子はnull
+ */
+void
+dump_ast_json(Dump *d, AST_Node *n)
+{
+    AST_Stack *st = &d->stack;
+    AST_Frame *f;
+    int  base, k;
+
+    base = st->num;
+    push_AST_Stack(st, n);
+    while (st->num > base) {
+	f = AST_STACK_TOP(st);
+	n = f->n;
+	k = f->state++;
+	if (n == NULL) {
+	    EMIT_LIT(d->out, "null");
+	    st->num--;
+	    continue;
+	}
+	if (k == 0) {
+	    EMIT_LIT(d->out, "{\"kind\":\"");
+	    if (n->kind == AST_KIND_FUNC) {
+		emit_str(d->out, kind_name[n->kind]);
+	    } else {
+		emit_str(d->out, sub_name[n->sub_kind]);
+	    }
+	    emit_char(d->out, '"');
+	    if (n->kind == AST_KIND_STM) {
+		EMIT_LIT(d->out, ",\"line\":");
+		emit_int(d->out, n->lineno);
+	    } else if (n->kind == AST_KIND_EXP) {
+		EMIT_LIT(d->out, ",\"reg\":");
+		emit_int(d->out, n->reg);
+	    }
+	    if (n->sub_kind == AST_EXP_IDENT) {
+		EMIT_LIT(d->out, ",\"name\":\"");
+		emit_str(d->out, n->str);
+		emit_char(d->out, '"');
+	    } else if (n->sub_kind == AST_EXP_CNST_INT) {
+		EMIT_LIT(d->out, ",\"value\":");
+		emit_int(d->out, n->val);
+	    }
+	    continue;
+	}
+	/* 子（stateが1からnum_childまで） */
+	k--;
+	if (k < n->num_child) {
+	    if (k == 0) {
+		EMIT_LIT(d->out, ",\"child\":[");
+	    } else {
+		emit_char(d->out, ',');
+	    }
+	    push_AST_Stack(st, n->child[k]);
+	    continue;
+	}
+	if (k == n->num_child && n->num_child > 0) {
+	    emit_char(d->out, ']');
+	}
+	/* 並びの要素 */
+	k -= n->num_child;
+	if (n->list != NULL) {
+	    if (k == 0) {
+		EMIT_LIT(d->out, ",\"list\":[");
+	    }
+	    if (k < n->list->num) {
+		if (k > 0) {
+		    emit_char(d->out, ',');
+		}
+		push_AST_Stack(st, n->list->elem[k]);
+		continue;
+	    }
+	    emit_char(d->out, ']');
+	}
+	emit_char(d->out, '}');
+	st->num--;
     }
+}
 
-    fputs(")", stderr);
+void
+dump_ast_json_list(Dump *d, AST_List *l)
+{
+    int  i;
+
+    emit_char(d->out, '[');
+    for (i = 0; l != NULL && i < l->num; i++) {
+	if (i > 0) {
+	    emit_char(d->out, ',');
+	}
+	dump_ast_json(d, l->elem[i]);
+    }
+    emit_char(d->out, ']');
 }
@@ -9,6 +9,9 @@
 #ifndef  AST_H
 #define  AST_H
 
+#include  "dump.h"
+#include  "util.h"
+
 /* ASTの主種別 */
 enum {
     AST_KIND_NONE,
@@ -56,56 +59,109 @@ enum {
     TYPE_INT
 };
 
-#define  AST_NUM_CHILDLEN  4
-
+/*
+ * ASTのノード
+ * 子の数は種別毎に決まっており(ast_num_child)、ノードの直後に連続して置く
+ * 文の並びや実引数・仮引数の並びはAST_List（連続した配列）で持つ
+ */
 typedef struct AST_Node {
-    int  kind;		/* 主種別 */
-    int  sub_kind;	/* 副種別 */
+    unsigned char  kind;	/* 主種別 */
+    unsigned char  sub_kind;	/* 副種別 */
+    signed char    reg;		/* 割り付けられたレジスタ（NO_REGならレジスタに読み込まない） */
+    unsigned char  num_child;	/* 子の数 */
     int  lineno;
-    int  id;
-    int  val;		/* AST_EXP_CNST_INTの時の値 */
-    char *str;		/* AST_EXP_IDENTの時の文字列 */
-    int  reg;		/* 割り付けられたレジスタ */
     int  rank;		/* レジスタ割り付けとコード生成時の巡回優先度 */
-    /* AST_EXP_IDENTの時のsymtab（予定） */
-    struct AST_List *parent_list;
+    union {
+	int  val;	/* AST_EXP_CNST_INTの時の値 */
+	int  id;	/* AST_KIND_FUNCの時の関数id */
+	/* 子のある式の、退避なしで評価するのに要るレジスタの数（cg.cのpass1） */
+	int  need;
+	/* 値をスタックフレームに退避した時はその位置（cg.cのpass2。負） */
+	int  spill;
+    };
     struct AST_Node *parent;
-    struct AST_Node *child[AST_NUM_CHILDLEN];
+    char *str;		/* AST_EXP_IDENTの時の文字列 */
+    struct SymTab   *symtab;	/* AST_EXP_IDENTの時のシンボルテーブルのエントリー */
     struct AST_List *list;
-    struct SymTab   *symtab;
+    struct AST_Node *child[];	/* num_child個の子 */
 } AST_Node;
 
+/* 定数や変数をレジスタに読み込まず、命令のオペランドとして直接使う式のreg */
+#define  NO_REG  (-1)
+
+/* 子の数の上限 */
+#define  AST_NUM_CHILDLEN  4
+
+/* i番目の子。子の数が足りなければNULL */
+#define  AST_CHILD(N, I)  ((I) < (N)->num_child ? (N)->child[I] : NULL)
+
 /*
- * AST双方向リスト
+ * ASTの並び
+ * 要素は連続した配列elemに納める
  */
 typedef struct AST_List {
-    struct AST_Node *elem;
-    struct AST_List *prev;
-    struct AST_List *next;
-    struct AST_Node *parent;
+    int  num;			/* 要素数 */
+    int  size;			/* elemの大きさ */
+    struct AST_Node *elem[];
 } AST_List;
 
-/* ASTの根 */
-extern AST_List *AST_root;
-
-#define TRAVERSE_AST_LIST(E, BEGIN, PROC) \
-    { (E) = (BEGIN); if ((E) != NULL) { do { \
+/* 並びLの各要素をEに入れてPROCを実行する */
+#define TRAVERSE_AST_LIST(E, L, PROC) \
+    { int i_; if ((L) != NULL) { for (i_ = 0; i_ < (L)->num; i_++) { \
+        (E) = (L)->elem[i_]; \
         PROC; \
-      (E) = (E)->next; } while ((E) != (BEGIN)); }}
+      }}}
 
-#define REV_TRAVERSE_AST_LIST(E, BEGIN, PROC) \
-    { (E) = (BEGIN); if ((E) != NULL) { do { (E) = (E)->prev; \
+/* TRAVERSE_AST_LISTの逆順 */
+#define REV_TRAVERSE_AST_LIST(E, L, PROC) \
+    { int i_; if ((L) != NULL) { for (i_ = (L)->num-1; i_ >= 0; i_--) { \
+        (E) = (L)->elem[i_]; \
         PROC; \
-      } while ((E) != (BEGIN)); }}
+      }}}
 
-extern AST_Node *create_AST_Node(int kind, int sub_kind);
-extern AST_Node *create_AST_Exp(int sub_kind);
-extern AST_Node *create_AST_Stm(int sub_kind, int line);
-
-/* リストlにノードnの要素を追加し、追加した要素のポインタを返す。
-   lはリストの先頭要素である。また、lはNULLでも良い。 */
-extern AST_List *append_AST_List(AST_List *l, AST_Node *n);
-
-extern void dump_ast();
+/*
+ * 明示的なスタックによるASTの巡回
+ * 左に深い a+b+c+... のような長い式でもCのスタックを使い切らないよう、
+ * 式の巡回は再帰せずにこのスタックで行う
+ * stateは巡回する関数毎の意味で使う（次に処理する子の番号など）
+ * 巡回の途中で同じスタックを使って別の巡回を始めてもよい。
+ * その場合は開始時のnumより上だけを使い、終わったらnumを元に戻すこと
+ * pushで領域が再確保されるので、フレームへのポインタはpushの後は使えない
+ */
+typedef struct AST_Frame {
+    AST_Node  *n;
+    int  state;
+} AST_Frame;
+
+typedef struct AST_Stack {
+    AST_Frame  *frame;
+    int  num;			/* 積んでいるフレームの数 */
+    int  size;			/* frameの大きさ */
+} AST_Stack;
+
+/* 一番上のフレーム */
+#define  AST_STACK_TOP(S)  (&(S)->frame[(S)->num-1])
+
+/* 空のスタック。全て0のAST_Stackも空のスタックとして使える */
+extern void init_AST_Stack(AST_Stack *s);
+extern void free_AST_Stack(AST_Stack *s);
+/* ノードnをstate 0で積む */
+extern void push_AST_Stack(AST_Stack *s, AST_Node *n);
+
+/* ノードは領域aから確保する */
+extern AST_Node *create_AST_Node(Arena *a, int kind, int sub_kind);
+extern AST_Node *create_AST_Exp(Arena *a, int sub_kind);
+extern AST_Node *create_AST_Stm(Arena *a, int sub_kind, int line);
+
+/* 並びlの末尾にノードnを追加し、追加後の並びを返す。
+   lはNULLでも良い。lの領域は再確保されることがあるので、
+   以降は返された並びを使うこと。並びは領域aから確保する */
+extern AST_List *append_AST_List(Arena *a, AST_List *l, AST_Node *n);
+
+/* nを根とする部分木のノードの数を*nodesに、並びの要素の数を*cellsに足す */
+extern void count_AST(AST_Node *n, long *nodes, long *cells);
+
+/* 関数の並びrootのASTを出力する。stageはDUMP_ASTかDUMP_AST_REG */
+extern void dump_ast(AST_List *root, Emit *out, int format, int stage);
 
 #endif	/* AST_H */
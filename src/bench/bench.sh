@@ -0,0 +1,59 @@
+#! /bin/sh
+# 生成したプログラムの大きさを変えながらtlcのコンパイル速度と最大常駐量を測る
+# 1行あたりの時間が大きさとともに増える項目があれば、どこかが線形でない
+# （式の深さは1行の長さそのものを変えるので、lines/sが下がるのは当然）
+# 時間と最大常駐量はtlc --time-report=jsonのtotal_msとpeak_rss_kb
+# 結果はbench/tmp/results.txtにも残す
+# srcディレクトリで make bench から実行する
+
+TLC=./tlc
+TLGEN=./tlgen
+TMP=bench/tmp
+
+mkdir -p $TMP
+out=$TMP/results.txt
+
+# 各行がtlgenの引数。上から関数の数・文の数・局所変数の数・式の深さ・
+# ループの入れ子・関数呼び出しの割合をそれぞれ増やしていく
+matrix="
+-f 100 -s 100
+-f 1000 -s 100
+-f 4000 -s 100
+-f 10 -s 1000
+-f 10 -s 10000
+-f 10 -s 40000
+-f 10 -s 1000 -l 100
+-f 10 -s 1000 -l 1000
+-f 10 -s 1000 -l 10000
+-f 100 -s 100 -d 1
+-f 100 -s 100 -d 10
+-f 100 -s 100 -d 50
+-f 100 -s 100 -n 1
+-f 100 -s 100 -n 4
+-f 100 -s 100 -n 8
+-f 100 -s 100 -c 0
+-f 100 -s 100 -c 50
+"
+
+printf "%-28s %9s %10s %12s %12s\n" "tlgen args" "lines" "time(ms)" "lines/s" "peak RSS(KB)" | tee $out
+echo "$matrix" | while read args
+do
+    if [ -z "$args" ]; then
+	continue
+    fi
+    $TLGEN $args > $TMP/bench.c
+    lines=`wc -l < $TMP/bench.c`
+    (cd $TMP && ../../$TLC --time-report=json bench.c 2> bench.log > /dev/null)
+    if [ $? -ne 0 ]; then
+	echo "tlc failed on tlgen $args" | tee -a $out
+	continue
+    fi
+    ms=`sed -n 's/.*"total_ms":\([0-9.]*\).*/\1/p' $TMP/bench.log`
+    rss=`sed -n 's/.*"total_ms":[0-9.]*,"peak_rss_kb":\([0-9]*\).*/\1/p' $TMP/bench.log`
+    echo "$args $lines $ms $rss" | awk '{
+	n = NF; rss = $n; ms = $(n-1); lines = $(n-2);
+	args = $1; for (i = 2; i <= n-3; i++) args = args " " $i;
+	printf "%-28s %9d %10.1f %12.0f %12d\n", args, lines, ms, lines/(ms > 0 ? ms : 1)*1000, rss
+    }' | tee -a $out
+done
+rm -f $TMP/bench.c $TMP/bench.s $TMP/bench.log
@@ -0,0 +1,63 @@
+/*
+    Tiny Language Compiler (tlc)
+
+    シンボルテーブル検索のベンチマーク
+    変数の数を増やしても1回あたりの検索時間がほぼ一定であることを確認する
+
+    2016年 木村啓二
+*/
+
+#include  <stdio.h>
+#include  <stdlib.h>
+#include  <string.h>
+#include  <time.h>
+#include  "../compiler.h"
+
+#define  NUM_LOOKUPS  2000000
+
+static double
+now(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec*1e-9;
+}
+
+int
+main(int argc, char **argv)
+{
+    Compiler  cc;
+    int  i, n, id;
+    long found;
+    char **names, buf[16];
+    double t0, t1;
+
+    memset(&cc, 0, sizeof(cc));
+    id = 0;
+    printf("%10s %14s\n", "symbols", "ns/lookup");
+    for (n = 1000; n <= 256000; n *= 4) {
+	names = xmalloc(n*sizeof(char*));
+	for (i = 0; i < n; i++) {
+	    snprintf(buf, sizeof(buf), "v%d", i);
+	    names[i] = intern(&cc.names, buf, strlen(buf));
+	    append_sym(&cc, TYPE_INT, SYM_AUTOVAR, names[i]);
+	}
+	found = 0;
+	t0 = now();
+	for (i = 0; i < NUM_LOOKUPS; i++) {
+	    found += lookup_sym(&cc, 0, SYM_VAR, names[(i*7919L) % n]) != NULL;
+	}
+	t1 = now();
+	if (found != NUM_LOOKUPS) {
+	    errexit("lookup failed.", __FILE__, __LINE__);
+	}
+	printf("%10d %14.1f\n", n, (t1-t0)*1e9/NUM_LOOKUPS);
+	commit_current_symtab(&cc, ++id);
+	xfree(names);
+    }
+
+    free_symtab(&cc);
+    intern_free(&cc.names);
+    return 0;
+}
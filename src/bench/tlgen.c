@@ -0,0 +1,262 @@
+/*
+    Tiny Language Compiler (tlc)
+
+    ベンチマーク用のTLプログラムの生成
+    関数の数、関数あたりの局所変数・文の数、式の深さ、ループの入れ子の深さ、
+    関数呼び出しの割合を指定して、tlcがエラーなくコンパイルできるプログラムを
+    標準出力に書く。同じ引数からは常に同じプログラムができる
+    再帰はせずループの回数も決まっているので実行すれば必ず終わるが、
+    関数呼び出しがあると実行時間は関数の数に対して指数的に増える
+
+    2016年 木村啓二
+*/
+
+#include  <stdio.h>
+#include  <stdlib.h>
+#include  <string.h>
+#include  <unistd.h>
+
+/* ループの繰り返し回数と、ループ・if文の本体の文の数の上限 */
+#define  LOOP_COUNT  3
+#define  MAX_BODY    8
+
+typedef struct Gen {
+    int  funcs;			/* 関数の数 */
+    int  locals;		/* 関数あたりの局所変数の数 */
+    int  stms;			/* 関数あたりの文の数（初期化とreturnを除く） */
+    int  depth;			/* 式の深さ（二項演算子の数） */
+    int  nest;			/* ループの入れ子の深さの上限 */
+    int  calls;			/* 式の葉が関数呼び出しになる割合（%） */
+    unsigned int  seed;
+    int  func;			/* 生成中の関数 */
+} Gen;
+
+static void usage(const char *prog);
+static int  rnd(Gen *g, int n);
+static void indent(int level);
+static void gen_leaf(Gen *g, int call);
+static void gen_exp(Gen *g, int depth);
+static void gen_cond(Gen *g);
+static int  gen_stms(Gen *g, int budget, int level, int loops);
+static void gen_func(Gen *g);
+
+void
+usage(const char *prog)
+{
+    fprintf(stderr,
+	    "usage: %s [options]\n"
+	    "  -f N  number of functions (default: 10)\n"
+	    "  -l N  local variables per function (default: 10)\n"
+	    "  -s N  statements per function (default: 100)\n"
+	    "  -d N  binary operators per expression (default: 3)\n"
+	    "  -n N  maximum loop nesting (default: 2)\n"
+	    "  -c N  percentage of expression leaves that are calls (default: 5)\n"
+	    "  -r N  random seed (default: 1)\n",
+	    prog);
+    exit(-1);
+}
+
+/* 0以上n未満の乱数（xorshift） */
+int
+rnd(Gen *g, int n)
+{
+    g->seed ^= g->seed << 13;
+    g->seed ^= g->seed >> 17;
+    g->seed ^= g->seed << 5;
+    return g->seed % n;
+}
+
+void
+indent(int level)
+{
+    printf("%*s", 4*level, "");
+}
+
+/* 局所変数・引数・定数、またはそれより前の関数の呼び出し */
+void
+gen_leaf(Gen *g, int call)
+{
+    int  r = rnd(g, 100);
+
+    if (call && g->func > 0 && r < g->calls) {
+	printf("f%d(", rnd(g, g->func));
+	gen_leaf(g, 0);
+	printf(", ");
+	gen_leaf(g, 0);
+	printf(")");
+    } else if (r % 4 == 0) {
+	printf("%d", rnd(g, 100));
+    } else if (r % 4 == 1) {
+	printf("%c", "ab"[rnd(g, 2)]);
+    } else {
+	printf("v%d", rnd(g, g->locals));
+    }
+}
+
+/*
+ * レジスタは3つしかないので、右の被演算子は常に葉にして
+ * 深さに関わらず2つのレジスタで計算できる形にする
+ * 除算はコード生成部が対応していないので使わない
+ */
+void
+gen_exp(Gen *g, int depth)
+{
+    static const char *ops[] = { "+", "-", "*", "+", "-" };
+
+    if (depth == 0) {
+	if (rnd(g, 10) == 0) {
+	    printf("-");
+	}
+	gen_leaf(g, 1);
+	return;
+    }
+    printf("(");
+    gen_exp(g, depth-1);
+    printf(" %s ", ops[rnd(g, sizeof(ops)/sizeof(ops[0]))]);
+    gen_leaf(g, 1);
+    printf(")");
+}
+
+void
+gen_cond(Gen *g)
+{
+    static const char *rel[] = { "<", ">", "<=", ">=", "==", "!=" };
+
+    gen_exp(g, g->depth/2);
+    printf(" %s ", rel[rnd(g, sizeof(rel)/sizeof(rel[0]))]);
+    gen_leaf(g, 0);
+}
+
+/* budget個の文を生成する。loopsは囲んでいるループの数 */
+int
+gen_stms(Gen *g, int budget, int level, int loops)
+{
+    int  n = 0, body, r, k;
+
+    while (n < budget) {
+	r = rnd(g, 100);
+	body = budget-n-1;
+	if (body > MAX_BODY) {
+	    body = MAX_BODY;
+	}
+	body = (body > 0) ? 1+rnd(g, body) : 1;
+	if (r < 12 && loops < g->nest && budget-n >= 2) {
+	    /* ループ変数k0, k1, ...は入れ子の深さ毎に1つ */
+	    k = loops;
+	    switch (rnd(g, 3)) {
+	    case 0:
+		indent(level);
+		printf("for (k%d = 0; k%d < %d; k%d = k%d + 1) {\n", k, k, LOOP_COUNT, k, k);
+		n += 1 + gen_stms(g, body, level+1, loops+1);
+		indent(level);
+		printf("}\n");
+		break;
+	    case 1:
+		indent(level);
+		printf("k%d = 0;\n", k);
+		indent(level);
+		printf("while (k%d < %d) {\n", k, LOOP_COUNT);
+		n += 1 + gen_stms(g, body, level+1, loops+1);
+		indent(level+1);
+		printf("k%d = k%d + 1;\n", k, k);
+		indent(level);
+		printf("}\n");
+		break;
+	    default:
+		indent(level);
+		printf("k%d = 0;\n", k);
+		indent(level);
+		printf("do {\n");
+		n += 1 + gen_stms(g, body, level+1, loops+1);
+		indent(level+1);
+		printf("k%d = k%d + 1;\n", k, k);
+		indent(level);
+		printf("} while (k%d < %d);\n", k, LOOP_COUNT);
+		break;
+	    }
+	} else if (r < 22 && budget-n >= 3) {
+	    indent(level);
+	    printf("if (");
+	    gen_cond(g);
+	    printf(") {\n");
+	    n += 1 + gen_stms(g, (body+1)/2, level+1, loops);
+	    indent(level);
+	    printf("} else {\n");
+	    n += gen_stms(g, body/2 > 0 ? body/2 : 1, level+1, loops);
+	    indent(level);
+	    printf("}\n");
+	} else if (r < 25) {
+	    indent(level);
+	    printf("put_int(v%d);\n", rnd(g, g->locals));
+	    n++;
+	} else {
+	    indent(level);
+	    printf("v%d = ", rnd(g, g->locals));
+	    gen_exp(g, g->depth);
+	    printf(";\n");
+	    n++;
+	}
+    }
+    return n;
+}
+
+void
+gen_func(Gen *g)
+{
+    int  i;
+
+    printf("f%d(int a, int b)\n{\n    int v0", g->func);
+    for (i = 1; i < g->locals; i++) {
+	printf(", v%d", i);
+    }
+    for (i = 0; i < g->nest; i++) {
+	printf(", k%d", i);
+    }
+    printf(";\n");
+    for (i = 0; i < g->locals; i++) {
+	printf("    v%d = %d;\n", i, rnd(g, 10));
+    }
+    gen_stms(g, g->stms, 1, 0);
+    printf("    return v0;\n}\n\n");
+}
+
+int
+main(int argc, char **argv)
+{
+    Gen  g;
+    int  c;
+
+    memset(&g, 0, sizeof(g));
+    g.funcs = 10;
+    g.locals = 10;
+    g.stms = 100;
+    g.depth = 3;
+    g.nest = 2;
+    g.calls = 5;
+    g.seed = 1;
+    while ((c = getopt(argc, argv, "f:l:s:d:n:c:r:")) != -1) {
+	switch (c) {
+	case 'f':  g.funcs = atoi(optarg);   break;
+	case 'l':  g.locals = atoi(optarg);  break;
+	case 's':  g.stms = atoi(optarg);    break;
+	case 'd':  g.depth = atoi(optarg);   break;
+	case 'n':  g.nest = atoi(optarg);    break;
+	case 'c':  g.calls = atoi(optarg);   break;
+	case 'r':  g.seed = atoi(optarg);    break;
+	default:   usage(argv[0]);
+	}
+    }
+    if (optind < argc || g.funcs < 1 || g.locals < 1 || g.stms < 0
+	|| g.depth < 0 || g.nest < 0 || g.calls < 0 || g.calls > 100) {
+	usage(argv[0]);
+    }
+    if (g.seed == 0) {
+	g.seed = 1;		/* xorshiftは0から抜け出せない */
+    }
+
+    for (g.func = 0; g.func < g.funcs; g.func++) {
+	gen_func(&g);
+    }
+    printf("main()\n{\n    put_int(f%d(1, 2));\n}\n", g.funcs-1);
+    return 0;
+}
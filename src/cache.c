@@ -0,0 +1,295 @@
+/*
+    Tiny Language Compiler (tlc)
+
+    関数毎のアセンブリのキャッシュ
+
+    2016年 木村啓二
+*/
+
+#include  <errno.h>
+#include  <fcntl.h>
+#include  <limits.h>
+#include  <stdio.h>
+#include  <stdlib.h>
+#include  <string.h>
+#include  <sys/stat.h>
+#include  <unistd.h>
+#include  "cache.h"
+#include  "compiler.h"
+#include  "tl_gram.h"
+
+/* 保存形式を変えたら上げる */
+#define  CACHE_VERSION  "tlc-asm-cache 1"
+
+#if defined(TARGET_LINUX)
+#define  CACHE_TARGET  "linux"
+#elif defined(TARGET_MAC)
+#define  CACHE_TARGET  "mac"
+#else
+#define  CACHE_TARGET  "cygwin"
+#endif
+
+#define  CACHE_MIN_KEYS  64
+
+static void hash_bytes(CacheKey *k, const void *p, size_t n);
+static CacheKey finish_key(const CacheKey *k);
+static void key_path(AsmCache *c, const CacheKey *k, char *buf, size_t size);
+static void emit_relocated(Emit *e, const char *s, size_t n, int delta);
+
+/*
+ * ハッシュ値
+ * 2本の64bitの状態を異なる定数で1byteずつ更新し、最後によく混ぜる
+ */
+void
+hash_bytes(CacheKey *k, const void *p, size_t n)
+{
+    const unsigned char *s = p;
+    uint64_t  h0 = k->h[0], h1 = k->h[1];
+    size_t  i;
+
+    for (i = 0; i < n; i++) {
+	h0 = (h0 ^ s[i]) * 0x100000001b3ull;			/* FNV-1a */
+	h1 = (h1 ^ s[i]) * 0x9e3779b97f4a7c15ull;
+	h1 = (h1 << 31) | (h1 >> 33);
+    }
+    k->h[0] = h0;
+    k->h[1] = h1;
+}
+
+CacheKey
+finish_key(const CacheKey *k)
+{
+    CacheKey  r;
+    uint64_t  h;
+    int  i;
+
+    for (i = 0; i < 2; i++) {
+	h = k->h[i] ^ k->h[1-i] >> 29;
+	h ^= h >> 33;
+	h *= 0xff51afd7ed558ccdull;
+	h ^= h >> 33;
+	h *= 0xc4ceb9fe1a85ec53ull;
+	h ^= h >> 33;
+	r.h[i] = h;
+    }
+    return r;
+}
+
+void
+cache_init(Compiler *cc, const char *dir)
+{
+    AsmCache *c = &cc->cache;
+    static const char version[] = CACHE_VERSION " " CACHE_TARGET;
+
+    memset(c, 0, sizeof(AsmCache));
+    c->dir = dir;
+    if (dir == NULL) {
+	return;
+    }
+    /* コード生成に影響する設定はここで全て混ぜておく */
+    c->seed.h[0] = 0xcbf29ce484222325ull;
+    c->seed.h[1] = 0x84222325cbf29ce4ull;
+    hash_bytes(&c->seed, version, sizeof(version));
+    hash_bytes(&c->seed, &cc->opt->optimize, sizeof(cc->opt->optimize));
+    hash_bytes(&c->seed, &cc->opt->backend, sizeof(cc->opt->backend));
+    c->cur = c->seed;
+    if (mkdir(dir, 0777) < 0 && errno != EEXIST) {
+	diag(cc, "Can't create the cache directory %s.\n", dir);
+	c->dir = NULL;
+    }
+}
+
+void
+cache_free(Compiler *cc)
+{
+    AsmCache *c = &cc->cache;
+    int  i;
+
+    if (c->entry != NULL) {
+	for (i = 1; i <= c->nkey; i++) {
+	    xfree(c->entry[i].text);
+	}
+    }
+    xfree(c->entry);
+    xfree(c->key);
+    c->entry = NULL;
+    c->key = NULL;
+    c->nkey = c->size_key = 0;
+}
+
+/* 識別子は綴りを、整数は値をトークンの種別と一緒にハッシュ値に加える
+   空白や改行は含まれないので、字下げを変えてもキーは変わらない */
+void
+cache_token(Compiler *cc, int tok, const YYSTYPE *lval)
+{
+    AsmCache *c = &cc->cache;
+    unsigned short  t = tok;
+    unsigned int  len;
+
+    hash_bytes(&c->cur, &t, sizeof(t));
+    if (tok == TOKEN_ID) {
+	len = strlen(lval->y_str);
+	hash_bytes(&c->cur, &len, sizeof(len));
+	hash_bytes(&c->cur, lval->y_str, len);
+    } else if (tok == TOKEN_CONST_INT) {
+	hash_bytes(&c->cur, &lval->y_int, sizeof(lval->y_int));
+    } else if (tok == TOKEN_LBRACE) {
+	c->depth++;
+    } else if (tok == TOKEN_RBRACE && c->depth > 0 && --c->depth == 0) {
+	/* 関数定義の終わり */
+	CacheKey  k = finish_key(&c->cur);
+
+	cache_add_key(cc, &k);
+	c->cur = c->seed;
+    }
+}
+
+void
+cache_add_key(Compiler *cc, const CacheKey *k)
+{
+    AsmCache *c = &cc->cache;
+
+    if (c->nkey+1 >= c->size_key) {
+	c->size_key = (c->size_key == 0) ? CACHE_MIN_KEYS : c->size_key*2;
+	c->key = xrealloc_tag(c->key, c->size_key*sizeof(CacheKey), ALLOC_CACHE);
+	c->entry = xrealloc_tag(c->entry, c->size_key*sizeof(CacheEntry), ALLOC_CACHE);
+    }
+    c->nkey++;
+    c->key[c->nkey] = *k;
+    memset(&c->entry[c->nkey], 0, sizeof(CacheEntry));
+}
+
+void
+key_path(AsmCache *c, const CacheKey *k, char *buf, size_t size)
+{
+    snprintf(buf, size, "%s/%016llx%016llx.s", c->dir,
+	     (unsigned long long)k->h[0], (unsigned long long)k->h[1]);
+}
+
+/*
+ * ファイルの形式
+ *   1行目  CACHE_VERSION
+ *   2行目  ラベルの数 アセンブリの長さ
+ *   以降   アセンブリ（ラベル番号は0から）
+ * 形式が合わないものや途中で切れているものは無いものとして扱う
+ */
+int
+cache_load(Compiler *cc, int id)
+{
+    AsmCache *c = &cc->cache;
+    CacheEntry *e;
+    char  path[PATH_MAX], *buf = NULL, *p;
+    struct stat  st;
+    int  fd, nlabels, ok = 0;
+    unsigned long  len;
+
+    if (id < 1 || id > c->nkey) {
+	__sync_fetch_and_add(&c->misses, 1);
+	return 0;
+    }
+    key_path(c, &c->key[id], path, sizeof(path));
+    if ((fd = open(path, O_RDONLY)) >= 0) {
+	if (fstat(fd, &st) == 0 && st.st_size > 0) {
+	    buf = xmalloc_tag(st.st_size+1, ALLOC_CACHE);
+	    if (read_all(fd, buf, st.st_size) == 0) {
+		buf[st.st_size] = '\0';
+		p = strchr(buf, '\n');
+		if (p != NULL && p-buf == sizeof(CACHE_VERSION)-1
+		    && memcmp(buf, CACHE_VERSION, p-buf) == 0
+		    && sscanf(p+1, "%d %lu", &nlabels, &len) == 2
+		    && (p = strchr(p+1, '\n')) != NULL
+		    && (unsigned long)(st.st_size-(p+1-buf)) == len) {
+		    ok = 1;
+		}
+	    }
+	}
+	close(fd);
+    }
+    if (!ok) {
+	xfree(buf);
+	__sync_fetch_and_add(&c->misses, 1);
+	return 0;
+    }
+    e = &c->entry[id];
+    e->len = len;
+    e->nlabels = nlabels;
+    e->text = xmalloc_tag(len+1, ALLOC_CACHE);
+    memcpy(e->text, p+1, len+1);
+    xfree(buf);
+    __sync_fetch_and_add(&c->hits, 1);
+    return 1;
+}
+
+/* sを書き写しながら、ラベル.Lnの番号nにdeltaを足す */
+void
+emit_relocated(Emit *e, const char *s, size_t n, int delta)
+{
+    const char *end = s+n, *p, *q;
+    int  v;
+
+    for (p = s; (q = memchr(p, '.', end-p)) != NULL; p = q) {
+	if (end-q < 3 || q[1] != 'L' || (unsigned)(q[2]-'0') >= 10) {
+	    q++;
+	    continue;
+	}
+	emit_mem(e, s, q-s);
+	for (q += 2, v = 0; q < end && (unsigned)(*q-'0') < 10; q++) {
+	    v = v*10 + (*q-'0');
+	}
+	emit_label(e, v+delta);
+	s = q;
+    }
+    emit_mem(e, s, end-s);
+}
+
+int
+cache_loaded(Compiler *cc, int id)
+{
+    AsmCache *c = &cc->cache;
+
+    return c->dir != NULL && id >= 1 && id <= c->nkey && c->entry[id].text != NULL;
+}
+
+int
+cache_emit(Compiler *cc, int id, Emit *out, int label_base)
+{
+    CacheEntry *e = &cc->cache.entry[id];
+    int  n = e->nlabels;
+
+    emit_relocated(out, e->text, e->len, label_base);
+    xfree(e->text);
+    memset(e, 0, sizeof(CacheEntry));
+    return n;
+}
+
+/* 一時ファイルに書いてからrenameで置き換えるので、読む側が書きかけを見ることはない */
+void
+cache_store(Compiler *cc, int id, const char *text, size_t len,
+	    int label_base, int nlabels)
+{
+    AsmCache *c = &cc->cache;
+    char  path[PATH_MAX], tmp[PATH_MAX], head[64];
+    Emit  body;
+    int  fd, n, ok;
+
+    if (id < 1 || id > c->nkey) {
+	return;
+    }
+    emit_init(&body, -1);
+    emit_relocated(&body, text, len, -label_base);
+    n = snprintf(head, sizeof(head), "%s\n%d %lu\n",
+		 CACHE_VERSION, nlabels, (unsigned long)body.len);
+
+    key_path(c, &c->key[id], path, sizeof(path));
+    snprintf(tmp, sizeof(tmp), "%s/.tmp-XXXXXX", c->dir);
+    if ((fd = mkstemp(tmp)) >= 0) {
+	fchmod(fd, 0644);
+	ok = write_all(fd, head, n) == 0 && write_all(fd, body.buf, body.len) == 0;
+	ok = (close(fd) == 0) && ok;
+	/* 書けなかった時はキャッシュしないだけ */
+	if (!ok || rename(tmp, path) < 0) {
+	    unlink(tmp);
+	}
+    }
+    emit_close(&body);
+}
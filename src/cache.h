@@ -0,0 +1,73 @@
+/*
+    Tiny Language Compiler (tlc)
+
+    関数毎のアセンブリのキャッシュ
+
+    2016年 木村啓二
+*/
+
+#ifndef  CACHE_H
+#define  CACHE_H
+
+#include  <stddef.h>
+#include  <stdint.h>
+#include  "emit.h"
+
+/*
+ * 関数のトークン列とコンパイラの設定から作る128bitのハッシュ値をキーとして、
+ * その関数のアセンブリをディレクトリ中のファイルに保存しておき、
+ * 次からはレジスタ割り付けとコード生成を省いてそれを使う
+ *
+ * ラベル番号は翻訳単位の通し番号なので、0から始まるように付け替えて保存し、
+ * 使う時に関数の最初の番号を足す
+ * ファイルは一時ファイルに書いてからrenameするので、
+ * 同じディレクトリを複数のtlcが同時に使ってもよい
+ */
+typedef struct CacheKey {
+    uint64_t  h[2];
+} CacheKey;
+
+/* 読み出した関数のアセンブリ */
+typedef struct CacheEntry {
+    char  *text;		/* NULLなら読み出していない */
+    size_t  len;
+    int  nlabels;		/* 使っているラベルの数 */
+} CacheEntry;
+
+typedef struct AsmCache {
+    const char  *dir;		/* NULLならキャッシュを使わない */
+    CacheKey  seed;		/* コンパイラの設定だけから作ったハッシュ値 */
+    CacheKey  cur;		/* 読み込み中の関数のハッシュ値 */
+    int  depth;			/* 読み込み中の{}の深さ */
+    CacheKey  *key;		/* 関数id毎のキー（添字は1から） */
+    CacheEntry  *entry;		/* 関数id毎に読み出したアセンブリ */
+    int  nkey;
+    int  size_key;
+    long  hits, misses;		/* 統計（複数のスレッドから更新する） */
+} AsmCache;
+
+struct Compiler;
+union YYSTYPE;
+
+/* ccの設定に従ってcc->cacheを準備する */
+extern void  cache_init(struct Compiler *cc, const char *dir);
+extern void  cache_free(struct Compiler *cc);
+
+/* 構文解析部が読んだトークンをハッシュ値に加える
+   関数定義の終わりの}で、次の関数idのキーを確定する */
+extern void  cache_token(struct Compiler *cc, int tok, const union YYSTYPE *lval);
+
+/* 次の関数idのキーをkとする（並列に構文解析した部分の結果をまとめる時） */
+extern void  cache_add_key(struct Compiler *cc, const CacheKey *k);
+
+/* 関数idのアセンブリがキャッシュにあればcc->cache.entry[id]に読み出して1を返す */
+extern int  cache_load(struct Compiler *cc, int id);
+extern int  cache_loaded(struct Compiler *cc, int id);
+/* 読み出しておいたアセンブリを、最初のラベル番号をlabel_baseとしてoutに書く
+   使ったラベルの数を返す */
+extern int  cache_emit(struct Compiler *cc, int id, Emit *out, int label_base);
+/* 関数idのアセンブリ(最初のラベル番号label_base、ラベル数nlabels)を保存する */
+extern void  cache_store(struct Compiler *cc, int id, const char *text, size_t len,
+			 int label_base, int nlabels);
+
+#endif	/* CACHE_H */
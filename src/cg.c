@@ -7,102 +7,339 @@
 */
 
 #include  <assert.h>
+#include  <setjmp.h>
+#include  <stdarg.h>
 #include  <stdio.h>
 #include  <stdlib.h>
 #include  <string.h>
 
 #include  "ast.h"
 #include  "cg.h"
+#include  "compiler.h"
+#include  "emit.h"
+#include  "ir.h"
+#include  "regalloc.h"
 #include  "symtab.h"
 #include  "util.h"
 
 /*
  * レジスタ割り付け系
  * 方針：
- * 式の構文木で深い方から優先してレジスタを割り付け、レジスタを3つだけ使う
+ * 式の構文木で多くのレジスタを要る方から優先してレジスタを割り付け、レジスタを3つだけ使う
  *
  * 流れ：
  * 1. 各式を深さ優先で探索し、末端から自分までいくつノードがあるかrankに記録する
+ *    rankの他に、退避なしで評価するのに要るレジスタの数をneedに記録する
  * 2. rankの大きい方から優先して探索し、使えるレジスタを割り付ける
  *  いずれも分の巡回までは同じ道筋なので、されぞれpass1/pass2で処理を分ける
  *
+ * レジスタが足りない場合（pass2）:
+ * 2つ目の子を評価する前に、その子のneedが空きレジスタの数を超えていれば、
+ * 最初の子の値を持っているレジスタを空ける
+ * - 定数・変数はレジスタに読み込まず（reg = NO_REG）、演算命令のオペランドとして直接使う
+ *   （再計算。変数は2つ目の子の中で代入されない場合だけ）
+ * - それ以外はスタックフレームの退避領域に書き出し（spill）、演算命令のオペランドにする
+ * 2つ目の子自身が定数・変数で空きがなければ、それを直接オペランドにし、退避はしない
+ * 退避領域は入れ子の深さ毎に1つで、関数のシンボルテーブルにSYM_SPILLとして追加するので、
+ * get_frame_sizeの大きさに含まれる。巡回の順はrankで決まり退避の有無によらないので、
+ * レジスタに収まる式のコードは退避を入れる前と変わらない
+ *
  * 簡単のため、式の子は高々2つであることを前提とする
  *
  * 関数呼び出しの際のレジスタの扱い:
  * - 引数を処理する前に（現状では）%eax, %ecx, %edxをスタックに保存し実引数の評価を行う
  * - 戻り値は%eaxに格納されるので、関数ノードに割り当てられたレジスタが%eaxでなければ値をコピーする
  *
+ * -O2では、先に変数を%ebx, %esi, %ediに割り付けておく（regalloc.c）
+ * 式の計算には引き続き%eax, %ecx, %edxだけを使い、レジスタに置かれた変数の参照・代入は
+ * メモリの代わりにそのレジスタとの間のmovlになる
+ * 2つ目の子がレジスタに置かれた変数なら、読み込まずにそのレジスタを直接オペランドにする
+ * これらは呼び出し先保存なので、関数呼び出しの前後で保存する必要はない
+ *
+ * --backend=irでは、pass1でASTをIRに変換し（ir.c）、-O2ならSSA形式で最適化して（ssa.c）、
+ * pass2でIRの上で割り付ける（irgen.c）。コード生成もIRから行う
+ * -O2でも変数はレジスタに割り付けず、SSA形式にした後の一時変数として割り付ける
  */
 
 #define  MAX_REG_NUM 3
 
-static void traverse_ast_func(AST_Node *f, int pass);
-static void traverse_ast_stm(AST_Node *s, int pass);
-static void traverse_ast_exp(AST_Node *e, int pass);
-static int  ranking_ast_exp(AST_Node *e);
-static void assign_ast_exp(AST_Node *e);
-static void assign_ast_call(AST_Node *e);
-static void assign_ast_exp_body(AST_Node *e, int regs[]);
+/*
+ * 関数毎の並列処理
+ * 各関数のレジスタ割り付けとコード生成はその関数のASTとシンボルテーブルしか
+ * 触らないので、関数毎に別々のスレッドで処理できる
+ * 出力と診断メッセージは関数毎のバッファに溜め、全て終わってから関数の順に繋ぐ
+ * ラベル番号は翻訳単位の通し番号なので、関数毎の使用数の累積和から
+ * 各関数の最初の番号を先に決めておく。出力はスレッド数によらず同じになる
+ */
+typedef struct FuncJob {
+    AST_Node  *f;
+    int  label_base;		/* 最初のラベル番号 */
+    Emit  out;			/* アセンブリ */
+    Emit  err;			/* 診断メッセージ */
+    int  failed;		/* 続行できないエラーが起きた */
+    AST_Stack  stack;		/* 式の巡回用 */
+    size_t  arena_bytes;	/* 退避領域の追加で関数の領域が確保した大きさ */
+    double  regs_pass[2];	/* レジスタ割り付けの各パスのCPU時間（--time-report） */
+    jmp_buf  fatal;
+} FuncJob;
+
+typedef struct FuncJobs {
+    Compiler  *cc;
+    FuncJob  *job;
+    int  num;
+} FuncJobs;
+
+static int  use_jobs(Compiler *cc);
+static void begin_jobs(FuncJobs *b, Compiler *cc);
+static void end_jobs(FuncJobs *b);
+static void init_codegen(CodeGen *g, Compiler *cc, FuncJob *job);
+static void cg_diag(CodeGen *g, const char *fmt, ...)
+    __attribute__((format(printf, 2, 3)));
+static void cg_fatal(CodeGen *g) __attribute__((noreturn));
+static AST_Stack *cg_stack(CodeGen *g);
+static void assign_regs_job(void *arg, int i);
+static void assign_pass(CodeGen *g, AST_Node *f, int pass);
+
+static void traverse_ast_func(CodeGen *g, AST_Node *f, int pass);
+static void traverse_ast_stm(CodeGen *g, AST_Node *s, int pass);
+static void traverse_ast_exp(CodeGen *g, AST_Node *e, int pass);
+static int  ranking_ast_exp(CodeGen *g, AST_Node *e);
+static void assign_ast_exp(CodeGen *g, AST_Node *e);
+static void assign_ast_exp_body(CodeGen *g, AST_Node *e, int regs[]);
+static AST_Node *exp_child(AST_Node *e, int k);
+static int  exp_need(AST_Node *e);
+static int  count_need(AST_Node *e);
+static int  direct_leaf(AST_Node *e, AST_Node *c);
+static int  make_room(CodeGen *g, AST_Node *e, AST_Node *s, int regs[]);
+static int  assigns_var(CodeGen *g, AST_Node *s, SymTab *var);
+static int  spill_slot(CodeGen *g);
+static int  spilled(AST_Node *e);
+static int  in_memory(AST_Node *e);
+
+/* 関数の数が2以上で、複数のスレッドを使ってよければ関数毎に並列に処理する */
+int
+use_jobs(Compiler *cc)
+{
+    return cc->opt != NULL && cc->opt->jobs > 1
+	&& cc->ast_root != NULL && cc->ast_root->num > 1;
+}
+
+void
+begin_jobs(FuncJobs *b, Compiler *cc)
+{
+    int  i;
+
+    b->cc = cc;
+    b->num = cc->ast_root->num;
+    b->job = xcalloc(b->num, sizeof(FuncJob));
+    for (i = 0; i < b->num; i++) {
+	b->job[i].f = cc->ast_root->elem[i];
+	emit_init(&b->job[i].err, -1);
+    }
+}
+
+/* 関数の順に診断メッセージを書き出す
+   続行できないエラーがあれば、逐次処理と同じく最初のものまでで止める */
+void
+end_jobs(FuncJobs *b)
+{
+    int  i, failed = 0;
+    FuncJob *j;
+
+    for (i = 0; i < b->num; i++) {
+	j = &b->job[i];
+	if (!failed && j->err.len > 0) {
+	    emit_mem(&b->cc->err, j->err.buf, j->err.len);
+	    emit_flush(&b->cc->err);
+	}
+	failed |= j->failed;
+	b->cc->stats.regs_pass[0] += j->regs_pass[0];
+	b->cc->stats.regs_pass[1] += j->regs_pass[1];
+	b->cc->stats.arena_bytes += j->arena_bytes;
+	emit_close(&j->err);
+	free_AST_Stack(&j->stack);
+	if (j->out.buf != NULL) {
+	    emit_close(&j->out);
+	}
+    }
+    xfree(b->job);
+    if (failed) {
+	fatal(b->cc);
+    }
+}
+
+void
+init_codegen(CodeGen *g, Compiler *cc, FuncJob *job)
+{
+    memset(g, 0, sizeof(CodeGen));
+    g->cc = cc;
+    g->job = job;
+}
+
+void
+cg_diag(CodeGen *g, const char *fmt, ...)
+{
+    va_list  ap;
+
+    va_start(ap, fmt);
+    if (g->job != NULL) {
+	emit_vprintf(&g->job->err, fmt, ap);
+    } else {
+	vdiag(g->cc, fmt, ap);
+    }
+    va_end(ap);
+}
+
+void
+cg_fatal(CodeGen *g)
+{
+    if (g->job != NULL) {
+	g->job->failed = 1;
+	longjmp(g->job->fatal, 1);
+    }
+    fatal(g->cc);
+}
+
+/* 式の巡回に使うスタック。並列処理中はスレッド毎に別のものを使う */
+AST_Stack*
+cg_stack(CodeGen *g)
+{
+    return (g->job != NULL) ? &g->job->stack : &g->cc->walk;
+}
+
+void
+assign_regs(Compiler *cc)
+{
+    CodeGen  g;
+    FuncJobs  b;
+    AST_Node *f;
+
+    if (use_jobs(cc)) {
+	begin_jobs(&b, cc);
+	parallel_for(b.num, cc->opt->jobs, assign_regs_job, &b);
+	end_jobs(&b);
+	return;
+    }
+    init_codegen(&g, cc, NULL);
+    TRAVERSE_AST_LIST(f, cc->ast_root, assign_regs_func(&g, f));
+}
+
+void
+assign_regs_job(void *arg, int i)
+{
+    FuncJobs *b = arg;
+    FuncJob *j = &b->job[i];
+    CodeGen  g;
+    Arena *a = &b->cc->arena_array[j->f->id];
+
+    init_codegen(&g, b->cc, j);
+    /* 退避領域の確保で共有のcc->statsを書き換えないよう、FuncJobに数える */
+    a->allocated = &j->arena_bytes;
+    if (setjmp(j->fatal) == 0) {
+	assign_regs_func(&g, j->f);
+    }
+    a->allocated = &b->cc->stats.arena_bytes;
+}
+
+/* 関数f1つ分のレジスタ割り付け。各関数は互いに独立に処理できる */
+void
+assign_regs_func(CodeGen *g, AST_Node *f)
+{
+    double  t0, t1, *pass;
+
+    /* キャッシュにあればコード生成でそれを使う */
+    if (g->cc->cache.dir != NULL && cache_load(g->cc, f->id)) {
+	return;
+    }
+    /* IRでは変数をSSA形式にして一時変数として割り付けるので、変数のままでは置かない */
+    if (g->cc->opt->optimize >= 2 && g->cc->opt->backend != BACKEND_IR) {
+	alloc_var_regs(g->cc, f, cg_stack(g));
+    }
+    g->func_id = f->id;
+    g->spill_base = get_frame_size(g->cc, f->id);
+    g->num_spill = g->spill_depth = 0;
+    if (g->cc->opt->time_report == TIME_REPORT_NONE) {
+	assign_pass(g, f, 1);
+	assign_pass(g, f, 2);
+	return;
+    }
+    /* 並列に処理する時は各スレッドのFuncJobに測り、end_jobsで合計する */
+    pass = (g->job != NULL) ? g->job->regs_pass : g->cc->stats.regs_pass;
+    t0 = stats_cpu_now();
+    assign_pass(g, f, 1);
+    t1 = stats_cpu_now();
+    assign_pass(g, f, 2);
+    pass[0] += t1-t0;
+    pass[1] += stats_cpu_now()-t1;
+}
 
 void
-assign_regs(void)
+assign_pass(CodeGen *g, AST_Node *f, int pass)
 {
-    AST_List *l;
+    Compiler *cc = g->cc;
 
-    TRAVERSE_AST_LIST(l, AST_root, traverse_ast_func(l->elem, 1));
-    TRAVERSE_AST_LIST(l, AST_root, traverse_ast_func(l->elem, 2));
+    if (cc->opt->backend != BACKEND_IR) {
+	traverse_ast_func(g, f, pass);
+    } else if (pass == 1) {
+	cc->ir_array[f->id] = ir_lower(cc, f, cg_stack(g));
+	if (cc->opt->optimize >= 2) {
+	    ir_optimize(cc->ir_array[f->id]);
+	}
+    } else {
+	ir_assign_regs(g, cc->ir_array[f->id]);
+    }
 }
 
 void
-traverse_ast_func(AST_Node *f, int pass)
+traverse_ast_func(CodeGen *g, AST_Node *f, int pass)
 {
-    traverse_ast_stm(f->child[1], pass);
+    traverse_ast_stm(g, f->child[1], pass);
 }
 
 void
-traverse_ast_stm(AST_Node *s, int pass)
+traverse_ast_stm(CodeGen *g, AST_Node *s, int pass)
 {
-    AST_List *l;
+    AST_Node *n;
 
     if (s == NULL) {
 	return;
     }
     switch (s->sub_kind) {
     case  AST_STM_LIST:
-	TRAVERSE_AST_LIST(l, s->list, traverse_ast_stm(l->elem, pass));
+	TRAVERSE_AST_LIST(n, s->list, traverse_ast_stm(g, n, pass));
 	break;
     case  AST_STM_DEC:
 	/* Nothing to do */
 	break;
     case  AST_STM_ASIGN:
-	traverse_ast_exp(s->child[0], pass);
+	traverse_ast_exp(g, s->child[0], pass);
 	break;
     case  AST_STM_IF:
-	traverse_ast_exp(s->child[0], pass);
+	traverse_ast_exp(g, s->child[0], pass);
 	/* then-statement */
-	traverse_ast_stm(s->child[1], pass);
+	traverse_ast_stm(g, s->child[1], pass);
 	/* else-statement */
-	traverse_ast_stm(s->child[2], pass);
+	traverse_ast_stm(g, s->child[2], pass);
 	break;
     case  AST_STM_WHILE:
-	traverse_ast_exp(s->child[0], pass);
-	traverse_ast_stm(s->child[1], pass);
+	traverse_ast_exp(g, s->child[0], pass);
+	traverse_ast_stm(g, s->child[1], pass);
 	break;
     case  AST_STM_FOR:
-	traverse_ast_exp(s->child[0], pass);
-	traverse_ast_exp(s->child[1], pass);
-	traverse_ast_exp(s->child[2], pass);
-	traverse_ast_stm(s->child[3], pass);
+	traverse_ast_exp(g, s->child[0], pass);
+	traverse_ast_exp(g, s->child[1], pass);
+	traverse_ast_exp(g, s->child[2], pass);
+	traverse_ast_stm(g, s->child[3], pass);
 	break;
 	case AST_STM_DOWHILE:
-	traverse_ast_stm(s->child[0], pass);
-	traverse_ast_exp(s->child[1], pass);
+	traverse_ast_stm(g, s->child[0], pass);
+	traverse_ast_exp(g, s->child[1], pass);
 	break;
 /* REPORT3
    このあたりにdo-while文ノード用のレジスタ割り付け巡回処理を追加する
 */
     case  AST_STM_RETURN:
-	traverse_ast_exp(s->child[0], pass);
+	traverse_ast_exp(g, s->child[0], pass);
 	break;
     default:
 	errexit("Invalid statement kind", __FILE__, __LINE__);
@@ -110,95 +347,198 @@ traverse_ast_stm(AST_Node *s, int pass)
 }
 
 void
-traverse_ast_exp(AST_Node *e, int pass)
+traverse_ast_exp(CodeGen *g, AST_Node *e, int pass)
 {
     if (e == NULL) {
 	return;
     }
     if (pass == 1) {
-	ranking_ast_exp(e);
+	ranking_ast_exp(g, e);
     } else if (pass == 2) {
-	assign_ast_exp(e);
+	assign_ast_exp(g, e);
     } else {
-	fputs("Illegal register assignemnt pass.\n", stderr);
-	abort();
+	errexit("Illegal register assignemnt pass.", __FILE__, __LINE__);
     }
 }
 
+/*
+ * 式の巡回はいずれもcg_stack(g)の明示的なスタックで行い、再帰しない
+ * 文法が a+b+c+... を左に深い木にするので、長い式でも深さに比例した
+ * Cのスタックを使わないようにするため
+ */
 int
-ranking_ast_exp(AST_Node *e)
+ranking_ast_exp(CodeGen *g, AST_Node *e)
 {
-    int  r0, r1, maxr;
-    AST_List *l;
-    
-    TRAVERSE_AST_LIST(l, e->list, ranking_ast_exp(l->elem));
-    r0 = r1 = 0;
-    if (e->sub_kind != AST_EXP_CALL && e->child[0] != NULL) {
-	r0 = ranking_ast_exp(e->child[0]);
-    }
-    if (e->child[1] != NULL) {
-	r1 = ranking_ast_exp(e->child[1]);
+    AST_Stack *st = cg_stack(g);
+    AST_Node *n, *a, *c0, *c1;
+    int  base, r0, r1;
+
+    base = st->num;
+    push_AST_Stack(st, e);
+    while (st->num > base) {
+	n = AST_STACK_TOP(st)->n;
+	c0 = (n->sub_kind != AST_EXP_CALL) ? AST_CHILD(n, 0) : NULL;
+	c1 = AST_CHILD(n, 1);
+	if (AST_STACK_TOP(st)->state++ == 0) {
+	    /* 子を先に処理する（実引数の順位は自分の順位には影響しない） */
+	    TRAVERSE_AST_LIST(a, n->list, push_AST_Stack(st, a));
+	    if (c0 != NULL) {
+		push_AST_Stack(st, c0);
+	    }
+	    if (c1 != NULL) {
+		push_AST_Stack(st, c1);
+	    }
+	    continue;
+	}
+	st->num--;
+	r0 = (c0 != NULL) ? c0->rank : 0;
+	r1 = (c1 != NULL) ? c1->rank : 0;
+	n->rank = (r0 >= r1 ? r0 : r1)+1; /* 末端でもこれでOK */
+	if (n->sub_kind != AST_EXP_CNST_INT) {
+	    n->need = count_need(n);
+	}
     }
-    maxr = r0 >= r1 ? r0 : r1;
-    e->rank = maxr+1; /* 末端でもこれでOK */
     return e->rank;
 }
 
+/*
+ * 式eの子を巡回する順番のk番目（0か1）。なければNULL
+ * rankの大きい子を先にする。子のrankが全て0なら（関数呼び出しも含め）末端として扱う
+ * レジスタ割り付けとコード生成は同じ順番で巡回する必要がある
+ */
+AST_Node*
+exp_child(AST_Node *e, int k)
+{
+    AST_Node *c0, *c1;
+    int  r0, r1;
 
-void
-assign_ast_exp(AST_Node *e)
+    c0 = AST_CHILD(e, 0);
+    c1 = AST_CHILD(e, 1);
+    r0 = (c0 != NULL) ? c0->rank : 0;
+    r1 = (c1 != NULL) ? c1->rank : 0;
+    if (r0 == 0 && r1 == 0) {
+	return NULL;
+    }
+    if (r0 < r1) {
+	k = 1-k;
+    }
+    return AST_CHILD(e, k);
+}
+
+/* 式eを退避なしで評価するのに要るレジスタの数 */
+int
+exp_need(AST_Node *e)
 {
-    if (e->sub_kind == AST_EXP_CALL) {
-	assign_ast_call(e);
-    } else {
-	int regs[MAX_REG_NUM];	/* 利用可能レジスタのフラグ */
-	memset(regs, 0, sizeof(regs));
-	assign_ast_exp_body(e, regs);
+    return (e->sub_kind == AST_EXP_CNST_INT) ? 1 : e->need;
+}
+
+/*
+ * 子のneedが決まった式eのneed（pass2のmake_roomと合わせておくこと）
+ * 最初の子の値を1つ持ったまま2つ目の子を評価するので、2項演算子は
+ * max(最初の子, 2つ目の子+1)。ただし直接オペランドにできる末端は数えない
+ * 最初の子が末端なら、rankの大きい方が先なので2つ目の子も末端である
+ */
+int
+count_need(AST_Node *e)
+{
+    AST_Node *c0, *c1;
+    int  n0, n1;
+
+    if ((c0 = exp_child(e, 0)) == NULL) {
+	return 1;
+    }
+    n0 = exp_need(c0);
+    if ((c1 = exp_child(e, 1)) == NULL || direct_leaf(e, c1)) {
+	return n0;
     }
+    if (direct_leaf(e, c0)) {
+	return 1;
+    }
+    n1 = exp_need(c1)+1;
+    return (n0 > n1) ? n0 : n1;
 }
 
 /*
- * 関数呼び出し前にREGISTERをスタックに保存するのでレジスタ使用状況はリセット
+ * 式eの子cがレジスタに読み込まずにオペランドとして直接使える定数・変数か
+ * 代入の右辺はメモリからメモリへのmovlになるので除く（左辺は読まないので使える）
  */
-void
-assign_ast_call(AST_Node *e)
+int
+direct_leaf(AST_Node *e, AST_Node *c)
 {
-    AST_List *l;
-    /* 引き数列の処理 */
-    TRAVERSE_AST_LIST(l, e->list, assign_ast_exp(l->elem));
+    if (e->sub_kind == AST_EXP_ASGN && c == e->child[1]) {
+	return 0;
+    }
+    return c->sub_kind == AST_EXP_CNST_INT || c->sub_kind == AST_EXP_IDENT;
 }
 
+/*
+ * 実引数毎にレジスタの使用状況をリセットして割り付ける
+ * 実引数の中の関数呼び出しも同じスタックで順に処理する
+ */
 void
-assign_ast_exp_body(AST_Node *e, int regs[])
+assign_ast_exp(CodeGen *g, AST_Node *e)
 {
-    int  i, i0, i1, r0, r1;
+    AST_Stack *st = cg_stack(g);
+    AST_Node *n;
+    int  base, regs[MAX_REG_NUM];	/* 利用可能レジスタのフラグ */
 
-    r0 = r1 = 0;
-    if (e->child[0] != NULL) {
-	r0 = e->child[0]->rank;
-    }
-    if (e->child[1] != NULL) {
-	r1 = e->child[1]->rank;
-    }
-    if (r0 >= r1) {
-	i0 = 0; i1 = 1;
-    } else {
-	i0 = 1; i1 = 0;
-    }
-    if (r0 != 0 || r1 != 0) { /* 子がある */
-	if (e->child[i0] != NULL) {
-	    assign_ast_exp_body(e->child[i0], regs);
-	}
-	if (e->child[i1] != NULL) {
-	    assign_ast_exp_body(e->child[i1], regs);
+    base = st->num;
+    push_AST_Stack(st, e);
+    while (st->num > base) {
+	e = st->frame[--st->num].n;
+	if (e->sub_kind == AST_EXP_CALL) {
+	    /* 関数呼び出し前にREGISTERをスタックに保存するのでレジスタ使用状況はリセット */
+	    REV_TRAVERSE_AST_LIST(n, e->list, push_AST_Stack(st, n));
+	} else {
+	    memset(regs, 0, sizeof(regs));
+	    assign_ast_exp_body(g, e, regs);
 	}
-	if (e->child[0] != NULL) {
-	    e->reg = e->child[0]->reg;
+    }
+}
+
+/*
+ * 子を巡回した後、自分のレジスタを決める（stateは巡回済みの子の数）
+ * 子の一方がレジスタにない（直接オペランドか退避した）なら、もう一方のレジスタを使う
+ */
+void
+assign_ast_exp_body(CodeGen *g, AST_Node *e, int regs[])
+{
+    AST_Stack *st = cg_stack(g);
+    AST_Frame *f;
+    AST_Node *c0, *c1;
+    int  i, k, base;
+
+    base = st->num;
+    push_AST_Stack(st, e);
+    while (st->num > base) {
+	f = AST_STACK_TOP(st);
+	e = f->n;
+	if (f->state < 2) {
+	    k = f->state++;
+	    if ((c0 = exp_child(e, k)) != NULL && (k == 0 || make_room(g, e, c0, regs))) {
+		push_AST_Stack(st, c0);
+	    }
+	    continue;
 	}
-	if (e->child[1] != NULL) {
-	    regs[e->child[1]->reg] = 0;
+	st->num--;
+	if (exp_child(e, 0) != NULL) { /* 子がある */
+	    c0 = AST_CHILD(e, 0);
+	    c1 = AST_CHILD(e, 1);
+	    if (c1 == NULL) {
+		e->reg = c0->reg;
+	    } else if (in_memory(c0)) {
+		e->reg = c1->reg;
+		g->spill_depth -= spilled(c0);
+	    } else {
+		e->reg = c0->reg;
+		if (in_memory(c1)) {
+		    g->spill_depth -= spilled(c1);
+		} else {
+		    regs[c1->reg] = 0;
+		}
+	    }
+	    continue;
 	}
-    } else {
 	for (i = 0; i < MAX_REG_NUM; i++) {
 	    if (regs[i] == 0) {
 		e->reg = i;
@@ -207,10 +547,98 @@ assign_ast_exp_body(AST_Node *e, int regs[])
 	    }
 	}
 	if (i == MAX_REG_NUM) {
-	    fputs("Number of registers is not sufficient.\n", stderr);
-	    abort();
+	    /* make_roomが空けているので起こらない */
+	    errexit("Number of registers is not sufficient.", __FILE__, __LINE__);
+	}
+    }
+}
+
+/*
+ * 式eの2つ目の子sを評価する前に、sに要るだけのレジスタを空ける
+ * （最初の子の値を1つレジスタに持っている）
+ * sが直接オペランドにできる定数・変数で、空きがないか、sがレジスタに置かれた
+ * 変数（-O2）なら読み込まない。この時は0を返し、sは巡回しない
+ * sのneedが空きの数を超えれば最初の子を直接オペランドにするか退避する
+ */
+int
+make_room(CodeGen *g, AST_Node *e, AST_Node *s, int regs[])
+{
+    AST_Node *f = exp_child(e, 0);
+    int  i, nfree = 0;
+
+    for (i = 0; i < MAX_REG_NUM; i++) {
+	nfree += (regs[i] == 0);
+    }
+    if (direct_leaf(e, s)
+	&& (nfree == 0 || (s->sub_kind == AST_EXP_IDENT && s->symtab->reg != 0))) {
+	s->reg = NO_REG;
+	return 0;
+    }
+    if (exp_need(s) <= nfree) {
+	return 1;
+    }
+    regs[f->reg] = 0;
+    if (direct_leaf(e, f)
+	&& (e->sub_kind == AST_EXP_ASGN || f->sub_kind == AST_EXP_CNST_INT
+	    || !assigns_var(g, s, f->symtab))) {
+	f->reg = NO_REG;
+    } else {
+	f->spill = spill_slot(g);
+    }
+    return 1;
+}
+
+/* 式sの中（実引数も含む）に変数varへの代入があるか */
+int
+assigns_var(CodeGen *g, AST_Node *s, SymTab *var)
+{
+    AST_Stack *st = cg_stack(g);
+    AST_Node *n, *a;
+    int  i, base, found = 0;
+
+    base = st->num;
+    push_AST_Stack(st, s);
+    while (st->num > base) {
+	n = st->frame[--st->num].n;
+	if (n->sub_kind == AST_EXP_ASGN && n->child[0]->symtab == var) {
+	    found = 1;
+	    st->num = base;
+	    break;
 	}
+	for (i = 0; i < n->num_child; i++) {
+	    if (n->child[i] != NULL) {
+		push_AST_Stack(st, n->child[i]);
+	    }
+	}
+	TRAVERSE_AST_LIST(a, n->list, push_AST_Stack(st, a));
     }
+    return found;
+}
+
+/* 使用中の退避領域を1つ増やし、その位置を返す。足りなければ関数のフレームに追加する */
+int
+spill_slot(CodeGen *g)
+{
+    if (g->spill_depth == g->num_spill) {
+	append_spill_slot(g->cc, g->func_id);
+	g->num_spill++;
+    }
+    g->spill_depth++;
+    return -(g->spill_base+4*g->spill_depth);
+}
+
+/* 式eの値を退避したか。pass2で割り付けていない式ではneedが入っている */
+int
+spilled(AST_Node *e)
+{
+    return e->sub_kind != AST_EXP_CNST_INT && e->reg != NO_REG && e->spill < 0;
+}
+
+/* 式eの値が演算の時にレジスタにないか（直接オペランドか退避した） */
+int
+in_memory(AST_Node *e)
+{
+    return e->reg == NO_REG || spilled(e);
 }
 
 /*
@@ -288,114 +716,264 @@ const char PUTINT_CODE[]  =
 #elif defined(TARGET_CYGWIN)
 #endif
 
-static void init_label(void);
-static void make_func_last_label(AST_Node *f);
-static int  get_label(void);
-static char *gen_label(int label);
-static void gen_label_stm(FILE *out, int label);
-static void gen_header(FILE *out);
-static void gen_func(FILE *out, AST_Node *f);
-static void gen_func_header(FILE *out, char *name, int frame_size);
-static void gen_func_footer(FILE *out);
-static void gen_put_int(FILE *out);
-static void gen_stm(FILE *out, AST_Node *s);
-static void gen_stm_asign(FILE *out, AST_Node *s);
-static void gen_stm_rel(FILE *out, AST_Node *e, int l_cmp);
-static void gen_stm_if(FILE *out, AST_Node *s);
-static void gen_stm_while(FILE *out, AST_Node *s);
-static void gen_stm_for(FILE *out, AST_Node *s);
-static void gen_stm_dowhile(FILE *out, AST_Node *s);
-static void gen_stm_return(FILE *out, AST_Node *s);
-static void gen_exp(FILE *out, AST_Node *e);
-static void gen_exp_asgn(FILE *out, AST_Node *e);
-static void gen_exp_cnst(FILE *out, AST_Node *c);
-static void gen_exp_ident(FILE *out, AST_Node *idnt);
-static void gen_exp_rel(FILE *out, AST_Node *rel);
-static void gen_exp_call(FILE *out, AST_Node *e);
-static void gen_exp_call_param(FILE *out, AST_Node *p, int offset);
-static void gen_exp_n2(FILE *out, AST_Node *e);
-
-static int local_label;		/* 関数内ラベルの番号 */
-static char *func_end_label;	/* 関数末尾のラベル */
-
-static char reg_name[][5] = {"%eax", "%ecx", "%edx"};
-
-void
-init_label(void)
-{
-    local_label = 0;
+static void init_label(CodeGen *g);
+static int  get_label(CodeGen *g);
+static int  count_labels(AST_Node *s);
+static void count_labels_job(void *arg, int i);
+static void gen_func_job(void *arg, int i);
+static void gen_label_stm(CodeGen *g, int label);
+static void gen_jump(CodeGen *g, const char *op, int label);
+static void gen_header(CodeGen *g);
+static void gen_saved_regs(CodeGen *g, int restore);
+static void gen_put_int(CodeGen *g);
+static void gen_stm(CodeGen *g, AST_Node *s);
+static void gen_stm_asign(CodeGen *g, AST_Node *s);
+static void gen_stm_rel(CodeGen *g, AST_Node *e, int l_cmp);
+static void gen_stm_if(CodeGen *g, AST_Node *s);
+static void gen_stm_while(CodeGen *g, AST_Node *s);
+static void gen_stm_for(CodeGen *g, AST_Node *s);
+static void gen_stm_dowhile(CodeGen *g, AST_Node *s);
+static void gen_stm_return(CodeGen *g, AST_Node *s);
+static void gen_exp(CodeGen *g, AST_Node *e);
+static void gen_exp_asgn(CodeGen *g, AST_Node *e);
+static void gen_exp_cnst(CodeGen *g, AST_Node *c);
+static void gen_exp_ident(CodeGen *g, AST_Node *idnt);
+static void gen_exp_rel(CodeGen *g, AST_Node *rel);
+static void gen_exp_call(CodeGen *g, AST_Node *e);
+static void gen_exp_call_param(CodeGen *g, AST_Node *p, int offset);
+static void gen_exp_n2(CodeGen *g, AST_Node *e);
+static int  rel_kind(AST_Node *e);
+static void gen_operand(CodeGen *g, AST_Node *c);
+static void gen_op(CodeGen *g, const char *op, AST_Node *src, int dst);
+
+void
+init_label(CodeGen *g)
+{
+    g->local_label = 0;
+}
+
+int
+get_label(CodeGen *g)
+{
+    return g->local_label++;
+}
+
+/* 文sのコード生成でget_labelを呼ぶ回数。gen_stm_*と合わせておくこと */
+int
+count_labels(AST_Node *s)
+{
+    int  n = 0;
+    AST_Node *c;
+
+    if (s == NULL) {
+	return 0;
+    }
+    switch (s->sub_kind) {
+    case  AST_STM_LIST:
+	TRAVERSE_AST_LIST(c, s->list, n += count_labels(c));
+	break;
+    case  AST_STM_IF:
+	n = (s->child[2] != NULL) ? 2 : 1;
+	n += count_labels(s->child[1]) + count_labels(s->child[2]);
+	break;
+    case  AST_STM_WHILE:
+	n = 2 + count_labels(s->child[1]);
+	break;
+    case  AST_STM_FOR:
+	n = 2 + count_labels(s->child[3]);
+	break;
+    case  AST_STM_DOWHILE:
+	n = 2 + count_labels(s->child[0]);
+	break;
+    }
+    return n;
+}
+
+void
+gen_label_stm(CodeGen *g, int label)
+{
+    emit_label(g->out, label);
+    EMIT_LIT(g->out, ":\n");
 }
 
 /*
- * 関数末尾のラベル
- * func1()のラベルの場合は_END_func1
+ * 分岐命令
+ * 関数末尾への分岐(label < 0)の飛び先は_END_関数名
  */
 void
-make_func_last_label(AST_Node *f)
+gen_jump(CodeGen *g, const char *op, int label)
 {
-    char *name;
-    int len;
-    assert(f->child[0]->sub_kind == AST_EXP_IDENT);
-    name = f->child[0]->str;
-    len = strlen(name)+6;
-    func_end_label = xmalloc(len);
-    snprintf(func_end_label, len, "_END_%s", name);
+    emit_char(g->out, '\t');
+    emit_str(g->out, op);
+    emit_char(g->out, '\t');
+    if (label < 0) {
+	EMIT_LIT(g->out, "_END_");
+	emit_str(g->out, g->func_name);
+    } else {
+	emit_label(g->out, label);
+    }
+    emit_char(g->out, '\n');
 }
 
-int
-get_label(void)
+void
+gen_code(Compiler *cc)
 {
-    return local_label++;
+    AST_Node *f;
+    FuncJobs  b;
+    int  i, n;
+    
+    gen_code_begin(cc);
+    if (!use_jobs(cc)) {
+	TRAVERSE_AST_LIST(f, cc->ast_root, gen_func(&cc->cg, f));
+	gen_code_end(cc);
+	return;
+    }
+
+    begin_jobs(&b, cc);
+    parallel_for(b.num, cc->opt->jobs, count_labels_job, &b);
+    for (i = 0; i < b.num; i++) {
+	n = b.job[i].label_base;
+	b.job[i].label_base = cc->cg.local_label;
+	cc->cg.local_label += n;
+    }
+    parallel_for(b.num, cc->opt->jobs, gen_func_job, &b);
+    for (i = 0; i < b.num; i++) {
+	emit_mem(&cc->out, b.job[i].out.buf, b.job[i].out.len);
+	emit_close(&b.job[i].out);
+    }
+    end_jobs(&b);
+    gen_code_end(cc);
 }
 
-char*
-gen_label(int label)
+/* 関数が使うラベルの数をlabel_baseに入れておく
+   キャッシュから読んだ関数は保存した時の数、IRから生成する関数はirgen.cの数える数 */
+void
+count_labels_job(void *arg, int i)
 {
-    static char buf[10];
+    FuncJobs *b = arg;
+    AST_Node *f = b->job[i].f;
+    IR_Func *ir = b->cc->ir_array[f->id];
 
-    snprintf(buf, sizeof(buf), ".L%d", label);
-    return buf;
+    if (cache_loaded(b->cc, f->id)) {
+	b->job[i].label_base = b->cc->cache.entry[f->id].nlabels;
+    } else if (ir != NULL) {
+	b->job[i].label_base = ir->nlabel;
+    } else {
+	b->job[i].label_base = count_labels(f->child[1]);
+    }
 }
 
 void
-gen_label_stm(FILE *out, int label)
+gen_func_job(void *arg, int i)
 {
-    fprintf(out, "%s:\n", gen_label(label));
+    FuncJobs *b = arg;
+    FuncJob *j = &b->job[i];
+    CodeGen  g;
+
+    init_codegen(&g, b->cc, j);
+    emit_init(&j->out, -1);
+    g.out = &j->out;
+    g.local_label = j->label_base;
+    if (setjmp(j->fatal) == 0) {
+	gen_func(&g, j->f);
+    }
 }
 
+/*
+ * 逐次コンパイル用
+ * gen_code_beginの後、関数毎にgen_func(&cc->cg, f)を呼び、
+ * 最後にgen_code_endを呼ぶ
+ */
 void
-gen_code(FILE *out)
+gen_code_begin(Compiler *cc)
 {
-    AST_List *l;
-    
-    gen_header(out);
-    init_label();
-    TRAVERSE_AST_LIST(l, AST_root, gen_func(out, l->elem));
-    gen_put_int(out);
+    CodeGen *g = &cc->cg;
+
+    init_codegen(g, cc, NULL);
+    g->out = &cc->out;
+    gen_header(g);
+    init_label(g);
+}
+
+void
+gen_code_end(Compiler *cc)
+{
+    gen_put_int(&cc->cg);
 }
 
 void
-gen_header(FILE *out)
+gen_header(CodeGen *g)
 {
-    fprintf(out, "%s", SECTION_TEXT);
+    EMIT_LIT(g->out, SECTION_TEXT);
 }
 
 void
-gen_func(FILE *out, AST_Node *f)
+gen_func(CodeGen *g, AST_Node *f)
 {
-    AST_List *l;
+    AST_Node *s;
+    SymTab *t;
+    Emit *out = g->out;
+    size_t  start;
+    int  i, nsaved, label_base = g->local_label;
+
+    if (cache_loaded(g->cc, f->id)) {
+	g->local_label += cache_emit(g->cc, f->id, g->out, label_base);
+	release_symtab(g->cc, f->id);
+	return;
+    }
+    /* キャッシュに保存するので、書き出される前に関数のコードを全て溜めておく */
+    if (g->cc->cache.dir != NULL && out->fd >= 0) {
+	if (g->func_out.buf == NULL) {
+	    emit_init(&g->func_out, -1);
+	}
+	g->func_out.len = 0;
+	g->out = &g->func_out;
+    }
+    start = g->out->len;
 
     assert(f->child[0]->sub_kind == AST_EXP_IDENT);
-    make_func_last_label(f);
-    gen_func_header(out, f->child[0]->str, get_frame_size(f->id));
-    TRAVERSE_AST_LIST(l, f->child[1]->list, gen_stm(out, l->elem));
-    gen_func_footer(out);
-    free(func_end_label);
-    func_end_label = NULL;
+    g->func_name = f->child[0]->str;
+    g->save_base = get_frame_size(g->cc, f->id);
+    g->saved_regs = var_regs_used(g->cc, f->id);
+    if (g->cc->ir_array[f->id] != NULL) {
+	g->saved_regs |= g->cc->ir_array[f->id]->saved_regs;
+    }
+    for (i = nsaved = 0; i < VAR_REG_BASE+NUM_VAR_REGS; i++) {
+	nsaved += (g->saved_regs >> i) & 1;
+    }
+    gen_func_header(g, f->child[0]->str, g->save_base+4*nsaved);
+    /* レジスタに置かれた仮引数を読み込む */
+    for (t = g->cc->symtab_array[f->id]; t != NULL; t = t->next) {
+	if (t->kind == SYM_ARG && t->reg != 0) {
+	    EMIT_LIT(g->out, "\tmovl\t");
+	    emit_ebp(g->out, t->offset);
+	    EMIT_LIT(g->out, ", ");
+	    emit_reg(g->out, t->reg);
+	    emit_char(g->out, '\n');
+	}
+    }
+    if (g->cc->ir_array[f->id] != NULL) {
+	ir_gen_code(g, g->cc->ir_array[f->id]);
+    } else {
+	TRAVERSE_AST_LIST(s, f->child[1]->list, gen_stm(g, s));
+    }
+    gen_func_footer(g);
+    g->func_name = NULL;
+
+    if (g->cc->cache.dir != NULL) {
+	cache_store(g->cc, f->id, g->out->buf+start, g->out->len-start,
+		    label_base, g->local_label-label_base);
+	if (g->out != out) {
+	    emit_mem(out, g->out->buf+start, g->out->len-start);
+	    g->out = out;
+	}
+    }
+    /* コードを生成し終えた関数のASTとシンボルテーブルは一括して解放する */
+    release_symtab(g->cc, f->id);
 }
 
 void
-gen_func_header(FILE *out, char *name, int frame_size)
+gen_func_header(CodeGen *g, char *name, int frame_size)
 {
     const char *targetn = name;
     int pad;
@@ -408,62 +986,96 @@ gen_func_header(FILE *out, char *name, int frame_size)
     if (strcmp(name, "main") == 0) {
 	targetn = MAIN_LABEL;
     }
-    fprintf(out,
-	    "\t.globl\t%s\n"
-	    "%s:\n", targetn, targetn);
-    fputs("\tpushl\t%ebp\n"
-	  "\tmovl\t%esp, %ebp\n", out);
+    EMIT_LIT(g->out, "\t.globl\t");
+    emit_str(g->out, targetn);
+    emit_char(g->out, '\n');
+    emit_str(g->out, targetn);
+    EMIT_LIT(g->out, ":\n"
+	     "\tpushl\t%ebp\n"
+	     "\tmovl\t%esp, %ebp\n");
     if (frame_size+pad > 0) {
-	fprintf(out, "\tsubl\t$%d, %%esp\n", frame_size+pad);
+	EMIT_LIT(g->out, "\tsubl\t");
+	emit_imm(g->out, frame_size+pad);
+	EMIT_LIT(g->out, ", %esp\n");
     }
+    gen_saved_regs(g, 0);
 }
 
 void
-gen_func_footer(FILE *out)
+gen_func_footer(CodeGen *g)
 {
-    fprintf(out, "%s:\n"
-	    "\tleave\n"
-	    "\tret\n\n", func_end_label);
+    EMIT_LIT(g->out, "_END_");
+    emit_str(g->out, g->func_name);
+    EMIT_LIT(g->out, ":\n");
+    gen_saved_regs(g, 1);
+    g->saved_regs = 0;
+    EMIT_LIT(g->out, "\tleave\n"
+	     "\tret\n\n");
 }
 
+/* g->saved_regsのレジスタをスタックフレームに保存する（restoreなら戻す） */
 void
-gen_put_int(FILE *out)
+gen_saved_regs(CodeGen *g, int restore)
 {
-    fprintf(out, "%s", PUTINT_CODE);
+    int  i, k;
+
+    for (i = k = 0; g->saved_regs >> i != 0; i++) {
+	if (((g->saved_regs >> i) & 1) == 0) {
+	    continue;
+	}
+	k++;
+	EMIT_LIT(g->out, "\tmovl\t");
+	if (restore) {
+	    emit_ebp(g->out, -(g->save_base+4*k));
+	    EMIT_LIT(g->out, ", ");
+	    emit_reg(g->out, i);
+	} else {
+	    emit_reg(g->out, i);
+	    EMIT_LIT(g->out, ", ");
+	    emit_ebp(g->out, -(g->save_base+4*k));
+	}
+	emit_char(g->out, '\n');
+    }
 }
 
 void
-gen_stm(FILE *out, AST_Node *s)
+gen_put_int(CodeGen *g)
 {
-    AST_List *l;
+    EMIT_LIT(g->out, PUTINT_CODE);
+}
+
+void
+gen_stm(CodeGen *g, AST_Node *s)
+{
+    AST_Node *n;
     
     if (s == NULL) {
 	return;
     }
     switch (s->sub_kind) {
     case  AST_STM_LIST:
-	TRAVERSE_AST_LIST(l, s->list, gen_stm(out, l->elem));
+	TRAVERSE_AST_LIST(n, s->list, gen_stm(g, n));
 	break;
     case  AST_STM_DEC:
 	/* Nothing to do */
 	break;
     case  AST_STM_ASIGN:
-	gen_stm_asign(out, s);
+	gen_stm_asign(g, s);
 	break;
     case  AST_STM_IF:
-	gen_stm_if(out, s);
+	gen_stm_if(g, s);
 	break;
     case  AST_STM_WHILE:
-	gen_stm_while(out, s);
+	gen_stm_while(g, s);
 	break;
     case  AST_STM_FOR:
-	gen_stm_for(out, s);
+	gen_stm_for(g, s);
 	break;
     case  AST_STM_DOWHILE:
-	gen_stm_dowhile(out, s);
+	gen_stm_dowhile(g, s);
 	break;
     case  AST_STM_RETURN:
-	gen_stm_return(out, s);
+	gen_stm_return(g, s);
 	break;
     default:
 	errexit("Invalid statement kind", __FILE__, __LINE__);
@@ -471,9 +1083,9 @@ gen_stm(FILE *out, AST_Node *s)
 }
 
 void
-gen_stm_asign(FILE *out, AST_Node *s)
+gen_stm_asign(CodeGen *g, AST_Node *s)
 {
-    gen_exp(out, s->child[0]);
+    gen_exp(g, s->child[0]);
 }
 
 /*
@@ -482,191 +1094,251 @@ gen_stm_asign(FILE *out, AST_Node *s)
  * l_cmpは条件が偽だった場合の飛び先ラベル
  */
 void
-gen_stm_rel(FILE *out, AST_Node *e, int l_cmp)
+gen_stm_rel(CodeGen *g, AST_Node *e, int l_cmp)
 {
     int  op;
 
-    op = e->sub_kind;
+    op = rel_kind(e);
     switch (op) {
     case  AST_EXP_LT:
-	fprintf(out, "\tjge\t%s\n", gen_label(l_cmp));
+	gen_jump(g, "jge", l_cmp);
 	break;
     case  AST_EXP_GT:
-	fprintf(out, "\tjle\t%s\n", gen_label(l_cmp));
+	gen_jump(g, "jle", l_cmp);
 	break;
     case  AST_EXP_LTE:
-	fprintf(out, "\tjg\t%s\n", gen_label(l_cmp));
+	gen_jump(g, "jg", l_cmp);
 	break;
     case  AST_EXP_GTE:
-	fprintf(out, "\tjl\t%s\n", gen_label(l_cmp));
+	gen_jump(g, "jl", l_cmp);
 	break;
     case  AST_EXP_EQ:
-	fprintf(out, "\tjne\t%s\n", gen_label(l_cmp));
+	gen_jump(g, "jne", l_cmp);
 	break;
     case  AST_EXP_NE:
-	fprintf(out, "\tje\t%s\n", gen_label(l_cmp));
+	gen_jump(g, "je", l_cmp);
 	break;
     default:
 	/* "0" stands for "false". */
-	fprintf(out, "\tcmpl\t$0,%s\n", reg_name[e->reg]);
-	fprintf(out, "\tje\t%s\n", gen_label(l_cmp));
+	EMIT_LIT(g->out, "\tcmpl\t$0,");
+	emit_reg(g->out, e->reg);
+	emit_char(g->out, '\n');
+	gen_jump(g, "je", l_cmp);
     }
 }
 
 void
-gen_stm_if(FILE *out, AST_Node *s)
+gen_stm_if(CodeGen *g, AST_Node *s)
 {
     int  l_else = -1, l_end, l_cmp;
-    l_cmp = l_end = get_label();
+    l_cmp = l_end = get_label(g);
     if (s->child[2] != NULL) { /* else */
-	l_cmp = l_else = get_label();
+	l_cmp = l_else = get_label(g);
     }
 
-    gen_exp(out, s->child[0]);
-    gen_stm_rel(out, s->child[0], l_cmp);
-    gen_stm(out, s->child[1]);
+    gen_exp(g, s->child[0]);
+    gen_stm_rel(g, s->child[0], l_cmp);
+    gen_stm(g, s->child[1]);
     if (s->child[2] != NULL) {
-	fprintf(out, "\tjmp\t%s\n", gen_label(l_end));
-	gen_label_stm(out, l_else);
-	gen_stm(out, s->child[2]);
+	gen_jump(g, "jmp", l_end);
+	gen_label_stm(g, l_else);
+	gen_stm(g, s->child[2]);
     }
-    gen_label_stm(out, l_end);
+    gen_label_stm(g, l_end);
 }
 
 void
-gen_stm_while(FILE *out, AST_Node *s)
+gen_stm_while(CodeGen *g, AST_Node *s)
 {
     int  l_begin, l_exit;
-    l_begin = get_label();
-    l_exit = get_label();
-    gen_label_stm(out, l_begin);
-    gen_exp(out, s->child[0]);
-    gen_stm_rel(out, s->child[0], l_exit);
-    gen_stm(out, s->child[1]);
-    fprintf(out, "\tjmp\t%s\n", gen_label(l_begin));
-    gen_label_stm(out, l_exit);
+    l_begin = get_label(g);
+    l_exit = get_label(g);
+    gen_label_stm(g, l_begin);
+    gen_exp(g, s->child[0]);
+    gen_stm_rel(g, s->child[0], l_exit);
+    gen_stm(g, s->child[1]);
+    gen_jump(g, "jmp", l_begin);
+    gen_label_stm(g, l_exit);
 }
 
 void
-gen_stm_for(FILE *out, AST_Node *s)
+gen_stm_for(CodeGen *g, AST_Node *s)
 {
     int  l_begin, l_exit;
-    l_begin = get_label();
-    l_exit = get_label();
-    gen_exp(out, s->child[0]);
-    gen_label_stm(out, l_begin);
-    gen_exp(out, s->child[1]);
-    gen_stm_rel(out, s->child[1], l_exit);
-    gen_stm(out, s->child[3]);
-    gen_exp(out, s->child[2]);
-    fprintf(out, "\tjmp\t%s\n", gen_label(l_begin));
-    gen_label_stm(out, l_exit);
+    l_begin = get_label(g);
+    l_exit = get_label(g);
+    gen_exp(g, s->child[0]);
+    gen_label_stm(g, l_begin);
+    gen_exp(g, s->child[1]);
+    gen_stm_rel(g, s->child[1], l_exit);
+    gen_stm(g, s->child[3]);
+    gen_exp(g, s->child[2]);
+    gen_jump(g, "jmp", l_begin);
+    gen_label_stm(g, l_exit);
 }
 
 void
-gen_stm_dowhile(FILE *out, AST_Node *s)
+gen_stm_dowhile(CodeGen *g, AST_Node *s)
 {
     /* REPORT3
        ここにdo-while文のコード生成処理を追加する
     */
 	int  l_begin, l_exit;
-    l_begin = get_label();
-    l_exit = get_label();
-    gen_label_stm(out, l_begin);
-    gen_stm(out, s->child[0]);
-    gen_exp(out, s->child[1]);
-	gen_stm_rel(out, s->child[1], l_exit);
-    fprintf(out, "\tjmp\t%s\n", gen_label(l_begin));
-    gen_label_stm(out, l_exit);
+    l_begin = get_label(g);
+    l_exit = get_label(g);
+    gen_label_stm(g, l_begin);
+    gen_stm(g, s->child[0]);
+    gen_exp(g, s->child[1]);
+	gen_stm_rel(g, s->child[1], l_exit);
+    gen_jump(g, "jmp", l_begin);
+    gen_label_stm(g, l_exit);
 }
 
 void
-gen_stm_return(FILE *out, AST_Node *s)
+gen_stm_return(CodeGen *g, AST_Node *s)
 {
-    gen_exp(out, s->child[0]);
-    if (s->reg != 0) {
-	fprintf(out, "\tmovl\t%s, %s\n", reg_name[s->reg], reg_name[0]);
+    gen_exp(g, s->child[0]);
+    /* 戻り値は%eaxで返す。式の値が他のレジスタに残った時は移す */
+    if (s->child[0] != NULL && s->child[0]->reg != 0) {
+	EMIT_LIT(g->out, "\tmovl\t");
+	emit_reg(g->out, s->child[0]->reg);
+	EMIT_LIT(g->out, ", ");
+	emit_reg(g->out, 0);
+	emit_char(g->out, '\n');
     }
-    fprintf(out, "\tjmp\t%s\n", func_end_label);
+    gen_jump(g, "jmp", -1);
 }
 
+/* 子を巡回した後で自分の命令を出力する（stateは巡回済みの子の数）
+   代入は右辺だけを巡回する。直接オペランドにする子（NO_REG）は巡回しない
+   退避する式は、値を計算したらすぐに退避領域に書き出す */
 void
-gen_exp(FILE *out, AST_Node *e)
+gen_exp(CodeGen *g, AST_Node *e)
 {
+    AST_Stack *st = cg_stack(g);
+    AST_Frame *f;
+    AST_Node *c;
+    int  base;
+
     if (e == NULL) {
 	return;
     }
-    if (e->sub_kind == AST_EXP_ASGN) {
-	gen_exp_asgn(out, e);
-    } else if (e->sub_kind == AST_EXP_IDENT) {
-	gen_exp_ident(out, e);
-    } else if (e->sub_kind == AST_EXP_CNST_INT) {
-	gen_exp_cnst(out, e);
-    } else if (e->sub_kind == AST_EXP_CALL) {
-	gen_exp_call(out, e);
-    } else {
-	gen_exp_n2(out, e);
+    base = st->num;
+    push_AST_Stack(st, e);
+    while (st->num > base) {
+	f = AST_STACK_TOP(st);
+	e = f->n;
+	if (f->state < 2) {
+	    if (e->sub_kind == AST_EXP_ASGN) {
+		c = (f->state++ == 0) ? e->child[1] : NULL;
+	    } else {
+		c = exp_child(e, f->state++);
+	    }
+	    if (c != NULL && c->reg != NO_REG) {
+		push_AST_Stack(st, c);
+	    }
+	    continue;
+	}
+	st->num--;
+	if (e->sub_kind == AST_EXP_ASGN) {
+	    gen_exp_asgn(g, e);
+	} else if (e->sub_kind == AST_EXP_IDENT) {
+	    gen_exp_ident(g, e);
+	} else if (e->sub_kind == AST_EXP_CNST_INT) {
+	    gen_exp_cnst(g, e);
+	} else if (e->sub_kind == AST_EXP_CALL) {
+	    gen_exp_call(g, e);
+	} else {
+	    gen_exp_n2(g, e);
+	}
+	if (spilled(e)) {
+	    EMIT_LIT(g->out, "\tmovl\t");
+	    emit_reg(g->out, e->reg);
+	    EMIT_LIT(g->out, ", ");
+	    emit_ebp(g->out, e->spill);
+	    emit_char(g->out, '\n');
+	}
     }
 }
 
+/* 右辺は巡回済み */
 void
-gen_exp_asgn(FILE *out, AST_Node *e)
+gen_exp_asgn(CodeGen *g, AST_Node *e)
 {
-    gen_exp(out, e->child[1]);
     if (e->child[0]->sub_kind != AST_EXP_IDENT) {
 	errexit("Invalid destination operand for assign.", __FILE__, __LINE__);
     }
-    fprintf(out, "\tmovl\t%s, %d(%%ebp)\n",
-	    reg_name[e->child[1]->reg], e->child[0]->symtab->offset);
+    EMIT_LIT(g->out, "\tmovl\t");
+    emit_reg(g->out, e->child[1]->reg);
+    EMIT_LIT(g->out, ", ");
+    if (e->child[0]->symtab->reg != 0) {
+	emit_reg(g->out, e->child[0]->symtab->reg);
+    } else {
+	emit_ebp(g->out, e->child[0]->symtab->offset);
+    }
+    emit_char(g->out, '\n');
 }
 
 void
-gen_exp_cnst(FILE *out, AST_Node *c)
+gen_exp_cnst(CodeGen *g, AST_Node *c)
 {
-    fprintf(out, "\tmovl\t$%d, %s\n", c->val, reg_name[c->reg]);
+    EMIT_LIT(g->out, "\tmovl\t");
+    emit_imm(g->out, c->val);
+    EMIT_LIT(g->out, ", ");
+    emit_reg(g->out, c->reg);
+    emit_char(g->out, '\n');
 }
 
 void
-gen_exp_ident(FILE *out, AST_Node *idnt)
+gen_exp_ident(CodeGen *g, AST_Node *idnt)
 {
-    fprintf(out, "\tmovl\t%d(%%ebp), %s\n",
-	    idnt->symtab->offset, reg_name[idnt->reg]);
+    EMIT_LIT(g->out, "\tmovl\t");
+    if (idnt->symtab->reg != 0) {
+	emit_reg(g->out, idnt->symtab->reg);
+    } else {
+	emit_ebp(g->out, idnt->symtab->offset);
+    }
+    EMIT_LIT(g->out, ", ");
+    emit_reg(g->out, idnt->reg);
+    emit_char(g->out, '\n');
 }
 
+/* 左辺がレジスタになければ、左辺をオペランドにして右辺のレジスタと比べる */
 void
-gen_exp_rel(FILE *out, AST_Node *e)
+gen_exp_rel(CodeGen *g, AST_Node *e)
 {
-    fprintf(out, "\tcmpl\t%s, %s\n",
-	    reg_name[e->child[1]->reg], reg_name[e->child[0]->reg]);
+    gen_op(g, "cmpl", in_memory(e->child[0]) ? e->child[0] : e->child[1], e->reg);
     if (e->parent->kind == AST_KIND_STM
 	&& (e->parent->sub_kind == AST_STM_IF
 	    || e->parent->sub_kind == AST_STM_WHILE
 	    || e->parent->sub_kind == AST_STM_FOR)) {
 	/* The parent statement generates a branch operation. */
     } else {
-	switch (e->sub_kind) {
+	switch (rel_kind(e)) {
 	case  AST_EXP_LT:
-	    fputs("\tsetl\t%al\n", out);
+	    EMIT_LIT(g->out, "\tsetl\t%al\n");
 	    break;
 	case  AST_EXP_GT:
-	    fputs("\tsetg\t%al\n", out);
+	    EMIT_LIT(g->out, "\tsetg\t%al\n");
 	    break;
 	case  AST_EXP_LTE:
-	    fputs("\tsetle\t%al\n", out);
+	    EMIT_LIT(g->out, "\tsetle\t%al\n");
 	    break;
 	case  AST_EXP_GTE:
-	    fputs("\tsetge\t%al\n", out);
+	    EMIT_LIT(g->out, "\tsetge\t%al\n");
 	    break;
 	case  AST_EXP_EQ:
-	    fputs("\tsete\t%al\n", out);
+	    EMIT_LIT(g->out, "\tsete\t%al\n");
 	    break;
 	case  AST_EXP_NE:
-	    fputs("\tsetne\t%al\n", out);
+	    EMIT_LIT(g->out, "\tsetne\t%al\n");
 	    break;
 	default:
 	    errexit("Invalid relation-op.", __FILE__, __LINE__);
 	}
-	fprintf(out, "\tmovzbl\t%%al, %s\n", reg_name[e->reg]);
+	EMIT_LIT(g->out, "\tmovzbl\t%al, ");
+	emit_reg(g->out, e->reg);
+	emit_char(g->out, '\n');
     }
 }
 
@@ -680,14 +1352,13 @@ gen_exp_rel(FILE *out, AST_Node *e)
    - %espを戻す
 */
 void
-gen_exp_call(FILE *out, AST_Node *e)
+gen_exp_call(CodeGen *g, AST_Node *e)
 {
     int i;
     int psize, fsize, pad;
-    AST_List *l;
+    AST_Node *p;
     
-    psize = 0;
-    TRAVERSE_AST_LIST(l, e->list, ++psize);
+    psize = (e->list != NULL) ? e->list->num : 0;
     /* %espの整列補正。symtab.cのスタックに関するメモを参照 */
     pad = (psize+3)%4;
     if (pad == 4) {
@@ -697,89 +1368,158 @@ gen_exp_call(FILE *out, AST_Node *e)
     fsize = pad+psize+3*4; /* 実引数+%eax, %ecx, %edx, 全てint(4byte) */
 
     /* 実引数とpadと待避するレジスタの分だけ%espをずらす */
-    fprintf(out, "\tsubl\t$%d, %%esp\n", fsize);
+    EMIT_LIT(g->out, "\tsubl\t");
+    emit_imm(g->out, fsize);
+    EMIT_LIT(g->out, ", %esp\n");
     for (i = 0; i < 3; i++) {
 	if (e->reg != i) {
-	    fprintf(out, "\tmovl\t%s, %d(%%esp)\n",
-		    reg_name[i], psize+12-4*(i+1));
+	    EMIT_LIT(g->out, "\tmovl\t");
+	    emit_reg(g->out, i);
+	    EMIT_LIT(g->out, ", ");
+	    emit_esp(g->out, psize+12-4*(i+1));
+	    emit_char(g->out, '\n');
 	}
     }
     /* 各実引数は逆順でスタックに格納する
        これは実引数の数が仮引数の数よりも多くても動作するようにするため */
     i = 0;
-    REV_TRAVERSE_AST_LIST(l, e->list,
-			  gen_exp_call_param(out, l->elem, psize-((i++)+1)*4));
+    REV_TRAVERSE_AST_LIST(p, e->list,
+			  gen_exp_call_param(g, p, psize-((i++)+1)*4));
     assert(e->child[0]->sub_kind == AST_EXP_IDENT);
-    fprintf(out, "\tcall\t%s\n", e->child[0]->str);
+    EMIT_LIT(g->out, "\tcall\t");
+    emit_str(g->out, e->child[0]->str);
+    emit_char(g->out, '\n');
     /* 戻り値の格納 */
     if (e->reg != 0) {
-	fprintf(out, "\tmovl\t%s, %s\n", reg_name[0], reg_name[e->reg]);
+	EMIT_LIT(g->out, "\tmovl\t");
+	emit_reg(g->out, 0);
+	EMIT_LIT(g->out, ", ");
+	emit_reg(g->out, e->reg);
+	emit_char(g->out, '\n');
     }
     /* %espを戻す */
     for (i = 0; i < 3; i++) {
 	if (e->reg != i) {
-	    fprintf(out, "\tmovl\t%d(%%esp), %s\n",
-		    psize+12-4*(i+1), reg_name[i]);
+	    EMIT_LIT(g->out, "\tmovl\t");
+	    emit_esp(g->out, psize+12-4*(i+1));
+	    EMIT_LIT(g->out, ", ");
+	    emit_reg(g->out, i);
+	    emit_char(g->out, '\n');
 	}
     }
-    fprintf(out, "\taddl\t$%d, %%esp\n", fsize);
+    EMIT_LIT(g->out, "\taddl\t");
+    emit_imm(g->out, fsize);
+    EMIT_LIT(g->out, ", %esp\n");
 }
 
 void
-gen_exp_call_param(FILE *out, AST_Node *p, int offset)
+gen_exp_call_param(CodeGen *g, AST_Node *p, int offset)
 {
-    gen_exp(out, p);
-    fprintf(out, "\tmovl\t%s, %d(%%esp)\n", reg_name[p->reg], offset);
+    gen_exp(g, p);
+    EMIT_LIT(g->out, "\tmovl\t");
+    emit_reg(g->out, p->reg);
+    EMIT_LIT(g->out, ", ");
+    emit_esp(g->out, offset);
+    emit_char(g->out, '\n');
 }
 
-
-void
-gen_exp_n2(FILE *out, AST_Node *e)
+/*
+ * 比較の種別
+ * 左辺をオペランドにして右辺のレジスタと比べた時（gen_exp_rel）は向きを逆にする
+ */
+int
+rel_kind(AST_Node *e)
 {
-    int  i0, i1, r0, r1, src;
-
-    /* レジスタ割り付けと同じ順番で巡回する必要がある */
-    r0 = r1 = 0;
-    src = e->reg;
-    if (e->child[0] != NULL) {
-	r0 = e->child[0]->rank;
+    if (AST_CHILD(e, 1) == NULL || !in_memory(e->child[0])) {
+	return e->sub_kind;
     }
-    if (e->child[1] != NULL) {
-	r1 = e->child[1]->rank;
-	src = e->child[1]->reg;
+    switch (e->sub_kind) {
+    case  AST_EXP_LT:
+	return AST_EXP_GT;
+    case  AST_EXP_GT:
+	return AST_EXP_LT;
+    case  AST_EXP_LTE:
+	return AST_EXP_GTE;
+    case  AST_EXP_GTE:
+	return AST_EXP_LTE;
     }
-    if (r0 >= r1) {
-	i0 = 0; i1 = 1;
+    return e->sub_kind;
+}
+
+/* 式cの値のある場所（レジスタ、定数、変数、退避領域） */
+void
+gen_operand(CodeGen *g, AST_Node *c)
+{
+    if (c->reg != NO_REG) {
+	if (spilled(c)) {
+	    emit_ebp(g->out, c->spill);
+	} else {
+	    emit_reg(g->out, c->reg);
+	}
+    } else if (c->sub_kind == AST_EXP_CNST_INT) {
+	emit_imm(g->out, c->val);
+    } else if (c->symtab->reg != 0) {
+	emit_reg(g->out, c->symtab->reg);
     } else {
-	i0 = 1; i1 = 0;
+	emit_ebp(g->out, c->symtab->offset);
     }
-    if (r0 != 0 || r1 != 0) {
-	if (e->child[i0] != NULL) {
-	    gen_exp(out, e->child[i0]);
-	}
-	if (e->child[i1] != NULL) {
-	    gen_exp(out, e->child[i1]);
-	}
+}
+
+/* 2オペランドの演算命令 op src, %dst */
+void
+gen_op(CodeGen *g, const char *op, AST_Node *src, int dst)
+{
+    emit_char(g->out, '\t');
+    emit_str(g->out, op);
+    emit_char(g->out, '\t');
+    gen_operand(g, src);
+    EMIT_LIT(g->out, ", ");
+    emit_reg(g->out, dst);
+    emit_char(g->out, '\n');
+}
+
+/*
+ * 子は巡回済み
+ * 2項演算子の結果はe->regの子のレジスタに求め、もう一方の子srcをオペランドにする
+ * 左辺がレジスタにない時（srcが左辺）の減算は、右辺の符号を反転して足す
+ */
+void
+gen_exp_n2(CodeGen *g, AST_Node *e)
+{
+    AST_Node *src;
+
+    src = AST_CHILD(e, 1);
+    if (src != NULL && in_memory(e->child[0])) {
+	src = e->child[0];
     }
     switch (e->sub_kind) {
     case  AST_EXP_UNARY_PLUS:
 	break;			/* nothing to do */
     case  AST_EXP_UNARY_MINUS:
-	fprintf(out, "\tnegl\t%s\n", reg_name[e->reg]);
+	EMIT_LIT(g->out, "\tnegl\t");
+	emit_reg(g->out, e->reg);
+	emit_char(g->out, '\n');
 	break;
     case  AST_EXP_MUL:
-	fprintf(out, "\timull\t%s, %s\n", reg_name[src], reg_name[e->reg]);
+	gen_op(g, "imull", src, e->reg);
 	break;
     case  AST_EXP_DIV:
 	/* "div" is not supported now because of its register restriction. */
-	fputs("Sorry, div is not suppoted.\n", stderr);
-	exit(-1);
+	cg_diag(g, "Sorry, div is not suppoted.\n");
+	cg_fatal(g);
 	break;
     case  AST_EXP_ADD:
-	fprintf(out, "\taddl\t%s, %s\n", reg_name[src], reg_name[e->reg]);
+	gen_op(g, "addl", src, e->reg);
 	break;
     case  AST_EXP_SUB:
-	fprintf(out, "\tsubl\t%s, %s\n", reg_name[src], reg_name[e->reg]);
+	if (src == e->child[0]) {
+	    EMIT_LIT(g->out, "\tnegl\t");
+	    emit_reg(g->out, e->reg);
+	    emit_char(g->out, '\n');
+	    gen_op(g, "addl", src, e->reg);
+	} else {
+	    gen_op(g, "subl", src, e->reg);
+	}
 	break;
     case  AST_EXP_LT:
     case  AST_EXP_GT:
@@ -787,10 +1527,10 @@ gen_exp_n2(FILE *out, AST_Node *e)
     case  AST_EXP_GTE:
     case  AST_EXP_EQ:
     case  AST_EXP_NE:
-	gen_exp_rel(out, e);
+	gen_exp_rel(g, e);
 	break;
     default:
-	fprintf(stderr, "Unsupported sub_kind %d\n", e->sub_kind);
+	cg_diag(g, "Unsupported sub_kind %d\n", e->sub_kind);
     }
 }
 
@@ -9,9 +9,50 @@
 #ifndef  CG_H
 #define  CG_H
 
-#include  <stdio.h>
+#include  "ast.h"
+#include  "emit.h"
 
-extern void  assign_regs(void);
-extern void  gen_code(FILE *out);
+struct Compiler;
+struct FuncJob;
+
+/* レジスタ割り付け・コード生成中の状態 */
+typedef struct CodeGen {
+    struct Compiler  *cc;
+    Emit  *out;			/* 出力先 */
+    int  local_label;		/* 関数内ラベルの番号 */
+    char  *func_name;		/* 処理中の関数名（末尾のラベルに使う） */
+    /* 関数毎に並列処理している場合の作業（cg.c内部）
+       NULLでなければエラーはcc->errではなくこちらに溜める */
+    struct FuncJob  *job;
+    Emit  func_out;		/* キャッシュに保存する関数のコードを溜める */
+    /* 関数の入口で保存し出口で戻すレジスタ（1 << 番号の和）と、
+       保存先のスタックフレーム中の位置（自動変数の下） */
+    int  saved_regs;
+    int  save_base;
+    /* 式の途中の値の退避領域（cg.c内部のレジスタ割り付け用）
+       関数のシンボルテーブルにSYM_SPILLとして追加し、自動変数の下に置く */
+    int  func_id;
+    int  spill_base;		/* 最初の退避領域の上端（自動変数の大きさ） */
+    int  num_spill;		/* 追加済みの退避領域の数 */
+    int  spill_depth;		/* 使用中の退避領域の数 */
+} CodeGen;
+
+extern void  assign_regs(struct Compiler *cc);
+/* cc->ast_rootの全ての関数のコードをcc->outに生成する */
+extern void  gen_code(struct Compiler *cc);
+
+/* 関数毎に処理する場合（逐次コンパイル用）
+   gに必要なのはccだけなので、gen_code_beginの前でも使える */
+extern void  assign_regs_func(CodeGen *g, AST_Node *f);
+extern void  gen_code_begin(struct Compiler *cc);
+/* 関数fのコードを生成し、fのASTとシンボルテーブルを解放する */
+extern void  gen_func(CodeGen *g, AST_Node *f);
+extern void  gen_code_end(struct Compiler *cc);
+
+/* 関数の入口と出口（direct.cと共用）
+   入口の後の%espは16byte境界にある。出口のラベルはg->func_nameから作る
+   g->saved_regsのレジスタは入口で-(g->save_base+4*k)(%ebp)に保存し、出口で戻す */
+extern void  gen_func_header(CodeGen *g, char *name, int frame_size);
+extern void  gen_func_footer(CodeGen *g);
 
 #endif	/* CG_H */
@@ -0,0 +1,291 @@
+/*
+    Tiny Language Compiler (tlc)
+
+    1つの翻訳単位のコンパイル
+
+    2016年 木村啓二
+*/
+
+#include  <fcntl.h>
+#include  <setjmp.h>
+#include  <stdarg.h>
+#include  <stdio.h>
+#include  <stdlib.h>
+#include  <string.h>
+#include  <unistd.h>
+#include  "compiler.h"
+#include  "ir.h"
+#include  "opt.h"
+
+static void clear_state(Compiler *cc, const Options *opt, ArenaPool *pool);
+static void compile_function(Compiler *cc, AST_Node *f);
+static void dump(Compiler *cc, int what);
+
+void
+compiler_init(Compiler *cc, const Options *opt, int err_fd, ArenaPool *pool)
+{
+    clear_state(cc, opt, pool);
+    emit_init(&cc->err, err_fd);
+}
+
+void
+clear_state(Compiler *cc, const Options *opt, ArenaPool *pool)
+{
+    memset(cc, 0, sizeof(Compiler));
+    cc->opt = opt;
+    cc->fd = -1;
+    cc->arena_pool = pool;
+    cc->unit_arena.pool = pool;
+    cc->func_arena.pool = pool;
+    cc->unit_arena.allocated = &cc->stats.arena_bytes;
+    cc->func_arena.allocated = &cc->stats.arena_bytes;
+    cc->names.arena.allocated = &cc->stats.arena_bytes;
+}
+
+void
+compiler_reset(Compiler *cc, const Options *opt)
+{
+    InternPool  names = cc->names;
+    Emit  err = cc->err;
+    ArenaPool  *pool = cc->arena_pool;
+
+    front_free(cc);
+    direct_free(cc);
+    free_symtab(cc);
+    cache_free(cc);
+    arena_free(&cc->func_arena);
+    arena_free(&cc->unit_arena);
+    free_AST_Stack(&cc->walk);
+    xfree(cc->out_file);
+    if (cc->out.buf != NULL) {
+	emit_close(&cc->out);
+    }
+    if (cc->cg.func_out.buf != NULL) {
+	emit_close(&cc->cg.func_out);
+    }
+    clear_state(cc, opt, pool);
+    cc->names = names;
+    cc->names.arena.allocated = &cc->stats.arena_bytes;
+    cc->err = err;
+}
+
+void
+compiler_free(Compiler *cc)
+{
+    compiler_reset(cc, cc->opt);
+    intern_free(&cc->names);
+    emit_close(&cc->err);
+}
+
+void
+diag(Compiler *cc, const char *fmt, ...)
+{
+    va_list  ap;
+
+    va_start(ap, fmt);
+    vdiag(cc, fmt, ap);
+    va_end(ap);
+}
+
+void
+vdiag(Compiler *cc, const char *fmt, va_list ap)
+{
+    emit_vprintf(&cc->err, fmt, ap);
+    emit_flush(&cc->err);
+}
+
+void
+fatal(Compiler *cc)
+{
+    longjmp(cc->fatal, 1);
+}
+
+/*
+ * 逐次コンパイル
+ * 関数を1つ解析し終えるたびに、フレームの割り付け・レジスタ割り付け・
+ * コード生成を行ってすぐに解放する。メモリ使用量は最大の関数で決まる
+ * エラーが出た後は、以降の関数は解放するだけ
+ */
+void
+compile_function(Compiler *cc, AST_Node *f)
+{
+    int  phase;
+
+    if (cc->nerrs > 0) {
+	release_symtab(cc, f->id);
+	return;
+    }
+    if (cc->opt->optimize >= 2) {
+	phase = stats_phase(cc, PHASE_OPTIMIZE);
+	optimize_func(cc, f);
+	stats_phase(cc, PHASE_ASSIGN_MEMORY);
+    } else {
+	phase = stats_phase(cc, PHASE_ASSIGN_MEMORY);
+    }
+    assign_memory_func(cc, f->id);
+    stats_phase(cc, PHASE_ASSIGN_REGS);
+    assign_regs_func(&cc->cg, f);
+    stats_phase(cc, PHASE_GEN_CODE);
+    gen_func(&cc->cg, f);
+    stats_phase(cc, phase);
+}
+
+/* ダンプは指定された時だけerrに書き出す
+   後続の処理でエラー終了しても失われないよう、都度書き出しておく */
+void
+dump(Compiler *cc, int what)
+{
+    int  phase;
+
+    if (!(cc->opt->dump & what)) {
+	return;
+    }
+    phase = stats_phase(cc, PHASE_DUMP);
+    if (what == DUMP_SYMTAB) {
+	dump_symtab(cc, &cc->err, cc->opt->dump_format);
+    } else if (what == DUMP_IR) {
+	dump_ir(cc, &cc->err, cc->opt->dump_format);
+    } else {
+	dump_ast(cc->ast_root, &cc->err, cc->opt->dump_format, what);
+    }
+    emit_flush(&cc->err);
+    stats_phase(cc, phase);
+}
+
+int
+compile_file(Compiler *cc, const char *path)
+{
+    cc->in_file = path;
+    if (open_source(&cc->src, path) < 0) {
+	diag(cc, "Can't open the input file %s.\n", path);
+	return -1;
+    }
+    if ((cc->out_file = asm_file_name(path)) == NULL) {
+	diag(cc, "Illegal suffix.\n");
+	close_source(&cc->src);
+	return -1;
+    }
+    if ((cc->fd = open(cc->out_file, O_WRONLY|O_CREAT|O_TRUNC, 0666)) < 0) {
+	diag(cc, "Can't open the output file %s.\n", cc->out_file);
+	close_source(&cc->src);
+	return -1;
+    }
+    emit_init(&cc->out, cc->fd);
+
+    if (compile_source(cc) < 0) {
+	/* 溜まっている出力は捨てる */
+	cc->out.fd = -1;
+	close(cc->fd);
+	cc->fd = -1;
+	/* 途中まで書き出したものは残さない */
+	unlink(cc->out_file);
+	return -1;
+    }
+    emit_flush(&cc->out);
+    close(cc->fd);
+    cc->fd = -1;
+    return 0;
+}
+
+char*
+asm_file_name(const char *path)
+{
+    const char *base;
+    char  *name;
+    int  fnlen;
+
+    /* basenameはスレッド安全とは限らないので自前で切り出す */
+    base = strrchr(path, '/');
+    base = (base != NULL) ? base+1 : path;
+    fnlen = strlen(base);
+    if (fnlen < 2 || strcmp(&base[fnlen-2], ".c") != 0) {
+	return NULL;
+    }
+    name = xmalloc(fnlen+1);
+    strcpy(name, base);
+    name[fnlen-1] = 's';
+    return name;
+}
+
+int
+compile_source(Compiler *cc)
+{
+    int  direct = cc->opt->optimize == 0 && cc->opt->dump == 0;
+    int  stream = cc->opt->stream && cc->opt->dump == 0 && !direct;
+
+    if (setjmp(cc->fatal) != 0) {
+	if (cc->scanner != NULL || cc->scan_cur != NULL) {
+	    lex_destroy(cc);
+	}
+	if (cc->src.base != NULL) {
+	    close_source(&cc->src);
+	}
+	if (cc->opt->time_report != TIME_REPORT_NONE) {
+	    stats_report(cc);
+	}
+	return -1;
+    }
+
+    if (cc->opt->time_report != TIME_REPORT_NONE) {
+	stats_begin(cc);
+    }
+    /* レジスタ割り付け後のASTやIRをダンプする時は、割り付けを省けない
+       直接コードを生成する時は、関数を読み終えた時にはもう出力してある */
+    cache_init(cc, ((cc->opt->dump & (DUMP_AST_REG|DUMP_IR)) || direct)
+	       ? NULL : cc->opt->cache_dir);
+    if (direct) {
+	gen_code_begin(cc);
+	direct_begin(cc);
+    } else if (stream) {
+	gen_code_begin(cc);
+	cc->function_done = compile_function;
+    }
+    stats_phase(cc, PHASE_PARSE);
+    /* 逐次コンパイルはメモリを抑えるためのものなので、全体を並列には解析しない
+       直接コードを生成する時も、出力の順に解析しなければならない */
+    if (stream || direct || cc->opt->jobs <= 1 || !front_parse(cc)) {
+	lex_init(cc);
+	if (cc->opt->parser == PARSER_RD) {
+	    rd_parse(cc);
+	} else {
+	    yyparse(cc);
+	}
+	lex_destroy(cc);
+    }
+    stats_phase(cc, PHASE_OTHER);
+    close_source(&cc->src);
+    if (cc->nerrs > 0) {
+	fatal(cc);
+    }
+
+    if (stream || direct) {
+	stats_phase(cc, PHASE_GEN_CODE);
+	gen_code_end(cc);
+    } else {
+	dump(cc, DUMP_AST);
+	if (cc->opt->optimize >= 2) {
+	    stats_phase(cc, PHASE_OPTIMIZE);
+	    optimize(cc);
+	}
+	stats_phase(cc, PHASE_ASSIGN_MEMORY);
+	assign_memory(cc);
+	stats_phase(cc, PHASE_ASSIGN_REGS);
+	assign_regs(cc);
+	stats_phase(cc, PHASE_OTHER);
+	dump(cc, DUMP_SYMTAB);
+	dump(cc, DUMP_AST_REG);
+	dump(cc, DUMP_IR);
+	stats_phase(cc, PHASE_GEN_CODE);
+	gen_code(cc);
+    }
+    stats_phase(cc, PHASE_OTHER);
+    if (cc->cache.dir != NULL) {
+	diag(cc, "cache: %s: %ld hits, %ld misses\n", cc->in_file,
+	     cc->cache.hits, cc->cache.misses);
+    }
+    if (cc->opt->time_report != TIME_REPORT_NONE) {
+	/* 書き出していない分の命令も数えられるよう、出力を閉じる前に報告する */
+	stats_report(cc);
+    }
+    return 0;
+}
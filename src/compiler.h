@@ -0,0 +1,170 @@
+/*
+    Tiny Language Compiler (tlc)
+
+    コンパイラの状態（1つの翻訳単位分）
+
+    2016年 木村啓二
+*/
+
+#ifndef  COMPILER_H
+#define  COMPILER_H
+
+#include  <setjmp.h>
+#include  <stdarg.h>
+#include  "ast.h"
+#include  "cache.h"
+#include  "cg.h"
+#include  "direct.h"
+#include  "emit.h"
+#include  "intern.h"
+#include  "source.h"
+#include  "stats.h"
+#include  "symtab.h"
+#include  "util.h"
+
+/* 構文解析部（--parser=bison|rd） */
+enum {
+    PARSER_BISON,		/* tl_gram.y */
+    PARSER_RD			/* parse.c（手書きの再帰下降） */
+};
+
+/* -O1, -O2のコード生成（--backend=ast|ir） */
+enum {
+    BACKEND_AST,		/* ASTの式毎にレジスタを割り付ける（cg.c） */
+    BACKEND_IR			/* 3番地コードのIRに変換し、関数全体で割り付ける（ir.c, irgen.c） */
+};
+
+/* コマンドラインで指定する動作 */
+typedef struct Options {
+    int  dump;			/* DUMP_*の組み合わせ */
+    int  dump_format;		/* DUMP_FORMAT_* */
+    int  stream;		/* 関数毎に逐次コンパイルする */
+    int  jobs;			/* 関数毎の処理に使うスレッド数 */
+    const char  *cache_dir;	/* 関数毎のアセンブリのキャッシュ（NULLなら使わない） */
+    int  time_report;		/* TIME_REPORT_* */
+    int  parser;		/* PARSER_* */
+    /* 最適化のレベル（-O）。0ならASTを作らずにコードを生成する
+       2ならレジスタ割り付けの前にASTを最適化し（opt.c）、
+       変数もレジスタに割り付ける（regalloc.c） */
+    int  optimize;
+    int  backend;		/* BACKEND_* */
+} Options;
+
+/*
+ * 1つの翻訳単位をコンパイルする間の状態
+ * 大域変数を持たないので、別々のCompilerは別々のスレッドで同時に使える
+ */
+typedef struct Compiler {
+    const Options *opt;
+    const char  *in_file;
+    char  *out_file;
+    int  fd;			/* アセンブリの出力先 */
+    Source  src;
+
+    /* 字句解析部 */
+    void  *scanner;		/* flexの走査器(yyscan_t) */
+    const char  *scan_cur;	/* scan.c: 次に読む位置 */
+    const char  *scan_end;	/* scan.c: ソースの末尾 */
+    int  lineno;		/* scan.c: 行番号 */
+    InternPool  names;		/* 識別子 */
+
+    /* 構文解析部 */
+    int  nerrs;			/* エラーの数 */
+    int  current_func_id;	/* 処理中関数のid */
+    AST_List  *ast_root;	/* ASTの根 */
+    /* 関数定義を解析し終えるたびに呼ぶ関数（逐次コンパイル用）
+       NULLなら関数はast_rootに溜める */
+    void  (*function_done)(struct Compiler *cc, AST_Node *f);
+    /* 並列の構文解析（front.c） */
+    struct FrontChunk  *chunk;	/* 解析しているソースの部分（NULLなら全体） */
+    struct Front  *front;	/* 部分毎の解析結果（コンパイルが終わるまで残す） */
+
+    /* 領域のチャンクの戻し先（NULLならfreeする） */
+    ArenaPool  *arena_pool;
+    /* 翻訳単位全体で使う領域 */
+    Arena  unit_arena;
+    /* 処理中関数のAST・シンボルテーブル用の領域 */
+    Arena  func_arena;
+    /* 式の巡回に使うスタック（名前の解決と、関数毎に並列処理しない時のcg.c） */
+    AST_Stack  walk;
+
+    /* シンボルテーブル（symtab.c） */
+    SymTab  current_symtab;	/* 現在処理関数（先頭はダミー） */
+    SymIndex  current_index;
+    SymTab  func_symtab;	/* 関数名（先頭はダミー） */
+    SymIndex  func_index;
+    SymTab  **symtab_array;	/* 関数id毎のシンボルテーブル */
+    SymIndex  *index_array;
+    Arena  *arena_array;	/* 関数id毎のASTとシンボルテーブルの領域 */
+    struct IR_Func  **ir_array;	/* 関数id毎のIR（--backend=ir。arena_arrayから確保） */
+    int  max_id;		/* 登録済み関数idの最大値 */
+    int  size_symtab_array;
+
+    /* コード生成 */
+    AsmCache  cache;		/* 関数毎のアセンブリのキャッシュ（cache.c） */
+    CodeGen  cg;
+    DirectGen  dg;		/* -O0の構文解析中のコード生成（direct.c） */
+    Emit  out;			/* アセンブリ */
+    Emit  err;			/* 診断メッセージとダンプ */
+
+    CompileStats  stats;	/* --time-report（stats.c） */
+
+    jmp_buf  fatal;		/* 続行できないエラーの戻り先 */
+} Compiler;
+
+/* errの出力先がfd。負ならメモリ上に溜め、呼び出し側が後で書き出す
+   poolがNULLでなければ、領域のチャンクはそこから取り、そこへ戻す */
+extern void  compiler_init(Compiler *cc, const Options *opt, int err_fd,
+			   ArenaPool *pool);
+extern void  compiler_free(Compiler *cc);
+/* 翻訳単位毎の状態を解放し、optで次の翻訳単位をコンパイルできるようにする
+   識別子の表とerrはそのまま残す */
+extern void  compiler_reset(Compiler *cc, const Options *opt);
+
+/* ファイルpathをコンパイルし、同じ名前の.sファイルを作る
+   成功したら0、エラーがあれば-1を返す */
+extern int  compile_file(Compiler *cc, const char *path);
+/* cc->srcをコンパイルし、アセンブリをcc->outに書く
+   cc->outは呼び出し側で用意しておく。cc->srcは閉じる
+   成功したら0、エラーがあれば-1を返す（cc->outに溜まった分は捨ててよい） */
+extern int  compile_source(Compiler *cc);
+/* ソースファイルpathに対するアセンブリのファイル名（カレントディレクトリに作る）
+   接尾辞が.cでなければNULLを返す。返した文字列はxfreeで解放する */
+extern char  *asm_file_name(const char *path);
+
+/* 診断メッセージをerrに出力する */
+extern void  diag(Compiler *cc, const char *fmt, ...)
+    __attribute__((format(printf, 2, 3)));
+extern void  vdiag(Compiler *cc, const char *fmt, va_list ap);
+/* 続行できないエラー。compile_fileに戻ってエラーを返させる */
+extern void  fatal(Compiler *cc) __attribute__((noreturn));
+
+/*
+ * 字句解析部（tl_lex.lまたはscan.c）
+ */
+union YYSTYPE;
+/* 次のトークンを読む。構文解析部はtl_gram.yのyylexを通して呼ぶ */
+extern int  lex_token(union YYSTYPE *lval, Compiler *cc);
+/* cc->srcを走査する準備 */
+extern void  lex_init(Compiler *cc);
+/* ソースの[begin, end)だけを、beginの行番号をlinenoとして走査する準備 */
+extern void  lex_init_range(Compiler *cc, const char *begin, const char *end, int lineno);
+extern void  lex_destroy(Compiler *cc);
+/* 最後に読んだトークンの行番号 */
+extern int  lex_lineno(Compiler *cc);
+
+/* 構文解析部（tl_gram.yまたはparse.c）
+   どちらも同じASTを作り、エラーがあれば0以外を返す */
+extern int  yyparse(Compiler *cc);
+extern int  rd_parse(Compiler *cc);
+/* 構文エラーを報告する */
+extern int  yyerror(Compiler *cc, const char *mes);
+
+/* 最上位の関数定義の境界でソースを分け、opt->jobs個のスレッドで並列に
+   構文解析する（front.c）。分けられなければ何もせず0を返す */
+extern int  front_parse(Compiler *cc);
+extern void  front_syntax_error(Compiler *cc, const char *mes);
+/* 部分毎の解析結果を解放する */
+extern void  front_free(Compiler *cc);
+
+#endif	/* COMPILER_H */
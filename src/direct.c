@@ -0,0 +1,604 @@
+/*
+    Tiny Language Compiler (tlc)
+
+    構文解析しながらの直接のコード生成（-O0）
+
+    2016年 木村啓二
+*/
+
+#include  <stdlib.h>
+#include  <string.h>
+#include  "ast.h"
+#include  "compiler.h"
+#include  "direct.h"
+
+/*
+ * 式の値の置き場所
+ *   最も新しい値は%eax、それより前の値はスタック（pushl）
+ *   スタックに積んでいる値の数は常にdepth-1（depthが0の時は0）
+ * 文の終わりではdepthは0に戻る。関数本体の%espは16byte境界にある
+ * （cg.cのgen_func_header）ので、呼び出しの時の整列補正は積んだ数から決まる
+ */
+
+static void grow(void **p, int *size, int n, size_t elem, int tag);
+static void push_label(DirectGen *d, int label);
+static int  new_label(Compiler *cc);
+static void emit_label_stm(DirectGen *d, int label);
+static void emit_jump(DirectGen *d, const char *op, int label);
+static void emit_ref(DirectGen *d, char *id, int seq);
+static void push_value(DirectGen *d);
+static void jump_if(Compiler *cc, int cond, int label);
+static int  compare_seq(const void *a, const void *b);
+static void resolve_refs(Compiler *cc);
+static void emit_body(Compiler *cc);
+
+/* nが配列の大きさを超えたら伸ばす（tagは確保の記録の用途） */
+void
+grow(void **p, int *size, int n, size_t elem, int tag)
+{
+    if (n < *size) {
+	return;
+    }
+    *size = (*size == 0) ? 16 : *size*2;
+    *p = xrealloc_tag(*p, *size*elem, tag);
+}
+
+void
+push_label(DirectGen *d, int label)
+{
+    grow((void**)&d->label, &d->size_label, d->nlabel, sizeof(int), ALLOC_LABEL);
+    d->label[d->nlabel++] = label;
+}
+
+/* ラベルの番号は翻訳単位で通しにする（cg.cのget_labelと同じ） */
+int
+new_label(Compiler *cc)
+{
+    return cc->cg.local_label++;
+}
+
+void
+emit_label_stm(DirectGen *d, int label)
+{
+    emit_label(&d->body, label);
+    EMIT_LIT(&d->body, ":\n");
+}
+
+/* 関数末尾への分岐(label < 0)の飛び先は_END_関数名 */
+void
+emit_jump(DirectGen *d, const char *op, int label)
+{
+    emit_char(&d->body, '\t');
+    emit_str(&d->body, op);
+    emit_char(&d->body, '\t');
+    if (label < 0) {
+	EMIT_LIT(&d->body, "_END_");
+	emit_str(&d->body, d->func_name);
+    } else {
+	emit_label(&d->body, label);
+    }
+    emit_char(&d->body, '\n');
+}
+
+/* 変数idの番地。関数の終わりにemit_bodyが埋める */
+void
+emit_ref(DirectGen *d, char *id, int seq)
+{
+    DirectRef *r;
+
+    grow((void**)&d->ref, &d->size_ref, d->nref, sizeof(DirectRef), ALLOC_OTHER);
+    r = &d->ref[d->nref++];
+    r->pos = d->body.len;
+    r->ident = id;
+    r->seq = seq;
+    r->sym = NULL;
+}
+
+/* 新しい値を%eaxに置く前に、それまでの値を退避する */
+void
+push_value(DirectGen *d)
+{
+    if (d->depth++ > 0) {
+	EMIT_LIT(&d->body, "\tpushl\t%eax\n");
+    }
+}
+
+void
+direct_begin(Compiler *cc)
+{
+    DirectGen *d = &cc->dg;
+
+    d->on = 1;
+    emit_init(&d->body, -1);
+}
+
+void
+direct_free(Compiler *cc)
+{
+    DirectGen *d = &cc->dg;
+
+    if (d->body.buf != NULL) {
+	emit_close(&d->body);
+    }
+    xfree(d->ref);
+    xfree(d->name);
+    xfree(d->param);
+    xfree(d->label);
+    xfree(d->nargs);
+    memset(d, 0, sizeof(DirectGen));
+}
+
+
+/*
+ * 識別子
+ * 変数の参照・代入の左辺・関数名・宣言のどれになるかは、後のアクションで決まる
+ * それまでに読んだ識別子は全て使われているので、名前はスタックで持てばよい
+ */
+void
+direct_ident(Compiler *cc, char *id)
+{
+    DirectGen *d = &cc->dg;
+
+    grow((void**)&d->name, &d->size_name, d->nname, sizeof(DirectRef), ALLOC_OTHER);
+    d->name[d->nname].ident = id;
+    d->name[d->nname].seq = d->seq++;
+    d->nname++;
+}
+
+void
+direct_ident_exp(Compiler *cc)
+{
+    DirectGen *d = &cc->dg;
+    DirectRef *n = &d->name[--d->nname];
+
+    push_value(d);
+    EMIT_LIT(&d->body, "\tmovl\t");
+    emit_ref(d, n->ident, n->seq);
+    EMIT_LIT(&d->body, ", %eax\n");
+}
+
+void
+direct_const_int(Compiler *cc, int c)
+{
+    DirectGen *d = &cc->dg;
+
+    push_value(d);
+    EMIT_LIT(&d->body, "\tmovl\t");
+    emit_imm(&d->body, c);
+    EMIT_LIT(&d->body, ", %eax\n");
+}
+
+/*
+ * 関数呼び出し
+ * 実引数は左から評価して積んであり、最後の実引数は%eaxにある
+ * 呼び出し規約では第1引数が(%esp)なので、逆順に並べ直した写しを作る
+ * 実引数が1つ以下で整列補正も要らなければ、積んだものをそのまま使う
+ */
+void
+direct_call(Compiler *cc, int has_args)
+{
+    DirectGen *d = &cc->dg;
+    char  *id = d->name[--d->nname].ident;
+    int  i, n, size, pad;
+
+    n = has_args ? d->nargs[--d->ncall] : 0;
+    if (d->depth > 0) {
+	EMIT_LIT(&d->body, "\tpushl\t%eax\n");
+    }
+    /* %espの整列補正。積んだd->depth個と実引数n個の分を16byteの倍数にする */
+    pad = (16 - (d->depth+n)*4%16) % 16;
+    size = (n <= 1 && pad == 0) ? 0 : n*4+pad;
+    if (size > 0) {
+	EMIT_LIT(&d->body, "\tsubl\t");
+	emit_imm(&d->body, size);
+	EMIT_LIT(&d->body, ", %esp\n");
+	for (i = 0; i < n; i++) {
+	    EMIT_LIT(&d->body, "\tmovl\t");
+	    emit_esp(&d->body, size+(n-1-i)*4);
+	    EMIT_LIT(&d->body, ", %ecx\n"
+		     "\tmovl\t%ecx, ");
+	    emit_esp(&d->body, i*4);
+	    emit_char(&d->body, '\n');
+	}
+    }
+    EMIT_LIT(&d->body, "\tcall\t");
+    emit_str(&d->body, id);
+    emit_char(&d->body, '\n');
+    if (size+n*4 > 0) {
+	EMIT_LIT(&d->body, "\taddl\t");
+	emit_imm(&d->body, size+n*4);
+	EMIT_LIT(&d->body, ", %esp\n");
+    }
+    /* 実引数n個の代わりに戻り値が1つ増える */
+    d->depth += 1-n;
+}
+
+/* 実引数の数は呼び出し毎に数える（実引数の中にも呼び出しがある） */
+void
+direct_argument(Compiler *cc, int first)
+{
+    DirectGen *d = &cc->dg;
+
+    if (first) {
+	grow((void**)&d->nargs, &d->size_call, d->ncall, sizeof(int), ALLOC_OTHER);
+	d->nargs[d->ncall++] = 1;
+    } else {
+	d->nargs[d->ncall-1]++;
+    }
+}
+
+void
+direct_unary(Compiler *cc, int ope)
+{
+    if (ope == AST_EXP_UNARY_MINUS) {
+	EMIT_LIT(&cc->dg.body, "\tnegl\t%eax\n");
+    }
+}
+
+/* 左の被演算子はスタック、右の被演算子は%eaxにある */
+void
+direct_n2(Compiler *cc, int ope)
+{
+    static const char *setcc[] = {
+	[AST_EXP_LT] = "setl", [AST_EXP_GT] = "setg",
+	[AST_EXP_LTE] = "setle", [AST_EXP_GTE] = "setge",
+	[AST_EXP_EQ] = "sete", [AST_EXP_NE] = "setne",
+    };
+    DirectGen *d = &cc->dg;
+    DirectRef *n;
+
+    if (ope == AST_EXP_ASGN) {
+	/* 値は代入式の値として%eaxに残す */
+	n = &d->name[--d->nname];
+	EMIT_LIT(&d->body, "\tmovl\t%eax, ");
+	emit_ref(d, n->ident, n->seq);
+	emit_char(&d->body, '\n');
+	return;
+    }
+    d->depth--;
+    switch (ope) {
+    case  AST_EXP_MUL:
+	EMIT_LIT(&d->body, "\tpopl\t%ecx\n"
+		 "\timull\t%ecx, %eax\n");
+	break;
+    case  AST_EXP_DIV:
+	EMIT_LIT(&d->body, "\tmovl\t%eax, %ecx\n"
+		 "\tpopl\t%eax\n"
+		 "\tcltd\n"
+		 "\tidivl\t%ecx\n");
+	break;
+    case  AST_EXP_ADD:
+	EMIT_LIT(&d->body, "\tpopl\t%ecx\n"
+		 "\taddl\t%ecx, %eax\n");
+	break;
+    case  AST_EXP_SUB:
+	EMIT_LIT(&d->body, "\tpopl\t%ecx\n"
+		 "\tsubl\t%eax, %ecx\n"
+		 "\tmovl\t%ecx, %eax\n");
+	break;
+    case  AST_EXP_LT:
+    case  AST_EXP_GT:
+    case  AST_EXP_LTE:
+    case  AST_EXP_GTE:
+    case  AST_EXP_EQ:
+    case  AST_EXP_NE:
+	EMIT_LIT(&d->body, "\tpopl\t%ecx\n"
+		 "\tcmpl\t%eax, %ecx\n");
+	/* 直後が条件分岐なら、jump_ifが条件分岐命令に書き換える */
+	d->rel_pos = d->body.len;
+	d->rel_op = ope;
+	emit_char(&d->body, '\t');
+	emit_str(&d->body, setcc[ope]);
+	EMIT_LIT(&d->body, "\t%al\n"
+		 "\tmovzbl\t%al, %eax\n");
+	d->rel_end = d->body.len;
+	break;
+    default:
+	errexit("Invalid expression kind", __FILE__, __LINE__);
+    }
+}
+
+
+/*
+ * 宣言
+ */
+void
+direct_ident_list(Compiler *cc, int first)
+{
+    cc->dg.ndecl = first ? 1 : cc->dg.ndecl+1;
+}
+
+void
+direct_dec_int(Compiler *cc)
+{
+    DirectGen *d = &cc->dg;
+    DirectRef *n;
+
+    d->nname -= d->ndecl;
+    for (n = &d->name[d->nname]; n < &d->name[d->nname+d->ndecl]; n++) {
+	if (append_sym(cc, TYPE_INT, SYM_AUTOVAR, n->ident) == 0) {
+	    diag(cc, "Duplicate variable declaration: %s\n", n->ident);
+	    cc->nerrs++;
+	}
+    }
+}
+
+/* 仮引数は関数名と一緒にdirect_function_defで登録する */
+void
+direct_param_dec(Compiler *cc)
+{
+    DirectGen *d = &cc->dg;
+
+    grow((void**)&d->param, &d->size_param, d->nparam, sizeof(char*), ALLOC_OTHER);
+    d->param[d->nparam++] = d->name[--d->nname].ident;
+}
+
+
+/*
+ * 文
+ * 分岐先のラベルは条件式の後などで決めてd->labelに積み、文の終わりで置く
+ */
+void
+direct_exp_stm(Compiler *cc, int has_exp)
+{
+    if (has_exp) {
+	cc->dg.depth--;
+    }
+}
+
+/* 条件式の値がcondならlabelに分岐する
+   値が比較の結果なら、setccで作った値を使わずに比較から直接分岐する */
+void
+jump_if(Compiler *cc, int cond, int label)
+{
+    static const char *jcc[][2] = {
+	[AST_EXP_LT] = { "jge", "jl" }, [AST_EXP_GT] = { "jle", "jg" },
+	[AST_EXP_LTE] = { "jg", "jle" }, [AST_EXP_GTE] = { "jl", "jge" },
+	[AST_EXP_EQ] = { "jne", "je" }, [AST_EXP_NE] = { "je", "jne" },
+    };
+    DirectGen *d = &cc->dg;
+
+    d->depth--;
+    if (d->rel_end == d->body.len && d->rel_end > 0) {
+	d->body.len = d->rel_pos;
+	d->rel_end = 0;
+	emit_jump(d, jcc[d->rel_op][cond], label);
+	return;
+    }
+    /* "0" stands for "false". */
+    EMIT_LIT(&d->body, "\tcmpl\t$0, %eax\n");
+    emit_jump(d, cond ? "jne" : "je", label);
+}
+
+/* if (e) S1 else S2
+       e; 偽ならLfへ; S1; jmp Lend; Lf: S2; Lend: */
+void
+direct_if_cond(Compiler *cc)
+{
+    int  l_false = new_label(cc);
+
+    jump_if(cc, 0, l_false);
+    push_label(&cc->dg, l_false);
+}
+
+void
+direct_else(Compiler *cc)
+{
+    DirectGen *d = &cc->dg;
+    int  l_end = new_label(cc);
+
+    emit_jump(d, "jmp", l_end);
+    emit_label_stm(d, d->label[d->nlabel-1]);
+    d->label[d->nlabel-1] = l_end;
+}
+
+void
+direct_if_stm(Compiler *cc)
+{
+    DirectGen *d = &cc->dg;
+
+    emit_label_stm(d, d->label[--d->nlabel]);
+}
+
+/* while (e) S
+       Lb: e; 偽ならLxへ; S; jmp Lb; Lx:
+   do S while (e)
+       Lb: S; e; 真ならLbへ */
+void
+direct_loop_begin(Compiler *cc)
+{
+    int  l_begin = new_label(cc);
+
+    emit_label_stm(&cc->dg, l_begin);
+    push_label(&cc->dg, l_begin);
+}
+
+void
+direct_while_cond(Compiler *cc)
+{
+    int  l_exit = new_label(cc);
+
+    jump_if(cc, 0, l_exit);
+    push_label(&cc->dg, l_exit);
+}
+
+void
+direct_while_stm(Compiler *cc)
+{
+    DirectGen *d = &cc->dg;
+
+    d->nlabel -= 2;
+    emit_jump(d, "jmp", d->label[d->nlabel]);
+    emit_label_stm(d, d->label[d->nlabel+1]);
+}
+
+void
+direct_dowhile_stm(Compiler *cc)
+{
+    DirectGen *d = &cc->dg;
+
+    jump_if(cc, 1, d->label[--d->nlabel]);
+}
+
+/* for (e1; e2; e3) S
+   e3はSより前に読むので、Sを飛び越す形に置く
+       e1; Lb: e2; 偽ならLxへ; jmp Lbody; Lstep: e3; jmp Lb; Lbody: S; jmp Lstep; Lx:
+   d->labelには Lb, Lx, Lstep, Lbody の順に積む */
+void
+direct_for_init(Compiler *cc)
+{
+    cc->dg.depth--;
+    direct_loop_begin(cc);
+}
+
+void
+direct_for_cond(Compiler *cc)
+{
+    DirectGen *d = &cc->dg;
+    int  l_exit, l_step, l_body;
+
+    l_exit = new_label(cc);
+    l_step = new_label(cc);
+    l_body = new_label(cc);
+    jump_if(cc, 0, l_exit);
+    emit_jump(d, "jmp", l_body);
+    emit_label_stm(d, l_step);
+    push_label(d, l_exit);
+    push_label(d, l_step);
+    push_label(d, l_body);
+}
+
+void
+direct_for_step(Compiler *cc)
+{
+    DirectGen *d = &cc->dg;
+
+    d->depth--;
+    emit_jump(d, "jmp", d->label[d->nlabel-4]);
+    emit_label_stm(d, d->label[d->nlabel-1]);
+}
+
+void
+direct_for_stm(Compiler *cc)
+{
+    DirectGen *d = &cc->dg;
+
+    d->nlabel -= 4;
+    emit_jump(d, "jmp", d->label[d->nlabel+2]);
+    emit_label_stm(d, d->label[d->nlabel+1]);
+}
+
+void
+direct_return_stm(Compiler *cc, int has_exp)
+{
+    DirectGen *d = &cc->dg;
+
+    if (has_exp) {
+	d->depth--;
+    }
+    emit_jump(d, "jmp", -1);
+}
+
+
+/*
+ * 関数
+ */
+
+/* 仮引数の並びの後。関数名はここで決まる */
+void
+direct_function_begin(Compiler *cc)
+{
+    DirectGen *d = &cc->dg;
+
+    d->func_name = d->name[--d->nname].ident;
+    d->body.len = 0;
+    d->nref = 0;
+    d->rel_end = 0;
+}
+
+int
+compare_seq(const void *a, const void *b)
+{
+    return (*(DirectRef**)a)->seq - (*(DirectRef**)b)->seq;
+}
+
+/* 変数の参照を解決する
+   未宣言の変数はcheck_expと同じくソースに現れた順に報告する
+   （代入の左辺は右辺より後に出力しているので、並べ直す） */
+void
+resolve_refs(Compiler *cc)
+{
+    DirectGen *d = &cc->dg;
+    DirectRef **undeclared = NULL;
+    int  i, n = 0;
+
+    for (i = 0; i < d->nref; i++) {
+	d->ref[i].sym = lookup_sym(cc, 0, SYM_VAR, d->ref[i].ident);
+	if (d->ref[i].sym == NULL) {
+	    if (undeclared == NULL) {
+		undeclared = xmalloc(d->nref*sizeof(DirectRef*));
+	    }
+	    undeclared[n++] = &d->ref[i];
+	}
+    }
+    if (n == 0) {
+	return;
+    }
+    qsort(undeclared, n, sizeof(DirectRef*), compare_seq);
+    for (i = 0; i < n; i++) {
+	diag(cc, "Undeclared variable: %s\n", undeclared[i]->ident);
+	cc->nerrs++;
+    }
+    xfree(undeclared);
+}
+
+/* 関数のコードを出力する。bodyの変数の位置には番地を入れる */
+void
+emit_body(Compiler *cc)
+{
+    DirectGen *d = &cc->dg;
+    CodeGen *g = &cc->cg;
+    size_t  pos = 0;
+    int  i;
+
+    g->func_name = d->func_name;
+    gen_func_header(g, d->func_name, get_frame_size(cc, cc->current_func_id));
+    for (i = 0; i < d->nref; i++) {
+	emit_mem(g->out, d->body.buf+pos, d->ref[i].pos-pos);
+	emit_ebp(g->out, d->ref[i].sym->offset);
+	pos = d->ref[i].pos;
+    }
+    emit_mem(g->out, d->body.buf+pos, d->body.len-pos);
+    gen_func_footer(g);
+    g->func_name = NULL;
+}
+
+/* 関数定義の終わり。act_function_defと同じ順に登録・解決し、コードを出力する */
+void
+direct_function_def(Compiler *cc)
+{
+    DirectGen *d = &cc->dg;
+    int  i, phase;
+
+    /* Only TYPE_INT is assumed. */
+    append_sym(cc, TYPE_INT, SYM_FUNC, d->func_name);
+    for (i = 0; i < d->nparam; i++) {
+	if (append_sym(cc, TYPE_INT, SYM_ARG, d->param[i]) == 0) {
+	    diag(cc, "Duplicate argument declaration: %s\n", d->param[i]);
+	    cc->nerrs++;
+	}
+    }
+    d->nparam = 0;
+    phase = stats_phase(cc, PHASE_RESOLVE);
+    resolve_refs(cc);
+    commit_current_symtab(cc, ++cc->current_func_id);
+    /* エラーが出た後は、以降の関数は解放するだけ */
+    if (cc->nerrs == 0) {
+	stats_phase(cc, PHASE_ASSIGN_MEMORY);
+	assign_memory_func(cc, cc->current_func_id);
+	stats_phase(cc, PHASE_GEN_CODE);
+	emit_body(cc);
+    }
+    stats_phase(cc, phase);
+    release_symtab(cc, cc->current_func_id);
+}
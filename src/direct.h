@@ -0,0 +1,95 @@
+/*
+    Tiny Language Compiler (tlc)
+
+    構文解析しながらの直接のコード生成（-O0）
+
+    2016年 木村啓二
+*/
+
+#ifndef  DIRECT_H
+#define  DIRECT_H
+
+#include  <stddef.h>
+#include  "emit.h"
+#include  "symtab.h"
+
+/*
+ * ASTを作らず、構文解析部のアクション（parse_action.c）から直接コードを生成する
+ *
+ * 式はスタックマシンとして評価する。最も新しい値は%eaxに置き、
+ * それより前の値はスタックにpushしておく
+ * if文やループは、条件式の後などで呼ぶアクションで先にラベル番号を決めて
+ * 分岐命令を出しておき、文の終わりでラベルを置く
+ *
+ * 変数の番地は関数を解析し終えるまで決まらない（宣言より前でも使える）ので、
+ * 関数本体のコードはbodyに溜め、変数を参照する位置を覚えておいて、
+ * 関数の終わりで番地を埋めながら出力する
+ * 識別子は使われ方（変数・関数名・宣言）が決まるまで名前のスタックに置く
+ */
+typedef struct DirectRef {
+    size_t  pos;		/* bodyの中で番地を入れる位置 */
+    char  *ident;
+    int  seq;			/* 識別子の出現順（未宣言の報告をソースの順にする） */
+    SymTab  *sym;		/* 解決した変数 */
+} DirectRef;
+
+typedef struct DirectGen {
+    int  on;			/* 直接コードを生成している */
+    Emit  body;			/* 関数本体のコード（変数の番地を除く） */
+    char  *func_name;
+    DirectRef  *ref;		/* 変数を参照する位置 */
+    int  nref, size_ref;
+    DirectRef  *name;		/* 使われ方が決まっていない識別子（posは未定） */
+    int  nname, size_name;
+    int  seq;			/* 次の識別子の出現順 */
+    char  **param;		/* 仮引数の名前 */
+    int  nparam, size_param;
+    int  *label;		/* 解析中の文のラベル */
+    int  nlabel, size_label;
+    int  *nargs;		/* 解析中の関数呼び出しの実引数の数 */
+    int  ncall, size_call;
+    int  ndecl;			/* 解析中の宣言の変数の数 */
+    int  depth;			/* 評価中の値の数（%eaxの分を含む） */
+    /* 最後の比較の値を作った命令（setcc, movzbl）の範囲
+       直後に条件分岐するなら、条件分岐命令に書き換える */
+    size_t  rel_pos, rel_end;
+    int  rel_op;
+} DirectGen;
+
+struct Compiler;
+
+/* 翻訳単位の解析を始める前と後 */
+extern void  direct_begin(struct Compiler *cc);
+extern void  direct_free(struct Compiler *cc);
+
+/*
+ * parse_action.cのact_*関数から、直接コードを生成している時に呼ぶ
+ * 値を返すものは、ASTの代わりにNULLでない目印を返す
+ */
+extern void  direct_ident(struct Compiler *cc, char *id);
+extern void  direct_ident_exp(struct Compiler *cc);
+extern void  direct_const_int(struct Compiler *cc, int c);
+extern void  direct_call(struct Compiler *cc, int has_args);
+extern void  direct_argument(struct Compiler *cc, int first);
+extern void  direct_unary(struct Compiler *cc, int ope);
+extern void  direct_n2(struct Compiler *cc, int ope);
+extern void  direct_ident_list(struct Compiler *cc, int first);
+extern void  direct_dec_int(struct Compiler *cc);
+extern void  direct_param_dec(struct Compiler *cc);
+extern void  direct_exp_stm(struct Compiler *cc, int has_exp);
+extern void  direct_if_cond(struct Compiler *cc);
+extern void  direct_else(struct Compiler *cc);
+extern void  direct_if_stm(struct Compiler *cc);
+extern void  direct_loop_begin(struct Compiler *cc);
+extern void  direct_while_cond(struct Compiler *cc);
+extern void  direct_while_stm(struct Compiler *cc);
+extern void  direct_for_init(struct Compiler *cc);
+extern void  direct_for_cond(struct Compiler *cc);
+extern void  direct_for_step(struct Compiler *cc);
+extern void  direct_for_stm(struct Compiler *cc);
+extern void  direct_dowhile_stm(struct Compiler *cc);
+extern void  direct_return_stm(struct Compiler *cc, int has_exp);
+extern void  direct_function_begin(struct Compiler *cc);
+extern void  direct_function_def(struct Compiler *cc);
+
+#endif	/* DIRECT_H */
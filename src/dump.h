@@ -0,0 +1,28 @@
+/*
+    Tiny Language Compiler (tlc)
+
+    シンボルテーブル・ASTのダンプの指定
+
+    2016年 木村啓二
+*/
+
+#ifndef  DUMP_H
+#define  DUMP_H
+
+#include  "emit.h"
+
+/* 出力するもの（--dump=symtab,ast,ast-reg,ir） */
+enum {
+    DUMP_SYMTAB  = 1 << 0,	/* シンボルテーブル */
+    DUMP_AST     = 1 << 1,	/* 構文解析直後のAST */
+    DUMP_AST_REG = 1 << 2,	/* レジスタ割り付け後のAST */
+    DUMP_IR      = 1 << 3	/* レジスタ割り付け後のIR（--backend=ir） */
+};
+
+/* 出力形式（--dump-format=text|json） */
+enum {
+    DUMP_FORMAT_TEXT,		/* 従来の形式（テストの.c.logと同じ） */
+    DUMP_FORMAT_JSON		/* 1回のダンプを1行のJSONで出力 */
+};
+
+#endif	/* DUMP_H */
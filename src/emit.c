@@ -0,0 +1,237 @@
+/*
+    Tiny Language Compiler (tlc)
+
+    アセンブリ出力用のバッファ
+
+    書式の解釈を伴うfprintfを命令ごとに呼ぶ代わりに、
+    決まった形のオペランドを直接バッファに書き込む
+
+    2016年 木村啓二
+*/
+
+#include  <stdarg.h>
+#include  <stdio.h>
+#include  <string.h>
+#include  <unistd.h>
+#include  "emit.h"
+#include  "util.h"
+
+static const char reg_name[][5] = {"%eax", "%ecx", "%edx", "%ebx", "%esi", "%edi"};
+
+static void write_out(int fd, const char *p, size_t n);
+static void make_room(Emit *e, size_t n);
+static void count_lines(Emit *e, const char *p, size_t n);
+
+void
+emit_init(Emit *e, int fd)
+{
+    memset(e, 0, sizeof(Emit));
+    e->size = (fd < 0) ? EMIT_MEM_INIT_SIZE : EMIT_BUF_SIZE;
+    e->buf = xmalloc_tag(e->size, ALLOC_OUTPUT);
+    e->fd = fd;
+}
+
+/* 書き出せなければ続けても意味がないので終了する */
+static void
+write_out(int fd, const char *p, size_t n)
+{
+    if (write_all(fd, p, n) < 0) {
+	perror("write");
+	exit(-1);
+    }
+}
+
+void
+emit_flush(Emit *e)
+{
+    if (e->fd < 0) {
+	return;
+    }
+    if (e->count_insns) {
+	count_lines(e, e->buf+e->counted, e->len-e->counted);
+	e->counted = 0;
+    }
+    write_out(e->fd, e->buf, e->len);
+    e->len = 0;
+}
+
+void
+emit_close(Emit *e)
+{
+    emit_flush(e);
+    xfree(e->buf);
+    e->buf = NULL;
+    e->len = e->size = 0;
+}
+
+/* 少なくともnバイト書き込めるようにする */
+void
+make_room(Emit *e, size_t n)
+{
+    if (e->fd >= 0) {
+	emit_flush(e);
+	if (n <= e->size) {
+	    return;
+	}
+    }
+    while (e->size - e->len < n) {
+	e->size *= 2;
+    }
+    e->buf = xrealloc_tag(e->buf, e->size, ALLOC_OUTPUT);
+}
+
+#define  ROOM(E, N)  do {				\
+	if ((E)->size - (E)->len < (size_t)(N)) {	\
+	    make_room((E), (N));			\
+	}						\
+    } while (0)
+
+void
+emit_mem(Emit *e, const char *s, size_t n)
+{
+    if (e->fd >= 0 && n > e->size) {
+	/* バッファより大きいものは直接書き出す */
+	emit_flush(e);
+	if (e->count_insns) {
+	    count_lines(e, s, n);
+	}
+	write_out(e->fd, s, n);
+	return;
+    }
+    ROOM(e, n);
+    memcpy(e->buf+e->len, s, n);
+    e->len += n;
+}
+
+void
+emit_str(Emit *e, const char *s)
+{
+    emit_mem(e, s, strlen(s));
+}
+
+/* 診断メッセージ用。命令の出力には使わない */
+void
+emit_vprintf(Emit *e, const char *fmt, va_list ap)
+{
+    va_list  aq;
+    int  n;
+
+    va_copy(aq, ap);
+    n = vsnprintf(NULL, 0, fmt, aq);
+    va_end(aq);
+    ROOM(e, n+1);
+    vsnprintf(e->buf+e->len, n+1, fmt, ap);
+    e->len += n;
+}
+
+void
+emit_char(Emit *e, int c)
+{
+    ROOM(e, 1);
+    e->buf[e->len++] = c;
+}
+
+/* 10進数の文字列に変換する。INT_MINも扱えるよう符号なしで計算する */
+void
+emit_int(Emit *e, int v)
+{
+    char  tmp[12], *p;
+    unsigned  u;
+
+    u = v < 0 ? -(unsigned)v : (unsigned)v;
+    p = tmp+sizeof(tmp);
+    do {
+	*--p = '0' + u%10;
+	u /= 10;
+    } while (u != 0);
+    if (v < 0) {
+	*--p = '-';
+    }
+    emit_mem(e, p, tmp+sizeof(tmp)-p);
+}
+
+void
+emit_reg(Emit *e, int reg)
+{
+    ROOM(e, 4);
+    memcpy(e->buf+e->len, reg_name[reg], 4);
+    e->len += 4;
+}
+
+void
+emit_imm(Emit *e, int v)
+{
+    emit_char(e, '$');
+    emit_int(e, v);
+}
+
+void
+emit_ebp(Emit *e, int offset)
+{
+    emit_int(e, offset);
+    EMIT_LIT(e, "(%ebp)");
+}
+
+void
+emit_esp(Emit *e, int offset)
+{
+    emit_int(e, offset);
+    EMIT_LIT(e, "(%esp)");
+}
+
+void
+emit_label(Emit *e, int label)
+{
+    EMIT_LIT(e, ".L");
+    emit_int(e, label);
+}
+
+
+/*
+ * 命令の行数
+ * 書き出す直前（メモリ上のみの場合はemit_insnsの時）にまとめて数える
+ * 行はバッファの境目で切れていることがあるので、行頭からの状態を持ち越す
+ */
+void
+emit_count_insns(Emit *e)
+{
+    e->count_insns = 1;
+    e->insn_state = 0;
+    e->counted = e->len;
+    e->insns = 0;
+}
+
+long
+emit_insns(Emit *e)
+{
+    if (e->count_insns) {
+	count_lines(e, e->buf+e->counted, e->len-e->counted);
+	e->counted = e->len;
+    }
+    return e->insns;
+}
+
+void
+count_lines(Emit *e, const char *p, size_t n)
+{
+    const char *end = p+n, *q;
+    int  st = e->insn_state;
+
+    while (p < end) {
+	if (st == 2) {
+	    /* 行の残りは次の改行まで読み飛ばす */
+	    if ((q = memchr(p, '\n', end-p)) == NULL) {
+		break;
+	    }
+	    p = q+1;
+	    st = 0;
+	    continue;
+	}
+	if (st == 1 && *p != '.' && *p != '\n') {
+	    e->insns++;
+	}
+	st = (*p == '\n') ? 0 : (st == 0 && *p == '\t') ? 1 : 2;
+	p++;
+    }
+    e->insn_state = st;
+}
@@ -0,0 +1,66 @@
+/*
+    Tiny Language Compiler (tlc)
+
+    アセンブリ出力用のバッファ
+
+    2016年 木村啓二
+*/
+
+#ifndef  EMIT_H
+#define  EMIT_H
+
+#include  <stdarg.h>
+#include  <stddef.h>
+
+/*
+ * 出力は大きなバッファに溜め、一杯になったらwriteでまとめて書き出す
+ * fdが負の場合はファイルに書き出さず、バッファを伸ばしながらメモリ上に溜める
+ */
+typedef struct Emit {
+    char  *buf;
+    size_t  len;		/* 溜まっているバイト数 */
+    size_t  size;		/* バッファの大きさ */
+    int  fd;			/* 出力先。負ならメモリ上のみ */
+    /* 命令の行数（emit_count_insnsで数え始めた時だけ） */
+    int  count_insns;
+    int  insn_state;		/* 0:行頭 1:行頭のタブの後 2:それ以外 */
+    size_t  counted;		/* bufのうち数え終えたバイト数 */
+    long  insns;
+} Emit;
+
+#define  EMIT_BUF_SIZE  (256*1024)
+/* メモリ上のみの場合の最初の大きさ。関数毎に作ることもあるので小さくしておく */
+#define  EMIT_MEM_INIT_SIZE  4096
+
+extern void  emit_init(Emit *e, int fd);
+/* 溜まっている内容を書き出す（メモリ上のみの場合は何もしない） */
+extern void  emit_flush(Emit *e);
+/* 書き出してからバッファを解放する */
+extern void  emit_close(Emit *e);
+
+extern void  emit_mem(Emit *e, const char *s, size_t n);
+extern void  emit_str(Emit *e, const char *s);
+extern void  emit_char(Emit *e, int c);
+extern void  emit_int(Emit *e, int v);
+extern void  emit_vprintf(Emit *e, const char *fmt, va_list ap);
+
+/* 以降に出力する命令の行（タブで始まり'.'が続かない行）を数える */
+extern void  emit_count_insns(Emit *e);
+/* ここまでに出力した命令の行数 */
+extern long  emit_insns(Emit *e);
+
+/* 文字列リテラルはstrlenを使わずに長さを求める */
+#define  EMIT_LIT(E, S)  emit_mem((E), (S), sizeof(S)-1)
+
+/*
+ * 命令のオペランド
+ * レジスタ番号はcg.cの割り付けと同じく 0:%eax 1:%ecx 2:%edx
+ * 3:%ebx 4:%esi 5:%edi は変数を置くもの（regalloc.c）
+ */
+extern void  emit_reg(Emit *e, int reg);	/* %eax */
+extern void  emit_imm(Emit *e, int v);		/* $v */
+extern void  emit_ebp(Emit *e, int offset);	/* offset(%ebp) */
+extern void  emit_esp(Emit *e, int offset);	/* offset(%esp) */
+extern void  emit_label(Emit *e, int label);	/* .Llabel */
+
+#endif	/* EMIT_H */
@@ -0,0 +1,252 @@
+/*
+    Tiny Language Compiler (tlc)
+
+    並列の構文解析（-j）
+
+    2016年 木村啓二
+*/
+
+#include  <setjmp.h>
+#include  <string.h>
+#include  "compiler.h"
+#include  "parse_action.h"
+
+/*
+ * ソースを最上位の関数定義の境界（{}の深さが0に戻る}の直後）で分け、
+ * 部分毎に別のCompilerで構文解析と名前の解決を行う
+ * 結果は部分の順にまとめるので、関数idも関数名の表の順も逐次の場合と同じになる
+ *
+ * 部分毎のCompilerは識別子の表を別々に持つ。ASTの識別子はそれを指しているので、
+ * 翻訳単位のコンパイルが終わるまで解放しない
+ * 診断メッセージも部分毎に溜め、まとめる時に部分の順に書き出す
+ * 構文エラーの番号は前の部分のエラーの数で決まるので、その時に付ける
+ */
+
+/* スレッドあたりの部分の数（部分毎の重さの違いをならす） */
+#define  FRONT_CHUNKS_PER_JOB  4
+/* これより小さくは分けない */
+#define  FRONT_MIN_CHUNK  (64*1024)
+
+/* 部分の解析結果 */
+enum {
+    FRONT_OK,
+    FRONT_SYNTAX_ERROR,		/* 構文エラーで解析をやめた */
+    FRONT_FATAL			/* 続行できないエラー */
+};
+
+typedef struct FrontChunk {
+    Compiler  cc;		/* この部分だけを翻訳単位として解析する */
+    const char  *begin, *end;
+    int  lineno;		/* beginの行番号 */
+    int  status;		/* FRONT_* */
+    int  error_lineno;		/* 構文エラーの行番号とメッセージ */
+    const char  *error_mes;
+} FrontChunk;
+
+typedef struct Front {
+    Options  opt;		/* 部分毎のCompilerの設定 */
+    FrontChunk  *chunk;
+    int  nchunk;
+} Front;
+
+static int  split_source(Compiler *cc, Front *fr);
+static void parse_chunk(void *arg, int i);
+static int  merge_chunk(Compiler *cc, FrontChunk *ch);
+static void merge_function(Compiler *cc, Compiler *w, AST_Node *f);
+
+/* 分ける位置を探す。{}以外のトークンは調べなくてよい
+   }が多過ぎるソースは分けずに逐次の構文解析にエラーを報告させる
+   分けた数を返す */
+int
+split_source(Compiler *cc, Front *fr)
+{
+    const char *p = cc->src.base, *end = p + cc->src.size, *next;
+    size_t  target;
+    int  depth = 0, lineno = 1, size = 0, body = 0;
+    FrontChunk *ch;
+
+    target = cc->src.size / (cc->opt->jobs * FRONT_CHUNKS_PER_JOB);
+    if (target < FRONT_MIN_CHUNK) {
+	target = FRONT_MIN_CHUNK;
+    }
+    fr->chunk = NULL;
+    fr->nchunk = 0;
+    next = p;
+    for (; p < end; p++) {
+	switch (*p) {
+	case '\n':
+	    lineno++;
+	    continue;
+	case ' ': case '\t': case '\r':
+	    continue;
+	case '{':
+	    depth++;
+	    break;
+	case '}':
+	    if (--depth < 0) {
+		return 0;
+	    }
+	    break;
+	}
+	if (!body) {
+	    /* 空白だけの部分は作らない */
+	    if (fr->nchunk == size) {
+		size = (size == 0) ? 16 : size*2;
+		fr->chunk = xrealloc(fr->chunk, size*sizeof(FrontChunk));
+	    }
+	    ch = &fr->chunk[fr->nchunk++];
+	    memset(ch, 0, sizeof(FrontChunk));
+	    ch->begin = (fr->nchunk == 1) ? cc->src.base : p;
+	    ch->lineno = (fr->nchunk == 1) ? 1 : lineno;
+	    next = ch->begin + target;
+	    body = 1;
+	}
+	if (depth == 0 && *p == '}' && p+1 >= next) {
+	    fr->chunk[fr->nchunk-1].end = p+1;
+	    body = 0;
+	}
+    }
+    if (fr->nchunk > 0) {
+	/* 最後の部分は末尾の空白も含める */
+	fr->chunk[fr->nchunk-1].end = end;
+    }
+    return fr->nchunk;
+}
+
+void
+parse_chunk(void *arg, int i)
+{
+    Front *fr = arg;
+    FrontChunk *ch = &fr->chunk[i];
+    Compiler *w = &ch->cc;
+
+    if (setjmp(w->fatal) != 0) {
+	if (w->scanner != NULL || w->scan_cur != NULL) {
+	    lex_destroy(w);
+	}
+	ch->status = FRONT_FATAL;
+	return;
+    }
+    lex_init_range(w, ch->begin, ch->end, ch->lineno);
+    if (fr->opt.parser == PARSER_RD) {
+	rd_parse(w);
+    } else {
+	yyparse(w);
+    }
+    lex_destroy(w);
+}
+
+int
+front_parse(Compiler *cc)
+{
+    Front  *fr;
+    int  i;
+
+    fr = xmalloc(sizeof(Front));
+    if (split_source(cc, fr) < 2) {
+	xfree(fr->chunk);
+	xfree(fr);
+	return 0;
+    }
+    fr->opt = *cc->opt;
+    fr->opt.jobs = 1;
+    cc->front = fr;
+    for (i = 0; i < fr->nchunk; i++) {
+	FrontChunk *ch = &fr->chunk[i];
+
+	compiler_init(&ch->cc, &fr->opt, -1, cc->arena_pool);
+	ch->cc.in_file = cc->in_file;
+	ch->cc.chunk = ch;
+	/* キーは設定だけから作った値から始めて部分毎に作る */
+	ch->cc.cache = cc->cache;
+    }
+
+    parallel_for(fr->nchunk, cc->opt->jobs, parse_chunk, fr);
+
+    for (i = 0; i < fr->nchunk; i++) {
+	if (merge_chunk(cc, &fr->chunk[i]) < 0) {
+	    break;
+	}
+    }
+    return 1;
+}
+
+/* 部分の結果を翻訳単位に加える。構文エラーで解析をやめる時は-1を返す */
+int
+merge_chunk(Compiler *cc, FrontChunk *ch)
+{
+    Compiler *w = &ch->cc;
+    AST_Node *f;
+
+    if (w->err.len > 0) {
+	emit_mem(&cc->err, w->err.buf, w->err.len);
+	emit_flush(&cc->err);
+    }
+    cc->nerrs += w->nerrs;
+    if (ch->status == FRONT_FATAL) {
+	fatal(cc);
+    }
+    TRAVERSE_AST_LIST(f, w->ast_root, merge_function(cc, w, f));
+    /* 関数名は翻訳単位の表に登録し直すので、その分は数えない */
+    cc->stats.symbols += w->stats.symbols - w->func_index.count;
+    cc->stats.ast_nodes += w->stats.ast_nodes;
+    cc->stats.list_cells += w->stats.list_cells;
+    cc->stats.arena_bytes += w->stats.arena_bytes;
+    if (ch->status == FRONT_SYNTAX_ERROR) {
+	cc->nerrs++;
+	diag(cc, "[error %d] line %d: %s\n", cc->nerrs, ch->error_lineno, ch->error_mes);
+	return -1;
+    }
+    return 0;
+}
+
+/* 部分の中のidの関数を、翻訳単位の次のidの関数として引き取る */
+void
+merge_function(Compiler *cc, Compiler *w, AST_Node *f)
+{
+    int  id = f->id;
+    char  *name = f->child[0]->str;
+
+    cc->current_symtab.next = w->symtab_array[id];
+    cc->current_index = w->index_array[id];
+    cc->func_arena = w->arena_array[id];
+    cc->func_arena.allocated = &cc->stats.arena_bytes;
+    w->symtab_array[id] = NULL;
+    memset(&w->index_array[id], 0, sizeof(SymIndex));
+    memset(&w->arena_array[id], 0, sizeof(Arena));
+    commit_current_symtab(cc, ++cc->current_func_id);
+    f->id = cc->current_func_id;
+    if (cc->cache.dir != NULL && id <= w->cache.nkey) {
+	cache_add_key(cc, &w->cache.key[id]);
+    }
+    append_sym(cc, TYPE_INT, SYM_FUNC, intern(&cc->names, name, strlen(name)));
+    cc->ast_root = act_unit_list(cc, cc->ast_root, f);
+}
+
+/* yyerrorから呼ぶ。行番号とメッセージを覚えておき、まとめる時に報告する */
+void
+front_syntax_error(Compiler *cc, const char *mes)
+{
+    FrontChunk *ch = cc->chunk;
+
+    ch->status = FRONT_SYNTAX_ERROR;
+    ch->error_lineno = lex_lineno(cc);
+    ch->error_mes = arena_strdup(&cc->unit_arena, mes);
+}
+
+void
+front_free(Compiler *cc)
+{
+    Front *fr = cc->front;
+    int  i;
+
+    if (fr == NULL) {
+	return;
+    }
+    for (i = 0; i < fr->nchunk; i++) {
+	compiler_free(&fr->chunk[i].cc);
+    }
+    xfree(fr->chunk);
+    xfree(fr);
+    cc->front = NULL;
+}
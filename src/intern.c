@@ -0,0 +1,93 @@
+/*
+    Tiny Language Compiler (tlc)
+
+    識別子文字列の一元化（intern）
+
+    2016年 木村啓二
+*/
+
+#include  <string.h>
+#include  "intern.h"
+#include  "util.h"
+
+typedef struct InternEntry {
+    unsigned int  hash;
+    unsigned int  len;
+    char  *str;
+} InternEntry;
+
+#define INTERN_MIN_SIZE 1024
+
+static unsigned int hash_str(const char *s, size_t len);
+static void grow_pool(InternPool *p);
+
+unsigned int
+hash_str(const char *s, size_t len)
+{
+    /* FNV-1a */
+    unsigned int h = 2166136261u;
+    size_t  i;
+
+    for (i = 0; i < len; i++) {
+	h ^= (unsigned char)s[i];
+	h *= 16777619u;
+    }
+    return h;
+}
+
+/* 充填率が1/2を超えないように表を拡張する */
+void
+grow_pool(InternPool *p)
+{
+    unsigned int  i, j, mask, osize;
+    InternEntry  *oentry;
+
+    osize = p->size;
+    oentry = p->entry;
+    p->size = (osize == 0) ? INTERN_MIN_SIZE : osize*2;
+    p->entry = xcalloc_tag(p->size, sizeof(InternEntry), ALLOC_IDENT);
+    mask = p->size-1;
+    for (i = 0; i < osize; i++) {
+	if (oentry[i].str != NULL) {
+	    for (j = oentry[i].hash & mask; p->entry[j].str != NULL; j = (j+1) & mask)
+		;
+	    p->entry[j] = oentry[i];
+	}
+    }
+    xfree(oentry);
+}
+
+char*
+intern(InternPool *p, const char *s, size_t len)
+{
+    unsigned int  h, i, mask;
+    InternEntry  *e;
+
+    if ((p->count+1)*2 > p->size) {
+	grow_pool(p);
+    }
+    h = hash_str(s, len);
+    mask = p->size-1;
+    for (i = h & mask; p->entry[i].str != NULL; i = (i+1) & mask) {
+	e = &p->entry[i];
+	if (e->hash == h && e->len == len && memcmp(e->str, s, len) == 0) {
+	    return e->str;
+	}
+    }
+    e = &p->entry[i];
+    e->hash = h;
+    e->len = len;
+    e->str = arena_alloc(&p->arena, len+1, ALLOC_IDENT);
+    memcpy(e->str, s, len);
+    p->count++;
+
+    return e->str;
+}
+
+void
+intern_free(InternPool *p)
+{
+    xfree(p->entry);
+    arena_free(&p->arena);
+    memset(p, 0, sizeof(InternPool));
+}
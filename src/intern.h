@@ -0,0 +1,35 @@
+/*
+    Tiny Language Compiler (tlc)
+
+    識別子文字列の一元化（intern）
+
+    2016年 木村啓二
+*/
+
+#ifndef  INTERN_H
+#define  INTERN_H
+
+#include  <stddef.h>
+#include  "util.h"
+
+/*
+ * 綴りをキーとするオープンアドレス法（線形探索）のハッシュ表
+ * 文字列の実体はarenaに置き、intern_freeまで解放しない
+ * 全て0で初期化すれば空の表になる
+ */
+typedef struct InternPool {
+    struct InternEntry  *entry;
+    unsigned int  size;		/* entryの数（2のべき乗） */
+    unsigned int  count;	/* 登録数 */
+    Arena  arena;
+} InternPool;
+
+/* 長さlenの文字列sと同じ綴りの文字列の、表pにおける唯一の実体を返す
+   同じ綴りに対しては常に同じポインタを返すので、
+   返された文字列同士はポインタの比較だけで等しいか判定できる
+   返された文字列は書き換えてはならない */
+extern char *intern(InternPool *p, const char *s, size_t len);
+/* 表pとその文字列を全て解放する */
+extern void intern_free(InternPool *p);
+
+#endif	/* INTERN_H */
@@ -0,0 +1,973 @@
+/*
+    Tiny Language Compiler (tlc)
+
+    3番地コードの中間表現（--backend=ir）
+
+    2016年 木村啓二
+*/
+
+#include  <stdio.h>
+#include  <stdlib.h>
+#include  <string.h>
+#include  "ast.h"
+#include  "compiler.h"
+#include  "ir.h"
+#include  "symtab.h"
+#include  "util.h"
+
+/*
+ * ASTからの変換
+ * 文は再帰で、式はcg.cと同じく明示的なスタックで巡回する
+ * 式の途中の値はvalsに積み、演算毎に一時変数を1つ作ってそこに結果を入れる
+ * 定数と変数の参照はそのままオペランドにするが、値を使う前に同じ式の中で
+ * その変数に代入されると値が変わるので、代入の直前に一時変数にコピーする
+ * （pendingはvalsに積んでいる参照の数で、0なら探さない）
+ *
+ * 制御構造はcg.cのコード生成と同じ順にブロックを配置する
+ *   if:    条件 then部 [else部] 後
+ *   while: 条件（先頭） 本体 後     for: 初期化 条件（先頭） 本体 更新 後
+ *   do:    本体（先頭） 条件 後
+ * returnの後の文は到達しないブロックに入れ、ir_build_cfgで除く
+ */
+typedef struct Lower {
+    Compiler  *cc;
+    IR_Func  *fn;
+    IR_Block  *cur;		/* 命令を加えているブロック（NULLなら到達しない位置） */
+    IR_Block  *tail;		/* 配置の順の最後のブロック */
+    AST_Stack  *st;		/* 式の巡回用 */
+    IR_Opd  *vals;		/* 式の巡回中の値のスタック */
+    int  nvals, size_vals;
+    int  nsym;			/* 仮引数・自動変数の数 */
+    int  *pending;		/* 仮引数・自動変数毎の、valsにある参照の数 */
+} Lower;
+
+static IR_Block *new_block(Lower *l);
+static void start_block(Lower *l, IR_Block *b);
+static void end_block(Lower *l, int term, IR_Block *s0, IR_Block *s1);
+static IR_Insn *add_insn(Lower *l, int op, int dst, IR_Opd a, IR_Opd b);
+static void grow_var(IR_Func *fn);
+static void push_val(Lower *l, IR_Opd v);
+static IR_Opd pop_val(Lower *l);
+static void keep_var(Lower *l, int v);
+static void lower_stm(Lower *l, AST_Node *s);
+static void lower_if(Lower *l, AST_Node *s);
+static void lower_loop(Lower *l, AST_Node *init, AST_Node *cond, AST_Node *step,
+		       AST_Node *body);
+static void lower_dowhile(Lower *l, AST_Node *s);
+static void lower_cond(Lower *l, AST_Node *e, IR_Block *t, IR_Block *f);
+static IR_Opd lower_exp(Lower *l, AST_Node *e, int *rel, IR_Opd *b);
+static AST_Node *lower_child(AST_Node *e, int k);
+static void lower_node(Lower *l, AST_Node *e);
+static int  ir_op(int sub_kind);
+static int  is_rel(int sub_kind);
+static void scan_block(IR_Func *fn, IR_Block *b, int k, int *defined,
+		       unsigned *use, unsigned *def);
+static void scan_use(IR_Func *fn, int v, int k, int *defined, unsigned *use);
+static void dump_opd(IR_Func *fn, Emit *out, IR_Opd v);
+static void dump_var(IR_Func *fn, Emit *out, int v);
+static void dump_insn(IR_Func *fn, Emit *out, IR_Insn *i);
+static void dump_term(IR_Func *fn, Emit *out, IR_Block *b);
+static void dump_ir_text(IR_Func *fn, Emit *out);
+static void dump_ir_json(IR_Func *fn, Emit *out);
+
+/* 演算子の表記（ダンプ用）。IR_ADD .. IR_NE */
+static const char *op_name[] = {
+    [IR_ADD] = "+", [IR_SUB] = "-", [IR_MUL] = "*", [IR_DIV] = "/",
+    [IR_LT] = "<", [IR_GT] = ">", [IR_LTE] = "<=", [IR_GTE] = ">=",
+    [IR_EQ] = "==", [IR_NE] = "!=",
+};
+
+IR_Func*
+ir_lower(Compiler *cc, AST_Node *f, AST_Stack *st)
+{
+    Lower  l;
+    IR_Func *fn;
+    SymTab *t;
+    Arena *a = &cc->arena_array[f->id];
+
+    memset(&l, 0, sizeof(Lower));
+    fn = arena_alloc(a, sizeof(IR_Func), ALLOC_IR);
+    fn->id = f->id;
+    fn->name = f->child[0]->str;
+    fn->arena = a;
+    fn->nvar = 1;
+    /* 仮引数・自動変数の番号はシンボルテーブルのentry番号 */
+    for (t = cc->symtab_array[f->id]; t != NULL; t = t->next) {
+	if (fn->nvar <= t->entry) {
+	    fn->nvar = t->entry+1;
+	}
+    }
+    l.nsym = fn->nvar-1;
+    fn->size_var = fn->nvar*2;
+    fn->var = arena_alloc(a, fn->size_var*sizeof(IR_Var), ALLOC_IR);
+    for (t = cc->symtab_array[f->id]; t != NULL; t = t->next) {
+	fn->var[t->entry].sym = t;
+    }
+
+    l.cc = cc;
+    l.fn = fn;
+    l.st = st;
+    l.pending = xcalloc_tag(fn->nvar, sizeof(int), ALLOC_IR);
+    start_block(&l, new_block(&l));
+    lower_stm(&l, f->child[1]);
+    /* 関数の終わりまで来たら値を返さずに戻る */
+    if (l.cur != NULL) {
+	end_block(&l, IR_RET, NULL, NULL);
+    }
+    xfree(l.pending);
+    xfree(l.vals);
+    ir_build_cfg(fn);
+    return fn;
+}
+
+IR_Block*
+new_block(Lower *l)
+{
+    return ir_new_block(l->fn);
+}
+
+IR_Block*
+ir_new_block(IR_Func *fn)
+{
+    IR_Block *b;
+
+    b = arena_alloc(fn->arena, sizeof(IR_Block), ALLOC_IR);
+    b->id = fn->nblock_id++;
+    b->label = -1;
+    return b;
+}
+
+/* bを配置の順の最後に置き、以降の命令をbに加える */
+void
+start_block(Lower *l, IR_Block *b)
+{
+    if (l->tail == NULL) {
+	l->fn->entry = b;
+    } else {
+	l->tail->next = b;
+    }
+    l->tail = b;
+    l->cur = b;
+}
+
+/* 処理中のブロックを終端termで終える。値はあらかじめcurに入れておく */
+void
+end_block(Lower *l, int term, IR_Block *s0, IR_Block *s1)
+{
+    if (l->cur == NULL) {
+	return;
+    }
+    l->cur->term = term;
+    l->cur->succ[0] = s0;
+    l->cur->succ[1] = s1;
+    l->cur = NULL;
+}
+
+/* 命令を処理中のブロックの末尾に加える。到達しない位置なら新しいブロックを作る */
+IR_Insn*
+add_insn(Lower *l, int op, int dst, IR_Opd a, IR_Opd b)
+{
+    if (l->cur == NULL) {
+	start_block(l, new_block(l));
+    }
+    return ir_insert_insn(l->fn, l->cur, NULL, op, dst, a, b);
+}
+
+IR_Insn*
+ir_insert_insn(IR_Func *fn, IR_Block *blk, IR_Insn *before, int op, int dst,
+	       IR_Opd a, IR_Opd b)
+{
+    IR_Insn *i;
+
+    i = arena_alloc(fn->arena, sizeof(IR_Insn), ALLOC_IR);
+    i->op = op;
+    i->dst = dst;
+    i->a = a;
+    i->b = b;
+    i->next = before;
+    i->prev = (before != NULL) ? before->prev : blk->last;
+    if (i->prev != NULL) {
+	i->prev->next = i;
+    } else {
+	blk->first = i;
+    }
+    if (before != NULL) {
+	before->prev = i;
+    } else {
+	blk->last = i;
+    }
+    return i;
+}
+
+/* 変数の表を伸ばす。表は関数の領域にあるので、古い方は関数と一緒に解放される */
+void
+grow_var(IR_Func *fn)
+{
+    IR_Var *v;
+
+    if (fn->nvar < fn->size_var) {
+	return;
+    }
+    fn->size_var *= 2;
+    v = arena_alloc(fn->arena, fn->size_var*sizeof(IR_Var), ALLOC_IR);
+    memcpy(v, fn->var, fn->nvar*sizeof(IR_Var));
+    fn->var = v;
+}
+
+int
+ir_new_temp(IR_Func *fn)
+{
+    grow_var(fn);
+    return fn->nvar++;
+}
+
+IR_Opd
+ir_opd(int kind, int val)
+{
+    IR_Opd  v;
+
+    v.kind = kind;
+    v.val = val;
+    return v;
+}
+
+void
+push_val(Lower *l, IR_Opd v)
+{
+    if (l->nvals == l->size_vals) {
+	l->size_vals = (l->size_vals == 0) ? 64 : l->size_vals*2;
+	l->vals = xrealloc_tag(l->vals, l->size_vals*sizeof(IR_Opd), ALLOC_IR);
+    }
+    l->vals[l->nvals++] = v;
+    if (v.kind == IR_VAR && v.val <= l->nsym) {
+	l->pending[v.val]++;
+    }
+}
+
+IR_Opd
+pop_val(Lower *l)
+{
+    IR_Opd  v = l->vals[--l->nvals];
+
+    if (v.kind == IR_VAR && v.val <= l->nsym) {
+	l->pending[v.val]--;
+    }
+    return v;
+}
+
+/* 変数vに代入する前に、まだ使っていないvの参照を一時変数のコピーに置き換える */
+void
+keep_var(Lower *l, int v)
+{
+    int  k, t;
+
+    if (l->pending[v] == 0) {
+	return;
+    }
+    for (k = 0; k < l->nvals; k++) {
+	if (l->vals[k].kind == IR_VAR && l->vals[k].val == v) {
+	    t = ir_new_temp(l->fn);
+	    add_insn(l, IR_MOV, t, l->vals[k], ir_opd(IR_NONE, 0));
+	    l->vals[k].val = t;
+	}
+    }
+    l->pending[v] = 0;
+}
+
+void
+lower_stm(Lower *l, AST_Node *s)
+{
+    AST_Node *n;
+    IR_Opd  v;
+
+    if (s == NULL) {
+	return;
+    }
+    switch (s->sub_kind) {
+    case  AST_STM_LIST:
+	TRAVERSE_AST_LIST(n, s->list, lower_stm(l, n));
+	break;
+    case  AST_STM_DEC:
+	/* Nothing to do */
+	break;
+    case  AST_STM_ASIGN:
+	if (s->child[0] != NULL) {
+	    lower_exp(l, s->child[0], NULL, NULL);
+	}
+	break;
+    case  AST_STM_IF:
+	lower_if(l, s);
+	break;
+    case  AST_STM_WHILE:
+	lower_loop(l, NULL, s->child[0], NULL, s->child[1]);
+	break;
+    case  AST_STM_FOR:
+	lower_loop(l, s->child[0], s->child[1], s->child[2], s->child[3]);
+	break;
+    case  AST_STM_DOWHILE:
+	lower_dowhile(l, s);
+	break;
+    case  AST_STM_RETURN:
+	v = (s->child[0] != NULL) ? lower_exp(l, s->child[0], NULL, NULL) : ir_opd(IR_NONE, 0);
+	if (l->cur == NULL) {
+	    start_block(l, new_block(l));
+	}
+	l->cur->a = v;
+	end_block(l, IR_RET, NULL, NULL);
+	break;
+    default:
+	errexit("Invalid statement kind", __FILE__, __LINE__);
+    }
+}
+
+void
+lower_if(Lower *l, AST_Node *s)
+{
+    IR_Block *then, *els, *join;
+
+    then = new_block(l);
+    join = new_block(l);
+    els = (s->child[2] != NULL) ? new_block(l) : join;
+    lower_cond(l, s->child[0], then, els);
+    start_block(l, then);
+    lower_stm(l, s->child[1]);
+    end_block(l, IR_JUMP, join, NULL);
+    if (s->child[2] != NULL) {
+	start_block(l, els);
+	lower_stm(l, s->child[2]);
+	end_block(l, IR_JUMP, join, NULL);
+    }
+    start_block(l, join);
+}
+
+/* while文（init, stepはNULL）とfor文 */
+void
+lower_loop(Lower *l, AST_Node *init, AST_Node *cond, AST_Node *step, AST_Node *body)
+{
+    IR_Block *head, *loop, *exit;
+
+    head = new_block(l);
+    loop = new_block(l);
+    exit = new_block(l);
+    if (init != NULL) {
+	lower_exp(l, init, NULL, NULL);
+    }
+    end_block(l, IR_JUMP, head, NULL);
+    start_block(l, head);
+    lower_cond(l, cond, loop, exit);
+    start_block(l, loop);
+    lower_stm(l, body);
+    if (step != NULL) {
+	lower_exp(l, step, NULL, NULL);
+    }
+    end_block(l, IR_JUMP, head, NULL);
+    start_block(l, exit);
+}
+
+void
+lower_dowhile(Lower *l, AST_Node *s)
+{
+    IR_Block *loop, *exit;
+
+    loop = new_block(l);
+    exit = new_block(l);
+    end_block(l, IR_JUMP, loop, NULL);
+    start_block(l, loop);
+    lower_stm(l, s->child[0]);
+    lower_cond(l, s->child[1], loop, exit);
+    start_block(l, exit);
+}
+
+/* 条件式eが真ならt、偽ならfへ分岐して処理中のブロックを終える
+   比較はそのまま分岐の条件にし、それ以外の値は0と比べる */
+void
+lower_cond(Lower *l, AST_Node *e, IR_Block *t, IR_Block *f)
+{
+    IR_Opd  a, b;
+    int  rel = IR_NE;
+
+    if (e == NULL) {
+	/* for(;;)の省略した条件は真 */
+	end_block(l, IR_JUMP, t, NULL);
+	return;
+    }
+    b = ir_opd(IR_CONST, 0);
+    a = lower_exp(l, e, &rel, &b);
+    if (l->cur == NULL) {
+	start_block(l, new_block(l));
+    }
+    l->cur->cond = rel;
+    l->cur->a = a;
+    l->cur->b = b;
+    end_block(l, IR_BRANCH, t, f);
+}
+
+/*
+ * 式eを評価する命令を加え、その値を返す
+ * relがNULLでなく、eが比較なら比較の命令は作らず、種別を*relに、
+ * 右辺の値を*bに入れて左辺の値を返す
+ * 子を巡回した後で自分の命令を加える（stateは次に巡回する子の番号）
+ */
+IR_Opd
+lower_exp(Lower *l, AST_Node *e, int *rel, IR_Opd *b)
+{
+    AST_Stack *st = l->st;
+    AST_Frame *f;
+    AST_Node *n, *c;
+    int  base;
+
+    base = st->num;
+    push_AST_Stack(st, e);
+    while (st->num > base) {
+	f = AST_STACK_TOP(st);
+	n = f->n;
+	if ((c = lower_child(n, f->state++)) != NULL) {
+	    push_AST_Stack(st, c);
+	    continue;
+	}
+	st->num--;
+	if (n == e && rel != NULL && is_rel(n->sub_kind)) {
+	    *rel = ir_op(n->sub_kind);
+	    *b = pop_val(l);
+	    return pop_val(l);
+	}
+	lower_node(l, n);
+    }
+    return pop_val(l);
+}
+
+/* 式eのk番目に評価する子。代入は右辺だけ、関数呼び出しは実引数を左から */
+AST_Node*
+lower_child(AST_Node *e, int k)
+{
+    if (e->sub_kind == AST_EXP_ASGN) {
+	return (k == 0) ? e->child[1] : NULL;
+    } else if (e->sub_kind == AST_EXP_CALL) {
+	return (e->list != NULL && k < e->list->num) ? e->list->elem[k] : NULL;
+    }
+    return AST_CHILD(e, k);
+}
+
+/* 子の値はvalsに積んである */
+void
+lower_node(Lower *l, AST_Node *e)
+{
+    IR_Insn *i;
+    IR_Opd  a, b;
+    int  k, t, v;
+
+    switch (e->sub_kind) {
+    case  AST_EXP_CNST_INT:
+	push_val(l, ir_opd(IR_CONST, e->val));
+	break;
+    case  AST_EXP_IDENT:
+	push_val(l, ir_opd(IR_VAR, e->symtab->entry));
+	break;
+    case  AST_EXP_ASGN:
+	a = pop_val(l);
+	v = e->child[0]->symtab->entry;
+	keep_var(l, v);
+	add_insn(l, IR_MOV, v, a, ir_opd(IR_NONE, 0));
+	push_val(l, ir_opd(IR_VAR, v));
+	break;
+    case  AST_EXP_UNARY_PLUS:
+	break;
+    case  AST_EXP_UNARY_MINUS:
+	a = pop_val(l);
+	t = ir_new_temp(l->fn);
+	add_insn(l, IR_NEG, t, a, ir_opd(IR_NONE, 0));
+	push_val(l, ir_opd(IR_VAR, t));
+	break;
+    case  AST_EXP_CALL:
+	t = ir_new_temp(l->fn);
+	i = add_insn(l, IR_CALL, t, ir_opd(IR_NONE, 0), ir_opd(IR_NONE, 0));
+	i->func = e->child[0]->str;
+	i->nargs = (e->list != NULL) ? e->list->num : 0;
+	i->arg = arena_alloc(l->fn->arena, i->nargs*sizeof(IR_Opd), ALLOC_IR);
+	for (k = i->nargs-1; k >= 0; k--) {
+	    i->arg[k] = pop_val(l);
+	}
+	push_val(l, ir_opd(IR_VAR, t));
+	break;
+    case  AST_EXP_MUL:
+    case  AST_EXP_DIV:
+    case  AST_EXP_ADD:
+    case  AST_EXP_SUB:
+    case  AST_EXP_LT:
+    case  AST_EXP_GT:
+    case  AST_EXP_LTE:
+    case  AST_EXP_GTE:
+    case  AST_EXP_EQ:
+    case  AST_EXP_NE:
+	b = pop_val(l);
+	a = pop_val(l);
+	t = ir_new_temp(l->fn);
+	add_insn(l, ir_op(e->sub_kind), t, a, b);
+	push_val(l, ir_opd(IR_VAR, t));
+	break;
+    default:
+	errexit("Invalid expression kind", __FILE__, __LINE__);
+    }
+}
+
+/* 2項演算子のASTの副種別に対する命令の種別 */
+int
+ir_op(int sub_kind)
+{
+    switch (sub_kind) {
+    case  AST_EXP_MUL:	return IR_MUL;
+    case  AST_EXP_DIV:	return IR_DIV;
+    case  AST_EXP_ADD:	return IR_ADD;
+    case  AST_EXP_SUB:	return IR_SUB;
+    case  AST_EXP_LT:	return IR_LT;
+    case  AST_EXP_GT:	return IR_GT;
+    case  AST_EXP_LTE:	return IR_LTE;
+    case  AST_EXP_GTE:	return IR_GTE;
+    case  AST_EXP_EQ:	return IR_EQ;
+    case  AST_EXP_NE:	return IR_NE;
+    }
+    errexit("Invalid binary operator", __FILE__, __LINE__);
+    return 0;
+}
+
+int
+is_rel(int sub_kind)
+{
+    return sub_kind >= AST_EXP_LT && sub_kind <= AST_EXP_NE;
+}
+
+/*
+ * 制御フローグラフ
+ */
+void
+ir_build_cfg(IR_Func *fn)
+{
+    IR_Block *b, *s, **p, **stack;
+    char  *mark;
+    int  k, n, sp = 0;
+
+    /* 命令のないブロックからの分岐は、その飛び先へ直接分岐する
+       （空のループで回り続けないよう、辿るのはブロックの数まで） */
+    for (b = fn->entry; b != NULL; b = b->next) {
+	for (k = 0; k < 2; k++) {
+	    for (s = b->succ[k], n = 0; s != NULL && s->first == NULL && s->term == IR_JUMP
+		     && s->succ[0] != s && n < fn->nblock_id; s = s->succ[0], n++)
+		;
+	    b->succ[k] = s;
+	}
+    }
+    /* 入口から到達するブロックに印を付ける */
+    mark = xcalloc_tag(fn->nblock_id, 1, ALLOC_IR);
+    stack = xmalloc_tag(fn->nblock_id*sizeof(IR_Block*), ALLOC_IR);
+    mark[fn->entry->id] = 1;
+    stack[sp++] = fn->entry;
+    while (sp > 0) {
+	b = stack[--sp];
+	for (k = 0; k < 2; k++) {
+	    if (b->succ[k] != NULL && !mark[b->succ[k]->id]) {
+		mark[b->succ[k]->id] = 1;
+		stack[sp++] = b->succ[k];
+	    }
+	}
+    }
+    /* 到達しないものを配置の順のリストから外し、先行を数え直す */
+    for (p = &fn->entry; *p != NULL; ) {
+	if (!mark[(*p)->id]) {
+	    *p = (*p)->next;
+	    continue;
+	}
+	(*p)->npred = 0;
+	p = &(*p)->next;
+    }
+    xfree(mark);
+    xfree(stack);
+    for (b = fn->entry; b != NULL; b = b->next) {
+	for (k = 0; k < 2; k++) {
+	    if (b->succ[k] != NULL && (k == 0 || b->succ[1] != b->succ[0])) {
+		ir_add_pred(fn, b->succ[k], b);
+	    }
+	}
+    }
+    ir_number_blocks(fn);
+}
+
+/* 配置の順に番号を振り直す */
+void
+ir_number_blocks(IR_Func *fn)
+{
+    IR_Block *b;
+    int  n = 0;
+
+    for (b = fn->entry; b != NULL; b = b->next) {
+	n++;
+    }
+    fn->block = arena_alloc(fn->arena, n*sizeof(IR_Block*), ALLOC_IR);
+    fn->nblock = 0;
+    for (b = fn->entry; b != NULL; b = b->next) {
+	b->id = fn->nblock;
+	fn->block[fn->nblock++] = b;
+    }
+    fn->nblock_id = fn->nblock;
+}
+
+void
+ir_add_pred(IR_Func *fn, IR_Block *b, IR_Block *p)
+{
+    IR_Block **a;
+
+    if (b->npred == b->size_pred) {
+	b->size_pred = (b->size_pred == 0) ? 2 : b->size_pred*2;
+	a = arena_alloc(fn->arena, b->size_pred*sizeof(IR_Block*), ALLOC_IR);
+	if (b->npred > 0) {
+	    memcpy(a, b->pred, b->npred*sizeof(IR_Block*));
+	}
+	b->pred = a;
+    }
+    b->pred[b->npred++] = p;
+}
+
+int
+ir_insn_uses(IR_Insn *i, int *uses)
+{
+    int  k, n = 0;
+
+    if (i->a.kind == IR_VAR) {
+	uses[n++] = i->a.val;
+    }
+    if (i->b.kind == IR_VAR) {
+	uses[n++] = i->b.val;
+    }
+    for (k = 0; k < i->nargs; k++) {
+	if (i->arg[k].kind == IR_VAR) {
+	    uses[n++] = i->arg[k].val;
+	}
+    }
+    return n;
+}
+
+void
+ir_remove_insn(IR_Block *b, IR_Insn *i)
+{
+    if (i->prev != NULL) {
+	i->prev->next = i->next;
+    } else {
+	b->first = i->next;
+    }
+    if (i->next != NULL) {
+	i->next->prev = i->prev;
+    } else {
+	b->last = i->prev;
+    }
+    i->prev = i->next = NULL;
+}
+
+/*
+ * 生きている変数の解析
+ * ブロックをまたいで生きうるのは、どこかのブロックで定義より前に読まれる変数だけなので、
+ * それらに0からの番号(live)を付け（fn->live_var）、集合はその番号で表す
+ * 式の途中の一時変数は大抵1つのブロックの中で終わるので、集合は変数の数によらず小さい
+ * ブロック毎に、定義より前に読む変数(use)と定義する変数(def)を求め、
+ * 出口 = 後続の入口の和、入口 = use ∪ (出口 - def) が変わらなくなるまで
+ * 配置の逆順に繰り返す
+ */
+void
+ir_liveness(IR_Func *fn, Arena *a)
+{
+    IR_Block *b;
+    unsigned  **use, **def, x;
+    int  *defined, nw, k, n, w, changed;
+
+    /* definedは変数を最後に定義したブロックの番号+1 */
+    defined = arena_alloc(a, fn->nvar*sizeof(int), ALLOC_IR);
+    for (k = 1; k < fn->nvar; k++) {
+	fn->var[k].live = -1;
+    }
+    fn->nlive = 0;
+    for (k = 0; k < fn->nblock; k++) {
+	scan_block(fn, fn->block[k], k, defined, NULL, NULL);
+    }
+    fn->live_var = arena_alloc(a, fn->nlive*sizeof(int), ALLOC_IR);
+    for (k = 1; k < fn->nvar; k++) {
+	if (fn->var[k].live >= 0) {
+	    fn->live_var[fn->var[k].live] = k;
+	}
+	defined[k] = 0;
+    }
+
+    nw = IR_SET_WORDS(fn);
+    use = arena_alloc(a, fn->nblock*sizeof(unsigned*), ALLOC_IR);
+    def = arena_alloc(a, fn->nblock*sizeof(unsigned*), ALLOC_IR);
+    for (k = 0; k < fn->nblock; k++) {
+	b = fn->block[k];
+	use[k] = arena_alloc(a, nw*sizeof(unsigned), ALLOC_IR);
+	def[k] = arena_alloc(a, nw*sizeof(unsigned), ALLOC_IR);
+	b->live_in = arena_alloc(a, nw*sizeof(unsigned), ALLOC_IR);
+	b->live_out = arena_alloc(a, nw*sizeof(unsigned), ALLOC_IR);
+	scan_block(fn, b, k, defined, use[k], def[k]);
+	memcpy(b->live_in, use[k], nw*sizeof(unsigned));
+    }
+    do {
+	changed = 0;
+	for (k = fn->nblock-1; k >= 0; k--) {
+	    b = fn->block[k];
+	    for (n = 0; n < 2; n++) {
+		if (b->succ[n] == NULL) {
+		    continue;
+		}
+		for (w = 0; w < nw; w++) {
+		    b->live_out[w] |= b->succ[n]->live_in[w];
+		}
+	    }
+	    for (w = 0; w < nw; w++) {
+		x = use[k][w] | (b->live_out[w] & ~def[k][w]);
+		if (x != b->live_in[w]) {
+		    b->live_in[w] = x;
+		    changed = 1;
+		}
+	    }
+	}
+    } while (changed);
+}
+
+/*
+ * k番目のブロックbの命令を順に見る
+ * useがNULLなら、定義より前に読む変数にliveの番号を付ける
+ * そうでなければ、liveの番号の付いた変数をuse, defの集合に入れる
+ */
+void
+scan_block(IR_Func *fn, IR_Block *b, int k, int *defined, unsigned *use, unsigned *def)
+{
+    IR_Insn *i;
+    int  n;
+
+    for (i = b->first; i != NULL; i = i->next) {
+	if (i->a.kind == IR_VAR) {
+	    scan_use(fn, i->a.val, k, defined, use);
+	}
+	if (i->b.kind == IR_VAR) {
+	    scan_use(fn, i->b.val, k, defined, use);
+	}
+	for (n = 0; n < i->nargs; n++) {
+	    if (i->arg[n].kind == IR_VAR) {
+		scan_use(fn, i->arg[n].val, k, defined, use);
+	    }
+	}
+	defined[i->dst] = k+1;
+	if (def != NULL && fn->var[i->dst].live >= 0) {
+	    IR_SET_ADD(def, fn->var[i->dst].live);
+	}
+    }
+    if (b->term != IR_JUMP && b->a.kind == IR_VAR) {
+	scan_use(fn, b->a.val, k, defined, use);
+    }
+    if (b->term == IR_BRANCH && b->b.kind == IR_VAR) {
+	scan_use(fn, b->b.val, k, defined, use);
+    }
+}
+
+void
+scan_use(IR_Func *fn, int v, int k, int *defined, unsigned *use)
+{
+    if (defined[v] == k+1) {
+	return;
+    }
+    if (use == NULL) {
+	if (fn->var[v].live < 0) {
+	    fn->var[v].live = fn->nlive++;
+	}
+    } else {
+	IR_SET_ADD(use, fn->var[v].live);
+    }
+}
+
+/*
+ * ダンプ（--dump=ir）
+ * テキストでは関数毎に「id(関数id) 関数名」、ブロック毎に「B番号 pred(先行)」の後に
+ * 1行1命令で出力する。一時変数はt番号
+ */
+void
+dump_ir(Compiler *cc, Emit *out, int format)
+{
+    int  i, first = 1;
+
+    if (format == DUMP_FORMAT_JSON) {
+	EMIT_LIT(out, "{\"dump\":\"ir\",\"funcs\":[");
+    } else {
+	EMIT_LIT(out, "IR\n");
+    }
+    for (i = 1; i <= cc->max_id; i++) {
+	if (cc->ir_array[i] == NULL) {
+	    continue;
+	}
+	if (format == DUMP_FORMAT_JSON) {
+	    if (!first) {
+		emit_char(out, ',');
+	    }
+	    dump_ir_json(cc->ir_array[i], out);
+	} else {
+	    dump_ir_text(cc->ir_array[i], out);
+	}
+	first = 0;
+    }
+    if (format == DUMP_FORMAT_JSON) {
+	EMIT_LIT(out, "]}\n");
+    }
+}
+
+void
+dump_ir_text(IR_Func *fn, Emit *out)
+{
+    IR_Block *b;
+    IR_Insn *i;
+    int  k;
+
+    EMIT_LIT(out, "id(");
+    emit_int(out, fn->id);
+    EMIT_LIT(out, ") ");
+    emit_str(out, fn->name);
+    emit_char(out, '\n');
+    for (b = fn->entry; b != NULL; b = b->next) {
+	EMIT_LIT(out, " B");
+	emit_int(out, b->id);
+	if (b->npred > 0) {
+	    EMIT_LIT(out, " pred(");
+	    for (k = 0; k < b->npred; k++) {
+		emit_str(out, (k > 0) ? " B" : "B");
+		emit_int(out, b->pred[k]->id);
+	    }
+	    emit_char(out, ')');
+	}
+	emit_char(out, '\n');
+	for (i = b->first; i != NULL; i = i->next) {
+	    EMIT_LIT(out, "  ");
+	    dump_insn(fn, out, i);
+	    emit_char(out, '\n');
+	}
+	EMIT_LIT(out, "  ");
+	dump_term(fn, out, b);
+	emit_char(out, '\n');
+    }
+}
+
+/* {"id":関数id,"name":関数名,"blocks":[{"id":..,"pred":[..],"code":["命令",..]},..]} */
+void
+dump_ir_json(IR_Func *fn, Emit *out)
+{
+    IR_Block *b;
+    IR_Insn *i;
+    int  k;
+
+    EMIT_LIT(out, "{\"id\":");
+    emit_int(out, fn->id);
+    EMIT_LIT(out, ",\"name\":\"");
+    emit_str(out, fn->name);
+    EMIT_LIT(out, "\",\"blocks\":[");
+    for (b = fn->entry; b != NULL; b = b->next) {
+	EMIT_LIT(out, "{\"id\":");
+	emit_int(out, b->id);
+	EMIT_LIT(out, ",\"pred\":[");
+	for (k = 0; k < b->npred; k++) {
+	    if (k > 0) {
+		emit_char(out, ',');
+	    }
+	    emit_int(out, b->pred[k]->id);
+	}
+	EMIT_LIT(out, "],\"code\":[");
+	for (i = b->first; i != NULL; i = i->next) {
+	    emit_char(out, '"');
+	    dump_insn(fn, out, i);
+	    EMIT_LIT(out, "\",");
+	}
+	emit_char(out, '"');
+	dump_term(fn, out, b);
+	emit_str(out, (b->next != NULL) ? "\"]}," : "\"]}");
+    }
+    EMIT_LIT(out, "]}");
+}
+
+void
+dump_opd(IR_Func *fn, Emit *out, IR_Opd v)
+{
+    if (v.kind == IR_CONST) {
+	emit_int(out, v.val);
+    } else if (v.kind == IR_VAR) {
+	dump_var(fn, out, v.val);
+    }
+}
+
+void
+dump_var(IR_Func *fn, Emit *out, int v)
+{
+    if (fn->var[v].sym != NULL) {
+	emit_str(out, fn->var[v].sym->ident);
+    } else {
+	emit_char(out, 't');
+	emit_int(out, v);
+    }
+}
+
+void
+dump_insn(IR_Func *fn, Emit *out, IR_Insn *i)
+{
+    int  k;
+
+    dump_var(fn, out, i->dst);
+    EMIT_LIT(out, " = ");
+    switch (i->op) {
+    case  IR_MOV:
+	dump_opd(fn, out, i->a);
+	break;
+    case  IR_NEG:
+	emit_char(out, '-');
+	dump_opd(fn, out, i->a);
+	break;
+    case  IR_CALL:
+    case  IR_PHI:
+	emit_str(out, (i->op == IR_CALL) ? i->func : "phi");
+	emit_char(out, '(');
+	for (k = 0; k < i->nargs; k++) {
+	    if (k > 0) {
+		EMIT_LIT(out, ", ");
+	    }
+	    dump_opd(fn, out, i->arg[k]);
+	}
+	emit_char(out, ')');
+	break;
+    default:
+	dump_opd(fn, out, i->a);
+	emit_char(out, ' ');
+	emit_str(out, op_name[i->op]);
+	emit_char(out, ' ');
+	dump_opd(fn, out, i->b);
+    }
+}
+
+void
+dump_term(IR_Func *fn, Emit *out, IR_Block *b)
+{
+    switch (b->term) {
+    case  IR_JUMP:
+	EMIT_LIT(out, "goto B");
+	emit_int(out, b->succ[0]->id);
+	break;
+    case  IR_BRANCH:
+	EMIT_LIT(out, "if ");
+	dump_opd(fn, out, b->a);
+	emit_char(out, ' ');
+	emit_str(out, op_name[b->cond]);
+	emit_char(out, ' ');
+	dump_opd(fn, out, b->b);
+	EMIT_LIT(out, " goto B");
+	emit_int(out, b->succ[0]->id);
+	EMIT_LIT(out, " else B");
+	emit_int(out, b->succ[1]->id);
+	break;
+    case  IR_RET:
+	EMIT_LIT(out, "return");
+	if (b->a.kind != IR_NONE) {
+	    emit_char(out, ' ');
+	    dump_opd(fn, out, b->a);
+	}
+	break;
+    }
+}
@@ -0,0 +1,183 @@
+/*
+    Tiny Language Compiler (tlc)
+
+    3番地コードの中間表現（--backend=ir）
+
+    2016年 木村啓二
+*/
+
+#ifndef  IR_H
+#define  IR_H
+
+#include  "ast.h"
+#include  "emit.h"
+#include  "symtab.h"
+#include  "util.h"
+
+/*
+ * 関数毎に、ASTを基本ブロックに分けた3番地コードに変換する（ir.c）
+ * 基本ブロックは命令の並びと、最後の分岐（終端）を持ち、
+ * 終端の飛び先（後続）と、そこへ分岐してくるブロック（先行）で制御フローグラフを作る
+ * コード生成（irgen.c）はこのグラフの上でレジスタを割り付け、命令を出力する
+ *
+ * 値は変数か定数。変数は仮引数・自動変数と、式の途中の値を置く一時変数で、
+ * 関数の中で1からの番号を付ける
+ * 式の評価の順は-O0の直接のコード生成と同じく、左の被演算子・左の実引数から
+ */
+
+/* 命令の種別 */
+enum {
+    IR_MOV,			/* dst = a */
+    IR_NEG,			/* dst = -a */
+    IR_ADD,			/* dst = a + b */
+    IR_SUB,
+    IR_MUL,
+    IR_DIV,
+    IR_LT,			/* dst = (a < b) ? 1 : 0 */
+    IR_GT,
+    IR_LTE,
+    IR_GTE,
+    IR_EQ,
+    IR_NE,
+    IR_CALL,			/* dst = func(arg[0], ..., arg[nargs-1]) */
+    IR_PHI			/* dst = phi(arg[0], ..., arg[nargs-1])（SSA形式の間だけ）
+				   pred[k]から来た時の値がarg[k]。ブロックの先頭に並べる */
+};
+
+/* 基本ブロックの終端 */
+enum {
+    IR_JUMP,			/* goto succ[0] */
+    IR_BRANCH,			/* if (a cond b) goto succ[0] else goto succ[1] */
+    IR_RET			/* return a（aがなければ値を返さない） */
+};
+
+/* 値の種類 */
+enum {
+    IR_NONE,
+    IR_CONST,
+    IR_VAR
+};
+
+/* 命令のオペランド */
+typedef struct IR_Opd {
+    int  kind;			/* IR_NONE, IR_CONST, IR_VAR */
+    int  val;			/* 定数の値か変数の番号 */
+} IR_Opd;
+
+typedef struct IR_Insn {
+    int  op;			/* IR_MOV .. IR_PHI */
+    int  dst;			/* 結果を入れる変数の番号 */
+    IR_Opd  a, b;
+    char  *func;		/* IR_CALLの呼び出す関数名 */
+    IR_Opd  *arg;		/* IR_CALLの実引数、IR_PHIの先行毎の値 */
+    int  nargs;
+    int  pos;			/* 命令の通し番号（irgen.c） */
+    struct IR_Insn  *prev, *next;
+} IR_Insn;
+
+typedef struct IR_Block {
+    int  id;			/* 番号（ir_build_cfgで配置の順に振り直す） */
+    IR_Insn  *first, *last;	/* 命令の並び */
+    int  term;			/* 終端の種別 IR_JUMP, IR_BRANCH, IR_RET */
+    int  cond;			/* IR_BRANCHの比較の種別（IR_LT .. IR_NE） */
+    IR_Opd  a, b;		/* IR_BRANCHの比較する値、IR_RETの戻り値 */
+    struct IR_Block  *succ[2];	/* 後続（IR_BRANCHは真・偽の順） */
+    struct IR_Block  **pred;	/* 先行 */
+    int  npred, size_pred;
+    struct IR_Block  *next;	/* 配置の順の次のブロック */
+    /* コード生成（irgen.c） */
+    int  label;			/* 分岐の飛び先にするラベルの番号（なければ-1） */
+    int  from, to;		/* 先頭と終端の通し番号 */
+    unsigned  *live_in, *live_out;	/* 入口・出口で生きている変数（ir_liveness） */
+} IR_Block;
+
+typedef struct IR_Var {
+    SymTab  *sym;		/* 仮引数・自動変数のエントリー。一時変数ならNULL */
+    int  live;			/* 生きている変数の集合での番号（ir_liveness）。なければ-1 */
+    /* コード生成（irgen.c） */
+    int  reg;			/* 置くレジスタ。NO_REGならスタックフレーム */
+    int  offset;		/* スタックフレームに置く時の%ebpからの位置 */
+    int  start, end;		/* 生きている範囲（命令の通し番号） */
+} IR_Var;
+
+typedef struct IR_Func {
+    int  id;			/* 関数id */
+    char  *name;
+    Arena  *arena;		/* 関数の領域（cc->arena_array[id]） */
+    IR_Block  *entry;		/* 入口のブロック。配置の順のリストの先頭 */
+    IR_Block  **block;		/* 番号順のブロック（ir_build_cfg） */
+    int  nblock;
+    int  nblock_id;		/* 次に作るブロックの番号 */
+    IR_Var  *var;		/* 番号順の変数（0番は使わない） */
+    int  nvar, size_var;	/* nvarは変数の数+1 */
+    int  *live_var;		/* 集合での番号順の、ブロックをまたいで生きうる変数 */
+    int  nlive;
+    /* コード生成（irgen.c） */
+    int  *temps;		/* 生きている範囲の始まりの順の一時変数 */
+    int  ntemp;
+    int  nlabel;		/* 使うラベルの数 */
+    int  saved_regs;		/* 一時変数に使う呼び出し先保存のレジスタ（1 << 番号の和） */
+} IR_Func;
+
+/* 生きている変数の集合（IR_Varのliveの番号のビット） */
+#define  IR_SET_WORDS(F)  (((F)->nlive+31)/32)
+#define  IR_SET_HAS(S, V)  (((S)[(V)/32] >> ((V)%32)) & 1)
+#define  IR_SET_ADD(S, V)  ((S)[(V)/32] |= 1u << ((V)%32))
+#define  IR_SET_DEL(S, V)  ((S)[(V)/32] &= ~(1u << ((V)%32)))
+
+/* ブロックBの命令をIに入れてPROCを実行する（PROCの中でIを外してもよい） */
+#define TRAVERSE_IR_INSNS(I, B, PROC) \
+    { IR_Insn *n_; for ((I) = (B)->first; (I) != NULL; (I) = n_) { \
+	n_ = (I)->next; \
+	PROC; \
+      }}
+
+struct Compiler;
+struct CodeGen;
+
+/*
+ * ASTからの変換と制御フローグラフ（ir.c）
+ */
+/* 関数fをIRに変換する。IRは関数の領域から確保し、release_symtabで解放される
+   stは式の巡回用のスタック（並列処理中はスレッド毎のもの） */
+extern IR_Func  *ir_lower(struct Compiler *cc, AST_Node *f, AST_Stack *st);
+/* 後続から先行を作り直し、入口から到達しないブロックを除いて番号を振り直す
+   命令のないブロックへの分岐は、その飛び先への分岐にする（IR_PHIがない時だけ使える） */
+extern void  ir_build_cfg(IR_Func *fn);
+/* 配置の順にfn->blockとブロックの番号を振り直す（先行は変えない） */
+extern void  ir_number_blocks(IR_Func *fn);
+/* ブロックbの先行の最後にpを加える */
+extern void  ir_add_pred(IR_Func *fn, IR_Block *b, IR_Block *p);
+/* 空のブロックを作る。配置の順のリストには入れない */
+extern IR_Block  *ir_new_block(IR_Func *fn);
+/* ブロックblkの命令beforeの前（NULLなら末尾）に命令を加える */
+extern IR_Insn  *ir_insert_insn(IR_Func *fn, IR_Block *blk, IR_Insn *before, int op,
+				int dst, IR_Opd a, IR_Opd b);
+extern IR_Opd  ir_opd(int kind, int val);
+/* 一時変数を1つ作り、その番号を返す */
+extern int  ir_new_temp(IR_Func *fn);
+/* 命令iの読む変数をuses[]に入れ、その数を返す（usesはnargs+2個以上） */
+extern int  ir_insn_uses(IR_Insn *i, int *uses);
+/* 命令iをブロックbから外す */
+extern void  ir_remove_insn(IR_Block *b, IR_Insn *i);
+/* 各ブロックの入口・出口で生きている変数を求める（集合とfn->live_varはaから確保する） */
+extern void  ir_liveness(IR_Func *fn, Arena *a);
+/* cc->ir_arrayにある全ての関数のIRのダンプ（--dump=ir） */
+extern void  dump_ir(struct Compiler *cc, Emit *out, int format);
+
+/*
+ * SSA形式での最適化（ssa.c）
+ */
+/* 仮引数・自動変数をSSA形式にして定数・コピーの伝播と不要な命令の削除を行い、
+   SSA形式でないIRに戻す */
+extern void  ir_optimize(IR_Func *fn);
+
+/*
+ * IRからのコード生成（irgen.c）
+ */
+/* IRの一時変数にレジスタかスタックフレームの位置を割り付ける */
+extern void  ir_assign_regs(struct CodeGen *g, IR_Func *fn);
+/* 関数本体のコードを出力する。ラベルはg->local_labelから使う */
+extern void  ir_gen_code(struct CodeGen *g, IR_Func *fn);
+
+#endif	/* IR_H */
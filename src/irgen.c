@@ -0,0 +1,917 @@
+/*
+    Tiny Language Compiler (tlc)
+
+    IRからのコード生成（--backend=ir）
+
+    2016年 木村啓二
+*/
+
+#include  <limits.h>
+#include  <stdio.h>
+#include  <stdlib.h>
+#include  <string.h>
+#include  "cg.h"
+#include  "compiler.h"
+#include  "emit.h"
+#include  "ir.h"
+#include  "regalloc.h"
+#include  "symtab.h"
+#include  "util.h"
+
+/*
+ * レジスタ割り付け（ir_assign_regs）
+ * 仮引数・自動変数はcg.cと同じくスタックフレーム上に置く
+ * -O2ではSSA形式での最適化（ssa.c）で一時変数になり、残るのは入口で読む所だけになる
+ * 一時変数は%eax, %ecx, %edxと、変数の使わない%ebx, %esi, %ediに線形走査で割り付ける
+ * 1. ブロックを配置の順に並べて命令に通し番号を付け、生きている変数を解析する
+ *    ブロック毎に先頭(from)と終端(to)にも番号を付け、入口で生きていればfromから、
+ *    出口で生きていればto+1（次のブロックのfrom）までを生きている範囲とする
+ *    ループがあっても範囲は1つの区間にまとめる
+ * 2. 範囲の始まりの順に、空いているレジスタを割り付ける。範囲が終わる命令で
+ *    始まる一時変数（その命令の結果）は同じレジスタを使ってよい
+ *    関数呼び出しをまたぐ一時変数は呼び出し先保存のレジスタから、
+ *    それ以外は呼び出し元保存のレジスタから先に探す
+ *    使った呼び出し先保存のレジスタは関数の入口で保存する（fn->saved_regs）
+ *    空いていなければ、範囲の終わりが最も遠いものをスタックフレームに置く
+ *    フレーム上の位置は関数のシンボルテーブルにSYM_SPILLとして追加し、
+ *    範囲の重ならない一時変数の間で使い回す
+ *
+ * コード生成（ir_gen_code）
+ * 2番地の命令にするため、結果のレジスタに左の被演算子を移してから演算する
+ * 結果がメモリにあるなどでレジスタが要る時は、その命令の位置で生きている
+ * 一時変数のないレジスタを使い、なければpushl/poplで一時的に空ける
+ * 関数呼び出しの前後では、呼び出しをまたいで生きている一時変数のレジスタだけを
+ * 保存する（cg.cは常に3つとも保存する）
+ * 除算はcg.cでは扱えないが、ここでは%eax, %edxを空けてidivlを使う
+ */
+
+/* 作業用と、関数呼び出しの前後で保存するレジスタ（0:%eax 1:%ecx 2:%edx） */
+#define  NUM_TEMP_REGS  3
+/* 一時変数を置けるレジスタ（3:%ebx 4:%esi 5:%edi まで） */
+#define  NUM_REGS  6
+
+/* 命令のオペランドの場所 */
+enum {
+    LOC_REG,
+    LOC_MEM,			/* %ebpからの位置 */
+    LOC_IMM
+};
+
+typedef struct Loc {
+    int  kind;
+    int  val;
+} Loc;
+
+typedef struct IRGen {
+    CodeGen  *g;
+    IR_Func  *fn;
+    Emit  *out;
+    int  next;			/* fn->tempsの次に範囲が始まる一時変数 */
+    int  owner[NUM_REGS];	/* レジスタに最後に割り付けた、範囲の始まった一時変数 */
+    int  pushed;		/* get_scratchがpushlで空けたレジスタ（なければ-1） */
+} IRGen;
+
+static void number_insns(IR_Func *fn);
+static void live_ranges(IR_Func *fn);
+static void widen(IR_Var *v, int pos);
+static void sort_temps(IR_Func *fn);
+static int  *count_calls(IR_Func *fn);
+static void linear_scan(IR_Func *fn, int avail, int *ncall);
+static void assign_slots(CodeGen *g, IR_Func *fn);
+static void find_labels(IR_Func *fn);
+
+static void advance(IRGen *G, int pos);
+static int  busy(IRGen *G, int r, int pos);
+static int  live_across(IRGen *G, int r, int pos);
+static int  get_scratch(IRGen *G, int pos, int avoid);
+static void put_scratch(IRGen *G);
+static Loc  loc_var(IRGen *G, int v);
+static Loc  loc_opd(IRGen *G, IR_Opd o);
+static Loc  loc_reg(int r);
+static int  same_loc(Loc x, Loc y);
+static int  reg_mask(Loc x);
+static void emit_loc(Emit *out, Loc x);
+static void gen_op(IRGen *G, const char *op, Loc src, Loc dst);
+static void gen_op1(IRGen *G, const char *op, Loc dst);
+static void gen_jump(IRGen *G, const char *op, IR_Block *b);
+static void gen_insn(IRGen *G, IR_Insn *i);
+static void gen_mov(IRGen *G, Loc src, Loc dst, int pos);
+static void gen_neg(IRGen *G, Loc a, Loc d, int pos);
+static void gen_arith(IRGen *G, int op, Loc a, Loc b, Loc d, int pos);
+static void gen_rel(IRGen *G, int op, Loc a, Loc b, Loc d, int pos);
+static void gen_div(IRGen *G, Loc a, Loc b, Loc d, int pos);
+static void gen_call(IRGen *G, IR_Insn *i);
+static void gen_term(IRGen *G, IR_Block *b);
+static int  mirror(int op);
+static int  negate(int op);
+
+/* 比較の種別毎の条件分岐命令とsetcc命令。IR_LT .. IR_NE */
+static const char *jcc_name[] = {
+    [IR_LT] = "jl", [IR_GT] = "jg", [IR_LTE] = "jle", [IR_GTE] = "jge",
+    [IR_EQ] = "je", [IR_NE] = "jne",
+};
+static const char *setcc_name[] = {
+    [IR_LT] = "setl", [IR_GT] = "setg", [IR_LTE] = "setle", [IR_GTE] = "setge",
+    [IR_EQ] = "sete", [IR_NE] = "setne",
+};
+/* 下位8bitの名前があるのは%eax, %ecx, %edx, %ebxだけ */
+static const char *byte_reg_name[] = { "%al", "%cl", "%dl", "%bl" };
+
+void
+ir_assign_regs(CodeGen *g, IR_Func *fn)
+{
+    Arena  a;
+    IR_Block *b;
+    int  *ncall;
+
+    /* 生きている変数の集合は割り付けの間だけ使う */
+    memset(&a, 0, sizeof(Arena));
+    a.pool = fn->arena->pool;
+    a.allocated = fn->arena->allocated;
+    number_insns(fn);
+    ir_liveness(fn, &a);
+    live_ranges(fn);
+    for (b = fn->entry; b != NULL; b = b->next) {
+	b->live_in = b->live_out = NULL;
+    }
+    fn->live_var = NULL;
+    arena_free(&a);
+    sort_temps(fn);
+    ncall = count_calls(fn);
+    linear_scan(fn, ~var_regs_used(g->cc, fn->id) & ((1 << NUM_REGS)-1), ncall);
+    xfree(ncall);
+    assign_slots(g, fn);
+    find_labels(fn);
+}
+
+void
+number_insns(IR_Func *fn)
+{
+    IR_Block *b;
+    IR_Insn *i;
+    int  pos = 0;
+
+    for (b = fn->entry; b != NULL; b = b->next) {
+	b->from = pos++;
+	for (i = b->first; i != NULL; i = i->next) {
+	    i->pos = pos++;
+	}
+	b->to = pos++;
+    }
+}
+
+/* 一時変数の生きている範囲[start, end]を求める。定義されない変数はstart > end */
+void
+live_ranges(IR_Func *fn)
+{
+    IR_Block *b;
+    IR_Insn *i;
+    IR_Var *v;
+    int  *uses, n, k, w, nw, size = 0;
+
+    for (k = 1; k < fn->nvar; k++) {
+	fn->var[k].start = INT_MAX;
+	fn->var[k].end = -1;
+	fn->var[k].reg = NO_REG;
+    }
+    nw = IR_SET_WORDS(fn);
+    uses = NULL;
+    for (b = fn->entry; b != NULL; b = b->next) {
+	for (w = 0; w < nw; w++) {
+	    for (k = 0; k < 32 && (b->live_in[w] | b->live_out[w]) >> k != 0; k++) {
+		if ((b->live_in[w] >> k) & 1) {
+		    widen(&fn->var[fn->live_var[w*32+k]], b->from);
+		}
+		if ((b->live_out[w] >> k) & 1) {
+		    widen(&fn->var[fn->live_var[w*32+k]], b->to+1);
+		}
+	    }
+	}
+	for (i = b->first; i != NULL; i = i->next) {
+	    if (i->nargs+2 > size) {
+		size = i->nargs+2;
+		uses = xrealloc_tag(uses, size*sizeof(int), ALLOC_IR);
+	    }
+	    n = ir_insn_uses(i, uses);
+	    for (k = 0; k < n; k++) {
+		widen(&fn->var[uses[k]], i->pos);
+	    }
+	    widen(&fn->var[i->dst], i->pos);
+	}
+	if (b->term != IR_JUMP && b->a.kind == IR_VAR) {
+	    widen(&fn->var[b->a.val], b->to);
+	}
+	if (b->term == IR_BRANCH && b->b.kind == IR_VAR) {
+	    widen(&fn->var[b->b.val], b->to);
+	}
+    }
+    xfree(uses);
+    for (k = 1; k < fn->nvar; k++) {
+	v = &fn->var[k];
+	if (v->sym != NULL) {
+	    v->start = INT_MAX;
+	    v->end = -1;
+	}
+    }
+}
+
+void
+widen(IR_Var *v, int pos)
+{
+    if (v->start > pos) {
+	v->start = pos;
+    }
+    if (v->end < pos) {
+	v->end = pos;
+    }
+}
+
+/* 定義される一時変数を範囲の始まりの順にfn->tempsに並べる（番号で分布数え上げ） */
+void
+sort_temps(IR_Func *fn)
+{
+    int  *count, k, npos, n = 0;
+
+    npos = (fn->entry != NULL) ? fn->block[fn->nblock-1]->to+2 : 1;
+    count = xcalloc_tag(npos+1, sizeof(int), ALLOC_IR);
+    for (k = 1; k < fn->nvar; k++) {
+	if (fn->var[k].start <= fn->var[k].end) {
+	    count[fn->var[k].start+1]++;
+	    n++;
+	}
+    }
+    for (k = 0; k < npos; k++) {
+	count[k+1] += count[k];
+    }
+    fn->temps = arena_alloc(fn->arena, n*sizeof(int), ALLOC_IR);
+    fn->ntemp = n;
+    for (k = 1; k < fn->nvar; k++) {
+	if (fn->var[k].start <= fn->var[k].end) {
+	    fn->temps[count[fn->var[k].start]++] = k;
+	}
+    }
+    xfree(count);
+}
+
+/* ncall[p]は通し番号p未満の関数呼び出しの数 */
+int*
+count_calls(IR_Func *fn)
+{
+    IR_Block *b;
+    IR_Insn *i;
+    int  *ncall, p, n = 0, npos;
+
+    npos = (fn->entry != NULL) ? fn->block[fn->nblock-1]->to+2 : 1;
+    ncall = xmalloc_tag((npos+1)*sizeof(int), ALLOC_IR);
+    p = 0;
+    for (b = fn->entry; b != NULL; b = b->next) {
+	for (i = b->first; i != NULL; i = i->next) {
+	    while (p <= i->pos) {
+		ncall[p++] = n;
+	    }
+	    n += (i->op == IR_CALL);
+	}
+    }
+    while (p <= npos) {
+	ncall[p++] = n;
+    }
+    return ncall;
+}
+
+/* availは使ってよいレジスタ（1 << 番号の和） */
+void
+linear_scan(IR_Func *fn, int avail, int *ncall)
+{
+    static const int  plain[NUM_REGS] = { 0, 1, 2, 3, 4, 5 };
+    static const int  across[NUM_REGS] = { 3, 4, 5, 0, 1, 2 };
+    int  active[NUM_REGS] = { 0 };
+    const int  *order;
+    IR_Var *v, *w;
+    int  k, n, r, far;
+
+    fn->saved_regs = 0;
+    for (k = 0; k < fn->ntemp; k++) {
+	v = &fn->var[fn->temps[k]];
+	for (r = 0; r < NUM_REGS; r++) {
+	    if (active[r] != 0 && fn->var[active[r]].end <= v->start) {
+		active[r] = 0;
+	    }
+	}
+	order = (ncall[v->end] - ncall[v->start+1] > 0) ? across : plain;
+	for (n = 0; n < NUM_REGS; n++) {
+	    r = order[n];
+	    if (((avail >> r) & 1) && active[r] == 0) {
+		break;
+	    }
+	}
+	if (n == NUM_REGS) {
+	    /* 範囲の終わりが最も遠いものをメモリに置く */
+	    far = -1;
+	    for (r = 0; r < NUM_REGS; r++) {
+		if (((avail >> r) & 1)
+		    && (far < 0 || fn->var[active[r]].end > fn->var[active[far]].end)) {
+		    far = r;
+		}
+	    }
+	    w = &fn->var[active[far]];
+	    if (w->end <= v->end) {
+		continue;
+	    }
+	    w->reg = NO_REG;
+	    r = far;
+	}
+	v->reg = r;
+	active[r] = fn->temps[k];
+	if (r >= NUM_TEMP_REGS) {
+	    fn->saved_regs |= 1 << r;
+	}
+    }
+}
+
+/* メモリに置く一時変数に、範囲の重ならないもの同士で共有する位置を割り付ける */
+void
+assign_slots(CodeGen *g, IR_Func *fn)
+{
+    int  *slot_end = NULL, *slot_offset = NULL, nslot = 0, k, s;
+    IR_Var *v;
+
+    for (k = 0; k < fn->ntemp; k++) {
+	v = &fn->var[fn->temps[k]];
+	if (v->reg != NO_REG) {
+	    continue;
+	}
+	for (s = 0; s < nslot && slot_end[s] > v->start; s++)
+	    ;
+	if (s == nslot) {
+	    nslot++;
+	    slot_end = xrealloc_tag(slot_end, nslot*sizeof(int), ALLOC_IR);
+	    slot_offset = xrealloc_tag(slot_offset, nslot*sizeof(int), ALLOC_IR);
+	    slot_offset[s] = append_spill_slot(g->cc, fn->id);
+	}
+	slot_end[s] = v->end;
+	v->offset = slot_offset[s];
+    }
+    xfree(slot_end);
+    xfree(slot_offset);
+}
+
+/* 次に配置したブロックへ落ちるのでなく、分岐で飛ぶブロックにラベルを付ける */
+void
+find_labels(IR_Func *fn)
+{
+    IR_Block *b;
+    int  k;
+
+    fn->nlabel = 0;
+    for (b = fn->entry; b != NULL; b = b->next) {
+	b->label = -1;
+    }
+    for (b = fn->entry; b != NULL; b = b->next) {
+	for (k = 0; k < 2; k++) {
+	    if (b->term == IR_RET || b->succ[k] == NULL || b->succ[k] == b->next) {
+		continue;
+	    }
+	    if (b->succ[k]->label < 0) {
+		b->succ[k]->label = 0;
+		fn->nlabel++;
+	    }
+	}
+    }
+}
+
+void
+ir_gen_code(CodeGen *g, IR_Func *fn)
+{
+    IRGen  G;
+    IR_Block *b;
+    IR_Insn *i;
+
+    memset(&G, 0, sizeof(IRGen));
+    G.g = g;
+    G.fn = fn;
+    G.out = g->out;
+    G.pushed = -1;
+    /* ラベルの番号は配置の順に振る */
+    for (b = fn->entry; b != NULL; b = b->next) {
+	if (b->label >= 0) {
+	    b->label = g->local_label++;
+	}
+    }
+    for (b = fn->entry; b != NULL; b = b->next) {
+	if (b->label >= 0) {
+	    emit_label(G.out, b->label);
+	    EMIT_LIT(G.out, ":\n");
+	}
+	for (i = b->first; i != NULL; i = i->next) {
+	    advance(&G, i->pos);
+	    gen_insn(&G, i);
+	}
+	advance(&G, b->to);
+	gen_term(&G, b);
+    }
+}
+
+/* 範囲がposまでに始まった一時変数を、そのレジスタの持ち主にする */
+void
+advance(IRGen *G, int pos)
+{
+    IR_Var *v;
+
+    while (G->next < G->fn->ntemp
+	   && (v = &G->fn->var[G->fn->temps[G->next]])->start <= pos) {
+	if (v->reg != NO_REG) {
+	    G->owner[v->reg] = G->fn->temps[G->next];
+	}
+	G->next++;
+    }
+}
+
+/* レジスタrがposの命令で使われているか（読む値、結果、生きている値） */
+int
+busy(IRGen *G, int r, int pos)
+{
+    return G->owner[r] != 0 && G->fn->var[G->owner[r]].end >= pos;
+}
+
+/* レジスタrの値がposの命令をまたいで生きているか */
+int
+live_across(IRGen *G, int r, int pos)
+{
+    IR_Var *v = &G->fn->var[G->owner[r]];
+
+    return G->owner[r] != 0 && v->start < pos && v->end > pos;
+}
+
+/* posの命令で使える作業用のレジスタ。avoidはオペランドのレジスタ（1 << 番号の和） */
+int
+get_scratch(IRGen *G, int pos, int avoid)
+{
+    int  r;
+
+    for (r = 0; r < NUM_TEMP_REGS; r++) {
+	if (!busy(G, r, pos) && !((avoid >> r) & 1)) {
+	    return r;
+	}
+    }
+    /* オペランドは高々2つなので、残りの1つを空ける */
+    for (r = 0; (avoid >> r) & 1; r++)
+	;
+    EMIT_LIT(G->out, "\tpushl\t");
+    emit_reg(G->out, r);
+    emit_char(G->out, '\n');
+    G->pushed = r;
+    return r;
+}
+
+void
+put_scratch(IRGen *G)
+{
+    if (G->pushed >= 0) {
+	EMIT_LIT(G->out, "\tpopl\t");
+	emit_reg(G->out, G->pushed);
+	emit_char(G->out, '\n');
+	G->pushed = -1;
+    }
+}
+
+Loc
+loc_var(IRGen *G, int v)
+{
+    IR_Var *x = &G->fn->var[v];
+    Loc  l;
+
+    if (x->sym != NULL) {
+	l.kind = (x->sym->reg != 0) ? LOC_REG : LOC_MEM;
+	l.val = (x->sym->reg != 0) ? x->sym->reg : x->sym->offset;
+    } else {
+	l.kind = (x->reg != NO_REG) ? LOC_REG : LOC_MEM;
+	l.val = (x->reg != NO_REG) ? x->reg : x->offset;
+    }
+    return l;
+}
+
+Loc
+loc_opd(IRGen *G, IR_Opd o)
+{
+    Loc  l;
+
+    if (o.kind == IR_VAR) {
+	return loc_var(G, o.val);
+    }
+    l.kind = LOC_IMM;
+    l.val = o.val;
+    return l;
+}
+
+Loc
+loc_reg(int r)
+{
+    Loc  l;
+
+    l.kind = LOC_REG;
+    l.val = r;
+    return l;
+}
+
+int
+same_loc(Loc x, Loc y)
+{
+    return x.kind == y.kind && x.val == y.val;
+}
+
+/* 作業用のレジスタにしてはいけないレジスタ */
+int
+reg_mask(Loc x)
+{
+    return (x.kind == LOC_REG) ? 1 << x.val : 0;
+}
+
+void
+emit_loc(Emit *out, Loc x)
+{
+    switch (x.kind) {
+    case  LOC_REG:
+	emit_reg(out, x.val);
+	break;
+    case  LOC_MEM:
+	emit_ebp(out, x.val);
+	break;
+    default:
+	emit_imm(out, x.val);
+    }
+}
+
+/* 2オペランドの命令 op src, dst */
+void
+gen_op(IRGen *G, const char *op, Loc src, Loc dst)
+{
+    emit_char(G->out, '\t');
+    emit_str(G->out, op);
+    emit_char(G->out, '\t');
+    emit_loc(G->out, src);
+    EMIT_LIT(G->out, ", ");
+    emit_loc(G->out, dst);
+    emit_char(G->out, '\n');
+}
+
+void
+gen_op1(IRGen *G, const char *op, Loc dst)
+{
+    emit_char(G->out, '\t');
+    emit_str(G->out, op);
+    emit_char(G->out, '\t');
+    emit_loc(G->out, dst);
+    emit_char(G->out, '\n');
+}
+
+void
+gen_jump(IRGen *G, const char *op, IR_Block *b)
+{
+    emit_char(G->out, '\t');
+    emit_str(G->out, op);
+    emit_char(G->out, '\t');
+    emit_label(G->out, b->label);
+    emit_char(G->out, '\n');
+}
+
+void
+gen_insn(IRGen *G, IR_Insn *i)
+{
+    Loc  a, b, d;
+
+    a = loc_opd(G, i->a);
+    b = loc_opd(G, i->b);
+    d = loc_var(G, i->dst);
+    switch (i->op) {
+    case  IR_MOV:
+	gen_mov(G, a, d, i->pos);
+	break;
+    case  IR_NEG:
+	gen_neg(G, a, d, i->pos);
+	break;
+    case  IR_ADD:
+    case  IR_SUB:
+    case  IR_MUL:
+	gen_arith(G, i->op, a, b, d, i->pos);
+	break;
+    case  IR_DIV:
+	gen_div(G, a, b, d, i->pos);
+	break;
+    case  IR_LT:
+    case  IR_GT:
+    case  IR_LTE:
+    case  IR_GTE:
+    case  IR_EQ:
+    case  IR_NE:
+	gen_rel(G, i->op, a, b, d, i->pos);
+	break;
+    case  IR_CALL:
+	gen_call(G, i);
+	break;
+    default:
+	errexit("Invalid IR instruction", __FILE__, __LINE__);
+    }
+}
+
+void
+gen_mov(IRGen *G, Loc src, Loc dst, int pos)
+{
+    Loc  s;
+
+    if (same_loc(src, dst)) {
+	return;
+    }
+    if (dst.kind == LOC_REG || src.kind != LOC_MEM) {
+	gen_op(G, "movl", src, dst);
+	return;
+    }
+    s = loc_reg(get_scratch(G, pos, 0));
+    gen_op(G, "movl", src, s);
+    gen_op(G, "movl", s, dst);
+    put_scratch(G);
+}
+
+void
+gen_neg(IRGen *G, Loc a, Loc d, int pos)
+{
+    Loc  s;
+
+    if (d.kind == LOC_REG || same_loc(a, d)) {
+	gen_mov(G, a, d, pos);
+	gen_op1(G, "negl", d);
+	return;
+    }
+    s = loc_reg(get_scratch(G, pos, reg_mask(a)));
+    gen_op(G, "movl", a, s);
+    gen_op1(G, "negl", s);
+    gen_op(G, "movl", s, d);
+    put_scratch(G);
+}
+
+/*
+ * 加算・減算・乗算
+ * 結果のレジスタが右の被演算子のものなら、加算・乗算は入れ替え、
+ * 減算は符号を反転して足す
+ * 結果がメモリにあれば、左の被演算子と同じ場所への加算・減算だけは
+ * メモリに直接行い、それ以外は作業用のレジスタで計算する
+ */
+void
+gen_arith(IRGen *G, int op, Loc a, Loc b, Loc d, int pos)
+{
+    static const char *name[] = {
+	[IR_ADD] = "addl", [IR_SUB] = "subl", [IR_MUL] = "imull",
+    };
+    Loc  s, t;
+
+    if (d.kind == LOC_REG) {
+	if (same_loc(b, d) && !same_loc(a, d)) {
+	    if (op == IR_SUB) {
+		gen_op1(G, "negl", d);
+		gen_op(G, "addl", a, d);
+		return;
+	    }
+	    t = a; a = b; b = t;
+	}
+	gen_mov(G, a, d, pos);
+	gen_op(G, name[op], b, d);
+	return;
+    }
+    if (op != IR_MUL && same_loc(a, d) && b.kind != LOC_MEM) {
+	gen_op(G, name[op], b, d);
+	return;
+    }
+    s = loc_reg(get_scratch(G, pos, reg_mask(a) | reg_mask(b)));
+    gen_op(G, "movl", a, s);
+    gen_op(G, name[op], b, s);
+    gen_op(G, "movl", s, d);
+    put_scratch(G);
+}
+
+/*
+ * 比較の値（0か1）
+ * cmplの2つ目のオペランドは定数にできず、2つともメモリにもできないので、
+ * その時は左の被演算子をレジスタに読み込む
+ * setccは下位8bitのあるレジスタにしか書けない
+ */
+void
+gen_rel(IRGen *G, int op, Loc a, Loc b, Loc d, int pos)
+{
+    Loc  t, s;
+    int  load;
+
+    if (a.kind == LOC_IMM) {
+	t = a; a = b; b = t;
+	op = mirror(op);
+    }
+    load = a.kind == LOC_IMM || (a.kind == LOC_MEM && b.kind == LOC_MEM);
+    if (d.kind == LOC_REG && d.val <= 3) {
+	/* 読み込む時のbは定数かメモリなので、dに読み込んでよい */
+	s = d;
+    } else {
+	s = loc_reg(get_scratch(G, pos, reg_mask(a) | reg_mask(b)));
+    }
+    if (load) {
+	gen_op(G, "movl", a, s);
+	a = s;
+    }
+    gen_op(G, "cmpl", b, a);
+    emit_char(G->out, '\t');
+    emit_str(G->out, setcc_name[op]);
+    emit_char(G->out, '\t');
+    emit_str(G->out, byte_reg_name[s.val]);
+    EMIT_LIT(G->out, "\n\tmovzbl\t");
+    emit_str(G->out, byte_reg_name[s.val]);
+    EMIT_LIT(G->out, ", ");
+    emit_reg(G->out, s.val);
+    emit_char(G->out, '\n');
+    if (!same_loc(s, d)) {
+	gen_op(G, "movl", s, d);
+    }
+    put_scratch(G);
+}
+
+/*
+ * 除算
+ * 被除数を%eaxに、その符号拡張を%edxに置いてidivlで割る
+ * 命令をまたいで生きている%eax, %edxの値はスタックに保存しておく
+ * 除数が定数か%eax, %edxにあれば、先にスタックに積んでそれで割る
+ */
+void
+gen_div(IRGen *G, Loc a, Loc b, Loc d, int pos)
+{
+    static const int  saved[] = { 2, 0 };	/* %edx, %eax */
+    Loc  eax = loc_reg(0);
+    int  k, push[2], on_stack;
+
+    for (k = 0; k < 2; k++) {
+	push[k] = live_across(G, saved[k], pos);
+	if (push[k]) {
+	    gen_op1(G, "pushl", loc_reg(saved[k]));
+	}
+    }
+    on_stack = b.kind == LOC_IMM || (b.kind == LOC_REG && (b.val == 0 || b.val == 2));
+    if (on_stack) {
+	gen_op1(G, "pushl", b);
+    }
+    gen_mov(G, a, eax, pos);
+    EMIT_LIT(G->out, "\tcltd\n");
+    if (on_stack) {
+	EMIT_LIT(G->out, "\tidivl\t(%esp)\n"
+		 "\taddl\t$4, %esp\n");
+    } else {
+	gen_op1(G, "idivl", b);
+    }
+    gen_mov(G, eax, d, pos);
+    for (k = 1; k >= 0; k--) {
+	if (push[k]) {
+	    gen_op1(G, "popl", loc_reg(saved[k]));
+	}
+    }
+}
+
+/*
+ * 関数呼び出し
+ * 実引数と保存するレジスタの分だけ%espをずらし（16byteの倍数）、実引数を
+ * 0(%esp)から順に置く。メモリにある実引数は、レジスタにあるものを置いた後で
+ * %eaxを通して置く（%eaxは呼び出しで壊れるので、生きていれば保存してある）
+ */
+void
+gen_call(IRGen *G, IR_Insn *i)
+{
+    Loc  a, eax = loc_reg(0);
+    int  k, r, nsave = 0, size, save[NUM_TEMP_REGS];
+
+    for (r = 0; r < NUM_TEMP_REGS; r++) {
+	if (live_across(G, r, i->pos)) {
+	    save[nsave++] = r;
+	}
+    }
+    size = ((i->nargs+nsave)*4+15)/16*16;
+    if (size > 0) {
+	EMIT_LIT(G->out, "\tsubl\t");
+	emit_imm(G->out, size);
+	EMIT_LIT(G->out, ", %esp\n");
+    }
+    for (k = 0; k < nsave; k++) {
+	EMIT_LIT(G->out, "\tmovl\t");
+	emit_reg(G->out, save[k]);
+	EMIT_LIT(G->out, ", ");
+	emit_esp(G->out, (i->nargs+k)*4);
+	emit_char(G->out, '\n');
+    }
+    for (r = 0; r < 2; r++) {
+	for (k = 0; k < i->nargs; k++) {
+	    a = loc_opd(G, i->arg[k]);
+	    if ((a.kind == LOC_MEM) != r) {
+		continue;
+	    }
+	    if (a.kind == LOC_MEM) {
+		gen_op(G, "movl", a, eax);
+		a = eax;
+	    }
+	    EMIT_LIT(G->out, "\tmovl\t");
+	    emit_loc(G->out, a);
+	    EMIT_LIT(G->out, ", ");
+	    emit_esp(G->out, k*4);
+	    emit_char(G->out, '\n');
+	}
+    }
+    EMIT_LIT(G->out, "\tcall\t");
+    emit_str(G->out, i->func);
+    emit_char(G->out, '\n');
+    /* 戻り値を使わなければ移さない */
+    if (G->fn->var[i->dst].end > i->pos) {
+	gen_mov(G, eax, loc_var(G, i->dst), i->pos);
+    }
+    for (k = 0; k < nsave; k++) {
+	EMIT_LIT(G->out, "\tmovl\t");
+	emit_esp(G->out, (i->nargs+k)*4);
+	EMIT_LIT(G->out, ", ");
+	emit_reg(G->out, save[k]);
+	emit_char(G->out, '\n');
+    }
+    if (size > 0) {
+	EMIT_LIT(G->out, "\taddl\t");
+	emit_imm(G->out, size);
+	EMIT_LIT(G->out, ", %esp\n");
+    }
+}
+
+/*
+ * ブロックの終端
+ * 次に配置したブロックへの分岐は省き、条件分岐は次のブロックが偽の方になるよう
+ * 条件を反転する。戻り値は%eaxに移して関数末尾（_END_関数名）へ分岐する
+ */
+void
+gen_term(IRGen *G, IR_Block *b)
+{
+    Loc  x, y, t;
+    int  cond;
+
+    if (b->term == IR_RET) {
+	if (b->a.kind != IR_NONE) {
+	    gen_mov(G, loc_opd(G, b->a), loc_reg(0), b->to);
+	}
+	if (b->next != NULL) {
+	    EMIT_LIT(G->out, "\tjmp\t_END_");
+	    emit_str(G->out, G->g->func_name);
+	    emit_char(G->out, '\n');
+	}
+	return;
+    }
+    if (b->term == IR_JUMP || b->succ[0] == b->succ[1]) {
+	if (b->succ[0] != b->next) {
+	    gen_jump(G, "jmp", b->succ[0]);
+	}
+	return;
+    }
+    x = loc_opd(G, b->a);
+    y = loc_opd(G, b->b);
+    cond = b->cond;
+    if (x.kind == LOC_IMM) {
+	t = x; x = y; y = t;
+	cond = mirror(cond);
+    }
+    if (x.kind == LOC_IMM || (x.kind == LOC_MEM && y.kind == LOC_MEM)) {
+	t = loc_reg(get_scratch(G, b->to, reg_mask(y)));
+	gen_op(G, "movl", x, t);
+	x = t;
+    }
+    gen_op(G, "cmpl", y, x);
+    put_scratch(G);
+    if (b->succ[1] == b->next) {
+	gen_jump(G, jcc_name[cond], b->succ[0]);
+    } else if (b->succ[0] == b->next) {
+	gen_jump(G, jcc_name[negate(cond)], b->succ[1]);
+    } else {
+	gen_jump(G, jcc_name[cond], b->succ[0]);
+	gen_jump(G, "jmp", b->succ[1]);
+    }
+}
+
+/* 被演算子を入れ替えた比較 */
+int
+mirror(int op)
+{
+    switch (op) {
+    case  IR_LT:	return IR_GT;
+    case  IR_GT:	return IR_LT;
+    case  IR_LTE:	return IR_GTE;
+    case  IR_GTE:	return IR_LTE;
+    }
+    return op;
+}
+
+/* 否定した比較 */
+int
+negate(int op)
+{
+    switch (op) {
+    case  IR_LT:	return IR_GTE;
+    case  IR_GT:	return IR_LTE;
+    case  IR_LTE:	return IR_GT;
+    case  IR_GTE:	return IR_LT;
+    case  IR_EQ:	return IR_NE;
+    }
+    return IR_EQ;
+}
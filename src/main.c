@@ -4,56 +4,365 @@
     2016年 木村啓二
 */
 
-#include  <libgen.h>
+#include  <getopt.h>
 #include  <stdio.h>
 #include  <stdlib.h>
 #include  <string.h>
-#include  "ast.h"
-#include  "cg.h"
-#include  "symtab.h"
+#include  <unistd.h>
+#include  "compiler.h"
+#include  "dump.h"
+#include  "emit.h"
+#include  "server.h"
 
-extern FILE  *yyin;
-extern int   yynerrs;
-extern void  yyparse(void);
+static void usage(const char *prog);
+static int  parse_dump(const char *arg);
+static int  parse_dump_format(const char *arg);
+static int  parse_time_report(const char *arg);
+static int  parse_parser(const char *arg);
+static int  parse_backend(const char *arg);
+static int  parse_optimize(const char *arg);
+static int  parse_alloc_report(const char *arg);
+static void compile_one(void *arg, int i);
+
+/*
+ * 複数ファイルのコンパイル
+ * ファイルは互いに独立なので、parallel_forで複数のスレッドに分担させる
+ * 診断メッセージは各Compilerのerrに溜め、全て終わってからファイルの順に書き出す
+ */
+typedef struct Batch {
+    const Options  *opt;
+    char  **files;
+    int  nfiles;
+    const char  *server;	/* NULLでなければコンパイルを頼むサーバのソケット */
+    int  parallel;		/* 診断メッセージを溜めるか */
+    Emit  *err;			/* ファイル毎の診断メッセージ */
+    int  *status;		/* ファイル毎のcompile_fileの結果 */
+} Batch;
+
+static struct option long_options[] = {
+    {"dump",        required_argument, NULL, 'd'},
+    {"dump-format", required_argument, NULL, 'f'},
+    {"stream",      no_argument,       NULL, 's'},
+    {"jobs",        required_argument, NULL, 'j'},
+    {"cache-dir",   required_argument, NULL, 'c'},
+    {"time-report", optional_argument, NULL, 't'},
+    {"parser",      required_argument, NULL, 'p'},
+    {"backend",     required_argument, NULL, 'B'},
+    {"optimize",    optional_argument, NULL, 'O'},
+    {"server",      required_argument, NULL, 'S'},
+    {"connect",     required_argument, NULL, 'C'},
+    {"alloc-report", optional_argument, NULL, 'A'},
+    {"help",        no_argument,       NULL, 'h'},
+    {NULL, 0, NULL, 0}
+};
+
+void
+usage(const char *prog)
+{
+    fprintf(stderr,
+	    "usage: %s [options] file.c...\n"
+	    "       %s --server=SOCKET [-j N] [--cache-dir=DIR]\n"
+	    "  --dump=symtab,ast,ast-reg,ir\n"
+	    "                             dump the symbol table, the AST (ast:\n"
+	    "                             after parsing, ast-reg: after register\n"
+	    "                             assignment) and/or the IR after register\n"
+	    "                             assignment (with --backend=ir) to stderr\n"
+	    "  --dump-format=text|json    format of the dumps (default: text)\n"
+	    "  --stream                   compile each function as soon as it is\n"
+	    "                             parsed and release it (ignored with --dump)\n"
+	    "  -j N, --jobs=N             compile up to N files at the same time;\n"
+	    "                             with fewer files, parse and compile the\n"
+	    "                             functions of a file in parallel (the\n"
+	    "                             output does not depend on N)\n"
+	    "  --cache-dir=DIR            reuse the assembly of functions whose\n"
+	    "                             tokens are unchanged, keeping it in DIR\n"
+	    "                             (ignored with --dump=ast-reg or ir); with\n"
+	    "                             --server, for the requests of all clients\n"
+	    "                             (not with --connect)\n"
+	    "  --time-report[=text|json]  report the time, arena allocation and\n"
+	    "                             peak RSS of each phase and the numbers of\n"
+	    "                             AST nodes, list cells, symbols, labels and\n"
+	    "                             instructions to stderr\n"
+	    "  --parser=bison|rd          parse with the bison parser or the\n"
+	    "                             hand-written recursive-descent parser;\n"
+	    "                             both build the same AST (default: bison)\n"
+	    "  --backend=ast|ir           with -O1 and -O2, generate code from the\n"
+	    "                             AST or from a three-address IR split into\n"
+	    "                             basic blocks, whose temporaries get\n"
+	    "                             registers by linear scan (default: ast);\n"
+	    "                             with -O2, the IR is also put into SSA\n"
+	    "                             form for sparse conditional constant\n"
+	    "                             and copy propagation and dead code\n"
+	    "                             removal, and variables are kept in\n"
+	    "                             temporaries instead of %%ebx, %%esi, %%edi\n"
+	    "  -O0, -O1, -O2, --optimize[=N]\n"
+	    "                             0: generate code while parsing, without\n"
+	    "                             building the AST (ignored with --dump);\n"
+	    "                             1: allocate registers on the AST (default);\n"
+	    "                             2: also fold and propagate constants and\n"
+	    "                             remove dead branches on the AST first,\n"
+	    "                             and keep the most used variables in\n"
+	    "                             %%ebx, %%esi and %%edi\n"
+	    "  --server=SOCKET            run as a compile server listening on the\n"
+	    "                             Unix domain socket SOCKET, serving up to\n"
+	    "                             N requests at the same time (default:\n"
+	    "                             the number of CPUs)\n"
+	    "  --connect=SOCKET           let the server at SOCKET compile the files\n"
+	    "  --alloc-report[=text|json] count the allocations by kind (AST node,\n"
+	    "                             list cell, symbol, label, identifier, ...)\n"
+	    "                             and size class, with the live and peak\n"
+	    "                             heap bytes, and report them to stderr at\n"
+	    "                             exit (not with --server)\n",
+	    prog, prog);
+    exit(-1);
+}
+
+/* --dumpの引数（カンマ区切り）をDUMP_*の組み合わせにする */
+int
+parse_dump(const char *arg)
+{
+    static const struct {
+	const char *name;
+	int  flag;
+    } names[] = {
+	{"symtab",  DUMP_SYMTAB},
+	{"ast",     DUMP_AST},
+	{"ast-reg", DUMP_AST_REG},
+	{"ir",      DUMP_IR},
+    };
+    size_t  i, len;
+    int  flags = 0;
+    const char *p, *q;
+
+    for (p = arg; *p != '\0'; p = (*q == ',') ? q+1 : q) {
+	q = strchr(p, ',');
+	if (q == NULL) {
+	    q = p+strlen(p);
+	}
+	len = q-p;
+	for (i = 0; i < sizeof(names)/sizeof(names[0]); i++) {
+	    if (strlen(names[i].name) == len && strncmp(names[i].name, p, len) == 0) {
+		break;
+	    }
+	}
+	if (i == sizeof(names)/sizeof(names[0])) {
+	    fprintf(stderr, "Unknown dump \"%.*s\".\n", (int)len, p);
+	    exit(-1);
+	}
+	flags |= names[i].flag;
+    }
+    return flags;
+}
+
+int
+parse_dump_format(const char *arg)
+{
+    if (strcmp(arg, "text") == 0) {
+	return DUMP_FORMAT_TEXT;
+    } else if (strcmp(arg, "json") == 0) {
+	return DUMP_FORMAT_JSON;
+    }
+    fprintf(stderr, "Unknown dump format \"%s\".\n", arg);
+    exit(-1);
+}
+
+int
+parse_time_report(const char *arg)
+{
+    if (arg == NULL || strcmp(arg, "text") == 0) {
+	return TIME_REPORT_TEXT;
+    } else if (strcmp(arg, "json") == 0) {
+	return TIME_REPORT_JSON;
+    }
+    fprintf(stderr, "Unknown report format \"%s\".\n", arg);
+    exit(-1);
+}
+
+int
+parse_parser(const char *arg)
+{
+    if (strcmp(arg, "bison") == 0) {
+	return PARSER_BISON;
+    } else if (strcmp(arg, "rd") == 0) {
+	return PARSER_RD;
+    }
+    fprintf(stderr, "Unknown parser \"%s\".\n", arg);
+    exit(-1);
+}
+
+int
+parse_backend(const char *arg)
+{
+    if (strcmp(arg, "ast") == 0) {
+	return BACKEND_AST;
+    } else if (strcmp(arg, "ir") == 0) {
+	return BACKEND_IR;
+    }
+    fprintf(stderr, "Unknown backend \"%s\".\n", arg);
+    exit(-1);
+}
+
+/* -Oだけなら-O1 */
+int
+parse_optimize(const char *arg)
+{
+    if (arg == NULL || strcmp(arg, "1") == 0) {
+	return 1;
+    } else if (strcmp(arg, "0") == 0) {
+	return 0;
+    } else if (strcmp(arg, "2") == 0) {
+	return 2;
+    }
+    fprintf(stderr, "Unknown optimization level \"%s\".\n", arg);
+    exit(-1);
+}
+
+/* --alloc-reportの引数。JSONなら1を返す */
+int
+parse_alloc_report(const char *arg)
+{
+    if (arg == NULL || strcmp(arg, "text") == 0) {
+	return 0;
+    } else if (strcmp(arg, "json") == 0) {
+	return 1;
+    }
+    fprintf(stderr, "Unknown report format \"%s\".\n", arg);
+    exit(-1);
+}
+
+void
+compile_one(void *arg, int i)
+{
+    Batch *b = arg;
+    Compiler  cc;
+
+    compiler_init(&cc, b->opt, b->parallel ? -1 : 2, NULL);
+    if (b->server != NULL) {
+	b->status[i] = remote_compile_file(&cc, b->server, b->files[i]);
+    } else {
+	b->status[i] = compile_file(&cc, b->files[i]);
+    }
+    if (b->parallel) {
+	/* 診断メッセージだけ引き取り、残りはすぐに解放する */
+	b->err[i] = cc.err;
+	b->err[i].buf = xrealloc_tag(cc.err.buf, cc.err.len+1, ALLOC_OUTPUT);
+	b->err[i].size = cc.err.len+1;
+	memset(&cc.err, 0, sizeof(Emit));
+	cc.err.fd = -1;
+    }
+    compiler_free(&cc);
+}
 
 int
 main(int argc, char **argv)
 {
-    char *in_file, *out_file;
-    int  fnlen;
-    FILE *out;
+    int  c, i, njobs = 0, ret = 0, alloc_json = -1;
+    Options opt = { 0, DUMP_FORMAT_TEXT, 0, 1, NULL, TIME_REPORT_NONE, PARSER_BISON, 1,
+		    BACKEND_AST };
+    Batch b;
+    const char *server = NULL, *connect = NULL;
+    char *endp;
 
-    in_file = argv[1];
-    if ((yyin = fopen(in_file, "r")) == NULL) {
-	fprintf(stderr, "Can't open the input file %s.\n", in_file);
-	exit(-1);
+    while ((c = getopt_long(argc, argv, "hj:O::", long_options, NULL)) != -1) {
+	switch (c) {
+	case 'd':
+	    opt.dump |= parse_dump(optarg);
+	    break;
+	case 'f':
+	    opt.dump_format = parse_dump_format(optarg);
+	    break;
+	case 's':
+	    opt.stream = 1;
+	    break;
+	case 'c':
+	    opt.cache_dir = optarg;
+	    break;
+	case 't':
+	    opt.time_report = parse_time_report(optarg);
+	    break;
+	case 'p':
+	    opt.parser = parse_parser(optarg);
+	    break;
+	case 'B':
+	    opt.backend = parse_backend(optarg);
+	    break;
+	case 'O':
+	    opt.optimize = parse_optimize(optarg);
+	    break;
+	case 'S':
+	    server = optarg;
+	    break;
+	case 'C':
+	    connect = optarg;
+	    break;
+	case 'A':
+	    alloc_json = parse_alloc_report(optarg);
+	    break;
+	case 'j':
+	    njobs = strtol(optarg, &endp, 10);
+	    if (*endp != '\0' || njobs < 1) {
+		usage(argv[0]);
+	    }
+	    break;
+	default:
+	    usage(argv[0]);
+	}
+    }
+    /* getopt_longは確保しないので、ここからなら全ての確保を記録できる */
+    if (alloc_json >= 0) {
+	alloc_profile_begin();
     }
-    if ((out_file = strdup(basename(in_file))) == NULL) {
-	fputs("Not enough memory for strdup.\n", stderr);
-	exit(-1);
+    if (server != NULL) {
+	if (optind < argc || connect != NULL) {
+	    usage(argv[0]);
+	}
+	if (njobs == 0) {
+	    njobs = sysconf(_SC_NPROCESSORS_ONLN);
+	}
+	return server_main(server, (njobs > 0) ? njobs : 1, opt.cache_dir);
     }
-    fnlen = strlen(out_file);
-    if (strcmp(&out_file[fnlen-2], ".c") != 0) {
-	fputs("Illegal suffix.\n", stderr);
-	exit(-1);
+    if (optind >= argc) {
+	usage(argv[0]);
     }
-    out_file[fnlen-1] = 's';
-    if ((out = fopen(out_file, "w")) == NULL) {
-	fprintf(stderr, "Can't open the output file %s.\n", out_file);
-	exit(-1);
+    if (njobs == 0) {
+	njobs = 1;
     }
 
-    yyparse();
-    if (yynerrs > 0) {
-	exit(-1);
+    memset(&b, 0, sizeof(b));
+    b.opt = &opt;
+    b.files = &argv[optind];
+    b.nfiles = argc-optind;
+    /* キャッシュの場所はサーバが決める */
+    if (connect != NULL && opt.cache_dir != NULL) {
+	usage(argv[0]);
     }
-    assign_memory();
-    assign_regs();
+    b.server = connect;
+    /* ファイルより多いスレッドは各ファイルの関数毎の処理に回す */
+    if (njobs > b.nfiles) {
+	opt.jobs = njobs / b.nfiles;
+	njobs = b.nfiles;
+    }
+    b.parallel = (njobs > 1);
+    b.err = xcalloc(b.nfiles, sizeof(Emit));
+    b.status = xcalloc(b.nfiles, sizeof(int));
 
-    dump_symtab();
-    dump_ast();
+    parallel_for(b.nfiles, njobs, compile_one, &b);
 
-    gen_code(out);
+    for (i = 0; i < b.nfiles; i++) {
+	if (b.parallel) {
+	    /* 溜めておいた診断メッセージをファイルの順に書き出す */
+	    b.err[i].fd = 2;
+	    emit_close(&b.err[i]);
+	}
+	if (b.status[i] < 0) {
+	    ret = -1;
+	}
+    }
+    xfree(b.err);
+    xfree(b.status);
+    if (alloc_json >= 0) {
+	alloc_report(2, alloc_json);
+    }
 
-    return 0;
+    return ret;
 }
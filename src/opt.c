@@ -0,0 +1,704 @@
+/*
+    Tiny Language Compiler (tlc)
+
+    ASTの上での最適化（-O2）
+
+    2016年 木村啓二
+*/
+
+#include  <limits.h>
+#include  <stdio.h>
+#include  <stdlib.h>
+#include  <string.h>
+#include  "ast.h"
+#include  "compiler.h"
+#include  "opt.h"
+#include  "symtab.h"
+#include  "util.h"
+
+/*
+ * 定数伝播
+ * 変数（シンボルテーブルのentry番号）毎に、その位置で値が分かっていれば値を持つ
+ * goto・break等がなく制御の流れはASTの構造そのままなので、文を実行順に辿りながら
+ * 値を更新していけばよい
+ * - if文: then部とelse部を同じ値から始め、終わりで両方が同じ値の変数だけ残す
+ * - ループ: 中で代入される変数は、繰り返しの先頭では値が分からないものとする
+ *   ループを抜けるのは条件式の直後だけなので、その時点の値がループの後の値になる
+ * - 関数呼び出し: ポインタも大域変数もないので、呼び出し側の変数は変わらない
+ *
+ * 式の中の評価の順はレジスタ割り付け（rankの大きい子が先）で決まり、畳み込むと
+ * 変わるので、式の中で代入される変数の参照は置き換えない
+ * ただし式全体が代入 x = e なら、eは全てxへの代入より前に評価される
+ * &&や||はないので、式の中の代入は必ず実行される
+ */
+typedef struct OptVal {
+    int  known;			/* 値が分かっている */
+    int  val;
+} OptVal;
+
+typedef struct Opt {
+    AST_Stack  *st;		/* 式の巡回用 */
+    int  nvar;			/* 変数の数+1（entry番号は1から） */
+    OptVal  *env;		/* 現在の位置での各変数の値 */
+    int  dead;			/* 現在の位置には到達しない（returnの後など） */
+    /* 退避した値。nvar+1個で1組とし、最後の1個のknownにdeadを入れる */
+    OptVal  *saved;
+    int  nsaved, size_saved;	/* 組の数 */
+    OptVal  *vals;		/* 式の巡回中の値のスタック */
+    int  nvals, size_vals;
+    /* 処理中の式の中の代入 */
+    AST_Node  **asgn;
+    int  nasgn, size_asgn;
+    int  *mark;			/* 変数毎。stampと等しければ処理中の式で代入される */
+    int  *count;		/* 処理中の式で代入される回数 */
+    int  stamp;
+    SymTab  *safe;		/* 式全体が代入の時の左辺。参照を置き換えてよい */
+} Opt;
+
+static void opt_list(Opt *o, AST_Node *s);
+static void opt_stm(Opt *o, AST_Node **sp);
+static void opt_if(Opt *o, AST_Node **sp);
+static void opt_while(Opt *o, AST_Node **sp);
+static void opt_for(Opt *o, AST_Node **sp);
+static void opt_dowhile(Opt *o, AST_Node **sp);
+static int  opt_exp(Opt *o, AST_Node *e, int *val);
+static int  loop_never_runs(Opt *o, AST_Node *cond);
+static int  eval_exp(Opt *o, AST_Node *e, int fold, int *val);
+static int  eval_n2(int op, int a, int b, int *val);
+static int  simplify_n2(AST_Node *e, OptVal a, OptVal b, int *val);
+static void make_const(AST_Node *e, int val);
+static void replace_exp(AST_Node *e, AST_Node *c);
+static int  no_effect(AST_Node *e);
+static void scan_asgn(Opt *o, AST_Node *e);
+static void kill_stm(Opt *o, AST_Node *s);
+static void push_val(Opt *o, int known, int val);
+static OptVal pop_val(Opt *o);
+static int  save_env(Opt *o);
+static void restore_env(Opt *o, int i);
+static void meet_env(Opt *o, int i);
+
+void
+optimize(Compiler *cc)
+{
+    AST_Node *f;
+
+    TRAVERSE_AST_LIST(f, cc->ast_root, optimize_func(cc, f));
+}
+
+void
+optimize_func(Compiler *cc, AST_Node *f)
+{
+    Opt  o;
+    SymTab *t;
+
+    memset(&o, 0, sizeof(Opt));
+    o.st = &cc->walk;
+    o.nvar = 1;
+    for (t = cc->symtab_array[f->id]; t != NULL; t = t->next) {
+	if (o.nvar <= t->entry) {
+	    o.nvar = t->entry+1;
+	}
+    }
+    /* 関数の入口では、仮引数も自動変数も値は分からない */
+    o.env = xcalloc(o.nvar, sizeof(OptVal));
+    o.mark = xcalloc(o.nvar, sizeof(int));
+    o.count = xcalloc(o.nvar, sizeof(int));
+    opt_list(&o, f->child[1]);
+    xfree(o.env);
+    xfree(o.mark);
+    xfree(o.count);
+    xfree(o.saved);
+    xfree(o.vals);
+    xfree(o.asgn);
+}
+
+/* 削除された文（NULL）を詰める */
+void
+opt_list(Opt *o, AST_Node *s)
+{
+    AST_List *l = s->list;
+    int  i, n;
+
+    if (l == NULL) {
+	return;
+    }
+    for (i = n = 0; i < l->num; i++) {
+	opt_stm(o, &l->elem[i]);
+	if (l->elem[i] != NULL) {
+	    l->elem[n++] = l->elem[i];
+	}
+    }
+    l->num = n;
+}
+
+/* *spの文を最適化する。文を置き換えたり削除（NULL）したりする */
+void
+opt_stm(Opt *o, AST_Node **sp)
+{
+    AST_Node *s = *sp;
+    int  val;
+
+    if (s == NULL) {
+	return;
+    }
+    if (o->dead) {
+	*sp = NULL;
+	return;
+    }
+    switch (s->sub_kind) {
+    case  AST_STM_LIST:
+	opt_list(o, s);
+	break;
+    case  AST_STM_DEC:
+	/* Nothing to do */
+	break;
+    case  AST_STM_ASIGN:
+	opt_exp(o, s->child[0], &val);
+	if (no_effect(s->child[0])) {
+	    *sp = NULL;
+	}
+	break;
+    case  AST_STM_IF:
+	opt_if(o, sp);
+	break;
+    case  AST_STM_WHILE:
+	opt_while(o, sp);
+	break;
+    case  AST_STM_FOR:
+	opt_for(o, sp);
+	break;
+    case  AST_STM_DOWHILE:
+	opt_dowhile(o, sp);
+	break;
+    case  AST_STM_RETURN:
+	opt_exp(o, s->child[0], &val);
+	o->dead = 1;
+	break;
+    default:
+	errexit("Invalid statement kind", __FILE__, __LINE__);
+    }
+}
+
+void
+opt_if(Opt *o, AST_Node **sp)
+{
+    AST_Node *s = *sp;
+    int  val, base, then;
+
+    if (opt_exp(o, s->child[0], &val)) {
+	/* 定数になった条件式には副作用がないので、実行される方だけを残す */
+	*sp = val ? s->child[1] : s->child[2];
+	if (*sp != NULL) {
+	    (*sp)->parent = s->parent;
+	}
+	opt_stm(o, sp);
+	return;
+    }
+    base = save_env(o);
+    opt_stm(o, &s->child[1]);
+    then = save_env(o);
+    restore_env(o, base);
+    opt_stm(o, &s->child[2]);
+    meet_env(o, then);
+    o->nsaved = base;
+}
+
+void
+opt_while(Opt *o, AST_Node **sp)
+{
+    AST_Node *s = *sp;
+    int  val, known, base;
+
+    if (loop_never_runs(o, s->child[0])) {
+	*sp = NULL;
+	return;
+    }
+    kill_stm(o, s);
+    known = opt_exp(o, s->child[0], &val);
+    base = save_env(o);
+    opt_stm(o, &s->child[1]);
+    restore_env(o, base);
+    o->nsaved = base;
+    /* 条件が常に真なら抜けることはない */
+    o->dead = known && val != 0;
+}
+
+void
+opt_for(Opt *o, AST_Node **sp)
+{
+    AST_Node *s = *sp;
+    int  val, known, base;
+
+    opt_exp(o, s->child[0], &val);
+    if (loop_never_runs(o, s->child[1])) {
+	/* 初期化の式文だけにする（子の数は減るので同じノードに収まる） */
+	s->sub_kind = AST_STM_ASIGN;
+	s->num_child = 1;
+	if (no_effect(s->child[0])) {
+	    *sp = NULL;
+	}
+	return;
+    }
+    /* 初期化の式は一度だけ実行されるので、繰り返しの中の代入だけを数える */
+    kill_stm(o, s->child[1]);
+    kill_stm(o, s->child[2]);
+    kill_stm(o, s->child[3]);
+    known = opt_exp(o, s->child[1], &val);
+    base = save_env(o);
+    opt_stm(o, &s->child[3]);
+    if (o->dead) {
+	/* 本体から戻ってこなければ再初期化の式には到達しない。値は控えめに扱う */
+	restore_env(o, base);
+    }
+    opt_exp(o, s->child[2], &val);
+    restore_env(o, base);
+    o->nsaved = base;
+    o->dead = known && val != 0;
+}
+
+void
+opt_dowhile(Opt *o, AST_Node **sp)
+{
+    AST_Node *s = *sp;
+    int  val, known;
+
+    kill_stm(o, s);
+    opt_stm(o, &s->child[0]);
+    if (o->dead) {
+	/* 本体から戻ってこない */
+	return;
+    }
+    known = opt_exp(o, s->child[1], &val);
+    if (known && val == 0) {
+	/* 本体を一度だけ実行する。本体は繰り返す前提で最適化してあるので、そのまま使える */
+	*sp = s->child[0];
+	if (*sp != NULL) {
+	    (*sp)->parent = s->parent;
+	}
+	return;
+    }
+    o->dead = known && val != 0;
+}
+
+/*
+ * 式eを畳み込み、eを実行した後の各変数の値を求める
+ * e全体が定数になれば、その値を*valに入れて1を返す
+ */
+int
+opt_exp(Opt *o, AST_Node *e, int *val)
+{
+    AST_Node *a, *r;
+    SymTab *t;
+    int  i, known;
+
+    if (e == NULL) {
+	return 0;
+    }
+    o->stamp++;
+    o->nasgn = 0;
+    scan_asgn(o, e);
+    for (i = 0; i < o->nasgn; i++) {
+	t = o->asgn[i]->child[0]->symtab;
+	if (o->mark[t->entry] != o->stamp) {
+	    o->mark[t->entry] = o->stamp;
+	    o->count[t->entry] = 0;
+	}
+	o->count[t->entry]++;
+    }
+    o->safe = NULL;
+    if (e->sub_kind == AST_EXP_ASGN && o->count[e->child[0]->symtab->entry] == 1) {
+	o->safe = e->child[0]->symtab;
+    }
+    known = eval_exp(o, e, 1, val);
+    /* 代入は全て実行される。1回だけ定数を代入される変数はその値になる */
+    for (i = 0; i < o->nasgn; i++) {
+	a = o->asgn[i];
+	t = a->child[0]->symtab;
+	r = a->child[1];
+	if (o->count[t->entry] == 1 && r->sub_kind == AST_EXP_CNST_INT) {
+	    o->env[t->entry].known = 1;
+	    o->env[t->entry].val = r->val;
+	} else {
+	    o->env[t->entry].known = 0;
+	}
+    }
+    return known;
+}
+
+/* ループの条件式condが、ループに入る前の値で偽になり副作用もないか */
+int
+loop_never_runs(Opt *o, AST_Node *cond)
+{
+    int  val;
+
+    o->stamp++;
+    o->safe = NULL;
+    return cond != NULL && eval_exp(o, cond, 0, &val) && val == 0;
+}
+
+/*
+ * 式eの値を求める。値が分かれば*valに入れて1を返す
+ * 値が分かるのは、葉が定数か値の分かっている変数だけで、代入も関数呼び出しも
+ * 含まない（副作用のない）式に限る
+ * foldが0でなければ、値の分かった部分式を定数のノードに書き換え、
+ * x+0などの演算を省く。書き換えた部分式はノードの中身か親の子が変わる
+ * 長い式でもCのスタックを使い切らないよう、o->stで再帰せずに巡回する
+ * （stateは0なら子をまだ積んでいない）
+ */
+int
+eval_exp(Opt *o, AST_Node *e, int fold, int *val)
+{
+    AST_Stack *st = o->st;
+    AST_Node *n, *c;
+    OptVal  a, b;
+    SymTab *t;
+    int  i, v, known, base;
+
+    base = st->num;
+    push_AST_Stack(st, e);
+    while (st->num > base) {
+	n = AST_STACK_TOP(st)->n;
+	if (AST_STACK_TOP(st)->state++ == 0) {
+	    /* 値を子の順にo->valsに積むよう、後の子から積む */
+	    if (n->sub_kind == AST_EXP_CALL) {
+		REV_TRAVERSE_AST_LIST(c, n->list, {
+		    if (fold) {
+			c->parent = n;
+		    }
+		    push_AST_Stack(st, c);
+		});
+	    } else if (n->sub_kind == AST_EXP_ASGN) {
+		push_AST_Stack(st, n->child[1]);
+	    } else {
+		for (i = n->num_child-1; i >= 0; i--) {
+		    if (n->child[i] != NULL) {
+			push_AST_Stack(st, n->child[i]);
+		    }
+		}
+	    }
+	    continue;
+	}
+	st->num--;
+	switch (n->sub_kind) {
+	case  AST_EXP_CNST_INT:
+	    push_val(o, 1, n->val);
+	    break;
+	case  AST_EXP_IDENT:
+	    t = n->symtab;
+	    if (t != NULL && (o->mark[t->entry] != o->stamp || t == o->safe)
+		&& o->env[t->entry].known) {
+		v = o->env[t->entry].val;
+		if (fold) {
+		    make_const(n, v);
+		}
+		push_val(o, 1, v);
+	    } else {
+		push_val(o, 0, 0);
+	    }
+	    break;
+	case  AST_EXP_CALL:
+	    for (i = (n->list != NULL) ? n->list->num : 0; i > 0; i--) {
+		pop_val(o);
+	    }
+	    push_val(o, 0, 0);
+	    break;
+	case  AST_EXP_ASGN:
+	    pop_val(o);
+	    push_val(o, 0, 0);
+	    break;
+	case  AST_EXP_UNARY_PLUS:
+	    a = pop_val(o);
+	    if (fold) {
+		replace_exp(n, n->child[0]);
+	    }
+	    push_val(o, a.known, a.val);
+	    break;
+	case  AST_EXP_UNARY_MINUS:
+	    a = pop_val(o);
+	    /* 分からない値は0として積む */
+	    v = a.known ? (int)(0u-(unsigned int)a.val) : 0;
+	    if (a.known && fold) {
+		make_const(n, v);
+	    }
+	    push_val(o, a.known, v);
+	    break;
+	default:
+	    b = pop_val(o);
+	    a = pop_val(o);
+	    v = 0;
+	    known = a.known && b.known && eval_n2(n->sub_kind, a.val, b.val, &v);
+	    if (known) {
+		if (fold) {
+		    make_const(n, v);
+		}
+	    } else if (fold) {
+		known = simplify_n2(n, a, b, &v);
+	    }
+	    push_val(o, known, v);
+	}
+    }
+    a = pop_val(o);
+    *val = a.val;
+    return a.known;
+}
+
+/*
+ * 2項演算 a op b の値。実行時と同じく32bitで桁あふれさせる
+ * 実行時の例外になる除算は畳み込まず、0を返す
+ */
+int
+eval_n2(int op, int a, int b, int *val)
+{
+    unsigned int  ua = a, ub = b;
+
+    switch (op) {
+    case  AST_EXP_MUL:
+	*val = (int)(ua*ub);
+	break;
+    case  AST_EXP_DIV:
+	if (b == 0 || (a == INT_MIN && b == -1)) {
+	    return 0;
+	}
+	*val = a/b;
+	break;
+    case  AST_EXP_ADD:
+	*val = (int)(ua+ub);
+	break;
+    case  AST_EXP_SUB:
+	*val = (int)(ua-ub);
+	break;
+    case  AST_EXP_LT:
+	*val = a < b;
+	break;
+    case  AST_EXP_GT:
+	*val = a > b;
+	break;
+    case  AST_EXP_LTE:
+	*val = a <= b;
+	break;
+    case  AST_EXP_GTE:
+	*val = a >= b;
+	break;
+    case  AST_EXP_EQ:
+	*val = a == b;
+	break;
+    case  AST_EXP_NE:
+	*val = a != b;
+	break;
+    default:
+	return 0;
+    }
+    return 1;
+}
+
+/*
+ * 片方だけ定数の2項演算eを簡単にする（x+0, 0+x, x-0, x*1, 1*x, x/1をxに）
+ * x*0と0*xは、xが変数ならその参照に副作用がないので0にする
+ * 値が分かれば*valに入れて1を返す
+ */
+int
+simplify_n2(AST_Node *e, OptVal a, OptVal b, int *val)
+{
+    AST_Node *c0 = e->child[0], *c1 = e->child[1];
+
+    switch (e->sub_kind) {
+    case  AST_EXP_ADD:
+	if (b.known && b.val == 0) {
+	    replace_exp(e, c0);
+	} else if (a.known && a.val == 0) {
+	    replace_exp(e, c1);
+	}
+	break;
+    case  AST_EXP_SUB:
+	if (b.known && b.val == 0) {
+	    replace_exp(e, c0);
+	}
+	break;
+    case  AST_EXP_MUL:
+	if ((b.known && b.val == 0 && c0->sub_kind == AST_EXP_IDENT)
+	    || (a.known && a.val == 0 && c1->sub_kind == AST_EXP_IDENT)) {
+	    make_const(e, 0);
+	    *val = 0;
+	    return 1;
+	}
+	if (b.known && b.val == 1) {
+	    replace_exp(e, c0);
+	} else if (a.known && a.val == 1) {
+	    replace_exp(e, c1);
+	}
+	break;
+    case  AST_EXP_DIV:
+	if (b.known && b.val == 1) {
+	    replace_exp(e, c0);
+	}
+	break;
+    }
+    return 0;
+}
+
+/* 式eを定数valのノードにする（子の数は減るので同じノードに収まる） */
+void
+make_const(AST_Node *e, int val)
+{
+    e->sub_kind = AST_EXP_CNST_INT;
+    e->num_child = 0;
+    e->val = val;
+    e->str = NULL;
+    e->symtab = NULL;
+    e->list = NULL;
+}
+
+/* 式eを、その部分式cで置き換える */
+void
+replace_exp(AST_Node *e, AST_Node *c)
+{
+    AST_Node *p = e->parent;
+    int  i;
+
+    if (p == NULL) {
+	return;
+    }
+    c->parent = p;
+    if (p->sub_kind == AST_EXP_CALL) {
+	for (i = 0; i < p->list->num; i++) {
+	    if (p->list->elem[i] == e) {
+		p->list->elem[i] = c;
+	    }
+	}
+	return;
+    }
+    for (i = 0; i < p->num_child; i++) {
+	if (p->child[i] == e) {
+	    p->child[i] = c;
+	}
+    }
+}
+
+/* 式文にしても何もしない式か */
+int
+no_effect(AST_Node *e)
+{
+    return e == NULL || e->sub_kind == AST_EXP_CNST_INT || e->sub_kind == AST_EXP_IDENT;
+}
+
+/* 式eの中の代入をo->asgnに加える */
+void
+scan_asgn(Opt *o, AST_Node *e)
+{
+    AST_Stack *st = o->st;
+    AST_Node *n, *c;
+    int  i, base;
+
+    base = st->num;
+    push_AST_Stack(st, e);
+    while (st->num > base) {
+	n = st->frame[--st->num].n;
+	if (n->sub_kind == AST_EXP_CALL) {
+	    TRAVERSE_AST_LIST(c, n->list, push_AST_Stack(st, c));
+	    continue;
+	}
+	if (n->sub_kind == AST_EXP_ASGN) {
+	    if (o->nasgn == o->size_asgn) {
+		o->size_asgn = (o->size_asgn == 0) ? 16 : o->size_asgn*2;
+		o->asgn = xrealloc(o->asgn, o->size_asgn*sizeof(AST_Node*));
+	    }
+	    o->asgn[o->nasgn++] = n;
+	}
+	for (i = 0; i < n->num_child; i++) {
+	    if (n->child[i] != NULL && n->child[i]->kind == AST_KIND_EXP) {
+		push_AST_Stack(st, n->child[i]);
+	    }
+	}
+    }
+}
+
+/* 文sの中で代入される変数の値を分からないことにする */
+void
+kill_stm(Opt *o, AST_Node *s)
+{
+    AST_Node *n;
+    int  i;
+
+    if (s == NULL) {
+	return;
+    }
+    if (s->kind == AST_KIND_EXP) {
+	o->nasgn = 0;
+	scan_asgn(o, s);
+	for (i = 0; i < o->nasgn; i++) {
+	    o->env[o->asgn[i]->child[0]->symtab->entry].known = 0;
+	}
+	return;
+    }
+    if (s->sub_kind == AST_STM_DEC) {
+	return;
+    }
+    TRAVERSE_AST_LIST(n, s->list, kill_stm(o, n));
+    for (i = 0; i < s->num_child; i++) {
+	kill_stm(o, s->child[i]);
+    }
+}
+
+void
+push_val(Opt *o, int known, int val)
+{
+    if (o->nvals == o->size_vals) {
+	o->size_vals = (o->size_vals == 0) ? 64 : o->size_vals*2;
+	o->vals = xrealloc(o->vals, o->size_vals*sizeof(OptVal));
+    }
+    o->vals[o->nvals].known = known;
+    o->vals[o->nvals].val = val;
+    o->nvals++;
+}
+
+OptVal
+pop_val(Opt *o)
+{
+    return o->vals[--o->nvals];
+}
+
+/* 現在の値を退避し、その組の番号を返す。o->nsavedを戻せば捨てられる */
+int
+save_env(Opt *o)
+{
+    OptVal *p;
+
+    if (o->nsaved == o->size_saved) {
+	o->size_saved = (o->size_saved == 0) ? 4 : o->size_saved*2;
+	o->saved = xrealloc(o->saved, o->size_saved*(o->nvar+1)*sizeof(OptVal));
+    }
+    p = &o->saved[o->nsaved*(o->nvar+1)];
+    memcpy(p, o->env, o->nvar*sizeof(OptVal));
+    p[o->nvar].known = o->dead;
+    return o->nsaved++;
+}
+
+void
+restore_env(Opt *o, int i)
+{
+    OptVal *p = &o->saved[i*(o->nvar+1)];
+
+    memcpy(o->env, p, o->nvar*sizeof(OptVal));
+    o->dead = p[o->nvar].known;
+}
+
+/* 退避したi番目の値から来る流れと、現在の位置に来る流れを合流させる */
+void
+meet_env(Opt *o, int i)
+{
+    OptVal *p = &o->saved[i*(o->nvar+1)];
+    int  v;
+
+    if (p[o->nvar].known) {
+	return;
+    }
+    if (o->dead) {
+	restore_env(o, i);
+	return;
+    }
+    for (v = 0; v < o->nvar; v++) {
+	if (!p[v].known || p[v].val != o->env[v].val) {
+	    o->env[v].known = 0;
+	}
+    }
+}
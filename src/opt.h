@@ -0,0 +1,29 @@
+/*
+    Tiny Language Compiler (tlc)
+
+    ASTの上での最適化（-O2）
+
+    2016年 木村啓二
+*/
+
+#ifndef  OPT_H
+#define  OPT_H
+
+#include  "ast.h"
+
+struct Compiler;
+
+/*
+ * 構文解析の後、レジスタ割り付けの前にASTを書き換える
+ * - 定数だけの部分式を畳み込む（0での除算などは実行時に残す）
+ * - 値の分かっている変数の参照を定数に置き換える（定数伝播）
+ * - 条件が定数のif文の実行されない方、一度も実行されないループ、
+ *   returnの後の文、効果のない式文を削除する
+ * 関数のメモリの割り付け（オフセット）には影響しない
+ */
+/* cc->ast_rootの全ての関数を最適化する */
+extern void  optimize(struct Compiler *cc);
+/* 関数f1つ分（逐次コンパイル用） */
+extern void  optimize_func(struct Compiler *cc, AST_Node *f);
+
+#endif	/* OPT_H */
@@ -0,0 +1,440 @@
+/*
+    Tiny Language Compiler (tlc)
+
+    手書きの構文解析部（--parser=rd）
+    tl_gram.yと同じ文法を再帰下降で解析し、式は演算子の優先順位で解析する
+    ASTはtl_gram.yと同じくparse_action.cのact_*関数で作る
+
+    2016年 木村啓二
+*/
+
+#include  <setjmp.h>
+#include  <stdio.h>
+#include  "ast.h"
+#include  "cache.h"
+#include  "compiler.h"
+#include  "parse_action.h"
+#include  "tl_gram.h"
+
+/*
+ * tl_gram.yと同じASTと診断メッセージになるよう、次の2点を合わせる
+ * - act_*関数を呼ぶ順番。式は左の被演算子から、内側から作る
+ *   文の途中のアクション（act_if_cond等。-O0のコード生成に使う）も同じ位置で呼ぶ
+ * - トークンを読む時機。act_*関数は行番号にlex_lineno（最後に読んだトークンの行）を使う
+ *   bisonは次のトークンを見ないと還元できない時だけ先読みするので、
+ *   ここでも次のトークンは必要になるまで読まない
+ */
+
+/* 先読みしていない */
+#define  NO_TOKEN  (-1)
+
+/* 括弧・関数呼び出し・単項演算子・文の入れ子の深さの上限
+   これを超えるとCのスタックを使い切る前にエラーにする */
+#define  MAX_NEST  4096
+
+typedef struct Parser {
+    Compiler  *cc;
+    int  tok;			/* 先読みしたトークン（NO_TOKENなら未読） */
+    YYSTYPE  lval;		/* tokの値 */
+    int  nest;			/* 入れ子の深さ */
+    jmp_buf  error;		/* 構文エラーの時にrd_parseに戻る */
+} Parser;
+
+/* 二項演算子の優先順位。大きいほど強く結合する。全て左結合 */
+enum {
+    PREC_NONE,
+    PREC_EQUALITY,		/* == != */
+    PREC_RELATIONAL,		/* < > <= >= */
+    PREC_ADDITIVE,		/* + - */
+    PREC_MULTIPLICATIVE		/* * / */
+};
+
+static int  peek(Parser *p);
+static void expect(Parser *p, int tok);
+static void syntax_error(Parser *p, const char *mes) __attribute__((noreturn));
+static void enter(Parser *p);
+static int  binary_op(int tok, int *prec);
+static AST_Node *parse_identifier(Parser *p);
+static AST_Node *parse_function(Parser *p);
+static AST_List *parse_parameter_list(Parser *p);
+static AST_Node *parse_compound(Parser *p);
+static AST_Node *parse_declaration(Parser *p);
+static AST_Node *parse_statement(Parser *p);
+static AST_Node *parse_if(Parser *p);
+static AST_Node *parse_expression(Parser *p);
+static AST_Node *parse_binary(Parser *p, AST_Node *left, int min_prec);
+static AST_Node *parse_unary(Parser *p);
+static AST_Node *parse_postfix(Parser *p, AST_Node *id);
+static AST_Node *parse_primary(Parser *p);
+
+/* 次のトークン。まだ読んでいなければ読む
+   tl_gram.yのyylexと同じく、キャッシュを使う時はハッシュ値に加える */
+int
+peek(Parser *p)
+{
+    if (p->tok == NO_TOKEN) {
+	p->tok = lex_token(&p->lval, p->cc);
+	if (p->cc->cache.dir != NULL) {
+	    cache_token(p->cc, p->tok, &p->lval);
+	}
+    }
+    return p->tok;
+}
+
+/* 次のトークンがtokであることを確かめて読み進める */
+void
+expect(Parser *p, int tok)
+{
+    if (peek(p) != tok) {
+	syntax_error(p, "syntax error");
+    }
+    p->tok = NO_TOKEN;
+}
+
+/* bisonと同じくエラーは1つ報告したら解析をやめる */
+void
+syntax_error(Parser *p, const char *mes)
+{
+    yyerror(p->cc, mes);
+    longjmp(p->error, 1);
+}
+
+/* 入れ子を1段深くする。戻る時にp->nest--する */
+void
+enter(Parser *p)
+{
+    if (++p->nest > MAX_NEST) {
+	syntax_error(p, "nesting too deep");
+    }
+}
+
+int
+rd_parse(Compiler *cc)
+{
+    Parser  pp, *p = &pp;
+    AST_List *unit = NULL;
+
+    p->cc = cc;
+    p->tok = NO_TOKEN;
+    p->nest = 0;
+    if (setjmp(p->error) != 0) {
+	return 1;
+    }
+    /* translation_unit: function_definition が1つ以上 */
+    do {
+	unit = act_unit_list(cc, unit, parse_function(p));
+    } while (peek(p) != 0);
+    cc->ast_root = unit;
+    return 0;
+}
+
+AST_Node*
+parse_identifier(Parser *p)
+{
+    if (peek(p) != TOKEN_ID) {
+	syntax_error(p, "syntax error");
+    }
+    p->tok = NO_TOKEN;
+    return act_ID(p->cc, p->lval.y_str);
+}
+
+/* identifier ( parameter_list ) compound_statement */
+AST_Node*
+parse_function(Parser *p)
+{
+    AST_Node *id, *body;
+    AST_List *lp = NULL;
+
+    id = parse_identifier(p);
+    expect(p, TOKEN_LPAREN);
+    if (peek(p) != TOKEN_RPAREN) {
+	lp = parse_parameter_list(p);
+    }
+    expect(p, TOKEN_RPAREN);
+    act_function_begin(p->cc, id);
+    body = parse_compound(p);
+    return act_function_def(p->cc, id, lp, body);
+}
+
+AST_List*
+parse_parameter_list(Parser *p)
+{
+    AST_List *lp = NULL;
+
+    for (;;) {
+	expect(p, TOKEN_INT);
+	lp = act_param_list(p->cc, lp, act_param_dec(p->cc, parse_identifier(p)));
+	if (peek(p) != TOKEN_COMMA) {
+	    return lp;
+	}
+	p->tok = NO_TOKEN;
+    }
+}
+
+/* { block_item ... } */
+AST_Node*
+parse_compound(Parser *p)
+{
+    AST_Node *s;
+    AST_List *l = NULL;
+
+    expect(p, TOKEN_LBRACE);
+    while (peek(p) != TOKEN_RBRACE) {
+	if (peek(p) == TOKEN_INT) {
+	    s = parse_declaration(p);
+	} else {
+	    s = parse_statement(p);
+	}
+	l = (l == NULL) ? act_block_item(p->cc, s) : act_block_item_list(p->cc, l, s);
+    }
+    p->tok = NO_TOKEN;
+    return act_compound_stm(p->cc, l);
+}
+
+/* int identifier, ... ; */
+AST_Node*
+parse_declaration(Parser *p)
+{
+    AST_List *l = NULL;
+
+    expect(p, TOKEN_INT);
+    for (;;) {
+	l = act_ident_list(p->cc, l, parse_identifier(p));
+	if (peek(p) != TOKEN_COMMA) {
+	    break;
+	}
+	p->tok = NO_TOKEN;
+    }
+    expect(p, TOKEN_SEMICOLON);
+    return act_dec_int(p->cc, l);
+}
+
+AST_Node*
+parse_statement(Parser *p)
+{
+    AST_Node *s, *e1, *e2, *e3;
+    Compiler *cc = p->cc;
+
+    enter(p);
+    switch (peek(p)) {
+    case  TOKEN_LBRACE:
+	s = parse_compound(p);
+	break;
+    case  TOKEN_IF:
+	s = parse_if(p);
+	break;
+    case  TOKEN_WHILE:
+	p->tok = NO_TOKEN;
+	act_loop_begin(cc);
+	expect(p, TOKEN_LPAREN);
+	e1 = parse_expression(p);
+	expect(p, TOKEN_RPAREN);
+	act_while_cond(cc, e1);
+	s = act_while_stm(cc, e1, parse_statement(p));
+	break;
+    case  TOKEN_FOR:
+	p->tok = NO_TOKEN;
+	expect(p, TOKEN_LPAREN);
+	e1 = parse_expression(p);
+	expect(p, TOKEN_SEMICOLON);
+	act_for_init(cc, e1);
+	e2 = parse_expression(p);
+	expect(p, TOKEN_SEMICOLON);
+	act_for_cond(cc, e2);
+	e3 = parse_expression(p);
+	expect(p, TOKEN_RPAREN);
+	act_for_step(cc, e3);
+	s = act_for_stm(cc, e1, e2, e3, parse_statement(p));
+	break;
+    case  TOKEN_DO:
+	/* 文法上、最後の;は続く空の式文になる */
+	p->tok = NO_TOKEN;
+	act_loop_begin(cc);
+	s = parse_statement(p);
+	expect(p, TOKEN_WHILE);
+	expect(p, TOKEN_LPAREN);
+	e1 = parse_expression(p);
+	expect(p, TOKEN_RPAREN);
+	s = act_dowhile_stm(cc, s, e1);
+	break;
+    case  TOKEN_RETURN:
+	p->tok = NO_TOKEN;
+	e1 = NULL;
+	if (peek(p) != TOKEN_SEMICOLON) {
+	    e1 = parse_expression(p);
+	}
+	expect(p, TOKEN_SEMICOLON);
+	s = act_return_stm(cc, e1);
+	break;
+    default:
+	/* 式文 */
+	e1 = NULL;
+	if (peek(p) != TOKEN_SEMICOLON) {
+	    e1 = parse_expression(p);
+	}
+	expect(p, TOKEN_SEMICOLON);
+	s = act_exp_stm(cc, e1);
+    }
+    p->nest--;
+    return s;
+}
+
+/* elseは最も内側のifに結び付ける（bisonのshift優先と同じ） */
+AST_Node*
+parse_if(Parser *p)
+{
+    AST_Node *e, *s1, *s2 = NULL;
+
+    expect(p, TOKEN_IF);
+    expect(p, TOKEN_LPAREN);
+    e = parse_expression(p);
+    expect(p, TOKEN_RPAREN);
+    act_if_cond(p->cc, e);
+    s1 = parse_statement(p);
+    /* elseがあるかどうかはbisonも先読みして決める */
+    if (peek(p) == TOKEN_ELSE) {
+	p->tok = NO_TOKEN;
+	act_else(p->cc);
+	s2 = parse_statement(p);
+    }
+    return act_if_stm(p->cc, e, s1, s2);
+}
+
+/*
+ * assignment_expression
+ * 代入の左辺は識別子だけなので、識別子の次が=かどうかで決める
+ * そうでなければその識別子から始まる二項演算の式として続ける
+ */
+AST_Node*
+parse_expression(Parser *p)
+{
+    AST_Node *id;
+
+    if (peek(p) != TOKEN_ID) {
+	return parse_binary(p, NULL, PREC_EQUALITY);
+    }
+    id = parse_identifier(p);
+    if (peek(p) == TOKEN_EQ) {
+	p->tok = NO_TOKEN;
+	return act_expr_n2(p->cc, AST_EXP_ASGN, id,
+			   parse_binary(p, NULL, PREC_EQUALITY));
+    }
+    return parse_binary(p, parse_postfix(p, id), PREC_EQUALITY);
+}
+
+/* 二項演算子ならASTの副種別を返し、*precに優先順位を入れる */
+int
+binary_op(int tok, int *prec)
+{
+    switch (tok) {
+    case  TOKEN_EQEQ:      *prec = PREC_EQUALITY;	    return AST_EXP_EQ;
+    case  TOKEN_NE:        *prec = PREC_EQUALITY;	    return AST_EXP_NE;
+    case  TOKEN_LT:        *prec = PREC_RELATIONAL;	    return AST_EXP_LT;
+    case  TOKEN_GT:        *prec = PREC_RELATIONAL;	    return AST_EXP_GT;
+    case  TOKEN_LTE:       *prec = PREC_RELATIONAL;	    return AST_EXP_LTE;
+    case  TOKEN_GTE:       *prec = PREC_RELATIONAL;	    return AST_EXP_GTE;
+    case  TOKEN_PLUS:      *prec = PREC_ADDITIVE;	    return AST_EXP_ADD;
+    case  TOKEN_MINUS:     *prec = PREC_ADDITIVE;	    return AST_EXP_SUB;
+    case  TOKEN_ASTERISK:  *prec = PREC_MULTIPLICATIVE;  return AST_EXP_MUL;
+    case  TOKEN_SLASH:     *prec = PREC_MULTIPLICATIVE;  return AST_EXP_DIV;
+    default:		   *prec = PREC_NONE;		    return AST_SUB_NONE;
+    }
+}
+
+/*
+ * 優先順位がmin_prec以上の二項演算子の並びを解析する
+ * leftがNULLでなければ、それを解析済みの最初の被演算子とする
+ * 右の被演算子は1段強い優先順位で解析するので左結合になり、
+ * a+b+c+... のような長い式でも再帰は優先順位の段数までしか深くならない
+ */
+AST_Node*
+parse_binary(Parser *p, AST_Node *left, int min_prec)
+{
+    AST_Node *right;
+    int  op, prec;
+
+    if (left == NULL) {
+	left = parse_unary(p);
+    }
+    for (;;) {
+	op = binary_op(peek(p), &prec);
+	if (prec == PREC_NONE || prec < min_prec) {
+	    return left;
+	}
+	p->tok = NO_TOKEN;
+	right = parse_binary(p, NULL, prec+1);
+	left = act_expr_n2(p->cc, op, left, right);
+    }
+}
+
+AST_Node*
+parse_unary(Parser *p)
+{
+    AST_Node *e;
+    int  op;
+
+    switch (peek(p)) {
+    case  TOKEN_PLUS:
+	op = AST_EXP_UNARY_PLUS;
+	break;
+    case  TOKEN_MINUS:
+	op = AST_EXP_UNARY_MINUS;
+	break;
+    case  TOKEN_ID:
+	return parse_postfix(p, parse_identifier(p));
+    default:
+	return parse_primary(p);
+    }
+    p->tok = NO_TOKEN;
+    enter(p);
+    e = act_unary_expr(p->cc, op, parse_unary(p));
+    p->nest--;
+    return e;
+}
+
+/* 識別子idの後に(が続けば関数呼び出し */
+AST_Node*
+parse_postfix(Parser *p, AST_Node *id)
+{
+    AST_List *l = NULL;
+
+    if (peek(p) != TOKEN_LPAREN) {
+	return act_ident_exp(p->cc, id);
+    }
+    p->tok = NO_TOKEN;
+    enter(p);
+    if (peek(p) != TOKEN_RPAREN) {
+	for (;;) {
+	    l = act_argument_list(p->cc, l, parse_expression(p));
+	    if (peek(p) != TOKEN_COMMA) {
+		break;
+	    }
+	    p->tok = NO_TOKEN;
+	}
+    }
+    expect(p, TOKEN_RPAREN);
+    p->nest--;
+    return act_postfix_func(p->cc, id, l);
+}
+
+/* 定数か括弧で囲んだ式（識別子はparse_unaryで扱う） */
+AST_Node*
+parse_primary(Parser *p)
+{
+    AST_Node *e;
+
+    switch (peek(p)) {
+    case  TOKEN_CONST_INT:
+	p->tok = NO_TOKEN;
+	return act_const_int(p->cc, p->lval.y_int);
+    case  TOKEN_LPAREN:
+	p->tok = NO_TOKEN;
+	enter(p);
+	e = parse_expression(p);
+	expect(p, TOKEN_RPAREN);
+	p->nest--;
+	return e;
+    default:
+	syntax_error(p, "syntax error");
+    }
+}
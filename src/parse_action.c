@@ -10,61 +10,93 @@
 #include  <stdlib.h>
 #include  <string.h>
 #include  "ast.h"
+#include  "compiler.h"
+#include  "parse_action.h"
 #include  "symtab.h"
+#include  "util.h"
 
-extern int yylineno;
-extern int yynerrs;
-
-/* 処理中関数のid */
-static int current_func_id;
-
-static void append_arg_sym(AST_Node *p);
-static void check_stm(AST_Node *s);
-static void check_exp(AST_Node *n);
+static void append_arg_sym(Compiler *cc, AST_Node *p);
+static void check_exp(Compiler *cc, AST_Node *n);
 
+/*
+ * -O0ではASTを作らず、各アクションはdirect.cでコードを生成する（cc->dg.on）
+ * その時は作ったASTの代わりに、NULLでない（式や実引数があることを示す）目印を返す
+ * act_ident_exp, act_if_cond等は直接のコード生成のためだけに呼ぶアクションで、
+ * ASTを作る時は何もしない
+ */
+static AST_Node  direct_node;
+static AST_List  direct_list;
+
+/* idは字句解析部でintern済みの文字列 */
 AST_Node*
-act_ID(char *id)
+act_ID(Compiler *cc, char *id)
 {
-    char* str;
     AST_Node *ret;
-    ret = create_AST_Exp(AST_EXP_IDENT);
-    if ((str = strdup(id)) == NULL) {
-	fprintf(stderr, "Not enough memory for strdup.\n");
-	abort();
+    if (cc->dg.on) {
+	direct_ident(cc, id);
+	return &direct_node;
     }
-    ret->str = str;
+    ret = create_AST_Exp(&cc->func_arena, AST_EXP_IDENT);
+    ret->str = id;
     return ret;
 }
 
+/* 変数の参照になる識別子 */
 AST_Node*
-act_const_int(int c)
+act_ident_exp(Compiler *cc, AST_Node *id)
 {
-    AST_Node *ret = create_AST_Exp(AST_EXP_CNST_INT);
+    if (cc->dg.on) {
+	direct_ident_exp(cc);
+    }
+    return id;
+}
+
+AST_Node*
+act_const_int(Compiler *cc, int c)
+{
+    AST_Node *ret;
+    if (cc->dg.on) {
+	direct_const_int(cc, c);
+	return &direct_node;
+    }
+    ret = create_AST_Exp(&cc->func_arena, AST_EXP_CNST_INT);
     ret->val = c;
     return ret;
 }
 
 AST_Node*
-act_postfix_func(AST_Node *e, AST_List *l)
+act_postfix_func(Compiler *cc, AST_Node *e, AST_List *l)
 {
-    AST_Node *ret = create_AST_Exp(AST_EXP_CALL);
+    AST_Node *ret;
+    if (cc->dg.on) {
+	direct_call(cc, l != NULL);
+	return &direct_node;
+    }
+    ret = create_AST_Exp(&cc->func_arena, AST_EXP_CALL);
     ret->child[0] = e;
     ret->list = l;
     return ret;
 }
 
 AST_List*
-act_argument_list(AST_List *lp, AST_Node *e)
+act_argument_list(Compiler *cc, AST_List *lp, AST_Node *e)
 {
-    AST_List *retl;
-    retl = append_AST_List(lp, e);
-    return lp == NULL ? retl : lp;
+    if (cc->dg.on) {
+	direct_argument(cc, lp == NULL);
+	return &direct_list;
+    }
+    return append_AST_List(&cc->func_arena, lp, e);
 }
 
 AST_Node*
-act_unary_expr(int ope, AST_Node *n1)
+act_unary_expr(Compiler *cc, int ope, AST_Node *n1)
 {
-    AST_Node *ret = create_AST_Exp(ope);
+    AST_Node *ret;
+    if (cc->dg.on) {
+	direct_unary(cc, ope);
+	return &direct_node;
+    }
+    ret = create_AST_Exp(&cc->func_arena, ope);
     ret->child[0] = n1;
     if (n1 != NULL) {
 	n1->parent = ret;
@@ -73,9 +105,14 @@ act_unary_expr(int ope, AST_Node *n1)
 }
 
 AST_Node*
-act_expr_n2(int ope, AST_Node *n1, AST_Node *n2)
+act_expr_n2(Compiler *cc, int ope, AST_Node *n1, AST_Node *n2)
 {
-    AST_Node *ret = create_AST_Exp(ope);
+    AST_Node *ret;
+    if (cc->dg.on) {
+	direct_n2(cc, ope);
+	return &direct_node;
+    }
+    ret = create_AST_Exp(&cc->func_arena, ope);
     ret->child[0] = n1;
     ret->child[1] = n2;
 
@@ -89,74 +126,81 @@ act_expr_n2(int ope, AST_Node *n1, AST_Node *n2)
 }
 
 AST_Node*
-act_dec_int(AST_Node *d)
+act_dec_int(Compiler *cc, AST_List *d)
 {
     AST_Node *n;
-    AST_Node *ret = create_AST_Stm(AST_STM_DEC, yylineno);
-    for (n = d; n != NULL; n = n->child[0]) {
-	if (append_sym(TYPE_INT, SYM_AUTOVAR, n->str) == 0) {
-	    fprintf(stderr, "Duplicate variable declaration: %s\n", n->str);
-	    yynerrs++;
-	}
-    }
-    ret->child[0] = d;
-    if (d != NULL) {
-	d->parent = ret;
+    AST_Node *ret;
+    if (cc->dg.on) {
+	direct_dec_int(cc);
+	return &direct_node;
     }
+    ret = create_AST_Stm(&cc->func_arena, AST_STM_DEC, lex_lineno(cc));
+    TRAVERSE_AST_LIST(n, d, {
+	if (append_sym(cc, TYPE_INT, SYM_AUTOVAR, n->str) == 0) {
+	    diag(cc, "Duplicate variable declaration: %s\n", n->str);
+	    cc->nerrs++;
+	}
+	n->parent = ret;
+    });
+    ret->list = d;
     return ret;
 }
 
-AST_Node*
-act_ident_list(AST_Node *dec1, AST_Node *dec2)
-{
-    if (dec1 == NULL) {
-	return dec2;
-    } else {
-	AST_Node *d;
-	for (d = dec1; d->child[0] != NULL; d = d->child[0])
-	    ;
-	d->child[0] = dec2;
-	if (dec2 != NULL) {
-	    dec2->parent = d;
-	}
-	return dec1;
+AST_List*
+act_ident_list(Compiler *cc, AST_List *dec1, AST_Node *dec2)
+{
+    if (cc->dg.on) {
+	direct_ident_list(cc, dec1 == NULL);
+	return &direct_list;
     }
+    return append_AST_List(&cc->func_arena, dec1, dec2);
 }
 
 AST_List*
-act_param_list(AST_List *lp, AST_Node *e)
+act_param_list(Compiler *cc, AST_List *lp, AST_Node *e)
 {
-    AST_List *retl;
-    retl = append_AST_List(lp, e);
-    return lp == NULL ? retl : lp;
+    if (cc->dg.on) {
+	return &direct_list;
+    }
+    return append_AST_List(&cc->func_arena, lp, e);
 }
 
 AST_Node*
-act_param_dec(AST_Node *e)
+act_param_dec(Compiler *cc, AST_Node *e)
 {
     AST_Node *ret;
     
-    ret = create_AST_Exp(AST_EXP_PARAM);
+    if (cc->dg.on) {
+	direct_param_dec(cc);
+	return &direct_node;
+    }
+    ret = create_AST_Exp(&cc->func_arena, AST_EXP_PARAM);
     /* Each parameter is registered when the current function is registered. */
     ret->child[0] = e;
     return ret;
 }
 
 AST_Node*
-act_compound_stm(AST_List *stm_list)
+act_compound_stm(Compiler *cc, AST_List *stm_list)
 {
-    AST_Node *ret = create_AST_Stm(AST_STM_LIST, yylineno);
-    ret->list = stm_list;
-    if (stm_list != NULL) {
-	stm_list->parent = ret;
+    AST_Node *ret;
+    if (cc->dg.on) {
+	return &direct_node;
     }
+    ret = create_AST_Stm(&cc->func_arena, AST_STM_LIST, lex_lineno(cc));
+    ret->list = stm_list;
     return ret;
 }
 
 AST_Node*
-act_exp_stm(AST_Node *e)
+act_exp_stm(Compiler *cc, AST_Node *e)
 {
-    AST_Node *ret = create_AST_Stm(AST_STM_ASIGN, yylineno);
+    AST_Node *ret;
+    if (cc->dg.on) {
+	direct_exp_stm(cc, e != NULL);
+	return &direct_node;
+    }
+    ret = create_AST_Stm(&cc->func_arena, AST_STM_ASIGN, lex_lineno(cc));
     ret->child[0] = e;
     if (e != NULL) {
 	e->parent = ret;
@@ -164,10 +208,34 @@ act_exp_stm(AST_Node *e)
     return ret;
 }
 
+/* 条件式の後 */
+void
+act_if_cond(Compiler *cc, AST_Node *e)
+{
+    (void)e;
+    if (cc->dg.on) {
+	direct_if_cond(cc);
+    }
+}
+
+/* elseの後 */
+void
+act_else(Compiler *cc)
+{
+    if (cc->dg.on) {
+	direct_else(cc);
+    }
+}
+
 AST_Node*
-act_if_stm(AST_Node *e, AST_Node *s1, AST_Node *s2)
+act_if_stm(Compiler *cc, AST_Node *e, AST_Node *s1, AST_Node *s2)
 {
-    AST_Node *ret = create_AST_Stm(AST_STM_IF, yylineno);
+    AST_Node *ret;
+    if (cc->dg.on) {
+	direct_if_stm(cc);
+	return &direct_node;
+    }
+    ret = create_AST_Stm(&cc->func_arena, AST_STM_IF, lex_lineno(cc));
     ret->child[0] = e;
     ret->child[1] = s1;
     ret->child[2] = s2;
@@ -183,10 +251,34 @@ act_if_stm(AST_Node *e, AST_Node *s1, AST_Node *s2)
     return ret;
 }
 
+/* whileとdoの後（繰り返しの先頭） */
+void
+act_loop_begin(Compiler *cc)
+{
+    if (cc->dg.on) {
+	direct_loop_begin(cc);
+    }
+}
+
+/* whileの条件式の後 */
+void
+act_while_cond(Compiler *cc, AST_Node *e)
+{
+    (void)e;
+    if (cc->dg.on) {
+	direct_while_cond(cc);
+    }
+}
+
 AST_Node*
-act_while_stm(AST_Node *e, AST_Node *s)
+act_while_stm(Compiler *cc, AST_Node *e, AST_Node *s)
 {
-    AST_Node *ret = create_AST_Stm(AST_STM_WHILE, yylineno);
+    AST_Node *ret;
+    if (cc->dg.on) {
+	direct_while_stm(cc);
+	return &direct_node;
+    }
+    ret = create_AST_Stm(&cc->func_arena, AST_STM_WHILE, lex_lineno(cc));
     ret->child[0] = e;
     ret->child[1] = s;
     if (e != NULL) {
@@ -198,10 +290,43 @@ act_while_stm(AST_Node *e, AST_Node *s)
     return ret;
 }
 
+/* forの3つの式のそれぞれの後 */
+void
+act_for_init(Compiler *cc, AST_Node *e1)
+{
+    (void)e1;
+    if (cc->dg.on) {
+	direct_for_init(cc);
+    }
+}
+
+void
+act_for_cond(Compiler *cc, AST_Node *e2)
+{
+    (void)e2;
+    if (cc->dg.on) {
+	direct_for_cond(cc);
+    }
+}
+
+void
+act_for_step(Compiler *cc, AST_Node *e3)
+{
+    (void)e3;
+    if (cc->dg.on) {
+	direct_for_step(cc);
+    }
+}
+
 AST_Node*
-act_for_stm(AST_Node *e1, AST_Node *e2, AST_Node *e3, AST_Node *s)
+act_for_stm(Compiler *cc, AST_Node *e1, AST_Node *e2, AST_Node *e3, AST_Node *s)
 {
-    AST_Node *ret = create_AST_Stm(AST_STM_FOR, yylineno);
+    AST_Node *ret;
+    if (cc->dg.on) {
+	direct_for_stm(cc);
+	return &direct_node;
+    }
+    ret = create_AST_Stm(&cc->func_arena, AST_STM_FOR, lex_lineno(cc));
     ret->child[0] = e1;
     ret->child[1] = e2;
     ret->child[2] = e3;
@@ -222,9 +347,14 @@ act_for_stm(AST_Node *e1, AST_Node *e2, AST_Node *e3, AST_Node *s)
 }
 
 AST_Node*
-act_dowhile_stm(AST_Node *s, AST_Node *e)
+act_dowhile_stm(Compiler *cc, AST_Node *s, AST_Node *e)
 {
-	AST_Node *ret = create_AST_Stm(AST_STM_DOWHILE, yylineno);
+	AST_Node *ret;
+    if (cc->dg.on) {
+	direct_dowhile_stm(cc);
+	return &direct_node;
+    }
+    ret = create_AST_Stm(&cc->func_arena, AST_STM_DOWHILE, lex_lineno(cc));
     ret->child[0] = s;
     ret->child[1] = e;
     if (s != NULL) {
@@ -241,9 +371,14 @@ act_dowhile_stm(AST_Node *s, AST_Node *e)
 */
 
 AST_Node*
-act_return_stm(AST_Node *e)
+act_return_stm(Compiler *cc, AST_Node *e)
 {
-    AST_Node *ret = create_AST_Stm(AST_STM_RETURN, yylineno);
+    AST_Node *ret;
+    if (cc->dg.on) {
+	direct_return_stm(cc, e != NULL);
+	return &direct_node;
+    }
+    ret = create_AST_Stm(&cc->func_arena, AST_STM_RETURN, lex_lineno(cc));
     ret->child[0] = e;
     if (e != NULL) {
 	e->parent = ret;
@@ -252,59 +387,86 @@ act_return_stm(AST_Node *e)
 }
 
 AST_List*
-act_unit_list(AST_List *lu, AST_Node *f)
+act_unit_list(Compiler *cc, AST_List *lu, AST_Node *f)
 {
-    AST_List *retl;
-    retl = append_AST_List(lu, f);
-    return lu == NULL ? retl : lu;
+    /* 逐次コンパイルで処理済みの関数は並べない */
+    if (f == NULL) {
+	return lu;
+    }
+    /* 関数の領域は関数毎に解放されるので、関数の並びは翻訳単位の領域に置く */
+    return append_AST_List(&cc->unit_arena, lu, f);
 }
 
 void
-append_arg_sym(AST_Node *p)
+append_arg_sym(Compiler *cc, AST_Node *p)
 {
     /* Only TYPE_INT is assumed. */
-    if (append_sym(TYPE_INT, SYM_ARG, p->child[0]->str) == 0) {
-	fprintf(stderr,
+    if (append_sym(cc, TYPE_INT, SYM_ARG, p->child[0]->str) == 0) {
+	diag(cc,
 		"Duplicate argument declaration: %s\n",	p->child[0]->str);
-	yynerrs++;
+	cc->nerrs++;
     }
 }
 
-static
-void check_stm(AST_Node *s)
+/*
+ * 名前の解決
+ * 関数本体の文と式を、識別子・並び（文や実引数）・子の順に行きがけ順で巡回する
+ * 長い式でもCのスタックを使い切らないよう、cc->walkを使って再帰せずに巡回する
+ */
+void
+check_exp(Compiler *cc, AST_Node *n)
 {
-    if (s->sub_kind != AST_STM_DEC) {
-	check_exp(s);
+    AST_Stack *st = &cc->walk;
+    AST_Node *e;
+    int  i, base;
+
+    base = st->num;
+    push_AST_Stack(st, n);
+    while (st->num > base) {
+	n = st->frame[--st->num].n;
+	if (n->sub_kind == AST_EXP_IDENT) {
+	    if ((n->symtab = lookup_sym(cc, 0, SYM_VAR, n->str)) == NULL) {
+		diag(cc, "Undeclared variable: %s\n", n->str);
+		cc->nerrs++;
+	    }
+	}
+	/* 後に処理するものから積む */
+	if (n->sub_kind != AST_EXP_CALL) {
+	    for (i = n->num_child-1; i >= 0; i--) {
+		if (n->child[i] != NULL) {
+		    push_AST_Stack(st, n->child[i]);
+		}
+	    }
+	}
+	/* 宣言には解決する名前がない */
+	REV_TRAVERSE_AST_LIST(e, n->list,
+			      if (e->sub_kind != AST_STM_DEC) push_AST_Stack(st, e));
     }
 }
 
-static void
-check_exp(AST_Node *n)
+/* 仮引数の並びの後（関数本体の前） */
+void
+act_function_begin(Compiler *cc, AST_Node *id)
 {
-    int i;
-    AST_List *l;
-
-    if (n->sub_kind == AST_EXP_IDENT) {
-	if ((n->symtab = lookup_sym(0, SYM_VAR, n->str)) == NULL) {
-	    fprintf(stderr, "Undeclared variable: %s\n", n->str);
-	    yynerrs++;
-	}
-    }
-    TRAVERSE_AST_LIST(l, n->list, check_stm(l->elem));
-    if (n->sub_kind != AST_EXP_CALL) {
-	for (i = 0; i < AST_NUM_CHILDLEN; i++) {
-	    if (n->child[i] != NULL) {
-		check_exp(n->child[i]);
-	    }
-	}
+    (void)id;
+    if (cc->dg.on) {
+	direct_function_begin(cc);
     }
 }
 
 AST_Node*
-act_function_def(AST_Node *id, AST_List *lp, AST_Node *b)
+act_function_def(Compiler *cc, AST_Node *id, AST_List *lp, AST_Node *b)
 {
-    AST_List *l;
-    AST_Node *ret = create_AST_Node(AST_KIND_FUNC, AST_SUB_NONE);
+    AST_Node *p;
+    AST_Node *ret;
+    int  phase;
+
+    if (cc->dg.on) {
+	/* コードは出力済みなので、翻訳単位の並びには加えない */
+	direct_function_def(cc);
+	return NULL;
+    }
+    ret = create_AST_Node(&cc->func_arena, AST_KIND_FUNC, AST_SUB_NONE);
 
     ret->child[0] = id;
     ret->list = lp;
@@ -313,25 +475,41 @@ act_function_def(AST_Node *id, AST_List *lp, AST_Node *b)
 	b->parent = ret;
     }
     /* Only TYPE_INT is assumed. */
-    append_sym(TYPE_INT, SYM_FUNC, id->str);
-    TRAVERSE_AST_LIST(l, lp, append_arg_sym(l->elem));
-    check_exp(b);
-
-    commit_current_symtab(++current_func_id);
-    ret->id = current_func_id;
+    append_sym(cc, TYPE_INT, SYM_FUNC, id->str);
+    TRAVERSE_AST_LIST(p, lp, append_arg_sym(cc, p));
+    phase = stats_phase(cc, PHASE_RESOLVE);
+    check_exp(cc, b);
+    if (cc->opt->time_report != TIME_REPORT_NONE) {
+	/* 数えるための巡回は計測の対象に含めない */
+	stats_phase(cc, PHASE_OTHER);
+	count_AST(ret, &cc->stats.ast_nodes, &cc->stats.list_cells);
+    }
+    stats_phase(cc, phase);
+
+    commit_current_symtab(cc, ++cc->current_func_id);
+    ret->id = cc->current_func_id;
+    if (cc->function_done != NULL) {
+	/* ここで処理し解放されるので、翻訳単位の並びには加えない */
+	cc->function_done(cc, ret);
+	return NULL;
+    }
     return ret;
 }
 
 AST_List*
-act_block_item(AST_Node *s)
+act_block_item(Compiler *cc, AST_Node *s)
 {
-    return  append_AST_List(NULL, s);
+    if (cc->dg.on) {
+	return &direct_list;
+    }
+    return  append_AST_List(&cc->func_arena, NULL, s);
 }
 
 AST_List*
-act_block_item_list(AST_List *l, AST_Node *item)
+act_block_item_list(Compiler *cc, AST_List *l, AST_Node *item)
 {
-    AST_List *nl;
-    nl = append_AST_List(l, item);
-    return l == NULL ? nl : l;
+    if (cc->dg.on) {
+	return &direct_list;
+    }
+    return append_AST_List(&cc->func_arena, l, item);
 }
@@ -0,0 +1,299 @@
+/*
+    Tiny Language Compiler (tlc)
+
+    変数のレジスタ割り付け（-O2）
+
+    2016年 木村啓二
+*/
+
+#include  <stdio.h>
+#include  <stdlib.h>
+#include  <string.h>
+#include  "ast.h"
+#include  "compiler.h"
+#include  "regalloc.h"
+#include  "symtab.h"
+#include  "util.h"
+
+/*
+ * 線形走査によるレジスタ割り付け
+ * 関数の文を実行順（forは初期化・条件・本体・更新の順）に辿って位置の番号を振り、
+ * 各変数の生存区間を最初に現れた位置から最後に現れた位置までとする
+ * - 式は1つの位置にまとめる。ただし式全体が代入 x = e なら、xへの代入はeを
+ *   全て評価した後なので次の位置とする（eで最後に使う変数とレジスタを共有できる）
+ * - ループの中に現れた変数は、次の繰り返しで使うかもしれないので、
+ *   区間を一番外側のループ全体まで広げる
+ * - 仮引数は関数の入口（位置0）から生きている
+ * gotoやbreakはなく、ifのthen部とelse部は位置の上で重ならないので、
+ * 区間が重ならない変数は同時に生きていることはなく、同じレジスタに置ける
+ *
+ * 区間を始まりの順に見て、空いているレジスタがあれば割り付ける
+ * 空いていなければ、割り付け済みで区間が続いているもの（active）と自分のうち
+ * 重み（ループの深さ毎に10倍した出現回数）が最も小さいものをメモリに置く
+ * 本来の線形走査は区間の終わりが最も遠いものを選ぶが、ループの中で
+ * よく使う変数（ループの制御変数や累積値）を優先するため重みで選ぶ
+ */
+typedef struct VarRange {
+    SymTab  *sym;
+    int  start, end;		/* 生存区間（endがstartより小さければ使われていない） */
+    long  weight;
+    int  loop;			/* 最後に現れた一番外側のループの番号 */
+} VarRange;
+
+typedef struct RegAlloc {
+    AST_Stack  *st;		/* 式の巡回用 */
+    VarRange  *var;		/* entry番号毎 */
+    int  nvar;			/* 変数の数+1（entry番号は1から） */
+    int  pos;			/* 現在の位置 */
+    int  depth;			/* ループの深さ */
+    int  loop;			/* 一番外側のループの番号 */
+    int  loop_start;		/* 一番外側のループの始まりの位置 */
+    int  *in_loop;		/* 一番外側のループの中に現れた変数のentry番号 */
+    int  num_in_loop;
+} RegAlloc;
+
+#define  MAX_WEIGHT_DEPTH  4
+
+static void ra_stm(RegAlloc *r, AST_Node *s);
+static void ra_exp(RegAlloc *r, AST_Node *e);
+static void ra_use(RegAlloc *r, SymTab *t, int pos);
+static void begin_loop(RegAlloc *r);
+static void end_loop(RegAlloc *r);
+static void linear_scan(RegAlloc *r);
+static int  compare_start(const void *a, const void *b);
+
+void
+alloc_var_regs(Compiler *cc, AST_Node *f, AST_Stack *st)
+{
+    RegAlloc  r;
+    SymTab *t;
+
+    memset(&r, 0, sizeof(RegAlloc));
+    r.st = st;
+    r.nvar = 1;
+    for (t = cc->symtab_array[f->id]; t != NULL; t = t->next) {
+	if (r.nvar <= t->entry) {
+	    r.nvar = t->entry+1;
+	}
+    }
+    r.var = xcalloc(r.nvar, sizeof(VarRange));
+    r.in_loop = xmalloc(r.nvar*sizeof(int));
+    for (t = cc->symtab_array[f->id]; t != NULL; t = t->next) {
+	t->reg = 0;
+	r.var[t->entry].sym = t;
+	r.var[t->entry].start = (t->kind == SYM_ARG) ? 0 : -1;
+	r.var[t->entry].end = -1;
+    }
+    ra_stm(&r, f->child[1]);
+    linear_scan(&r);
+    xfree(r.var);
+    xfree(r.in_loop);
+}
+
+int
+var_regs_used(Compiler *cc, int id)
+{
+    SymTab *t;
+    int  regs = 0;
+
+    for (t = cc->symtab_array[id]; t != NULL; t = t->next) {
+	if (t->reg != 0) {
+	    regs |= 1 << t->reg;
+	}
+    }
+    return regs;
+}
+
+/* 位置はcg.cのコード生成の順に振る */
+void
+ra_stm(RegAlloc *r, AST_Node *s)
+{
+    AST_Node *n;
+
+    if (s == NULL) {
+	return;
+    }
+    switch (s->sub_kind) {
+    case  AST_STM_LIST:
+	TRAVERSE_AST_LIST(n, s->list, ra_stm(r, n));
+	break;
+    case  AST_STM_DEC:
+	break;
+    case  AST_STM_ASIGN:
+    case  AST_STM_RETURN:
+	ra_exp(r, s->child[0]);
+	break;
+    case  AST_STM_IF:
+	ra_exp(r, s->child[0]);
+	ra_stm(r, s->child[1]);
+	ra_stm(r, s->child[2]);
+	break;
+    case  AST_STM_WHILE:
+	begin_loop(r);
+	ra_exp(r, s->child[0]);
+	ra_stm(r, s->child[1]);
+	end_loop(r);
+	break;
+    case  AST_STM_FOR:
+	ra_exp(r, s->child[0]);
+	begin_loop(r);
+	ra_exp(r, s->child[1]);
+	ra_stm(r, s->child[3]);
+	ra_exp(r, s->child[2]);
+	end_loop(r);
+	break;
+    case  AST_STM_DOWHILE:
+	begin_loop(r);
+	ra_stm(r, s->child[0]);
+	ra_exp(r, s->child[1]);
+	end_loop(r);
+	break;
+    default:
+	errexit("Invalid statement kind", __FILE__, __LINE__);
+    }
+}
+
+/* 式eの中の変数を全て現在の位置に現れたものとする（巡回の順は問わない） */
+void
+ra_exp(RegAlloc *r, AST_Node *e)
+{
+    AST_Stack *st = r->st;
+    AST_Node *n, *a;
+    int  i, base;
+
+    if (e == NULL) {
+	return;
+    }
+    r->pos += 2;
+    if (e->sub_kind == AST_EXP_ASGN) {
+	ra_use(r, e->child[0]->symtab, r->pos+1);
+	e = e->child[1];
+    }
+    base = st->num;
+    push_AST_Stack(st, e);
+    while (st->num > base) {
+	n = st->frame[--st->num].n;
+	if (n->sub_kind == AST_EXP_IDENT) {
+	    ra_use(r, n->symtab, r->pos);
+	    continue;
+	}
+	/* 関数呼び出しのchild[0]は関数名 */
+	for (i = (n->sub_kind == AST_EXP_CALL) ? 1 : 0; i < n->num_child; i++) {
+	    push_AST_Stack(st, n->child[i]);
+	}
+	TRAVERSE_AST_LIST(a, n->list, push_AST_Stack(st, a));
+    }
+}
+
+void
+ra_use(RegAlloc *r, SymTab *t, int pos)
+{
+    static const long  weight[MAX_WEIGHT_DEPTH+1] = { 1, 10, 100, 1000, 10000 };
+    VarRange *v = &r->var[t->entry];
+
+    if (v->start < 0 || v->start > pos) {
+	v->start = pos;
+    }
+    if (v->end < pos) {
+	v->end = pos;
+    }
+    v->weight += weight[(r->depth < MAX_WEIGHT_DEPTH) ? r->depth : MAX_WEIGHT_DEPTH];
+    if (r->depth > 0 && v->loop != r->loop) {
+	v->loop = r->loop;
+	if (v->start > r->loop_start) {
+	    v->start = r->loop_start;
+	}
+	r->in_loop[r->num_in_loop++] = t->entry;
+    }
+}
+
+void
+begin_loop(RegAlloc *r)
+{
+    if (r->depth++ == 0) {
+	r->loop++;
+	r->loop_start = r->pos+1;
+    }
+}
+
+/* 一番外側のループを抜けたら、中に現れた変数の区間をループの終わりまで広げる */
+void
+end_loop(RegAlloc *r)
+{
+    VarRange *v;
+    int  i;
+
+    if (--r->depth > 0) {
+	return;
+    }
+    r->pos += 2;
+    for (i = 0; i < r->num_in_loop; i++) {
+	v = &r->var[r->in_loop[i]];
+	if (v->end < r->pos) {
+	    v->end = r->pos;
+	}
+    }
+    r->num_in_loop = 0;
+}
+
+void
+linear_scan(RegAlloc *r)
+{
+    VarRange **order, *active[NUM_VAR_REGS], *v;
+    int  i, j, k, n, nactive = 0;
+
+    order = xmalloc(r->nvar*sizeof(VarRange*));
+    for (i = 1, n = 0; i < r->nvar; i++) {
+	if (r->var[i].sym != NULL && r->var[i].end >= r->var[i].start) {
+	    order[n++] = &r->var[i];
+	}
+    }
+    qsort(order, n, sizeof(VarRange*), compare_start);
+    for (i = 0; i < n; i++) {
+	v = order[i];
+	/* 区間の終わったものを外す */
+	for (j = k = 0; j < nactive; j++) {
+	    if (active[j]->end >= v->start) {
+		active[k++] = active[j];
+	    }
+	}
+	nactive = k;
+	if (nactive < NUM_VAR_REGS) {
+	    /* 空いているうち番号の小さいもの */
+	    for (k = VAR_REG_BASE; ; k++) {
+		for (j = 0; j < nactive && active[j]->sym->reg != k; j++)
+		    ;
+		if (j == nactive) {
+		    break;
+		}
+	    }
+	    v->sym->reg = k;
+	    active[nactive++] = v;
+	    continue;
+	}
+	/* 重みの最も小さいものをメモリに置く */
+	for (j = 0, k = 1; k < nactive; k++) {
+	    if (active[k]->weight < active[j]->weight) {
+		j = k;
+	    }
+	}
+	if (active[j]->weight < v->weight) {
+	    v->sym->reg = active[j]->sym->reg;
+	    active[j]->sym->reg = 0;
+	    active[j] = v;
+	}
+    }
+    xfree(order);
+}
+
+/* 区間の始まりの順。同じならentry番号の順にして、結果を一意に決める */
+int
+compare_start(const void *a, const void *b)
+{
+    const VarRange *x = *(VarRange * const *)a, *y = *(VarRange * const *)b;
+
+    if (x->start != y->start) {
+	return (x->start < y->start) ? -1 : 1;
+    }
+    return x->sym->entry - y->sym->entry;
+}
@@ -0,0 +1,30 @@
+/*
+    Tiny Language Compiler (tlc)
+
+    変数のレジスタ割り付け（-O2）
+
+    2016年 木村啓二
+*/
+
+#ifndef  REGALLOC_H
+#define  REGALLOC_H
+
+#include  "ast.h"
+
+struct Compiler;
+
+/* 変数を置くレジスタ（呼び出し先保存の%ebx, %esi, %edi）の番号と数 */
+#define  VAR_REG_BASE  3
+#define  NUM_VAR_REGS  3
+
+/*
+ * 関数fの仮引数・自動変数のうち、よく使うものをVAR_REG_BASEからの
+ * レジスタに割り付け、シンボルテーブルのregに入れる（0ならメモリのまま）
+ * stは式の巡回用のスタック（並列処理中はスレッド毎のもの）
+ */
+extern void  alloc_var_regs(struct Compiler *cc, AST_Node *f, AST_Stack *st);
+
+/* 関数idの変数が使うレジスタ（1 << 番号の和） */
+extern int  var_regs_used(struct Compiler *cc, int id);
+
+#endif	/* REGALLOC_H */
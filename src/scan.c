@@ -0,0 +1,322 @@
+/*
+    Tiny Language Compiler (tlc)
+
+    字句解析部 (手書き・SIMD版)
+
+    tl_lex.lと同じトークン列を返す。空白の読み飛ばしと識別子・整数の
+    連続部分の切り出しを16byte(AVX2では32byte)ずつまとめて判定する。
+    ソースの末尾には'\0'がSOURCE_PAD_SIZE個続くので、末尾を越えた
+    読み出しは常にこの詰め物の中に収まる。
+
+    2016年 木村啓二
+*/
+
+#include  <stdio.h>
+#include  <stdlib.h>
+#include  <string.h>
+
+#if defined(__AVX2__) || defined(__SSE2__)
+#include  <immintrin.h>
+#endif
+
+#include  "ast.h"
+#include  "compiler.h"
+#include  "intern.h"
+#include  "source.h"
+#include  "tl_gram.h"
+
+
+/*
+ * 文字の分類 (SIMD命令を使えない場合と先頭文字の判定用)
+ */
+#define  IS_SPACE(C)  ((C) == ' ' || (C) == '\t' || (C) == '\r' || (C) == '\n')
+#define  IS_DIGIT(C)  ((unsigned)((C) - '0') < 10)
+#define  IS_ALPHA(C)  ((unsigned)(((C) | 0x20) - 'a') < 26)
+#define  IS_IDENT(C)  (IS_ALPHA(C) || IS_DIGIT(C) || (C) == '_')
+
+
+#if defined(__AVX2__)
+
+/*
+ * AVX2: 32byteずつ判定する
+ */
+typedef __m256i           vec_t;
+typedef unsigned int      mask_t;
+#define  VEC_SIZE         32
+#define  VEC_FULL         0xFFFFFFFFu
+#define  VEC_LOAD(P)      _mm256_loadu_si256((const __m256i*)(P))
+#define  VEC_SET1(C)      _mm256_set1_epi8(C)
+#define  VEC_EQ(A, B)     _mm256_cmpeq_epi8(A, B)
+#define  VEC_GT(A, B)     _mm256_cmpgt_epi8(A, B)
+#define  VEC_ADD(A, B)    _mm256_add_epi8(A, B)
+#define  VEC_OR(A, B)     _mm256_or_si256(A, B)
+#define  VEC_MASK(A)      ((mask_t)_mm256_movemask_epi8(A))
+
+#elif defined(__SSE2__)
+
+/*
+ * SSE2: 16byteずつ判定する
+ */
+typedef __m128i           vec_t;
+typedef unsigned int      mask_t;
+#define  VEC_SIZE         16
+#define  VEC_FULL         0xFFFFu
+#define  VEC_LOAD(P)      _mm_loadu_si128((const __m128i*)(P))
+#define  VEC_SET1(C)      _mm_set1_epi8(C)
+#define  VEC_EQ(A, B)     _mm_cmpeq_epi8(A, B)
+#define  VEC_GT(A, B)     _mm_cmpgt_epi8(A, B)
+#define  VEC_ADD(A, B)    _mm_add_epi8(A, B)
+#define  VEC_OR(A, B)     _mm_or_si128(A, B)
+#define  VEC_MASK(A)      ((mask_t)_mm_movemask_epi8(A))
+
+#endif
+
+
+#ifdef VEC_SIZE
+
+/*
+ * LO <= c <= HI のbyteを0xFFにする
+ * 符号付き比較しかないので、LOが-128に来るようにずらしてから比較する
+ */
+static inline vec_t
+vec_in_range(vec_t c, char lo, char hi)
+{
+    vec_t t = VEC_ADD(c, VEC_SET1((char)(0x80 - lo)));
+
+    return VEC_GT(VEC_SET1((char)(-128 + (hi - lo) + 1)), t);
+}
+
+/* 識別子を構成する文字 [_a-zA-Z0-9] */
+static inline mask_t
+ident_mask(vec_t c)
+{
+    vec_t alpha = vec_in_range(VEC_OR(c, VEC_SET1(0x20)), 'a', 'z');
+    vec_t digit = vec_in_range(c, '0', '9');
+
+    return VEC_MASK(VEC_OR(VEC_OR(alpha, digit), VEC_EQ(c, VEC_SET1('_'))));
+}
+
+/* 空白を読み飛ばし、途中の改行の数だけ行番号*linenoを進める */
+static const char*
+skip_space(const char *p, int *lineno)
+{
+    for (;;) {
+	vec_t  c = VEC_LOAD(p);
+	vec_t  nl = VEC_EQ(c, VEC_SET1('\n'));
+	vec_t  sp = VEC_OR(VEC_OR(VEC_EQ(c, VEC_SET1(' ')), VEC_EQ(c, VEC_SET1('\t'))),
+			   VEC_OR(VEC_EQ(c, VEC_SET1('\r')), nl));
+	mask_t ws = VEC_MASK(sp);
+	mask_t nls = VEC_MASK(nl);
+
+	if (ws != VEC_FULL) {
+	    int n = __builtin_ctz(~ws);
+
+	    *lineno += __builtin_popcount(nls & ((1u << n) - 1));
+	    return p + n;
+	}
+	*lineno += __builtin_popcount(nls);
+	p += VEC_SIZE;
+    }
+}
+
+/* 識別子の残りの部分を読み飛ばす */
+static const char*
+skip_ident(const char *p)
+{
+    for (;;) {
+	mask_t m = ident_mask(VEC_LOAD(p));
+
+	if (m != VEC_FULL) {
+	    return p + __builtin_ctz(~m);
+	}
+	p += VEC_SIZE;
+    }
+}
+
+/* 数字の並びを読み飛ばす */
+static const char*
+skip_digit(const char *p)
+{
+    for (;;) {
+	mask_t m = VEC_MASK(vec_in_range(VEC_LOAD(p), '0', '9'));
+
+	if (m != VEC_FULL) {
+	    return p + __builtin_ctz(~m);
+	}
+	p += VEC_SIZE;
+    }
+}
+
+#else  /* VEC_SIZE */
+
+/*
+ * SIMD命令を使えない場合は1byteずつ判定する
+ */
+static const char*
+skip_space(const char *p, int *lineno)
+{
+    while (IS_SPACE(*p)) {
+	if (*p == '\n') {
+	    (*lineno)++;
+	}
+	p++;
+    }
+    return p;
+}
+
+static const char*
+skip_ident(const char *p)
+{
+    while (IS_IDENT(*p)) {
+	p++;
+    }
+    return p;
+}
+
+static const char*
+skip_digit(const char *p)
+{
+    while (IS_DIGIT(*p)) {
+	p++;
+    }
+    return p;
+}
+
+#endif /* VEC_SIZE */
+
+
+/*
+ * 予約語の表
+ * 先頭2文字と長さから作った完全ハッシュで引き、綴りを照合する
+ */
+#define  KEYWORD_HASH(P, LEN)  (((unsigned char)(P)[0]*3 + (unsigned char)(P)[1]*5 + (LEN)) & 7)
+
+static const struct {
+    const char *name;
+    int  len;
+    int  token;
+} keyword[8] = {
+    { "for",    3, TOKEN_FOR },
+    { "do",     2, TOKEN_DO },
+    { "while",  5, TOKEN_WHILE },
+    { "if",     2, TOKEN_IF },
+    { "int",    3, TOKEN_INT },
+    { "return", 6, TOKEN_RETURN },
+    { NULL,     0, 0 },
+    { "else",   4, TOKEN_ELSE },
+};
+
+static int
+lookup_keyword(const char *p, int len)
+{
+    int  h;
+
+    if (len < 2 || len > 6) {
+	return 0;
+    }
+    h = KEYWORD_HASH(p, len);
+    if (keyword[h].len == len && memcmp(keyword[h].name, p, len) == 0) {
+	return keyword[h].token;
+    }
+    return 0;
+}
+
+
+/* メモリ上のソース全体を複写せずにその場で走査する */
+void
+lex_init(Compiler *cc)
+{
+    lex_init_range(cc, cc->src.base, cc->src.base + cc->src.size, 1);
+}
+
+/* endで入力が終わったものとする。endの先も読めなければならない */
+void
+lex_init_range(Compiler *cc, const char *begin, const char *end, int lineno)
+{
+    cc->scan_cur = begin;
+    cc->scan_end = end;
+    cc->lineno = lineno;
+}
+
+void
+lex_destroy(Compiler *cc)
+{
+    cc->scan_cur = cc->scan_end = NULL;
+}
+
+int
+lex_lineno(Compiler *cc)
+{
+    return cc->lineno;
+}
+
+int
+lex_token(YYSTYPE *lval, Compiler *cc)
+{
+    const char *p, *q;
+    int  c, tok;
+
+    p = skip_space(cc->scan_cur, &cc->lineno);
+    if (p >= cc->scan_end) {
+	cc->scan_cur = p;
+	return  0;
+    }
+    c = (unsigned char)*p;
+
+    if (IS_DIGIT(c)) {
+	q = skip_digit(p+1);
+	lval->y_int = strtoul(p, NULL, 10);
+	cc->scan_cur = q;
+	return  TOKEN_CONST_INT;
+    }
+
+    if (IS_ALPHA(c)) {
+	q = skip_ident(p+1);
+	cc->scan_cur = q;
+	if ((tok = lookup_keyword(p, q-p)) != 0) {
+	    return tok;
+	}
+	lval->y_str = intern(&cc->names, p, q-p);
+	return  TOKEN_ID;
+    }
+
+    cc->scan_cur = p+1;
+    switch (c) {
+    case '=':
+	if (p[1] == '=') {
+	    cc->scan_cur = p+2;
+	    return  TOKEN_EQEQ;
+	}
+	return  TOKEN_EQ;
+    case '<':
+	if (p[1] == '=') {
+	    cc->scan_cur = p+2;
+	    return  TOKEN_LTE;
+	}
+	return  TOKEN_LT;
+    case '>':
+	if (p[1] == '=') {
+	    cc->scan_cur = p+2;
+	    return  TOKEN_GTE;
+	}
+	return  TOKEN_GT;
+    case '!':
+	if (p[1] == '=') {
+	    cc->scan_cur = p+2;
+	    return  TOKEN_NE;
+	}
+	return  TOKEN_LEX_ERROR;
+    case '+':  return  TOKEN_PLUS;
+    case '-':  return  TOKEN_MINUS;
+    case '*':  return  TOKEN_ASTERISK;
+    case '/':  return  TOKEN_SLASH;
+    case ',':  return  TOKEN_COMMA;
+    case '(':  return  TOKEN_LPAREN;
+    case ')':  return  TOKEN_RPAREN;
+    case '{':  return  TOKEN_LBRACE;
+    case '}':  return  TOKEN_RBRACE;
+    case ';':  return  TOKEN_SEMICOLON;
+    default:
+	return  TOKEN_LEX_ERROR;
+    }
+}
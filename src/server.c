@@ -0,0 +1,441 @@
+/*
+    Tiny Language Compiler (tlc)
+
+    コンパイルサーバ（--server）とそのクライアント（--connect）
+
+    2016年 木村啓二
+*/
+
+#include  <errno.h>
+#include  <fcntl.h>
+#include  <limits.h>
+#ifdef __GLIBC__
+#include  <malloc.h>
+#endif
+#include  <signal.h>
+#include  <stdint.h>
+#include  <stdio.h>
+#include  <stdlib.h>
+#include  <string.h>
+#include  <sys/socket.h>
+#include  <sys/stat.h>
+#include  <sys/un.h>
+#include  <unistd.h>
+#include  "compiler.h"
+#include  "dump.h"
+#include  "server.h"
+
+/* 領域の空きチャンクはここまで溜めておく（64KB×1024） */
+#define  SERVER_POOL_CHUNKS  1024
+/* 識別子の表がこれより大きくなったら作り直す */
+#define  SERVER_MAX_NAMES  (1<<20)
+/* 要求のファイル名とソースの長さの上限。超えたものは確保せずに読み捨て、エラーを返す */
+#define  SERVER_MAX_NAME  PATH_MAX
+#define  SERVER_MAX_SOURCE  (16<<20)
+/* クライアントが受け取る応答の文字列の長さの上限 */
+#define  SERVER_MAX_REPLY  (1<<30)
+
+typedef struct Server {
+    int  fd;			/* 待ち受けているソケット */
+    const char  *cache_dir;	/* 関数毎のアセンブリのキャッシュ（NULLなら使わない） */
+    ArenaPool  pool;		/* 全てのスレッドで共有する空きチャンク */
+} Server;
+
+/* 処理中の要求。続行できないエラーはその要求だけのエラーにする */
+typedef struct Request {
+    Compiler  *cc;
+    int  escaped;		/* 抜け出し先を通ったか */
+} Request;
+
+/* シグナルを受けた時に消すソケット */
+static const char *server_path;
+
+static void on_signal(int sig);
+static void server_worker(void *arg, int i);
+static void serve(Compiler *cc, Options *opt, int fd);
+static void request_failed(void *arg, const char *mes);
+static int  send_int(int fd, int v);
+static int  send_str(int fd, const char *s, size_t len);
+static int  recv_int(int fd, int *v);
+static int  recv_len(int fd, int max, int *len);
+static int  skip_bytes(int fd, int n);
+static char *recv_body(int fd, int n, size_t *len);
+static char *recv_str(int fd, int max, size_t *len);
+static int  recv_source(int fd, int n, Source *src);
+static int  connect_server(const char *path);
+
+int
+send_int(int fd, int v)
+{
+    int32_t  x = v;
+
+    return write_all(fd, &x, sizeof(x));
+}
+
+int
+send_str(int fd, const char *s, size_t len)
+{
+    if (send_int(fd, len) < 0) {
+	return -1;
+    }
+    return write_all(fd, s, len);
+}
+
+int
+recv_int(int fd, int *v)
+{
+    int32_t  x;
+
+    if (read_all(fd, &x, sizeof(x)) < 0) {
+	return -1;
+    }
+    *v = x;
+    return 0;
+}
+
+/* 文字列の長さを受け取る。maxを超えていれば中身を読み捨てて*lenを-1にする
+   接続が切れたか壊れた要求なら-1を返す */
+int
+recv_len(int fd, int max, int *len)
+{
+    int  n;
+
+    if (recv_int(fd, &n) < 0 || n < 0) {
+	return -1;
+    }
+    if (n > max) {
+	if (skip_bytes(fd, n) < 0) {
+	    return -1;
+	}
+	n = -1;
+    }
+    *len = n;
+    return 0;
+}
+
+int
+skip_bytes(int fd, int n)
+{
+    char  buf[4096];
+    int  k;
+
+    for (; n > 0; n -= k) {
+	k = (n < (int)sizeof(buf)) ? n : (int)sizeof(buf);
+	if (read_all(fd, buf, k) < 0) {
+	    return -1;
+	}
+    }
+    return 0;
+}
+
+/* 長さnの文字列の中身を受け取る。'\0'で終わる。NULLなら接続が切れた */
+char*
+recv_body(int fd, int n, size_t *len)
+{
+    char  *s;
+
+    s = xmalloc(n+1);
+    if (read_all(fd, s, n) < 0) {
+	xfree(s);
+	return NULL;
+    }
+    s[n] = '\0';
+    if (len != NULL) {
+	*len = n;
+    }
+    return s;
+}
+
+/* NULLなら接続が切れたか、長さがmaxを超える壊れた応答 */
+char*
+recv_str(int fd, int max, size_t *len)
+{
+    int  n;
+
+    if (recv_int(fd, &n) < 0 || n < 0 || n > max) {
+	return NULL;
+    }
+    return recv_body(fd, n, len);
+}
+
+/* 長さnのソースを、字句解析部が走査できるよう末尾の詰め物付きの領域に直接受け取る */
+int
+recv_source(int fd, int n, Source *src)
+{
+    alloc_source(src, n);
+    if (read_all(fd, src->base, n) < 0) {
+	close_source(src);
+	return -1;
+    }
+    return 0;
+}
+
+
+/*
+ * サーバ
+ */
+void
+on_signal(int sig)
+{
+    (void)sig;
+    unlink(server_path);
+    _exit(0);
+}
+
+int
+server_main(const char *path, int nworkers, const char *cache_dir)
+{
+    Server  s;
+    struct sockaddr_un  addr;
+    struct stat  st;
+    struct sigaction  sa;
+
+    if (strlen(path) >= sizeof(addr.sun_path)) {
+	fprintf(stderr, "Too long socket path %s.\n", path);
+	return -1;
+    }
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    strcpy(addr.sun_path, path);
+    /* 前のサーバが残したソケットは消す。他の種類のファイルは消さない */
+    if (lstat(path, &st) == 0 && S_ISSOCK(st.st_mode)) {
+	unlink(path);
+    }
+    if ((s.fd = socket(AF_UNIX, SOCK_STREAM, 0)) < 0
+	|| bind(s.fd, (struct sockaddr*)&addr, sizeof(addr)) < 0
+	|| listen(s.fd, SOMAXCONN) < 0) {
+	fprintf(stderr, "Can't listen on the socket %s.\n", path);
+	if (s.fd >= 0) {
+	    close(s.fd);
+	}
+	return -1;
+    }
+
+    server_path = path;
+    memset(&sa, 0, sizeof(sa));
+    sa.sa_handler = on_signal;
+    sigemptyset(&sa.sa_mask);
+    sigaction(SIGINT, &sa, NULL);
+    sigaction(SIGTERM, &sa, NULL);
+    /* クライアントが先に切断しても落ちないようにする */
+    signal(SIGPIPE, SIG_IGN);
+
+    s.cache_dir = cache_dir;
+    arena_pool_init(&s.pool, SERVER_POOL_CHUNKS);
+    /* 各スレッドは戻らない */
+    parallel_for(nworkers, nworkers, server_worker, &s);
+    return 0;
+}
+
+/* 接続を1つずつ受け付けて処理する。Compilerは接続をまたいで使い回す */
+void
+server_worker(void *arg, int i)
+{
+    Server *s = arg;
+    Options  opt;
+    Compiler  cc;
+    int  fd;
+
+    (void)i;
+    memset(&opt, 0, sizeof(opt));
+    opt.cache_dir = s->cache_dir;
+    compiler_init(&cc, &opt, -1, &s->pool);
+    for (;;) {
+	if ((fd = accept(s->fd, NULL, NULL)) < 0) {
+	    if (errno != EINTR && errno != ECONNABORTED) {
+		/* 記述子が足りない時などは少し待ってからやり直す */
+		usleep(100*1000);
+	    }
+	    continue;
+	}
+	serve(&cc, &opt, fd);
+	close(fd);
+    }
+}
+
+/* 接続fdの要求を、相手が閉じるまで順に処理する */
+void
+serve(Compiler *cc, Options *opt, int fd)
+{
+    int  dump, dump_format, stream, time_report, parser, optimize, backend, status;
+    int  name_len, src_len;
+    char  *name;
+    Request  req;
+
+    for (;;) {
+	if (recv_int(fd, &dump) < 0 || recv_int(fd, &dump_format) < 0
+	    || recv_int(fd, &stream) < 0 || recv_int(fd, &time_report) < 0
+	    || recv_int(fd, &parser) < 0 || recv_int(fd, &optimize) < 0
+	    || recv_int(fd, &backend) < 0) {
+	    return;
+	}
+	if ((dump & ~(DUMP_SYMTAB|DUMP_AST|DUMP_AST_REG|DUMP_IR)) != 0
+	    || (dump_format != DUMP_FORMAT_TEXT && dump_format != DUMP_FORMAT_JSON)
+	    || time_report < TIME_REPORT_NONE || time_report > TIME_REPORT_JSON
+	    || (parser != PARSER_BISON && parser != PARSER_RD)
+	    || optimize < 0 || optimize > 2
+	    || (backend != BACKEND_AST && backend != BACKEND_IR)) {
+	    return;
+	}
+	name = NULL;
+	if (recv_len(fd, SERVER_MAX_NAME, &name_len) < 0
+	    || (name_len >= 0 && (name = recv_body(fd, name_len, NULL)) == NULL)
+	    || recv_len(fd, SERVER_MAX_SOURCE, &src_len) < 0) {
+	    xfree(name);
+	    return;
+	}
+
+	cc->err.len = 0;
+	opt->dump = dump;
+	opt->dump_format = dump_format;
+	opt->stream = stream;
+	opt->time_report = time_report;
+	opt->parser = parser;
+	opt->optimize = optimize;
+	opt->backend = backend;
+	opt->jobs = 1;		/* 並列性は接続の間で得る */
+	cc->in_file = name;
+	req.cc = cc;
+	req.escaped = 0;
+
+	/* 長過ぎる要求は確保せずにエラーを返す */
+	if (name == NULL || src_len < 0) {
+	    if (name == NULL) {
+		diag(cc, "Too long input file name for the server.\n");
+	    } else {
+		diag(cc, "Too large input file %s for the server (max %d bytes).\n",
+		     name, SERVER_MAX_SOURCE);
+	    }
+	    status = -1;
+	} else if (recv_source(fd, src_len, &cc->src) < 0) {
+	    cc->in_file = NULL;
+	    xfree(name);
+	    return;
+	} else {
+	    /* 続行できないエラーはこの要求のエラーとして返し、サーバは動き続ける */
+	    emit_init(&cc->out, -1);
+	    set_fatal_escape(request_failed, &req);
+	    status = compile_source(cc);
+	    set_fatal_escape(NULL, NULL);
+	}
+	if (status < 0) {
+	    cc->out.len = 0;
+	}
+	status = (send_int(fd, status) < 0
+		  || send_str(fd, cc->out.buf, cc->out.len) < 0
+		  || send_str(fd, cc->err.buf, cc->err.len) < 0) ? -1 : 0;
+	/* 次の要求を待つ間は翻訳単位の状態を持たない
+	   識別子の表は大きくなり過ぎていなければ残す
+	   途中で抜け出した時は、表が更新の途中かもしれないので作り直す */
+	compiler_reset(cc, opt);
+	if (cc->names.count > SERVER_MAX_NAMES || req.escaped) {
+	    intern_free(&cc->names);
+	}
+	xfree(name);
+#ifdef __GLIBC__
+	/* 大きなソースで使った分をOSに返す（溜めてあるチャンクは残る） */
+	malloc_trim(0);
+#endif
+	if (status < 0) {
+	    return;
+	}
+    }
+}
+
+/* 要求の処理中に確保に失敗したり内部エラーになったりした時の抜け出し先
+   Compilerの続行できないエラーと同じく、compile_sourceから-1で戻る */
+void
+request_failed(void *arg, const char *mes)
+{
+    Request *req = arg;
+
+    req->escaped = 1;
+    diag(req->cc, "%s\n", mes);
+    fatal(req->cc);
+}
+
+
+/*
+ * クライアント
+ */
+int
+connect_server(const char *path)
+{
+    struct sockaddr_un  addr;
+    int  fd;
+
+    if (strlen(path) >= sizeof(addr.sun_path)) {
+	return -1;
+    }
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    strcpy(addr.sun_path, path);
+    if ((fd = socket(AF_UNIX, SOCK_STREAM, 0)) < 0) {
+	return -1;
+    }
+    if (connect(fd, (struct sockaddr*)&addr, sizeof(addr)) < 0) {
+	close(fd);
+	return -1;
+    }
+    return fd;
+}
+
+int
+remote_compile_file(Compiler *cc, const char *sock, const char *path)
+{
+    const Options *opt = cc->opt;
+    char  *text = NULL, *err = NULL;
+    size_t  text_len, err_len;
+    int  fd, out, status, ok;
+
+    cc->in_file = path;
+    if (open_source(&cc->src, path) < 0) {
+	diag(cc, "Can't open the input file %s.\n", path);
+	return -1;
+    }
+    if ((cc->out_file = asm_file_name(path)) == NULL) {
+	diag(cc, "Illegal suffix.\n");
+	close_source(&cc->src);
+	return -1;
+    }
+    if ((fd = connect_server(sock)) < 0) {
+	diag(cc, "Can't connect to the server %s.\n", sock);
+	close_source(&cc->src);
+	return -1;
+    }
+
+    ok = send_int(fd, opt->dump) == 0
+	&& send_int(fd, opt->dump_format) == 0
+	&& send_int(fd, opt->stream) == 0
+	&& send_int(fd, opt->time_report) == 0
+	&& send_int(fd, opt->parser) == 0
+	&& send_int(fd, opt->optimize) == 0
+	&& send_int(fd, opt->backend) == 0
+	&& send_str(fd, path, strlen(path)) == 0
+	&& send_str(fd, cc->src.base, cc->src.size) == 0
+	&& recv_int(fd, &status) == 0
+	&& (text = recv_str(fd, SERVER_MAX_REPLY, &text_len)) != NULL
+	&& (err = recv_str(fd, SERVER_MAX_REPLY, &err_len)) != NULL;
+    close(fd);
+    close_source(&cc->src);
+    if (!ok) {
+	diag(cc, "Lost the connection to the server %s.\n", sock);
+	xfree(text);
+	return -1;
+    }
+
+    emit_mem(&cc->err, err, err_len);
+    emit_flush(&cc->err);
+    if (status == 0) {
+	if ((out = open(cc->out_file, O_WRONLY|O_CREAT|O_TRUNC, 0666)) < 0) {
+	    diag(cc, "Can't open the output file %s.\n", cc->out_file);
+	    status = -1;
+	} else {
+	    write_all(out, text, text_len);
+	    close(out);
+	}
+    }
+    xfree(text);
+    xfree(err);
+    return (status == 0) ? 0 : -1;
+}
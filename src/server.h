@@ -0,0 +1,40 @@
+/*
+    Tiny Language Compiler (tlc)
+
+    コンパイルサーバ（--server）とそのクライアント（--connect）
+
+    2016年 木村啓二
+*/
+
+#ifndef  SERVER_H
+#define  SERVER_H
+
+#include  "compiler.h"
+
+/*
+ * サーバはUnixドメインソケットで要求を待ち、受け取ったソースをコンパイルして
+ * アセンブリと診断メッセージを返す。キャッシュ以外のファイルは読み書きしない
+ * nworkers個のスレッドがそれぞれCompilerを1つずつ持ち、別々の接続を同時に処理する
+ * 識別子の表と領域のチャンクは要求の間も解放せずに使い回す
+ *
+ * 1つの接続では要求と応答を何度でも交互にやり取りできる
+ * 整数は4byte（ホストのバイト順）、文字列は長さ（整数）と内容の組
+ *   要求  dump, dump_format, stream, time_report, parser, optimize, backend,
+ *         ファイル名, ソース
+ *   応答  compile_sourceの結果, アセンブリ, 診断メッセージ
+ * 長過ぎるファイル名やソースは読み捨ててエラーを返す
+ * 要求の処理中の確保の失敗や内部エラーも、その要求のエラーとして返す
+ *
+ * キャッシュはサーバ側でだけ指定でき、クライアントはその場所を選べない
+ */
+
+/* ソケットpathでサーバを動かす。SIGINTかSIGTERMを受けるまで戻らない
+   cache_dirがNULLでなければ、全ての要求でそこにキャッシュを置く
+   起動できなければ-1を返す */
+extern int  server_main(const char *path, int nworkers, const char *cache_dir);
+
+/* ファイルpathをソケットsockのサーバにコンパイルさせ、同じ名前の.sファイルを作る
+   compile_fileと同じく、成功したら0、エラーがあれば-1を返す */
+extern int  remote_compile_file(Compiler *cc, const char *sock, const char *path);
+
+#endif	/* SERVER_H */
@@ -0,0 +1,114 @@
+/*
+    Tiny Language Compiler (tlc)
+
+    ソースファイルの読み込み
+
+    2016年 木村啓二
+*/
+
+#include  <fcntl.h>
+#include  <string.h>
+#include  <sys/mman.h>
+#include  <sys/stat.h>
+#include  <unistd.h>
+#include  "source.h"
+#include  "util.h"
+
+static int read_source(Source *src, int fd);
+
+/*
+ * 通常のファイルはmmapで写像する
+ * 末尾の'\0'のために、ファイルより少し大きい無名の領域を確保してから
+ * その先頭にファイルを重ねて写像する（ファイル末尾以降のページ内は0で埋まる）
+ * 字句解析部（flex）は走査中にバッファへ書き込むのでMAP_PRIVATEで写像する
+ * パイプなど写像できないものは全体を読み込む
+ */
+int
+open_source(Source *src, const char *path)
+{
+    int  fd;
+    long  page;
+    struct stat st;
+    char  *p;
+
+    memset(src, 0, sizeof(Source));
+    if ((fd = open(path, O_RDONLY)) < 0) {
+	return -1;
+    }
+    if (fstat(fd, &st) < 0) {
+	close(fd);
+	return -1;
+    }
+    if (!S_ISREG(st.st_mode) || st.st_size == 0) {
+	return read_source(src, fd);
+    }
+    page = sysconf(_SC_PAGESIZE);
+    src->size = st.st_size;
+    src->map_size = (src->size+SOURCE_PAD_SIZE+page-1) / page * page;
+    p = mmap(NULL, src->map_size, PROT_READ|PROT_WRITE,
+	     MAP_PRIVATE|MAP_ANONYMOUS, -1, 0);
+    if (p == MAP_FAILED) {
+	return read_source(src, fd);
+    }
+    if (mmap(p, src->size, PROT_READ|PROT_WRITE,
+	     MAP_PRIVATE|MAP_FIXED, fd, 0) == MAP_FAILED) {
+	munmap(p, src->map_size);
+	return read_source(src, fd);
+    }
+    close(fd);
+    src->base = p;
+    return 0;
+}
+
+/* fdの内容を全て読み込む。fdは閉じる */
+int
+read_source(Source *src, int fd)
+{
+    size_t  size;
+    ssize_t  n;
+
+    src->map_size = 0;
+    src->size = 0;
+    size = 64*1024;
+    src->base = xmalloc_tag(size, ALLOC_SOURCE);
+    for (;;) {
+	if (src->size+SOURCE_PAD_SIZE >= size) {
+	    size *= 2;
+	    src->base = xrealloc_tag(src->base, size, ALLOC_SOURCE);
+	}
+	n = read(fd, src->base+src->size, size-src->size-SOURCE_PAD_SIZE);
+	if (n < 0) {
+	    close(fd);
+	    xfree(src->base);
+	    src->base = NULL;
+	    return -1;
+	}
+	if (n == 0) {
+	    break;
+	}
+	src->size += n;
+    }
+    close(fd);
+    memset(src->base+src->size, 0, SOURCE_PAD_SIZE);
+    return 0;
+}
+
+void
+close_source(Source *src)
+{
+    if (src->map_size != 0) {
+	munmap(src->base, src->map_size);
+    } else {
+	xfree(src->base);
+    }
+    memset(src, 0, sizeof(Source));
+}
+
+void
+alloc_source(Source *src, size_t size)
+{
+    src->map_size = 0;
+    src->size = size;
+    src->base = xmalloc_tag(size+SOURCE_PAD_SIZE, ALLOC_SOURCE);
+    memset(src->base+size, 0, SOURCE_PAD_SIZE);
+}
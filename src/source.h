@@ -0,0 +1,36 @@
+/*
+    Tiny Language Compiler (tlc)
+
+    ソースファイルの読み込み
+
+    2016年 木村啓二
+*/
+
+#ifndef  SOURCE_H
+#define  SOURCE_H
+
+#include  <stddef.h>
+
+/*
+ * メモリ上に置いたソースファイル全体
+ * 字句解析部はこれを複写せずにその場で走査する
+ * 内容の直後には'\0'が少なくともSOURCE_PAD_SIZE個続く
+ */
+typedef struct Source {
+    char  *base;		/* 先頭 */
+    size_t  size;		/* ファイルの大きさ */
+    size_t  map_size;		/* 写像した領域の大きさ（0ならmalloc） */
+} Source;
+
+/* 内容の直後に続く'\0'の数
+   flexのyy_scan_bufferは2個を要求する。手書きの字句解析部(scan.c)は
+   SIMD命令で末尾を越えて最大32byteを一度に読むので、その分も含めておく */
+#define  SOURCE_PAD_SIZE  64
+
+/* pathのファイルをメモリに写像する。失敗したら-1を返す */
+extern int  open_source(Source *src, const char *path);
+extern void close_source(Source *src);
+/* 大きさsizeのソースを置く領域を確保する。内容は呼び出し側が書き込む */
+extern void alloc_source(Source *src, size_t size);
+
+#endif	/* SOURCE_H */
@@ -0,0 +1,1054 @@
+/*
+    Tiny Language Compiler (tlc)
+
+    SSA形式での最適化（-O2 --backend=ir）
+
+    2016年 木村啓二
+*/
+
+#include  <limits.h>
+#include  <stdlib.h>
+#include  <string.h>
+#include  "ir.h"
+#include  "util.h"
+
+/*
+ * TLの変数はintだけで、ポインタも大域変数もないので、仮引数・自動変数は
+ * 全て関数の中だけで読み書きされる。そこで全ての変数をSSA形式にして最適化する
+ *
+ * 流れ：
+ * 1. 分岐するブロックから、先行が複数あるブロックへの辺（critical edge）に
+ *    空のブロックを挟む（8.でphiのコピーを置く場所）
+ * 2. 支配木（Cooper, Harvey, Kennedyの反復法）と支配辺境を求める
+ * 3. ブロックをまたいで生きる変数について、定義のあるブロックの反復支配辺境のうち
+ *    入口で変数が生きているブロックにphiを置く（pruned SSA）
+ *    関数の入口の値を読む変数は、入口で自分自身に代入しておく
+ * 4. 支配木を前順に辿り、変数の定義毎に新しい一時変数に名前を付け替える
+ *    変数そのものが残るのは、3.の入口の代入の右辺だけになる
+ * 5. 疎な条件付き定数伝播（Wegman, Zadeck）。実行されうる辺だけを辿って、
+ *    定数になる変数を定数に置き換え、条件が定数の分岐を無条件の分岐にし、
+ *    実行されないブロックを除く。式の値の計算はopt.cと同じく32bitで桁あふれさせ、
+ *    実行時の例外になる除算は畳み込まない
+ * 6. コピーの伝播。dst = aと、全ての値が同じphiは、dstの参照をaにする
+ *    （入口で読む変数そのものは伝播しない。レジスタに置けるよう一時変数に読んでおく）
+ * 7. 不要な命令の削除。関数呼び出し・例外になりうる除算・分岐と戻り値から
+ *    辿れない命令を除く
+ * 8. phiを先行の末尾（先行が分岐するなら1.で挟んだブロック）のコピーにする
+ *    同じブロックのphiは同時に代入されるので、コピーの循環は一時変数を通して解く
+ *    最後にir_build_cfgで、コピーの要らなかった空のブロックを除く
+ *
+ * 支配木の巡回も含め、関数の大きさだけ再帰することはない
+ */
+
+/* 定数伝播の値の束 */
+enum {
+    VAL_TOP,			/* まだ値が決まっていない */
+    VAL_CONST,			/* 定数 */
+    VAL_BOTTOM			/* 実行時まで分からない */
+};
+
+/* 変数を参照する命令（iがNULLならブロックbの終端） */
+typedef struct SSA_Use {
+    IR_Block  *b;
+    IR_Insn  *i;
+} SSA_Use;
+
+typedef struct SSA {
+    IR_Func  *fn;
+    Arena  a;			/* 作業用の領域（ir_optimizeの終わりに解放する） */
+    int  nsym;			/* 名前を付け替える前の変数の数+1 */
+    /* 支配木 */
+    int  *rpo;			/* 逆後順に並べたブロックの番号 */
+    int  *order;		/* ブロックの逆後順での位置 */
+    int  *idom;			/* 直接の支配ブロック（入口は自分） */
+    int  **df, *ndf, *size_df;	/* 支配辺境 */
+    int  *child, *sibling;	/* 支配木の最初の子と次の兄弟（なければ-1） */
+    /* 定数伝播 */
+    char  *state;		/* VAL_* */
+    int  *cval;			/* VAL_CONSTの値 */
+    char  *exec_block;		/* 実行されうるブロック */
+    char  *exec_edge;		/* 実行されうる辺（ブロックの番号*2+後続の番号） */
+    IR_Insn  **def;		/* 変数を定義する命令 */
+    SSA_Use  **use;		/* 変数を参照する命令 */
+    int  *nuse;
+    int  *flow, nflow;		/* 調べるブロック（番号*2+全ての命令なら1、phiだけなら0） */
+    int  *work, nwork, size_work;	/* 値の変わった変数 */
+} SSA;
+
+static void split_edges(SSA *s);
+static void find_dominators(SSA *s);
+static int  intersect(SSA *s, int b1, int b2);
+static void find_frontiers(SSA *s);
+static void place_phis(SSA *s);
+static void rename_vars(SSA *s);
+static void rename_block(SSA *s, IR_Block *b, int *cur, int **log, int *nlog, int *size_log);
+static int  pred_index(IR_Block *b, IR_Block *p);
+static int  is_var(SSA *s, IR_Opd o);
+static void find_uses(SSA *s);
+static void propagate_constants(SSA *s);
+static void visit_insn(SSA *s, IR_Block *b, IR_Insn *i);
+static void visit_term(SSA *s, IR_Block *b);
+static void mark_edge(SSA *s, IR_Block *b, int k);
+static int  edge_exec(SSA *s, IR_Block *p, IR_Block *b);
+static void lower_val(SSA *s, int v, int state, int c);
+static int  opd_state(SSA *s, IR_Opd o, int *c);
+static int  fold(int op, int x, int y, int *val);
+static void rewrite_constants(SSA *s);
+static void replace_const(SSA *s, IR_Opd *o);
+static void propagate_copies(SSA *s);
+static IR_Opd resolve(IR_Opd *repl, IR_Opd o);
+static void remove_dead(SSA *s);
+static int  is_root(IR_Insn *i);
+static void need_opd(SSA *s, char *need, IR_Opd o);
+static void leave_ssa(SSA *s);
+static void emit_copies(SSA *s, IR_Block *b, IR_Insn *before, int *dst, IR_Opd *src, int n);
+
+void
+ir_optimize(IR_Func *fn)
+{
+    SSA  s;
+    IR_Block *b;
+
+    memset(&s, 0, sizeof(SSA));
+    s.fn = fn;
+    s.a.pool = fn->arena->pool;
+    s.a.allocated = fn->arena->allocated;
+    s.nsym = fn->nvar;
+    split_edges(&s);
+    find_dominators(&s);
+    find_frontiers(&s);
+    ir_liveness(fn, &s.a);
+    place_phis(&s);
+    rename_vars(&s);
+    find_uses(&s);
+    propagate_constants(&s);
+    rewrite_constants(&s);
+    propagate_copies(&s);
+    remove_dead(&s);
+    leave_ssa(&s);
+    for (b = fn->entry; b != NULL; b = b->next) {
+	b->live_in = b->live_out = NULL;
+    }
+    fn->live_var = NULL;
+    arena_free(&s.a);
+    ir_build_cfg(fn);
+}
+
+/* 1. 分岐の飛び先に先行が複数あれば、間にブロックを挟んで分岐するブロックの直後に置く */
+void
+split_edges(SSA *s)
+{
+    IR_Func *fn = s->fn;
+    IR_Block *b, *n, *t, *after;
+    int  k;
+
+    for (b = fn->entry; b != NULL; b = after->next) {
+	after = b;
+	if (b->term == IR_BRANCH && b->succ[0] == b->succ[1]) {
+	    b->term = IR_JUMP;
+	    b->succ[1] = NULL;
+	}
+	if (b->term != IR_BRANCH) {
+	    continue;
+	}
+	for (k = 0; k < 2; k++) {
+	    t = b->succ[k];
+	    if (t->npred < 2) {
+		continue;
+	    }
+	    n = ir_new_block(fn);
+	    n->term = IR_JUMP;
+	    n->succ[0] = t;
+	    ir_add_pred(fn, n, b);
+	    t->pred[pred_index(t, b)] = n;
+	    b->succ[k] = n;
+	    n->next = after->next;
+	    after->next = n;
+	    after = n;
+	}
+    }
+    ir_number_blocks(fn);
+}
+
+/* 2. 逆後順に、先行の支配ブロックの共通の祖先を求めることを変わらなくなるまで繰り返す */
+void
+find_dominators(SSA *s)
+{
+    IR_Func *fn = s->fn;
+    IR_Block *b, *c;
+    int  *stack, *next, sp = 0, post, n = fn->nblock, k, j, d, changed;
+    char  *seen;
+
+    s->rpo = arena_alloc(&s->a, n*sizeof(int), ALLOC_IR);
+    s->order = arena_alloc(&s->a, n*sizeof(int), ALLOC_IR);
+    s->idom = arena_alloc(&s->a, n*sizeof(int), ALLOC_IR);
+    stack = arena_alloc(&s->a, n*sizeof(int), ALLOC_IR);
+    next = arena_alloc(&s->a, n*sizeof(int), ALLOC_IR);
+    seen = arena_alloc(&s->a, n, ALLOC_IR);
+
+    /* 明示的なスタックでの深さ優先探索 */
+    post = n;
+    stack[sp++] = fn->entry->id;
+    seen[fn->entry->id] = 1;
+    while (sp > 0) {
+	b = fn->block[stack[sp-1]];
+	if (next[b->id] < 2) {
+	    c = b->succ[next[b->id]++];
+	    if (c != NULL && !seen[c->id]) {
+		seen[c->id] = 1;
+		stack[sp++] = c->id;
+	    }
+	    continue;
+	}
+	sp--;
+	s->rpo[--post] = b->id;
+    }
+    for (k = 0; k < n; k++) {
+	s->order[s->rpo[k]] = k;
+	s->idom[k] = -1;
+    }
+    s->idom[fn->entry->id] = fn->entry->id;
+    do {
+	changed = 0;
+	for (k = 1; k < n; k++) {
+	    b = fn->block[s->rpo[k]];
+	    d = -1;
+	    for (j = 0; j < b->npred; j++) {
+		if (s->idom[b->pred[j]->id] < 0) {
+		    continue;
+		}
+		d = (d < 0) ? b->pred[j]->id : intersect(s, d, b->pred[j]->id);
+	    }
+	    if (s->idom[b->id] != d) {
+		s->idom[b->id] = d;
+		changed = 1;
+	    }
+	}
+    } while (changed);
+
+    /* 支配木の子の並び */
+    s->child = arena_alloc(&s->a, n*sizeof(int), ALLOC_IR);
+    s->sibling = arena_alloc(&s->a, n*sizeof(int), ALLOC_IR);
+    for (k = 0; k < n; k++) {
+	s->child[k] = -1;
+    }
+    for (k = n-1; k > 0; k--) {
+	b = fn->block[s->rpo[k]];
+	s->sibling[b->id] = s->child[s->idom[b->id]];
+	s->child[s->idom[b->id]] = b->id;
+    }
+    s->sibling[fn->entry->id] = -1;
+}
+
+int
+intersect(SSA *s, int b1, int b2)
+{
+    while (b1 != b2) {
+	while (s->order[b1] > s->order[b2]) {
+	    b1 = s->idom[b1];
+	}
+	while (s->order[b2] > s->order[b1]) {
+	    b2 = s->idom[b2];
+	}
+    }
+    return b1;
+}
+
+/* 合流するブロックbの各先行から、bの直接の支配ブロックまでの支配木の道にbを加える */
+void
+find_frontiers(SSA *s)
+{
+    IR_Func *fn = s->fn;
+    IR_Block *b;
+    int  *a, n = fn->nblock, k, j, r;
+
+    s->df = arena_alloc(&s->a, n*sizeof(int*), ALLOC_IR);
+    s->ndf = arena_alloc(&s->a, n*sizeof(int), ALLOC_IR);
+    s->size_df = arena_alloc(&s->a, n*sizeof(int), ALLOC_IR);
+    for (k = 0; k < n; k++) {
+	b = fn->block[k];
+	if (b->npred < 2) {
+	    continue;
+	}
+	for (j = 0; j < b->npred; j++) {
+	    for (r = b->pred[j]->id; r != s->idom[b->id]; r = s->idom[r]) {
+		if (s->ndf[r] > 0 && s->df[r][s->ndf[r]-1] == b->id) {
+		    break;
+		}
+		if (s->ndf[r] == s->size_df[r]) {
+		    s->size_df[r] = (s->size_df[r] == 0) ? 4 : s->size_df[r]*2;
+		    a = arena_alloc(&s->a, s->size_df[r]*sizeof(int), ALLOC_IR);
+		    if (s->ndf[r] > 0) {
+			memcpy(a, s->df[r], s->ndf[r]*sizeof(int));
+		    }
+		    s->df[r] = a;
+		}
+		s->df[r][s->ndf[r]++] = b->id;
+	    }
+	}
+    }
+}
+
+/* 3. phiを置く。関数の入口の値を読む変数は入口で v = v とする */
+void
+place_phis(SSA *s)
+{
+    IR_Func *fn = s->fn;
+    IR_Block *b, *d;
+    IR_Insn *i;
+    int  *count, *start, *blocks, *has_phi, *in_work, *work;
+    int  n = fn->nblock, v, k, j, nw, live;
+
+    for (v = 1; v < s->nsym; v++) {
+	live = fn->var[v].live;
+	if (fn->var[v].sym != NULL && live >= 0 && IR_SET_HAS(fn->entry->live_in, live)) {
+	    ir_insert_insn(fn, fn->entry, fn->entry->first, IR_MOV, v,
+			   ir_opd(IR_VAR, v), ir_opd(IR_NONE, 0));
+	}
+    }
+
+    /* 変数毎に、定義するブロックの並び */
+    count = arena_alloc(&s->a, (s->nsym+1)*sizeof(int), ALLOC_IR);
+    start = arena_alloc(&s->a, (s->nsym+1)*sizeof(int), ALLOC_IR);
+    for (k = 0; k < n; k++) {
+	for (i = fn->block[k]->first; i != NULL; i = i->next) {
+	    if (is_var(s, ir_opd(IR_VAR, i->dst)) && fn->var[i->dst].live >= 0) {
+		count[i->dst+1]++;
+	    }
+	}
+    }
+    for (v = 0; v < s->nsym; v++) {
+	count[v+1] += count[v];
+	start[v+1] = count[v+1];
+    }
+    blocks = arena_alloc(&s->a, (count[s->nsym]+1)*sizeof(int), ALLOC_IR);
+    for (k = 0; k < n; k++) {
+	for (i = fn->block[k]->first; i != NULL; i = i->next) {
+	    if (is_var(s, ir_opd(IR_VAR, i->dst)) && fn->var[i->dst].live >= 0) {
+		blocks[count[i->dst]++] = k;
+	    }
+	}
+    }
+
+    has_phi = arena_alloc(&s->a, n*sizeof(int), ALLOC_IR);
+    in_work = arena_alloc(&s->a, n*sizeof(int), ALLOC_IR);
+    work = arena_alloc(&s->a, n*sizeof(int), ALLOC_IR);
+    for (v = 1; v < s->nsym; v++) {
+	live = fn->var[v].live;
+	if (fn->var[v].sym == NULL || live < 0) {
+	    continue;
+	}
+	nw = 0;
+	for (k = start[v]; k < start[v+1]; k++) {
+	    if (in_work[blocks[k]] != v) {
+		in_work[blocks[k]] = v;
+		work[nw++] = blocks[k];
+	    }
+	}
+	while (nw > 0) {
+	    b = fn->block[work[--nw]];
+	    for (j = 0; j < s->ndf[b->id]; j++) {
+		d = fn->block[s->df[b->id][j]];
+		if (has_phi[d->id] == v) {
+		    continue;
+		}
+		has_phi[d->id] = v;
+		if (!IR_SET_HAS(d->live_in, live)) {
+		    continue;
+		}
+		i = ir_insert_insn(fn, d, d->first, IR_PHI, v,
+				   ir_opd(IR_NONE, 0), ir_opd(IR_NONE, 0));
+		i->nargs = d->npred;
+		i->arg = arena_alloc(fn->arena, d->npred*sizeof(IR_Opd), ALLOC_IR);
+		for (k = 0; k < d->npred; k++) {
+		    i->arg[k] = ir_opd(IR_VAR, v);
+		}
+		if (in_work[d->id] != v) {
+		    in_work[d->id] = v;
+		    work[nw++] = d->id;
+		}
+	    }
+	}
+    }
+}
+
+/* 4. 支配木を前順に辿る。ブロックを出る時に、そこで付けた名前を記録（log）から戻す */
+void
+rename_vars(SSA *s)
+{
+    IR_Func *fn = s->fn;
+    int  *cur, *stack, *mark, *log = NULL, nlog = 0, size_log = 0, sp = 0, b, c, v;
+
+    cur = arena_alloc(&s->a, s->nsym*sizeof(int), ALLOC_IR);
+    for (v = 1; v < s->nsym; v++) {
+	cur[v] = v;
+    }
+    stack = arena_alloc(&s->a, 2*fn->nblock*sizeof(int), ALLOC_IR);
+    mark = arena_alloc(&s->a, fn->nblock*sizeof(int), ALLOC_IR);
+    stack[sp++] = fn->entry->id;
+    while (sp > 0) {
+	b = stack[--sp];
+	if (b < 0) {
+	    /* 出る時はlogに積んだ（変数, 前の名前）を戻す */
+	    for (b = -b-1; nlog > mark[b]; nlog -= 2) {
+		cur[log[nlog-2]] = log[nlog-1];
+	    }
+	    continue;
+	}
+	mark[b] = nlog;
+	rename_block(s, fn->block[b], cur, &log, &nlog, &size_log);
+	stack[sp++] = -b-1;
+	for (c = s->child[b]; c >= 0; c = s->sibling[c]) {
+	    stack[sp++] = c;
+	}
+    }
+    xfree(log);
+}
+
+void
+rename_block(SSA *s, IR_Block *b, int *cur, int **log, int *nlog, int *size_log)
+{
+    IR_Func *fn = s->fn;
+    IR_Block *t;
+    IR_Insn *i;
+    int  k, j;
+
+    for (i = b->first; i != NULL; i = i->next) {
+	if (i->op != IR_PHI) {
+	    if (is_var(s, i->a)) {
+		i->a.val = cur[i->a.val];
+	    }
+	    if (is_var(s, i->b)) {
+		i->b.val = cur[i->b.val];
+	    }
+	    for (k = 0; k < i->nargs; k++) {
+		if (is_var(s, i->arg[k])) {
+		    i->arg[k].val = cur[i->arg[k].val];
+		}
+	    }
+	}
+	if (is_var(s, ir_opd(IR_VAR, i->dst))) {
+	    if (*nlog+2 > *size_log) {
+		*size_log = (*size_log == 0) ? 64 : *size_log*2;
+		*log = xrealloc_tag(*log, *size_log*sizeof(int), ALLOC_IR);
+	    }
+	    (*log)[(*nlog)++] = i->dst;
+	    (*log)[(*nlog)++] = cur[i->dst];
+	    cur[i->dst] = ir_new_temp(fn);
+	    i->dst = cur[i->dst];
+	}
+    }
+    if (b->term != IR_JUMP && is_var(s, b->a)) {
+	b->a.val = cur[b->a.val];
+    }
+    if (b->term == IR_BRANCH && is_var(s, b->b)) {
+	b->b.val = cur[b->b.val];
+    }
+    /* 後続のphiの、bから来た時の値 */
+    for (k = 0; k < 2; k++) {
+	if ((t = b->succ[k]) == NULL || (k == 1 && t == b->succ[0])) {
+	    continue;
+	}
+	j = pred_index(t, b);
+	for (i = t->first; i != NULL && i->op == IR_PHI; i = i->next) {
+	    i->arg[j].val = cur[i->arg[j].val];
+	}
+    }
+}
+
+int
+pred_index(IR_Block *b, IR_Block *p)
+{
+    int  j;
+
+    for (j = 0; j < b->npred; j++) {
+	if (b->pred[j] == p) {
+	    return j;
+	}
+    }
+    errexit("Not a predecessor", __FILE__, __LINE__);
+    return -1;
+}
+
+/* oが名前を付け替える変数（仮引数・自動変数）か */
+int
+is_var(SSA *s, IR_Opd o)
+{
+    return o.kind == IR_VAR && o.val < s->nsym && s->fn->var[o.val].sym != NULL;
+}
+
+/* 変数毎の定義と参照 */
+void
+find_uses(SSA *s)
+{
+    IR_Func *fn = s->fn;
+    IR_Block *b;
+    IR_Insn *i;
+    int  *uses = NULL, size = 0, n, k, pass;
+
+    s->def = arena_alloc(&s->a, fn->nvar*sizeof(IR_Insn*), ALLOC_IR);
+    s->use = arena_alloc(&s->a, fn->nvar*sizeof(SSA_Use*), ALLOC_IR);
+    s->nuse = arena_alloc(&s->a, fn->nvar*sizeof(int), ALLOC_IR);
+    /* 1回目で数え、2回目で入れる */
+    for (pass = 0; pass < 2; pass++) {
+	for (b = fn->entry; b != NULL; b = b->next) {
+	    for (i = b->first; i != NULL; i = i->next) {
+		s->def[i->dst] = i;
+		if (i->nargs+2 > size) {
+		    size = i->nargs+2;
+		    uses = xrealloc_tag(uses, size*sizeof(int), ALLOC_IR);
+		}
+		for (k = ir_insn_uses(i, uses)-1; k >= 0; k--) {
+		    n = s->nuse[uses[k]]++;
+		    if (pass == 1) {
+			s->use[uses[k]][n].b = b;
+			s->use[uses[k]][n].i = i;
+		    }
+		}
+	    }
+	    for (k = 0; k < 2; k++) {
+		if ((k == 0) ? b->term == IR_JUMP : b->term != IR_BRANCH) {
+		    continue;
+		}
+		n = (k == 0) ? b->a.kind == IR_VAR : b->b.kind == IR_VAR;
+		if (!n) {
+		    continue;
+		}
+		n = (k == 0) ? b->a.val : b->b.val;
+		if (pass == 1) {
+		    s->use[n][s->nuse[n]].b = b;
+		    s->use[n][s->nuse[n]].i = NULL;
+		}
+		s->nuse[n]++;
+	    }
+	}
+	if (pass == 0) {
+	    for (k = 1; k < fn->nvar; k++) {
+		s->use[k] = arena_alloc(&s->a, s->nuse[k]*sizeof(SSA_Use), ALLOC_IR);
+		s->nuse[k] = 0;
+	    }
+	}
+    }
+    xfree(uses);
+}
+
+/* 5. 疎な条件付き定数伝播 */
+void
+propagate_constants(SSA *s)
+{
+    IR_Func *fn = s->fn;
+    IR_Block *b;
+    IR_Insn *i;
+    SSA_Use *u;
+    int  k, v, full;
+
+    s->state = arena_alloc(&s->a, fn->nvar, ALLOC_IR);
+    s->cval = arena_alloc(&s->a, fn->nvar*sizeof(int), ALLOC_IR);
+    s->exec_block = arena_alloc(&s->a, fn->nblock, ALLOC_IR);
+    s->exec_edge = arena_alloc(&s->a, fn->nblock*2, ALLOC_IR);
+    /* ブロック毎に、全ての命令を調べる時とphiだけを調べる時の高々2回ずつ積まれる */
+    s->flow = arena_alloc(&s->a, fn->nblock*2*sizeof(int)+sizeof(int), ALLOC_IR);
+    for (v = 1; v < fn->nvar; v++) {
+	/* 関数の入口の値（名前を付け替えていない変数）は分からない */
+	s->state[v] = (fn->var[v].sym != NULL) ? VAL_BOTTOM : VAL_TOP;
+    }
+    s->exec_block[fn->entry->id] = 1;
+    s->flow[s->nflow++] = fn->entry->id*2+1;
+    while (s->nflow > 0 || s->nwork > 0) {
+	if (s->nflow > 0) {
+	    k = s->flow[--s->nflow];
+	    b = fn->block[k/2];
+	    full = k%2;
+	    for (i = b->first; i != NULL && (full || i->op == IR_PHI); i = i->next) {
+		visit_insn(s, b, i);
+	    }
+	    if (full) {
+		visit_term(s, b);
+	    }
+	    continue;
+	}
+	v = s->work[--s->nwork];
+	for (k = 0; k < s->nuse[v]; k++) {
+	    u = &s->use[v][k];
+	    if (!s->exec_block[u->b->id]) {
+		continue;
+	    }
+	    if (u->i != NULL) {
+		visit_insn(s, u->b, u->i);
+	    } else {
+		visit_term(s, u->b);
+	    }
+	}
+    }
+}
+
+void
+visit_insn(SSA *s, IR_Block *b, IR_Insn *i)
+{
+    int  sa, sb, x, y, k, val;
+
+    switch (i->op) {
+    case  IR_PHI:
+	for (k = 0; k < i->nargs; k++) {
+	    if (edge_exec(s, b->pred[k], b)) {
+		sa = opd_state(s, i->arg[k], &x);
+		lower_val(s, i->dst, sa, x);
+	    }
+	}
+	return;
+    case  IR_CALL:
+	lower_val(s, i->dst, VAL_BOTTOM, 0);
+	return;
+    }
+    /* MOVとNEGは右のオペランドを持たないので、定数0とみなす */
+    y = 0;
+    sa = opd_state(s, i->a, &x);
+    sb = (i->op == IR_MOV || i->op == IR_NEG) ? VAL_CONST : opd_state(s, i->b, &y);
+    if (sa == VAL_BOTTOM || sb == VAL_BOTTOM) {
+	lower_val(s, i->dst, VAL_BOTTOM, 0);
+    } else if (sa == VAL_CONST && sb == VAL_CONST) {
+	if (i->op == IR_MOV) {
+	    lower_val(s, i->dst, VAL_CONST, x);
+	} else if (i->op == IR_NEG) {
+	    lower_val(s, i->dst, VAL_CONST, (int)(0u-(unsigned int)x));
+	} else if (fold(i->op, x, y, &val)) {
+	    lower_val(s, i->dst, VAL_CONST, val);
+	} else {
+	    lower_val(s, i->dst, VAL_BOTTOM, 0);
+	}
+    }
+}
+
+void
+visit_term(SSA *s, IR_Block *b)
+{
+    int  sa, sb, x, y, val;
+
+    switch (b->term) {
+    case  IR_JUMP:
+	mark_edge(s, b, 0);
+	break;
+    case  IR_BRANCH:
+	sa = opd_state(s, b->a, &x);
+	sb = opd_state(s, b->b, &y);
+	if (sa == VAL_CONST && sb == VAL_CONST) {
+	    fold(b->cond, x, y, &val);
+	    mark_edge(s, b, val ? 0 : 1);
+	} else if (sa == VAL_BOTTOM || sb == VAL_BOTTOM) {
+	    mark_edge(s, b, 0);
+	    mark_edge(s, b, 1);
+	}
+	break;
+    }
+}
+
+/* bのk番目の後続への辺を実行されうるものとし、飛び先を調べ直す */
+void
+mark_edge(SSA *s, IR_Block *b, int k)
+{
+    IR_Block *t = b->succ[k];
+
+    if (s->exec_edge[b->id*2+k]) {
+	return;
+    }
+    s->exec_edge[b->id*2+k] = 1;
+    if (!s->exec_block[t->id]) {
+	s->exec_block[t->id] = 1;
+	s->flow[s->nflow++] = t->id*2+1;
+    } else if (t->first != NULL && t->first->op == IR_PHI) {
+	s->flow[s->nflow++] = t->id*2;
+    }
+}
+
+int
+edge_exec(SSA *s, IR_Block *p, IR_Block *b)
+{
+    return (p->succ[0] == b && s->exec_edge[p->id*2])
+	|| (p->succ[1] == b && s->exec_edge[p->id*2+1]);
+}
+
+/* 変数vの値を束の下の方へ動かす。変わったらvを参照する命令を調べ直す */
+void
+lower_val(SSA *s, int v, int state, int c)
+{
+    if (state == VAL_CONST && s->state[v] == VAL_CONST && s->cval[v] != c) {
+	state = VAL_BOTTOM;
+    }
+    if (state <= s->state[v]) {
+	return;
+    }
+    s->state[v] = state;
+    s->cval[v] = c;
+    if (s->nwork == s->size_work) {
+	s->size_work = (s->size_work == 0) ? 64 : s->size_work*2;
+	s->work = xrealloc_tag(s->work, s->size_work*sizeof(int), ALLOC_IR);
+    }
+    s->work[s->nwork++] = v;
+}
+
+int
+opd_state(SSA *s, IR_Opd o, int *c)
+{
+    *c = 0;
+    if (o.kind == IR_CONST) {
+	*c = o.val;
+	return VAL_CONST;
+    } else if (o.kind != IR_VAR) {
+	return VAL_BOTTOM;
+    }
+    *c = s->cval[o.val];
+    return s->state[o.val];
+}
+
+/* x op y の値。実行時の例外になる除算なら0を返す */
+int
+fold(int op, int x, int y, int *val)
+{
+    unsigned int  ux = x, uy = y;
+
+    switch (op) {
+    case  IR_ADD:	*val = (int)(ux+uy);	break;
+    case  IR_SUB:	*val = (int)(ux-uy);	break;
+    case  IR_MUL:	*val = (int)(ux*uy);	break;
+    case  IR_DIV:
+	if (y == 0 || (x == INT_MIN && y == -1)) {
+	    return 0;
+	}
+	*val = x/y;
+	break;
+    case  IR_LT:	*val = x < y;	break;
+    case  IR_GT:	*val = x > y;	break;
+    case  IR_LTE:	*val = x <= y;	break;
+    case  IR_GTE:	*val = x >= y;	break;
+    case  IR_EQ:	*val = x == y;	break;
+    case  IR_NE:	*val = x != y;	break;
+    default:
+	errexit("Invalid IR instruction", __FILE__, __LINE__);
+    }
+    return 1;
+}
+
+/*
+ * 定数伝播の結果でIRを書き換える
+ * 実行されない辺をphiと先行から除き、定数になった変数の参照を定数にして定義を除く
+ * 後続の一方にしか行かない分岐は無条件の分岐にし、実行されないブロックを除く
+ */
+void
+rewrite_constants(SSA *s)
+{
+    IR_Func *fn = s->fn;
+    IR_Block *b, **p;
+    IR_Insn *i;
+    int  j, n, k;
+
+    /* 先行を詰めるのは、分岐を書き換えて辺の番号が変わる前に行う */
+    for (b = fn->entry; b != NULL; b = b->next) {
+	if (!s->exec_block[b->id]) {
+	    continue;
+	}
+	for (j = n = 0; j < b->npred; j++) {
+	    if (!s->exec_block[b->pred[j]->id] || !edge_exec(s, b->pred[j], b)) {
+		continue;
+	    }
+	    for (i = b->first; i != NULL && i->op == IR_PHI; i = i->next) {
+		i->arg[n] = i->arg[j];
+	    }
+	    b->pred[n++] = b->pred[j];
+	}
+	b->npred = n;
+	for (i = b->first; i != NULL && i->op == IR_PHI; i = i->next) {
+	    i->nargs = n;
+	}
+    }
+    for (b = fn->entry; b != NULL; b = b->next) {
+	if (!s->exec_block[b->id]) {
+	    continue;
+	}
+	TRAVERSE_IR_INSNS(i, b, {
+		replace_const(s, &i->a);
+		replace_const(s, &i->b);
+		for (k = 0; k < i->nargs; k++) {
+		    replace_const(s, &i->arg[k]);
+		}
+		if (i->op != IR_CALL && s->state[i->dst] == VAL_CONST) {
+		    ir_remove_insn(b, i);
+		}
+	    });
+	if (b->term != IR_JUMP) {
+	    replace_const(s, &b->a);
+	}
+	if (b->term == IR_BRANCH) {
+	    replace_const(s, &b->b);
+	    if (s->exec_edge[b->id*2] != s->exec_edge[b->id*2+1]) {
+		b->succ[0] = b->succ[s->exec_edge[b->id*2] ? 0 : 1];
+		b->succ[1] = NULL;
+		b->term = IR_JUMP;
+		b->a = b->b = ir_opd(IR_NONE, 0);
+	    }
+	}
+    }
+    for (p = &fn->entry; *p != NULL; ) {
+	if (!s->exec_block[(*p)->id]) {
+	    *p = (*p)->next;
+	} else {
+	    p = &(*p)->next;
+	}
+    }
+    ir_number_blocks(fn);
+}
+
+void
+replace_const(SSA *s, IR_Opd *o)
+{
+    if (o->kind == IR_VAR && s->state[o->val] == VAL_CONST) {
+	*o = ir_opd(IR_CONST, s->cval[o->val]);
+    }
+}
+
+/*
+ * 6. コピーの伝播
+ * replに置き換え先を入れ、phiが自明になることもあるので変わらなくなるまで繰り返す
+ */
+void
+propagate_copies(SSA *s)
+{
+    IR_Func *fn = s->fn;
+    IR_Block *b;
+    IR_Insn *i;
+    IR_Opd  *repl, x, o;
+    int  k, same, changed;
+
+    repl = arena_alloc(&s->a, fn->nvar*sizeof(IR_Opd), ALLOC_IR);
+    do {
+	changed = 0;
+	for (b = fn->entry; b != NULL; b = b->next) {
+	    for (i = b->first; i != NULL; i = i->next) {
+		if (repl[i->dst].kind != IR_NONE) {
+		    continue;
+		}
+		if (i->op == IR_MOV) {
+		    x = resolve(repl, i->a);
+		} else if (i->op == IR_PHI) {
+		    x = ir_opd(IR_NONE, 0);
+		    for (k = 0, same = 1; k < i->nargs && same; k++) {
+			o = resolve(repl, i->arg[k]);
+			if (o.kind == IR_VAR && o.val == i->dst) {
+			    continue;
+			}
+			if (x.kind == IR_NONE) {
+			    x = o;
+			}
+			same = (o.kind == x.kind && o.val == x.val);
+		    }
+		    if (!same) {
+			continue;
+		    }
+		} else {
+		    continue;
+		}
+		if (x.kind == IR_NONE || (x.kind == IR_VAR && fn->var[x.val].sym != NULL)) {
+		    continue;
+		}
+		repl[i->dst] = x;
+		changed = 1;
+	    }
+	}
+    } while (changed);
+
+    for (b = fn->entry; b != NULL; b = b->next) {
+	for (i = b->first; i != NULL; i = i->next) {
+	    i->a = resolve(repl, i->a);
+	    i->b = resolve(repl, i->b);
+	    for (k = 0; k < i->nargs; k++) {
+		i->arg[k] = resolve(repl, i->arg[k]);
+	    }
+	}
+	b->a = resolve(repl, b->a);
+	b->b = resolve(repl, b->b);
+    }
+}
+
+/* 置き換え先を辿る。辿った変数は最後の置き換え先を直接指すようにする */
+IR_Opd
+resolve(IR_Opd *repl, IR_Opd o)
+{
+    IR_Opd  x = o, next;
+
+    while (x.kind == IR_VAR && repl[x.val].kind != IR_NONE) {
+	x = repl[x.val];
+    }
+    while (o.kind == IR_VAR && repl[o.val].kind != IR_NONE) {
+	next = repl[o.val];
+	repl[o.val] = x;
+	o = next;
+    }
+    return x;
+}
+
+/* 7. 除けない命令から、読む変数を定義する命令を辿って印を付け、残りを除く */
+void
+remove_dead(SSA *s)
+{
+    IR_Func *fn = s->fn;
+    IR_Block *b;
+    IR_Insn *i;
+    char  *need;
+    int  k, v;
+
+    need = arena_alloc(&s->a, fn->nvar, ALLOC_IR);
+    s->nwork = 0;
+    for (b = fn->entry; b != NULL; b = b->next) {
+	for (i = b->first; i != NULL; i = i->next) {
+	    s->def[i->dst] = i;
+	    if (is_root(i)) {
+		need_opd(s, need, ir_opd(IR_VAR, i->dst));
+	    }
+	}
+	need_opd(s, need, b->a);
+	need_opd(s, need, b->b);
+    }
+    while (s->nwork > 0) {
+	v = s->work[--s->nwork];
+	if ((i = s->def[v]) == NULL) {
+	    continue;
+	}
+	need_opd(s, need, i->a);
+	need_opd(s, need, i->b);
+	for (k = 0; k < i->nargs; k++) {
+	    need_opd(s, need, i->arg[k]);
+	}
+    }
+    for (b = fn->entry; b != NULL; b = b->next) {
+	TRAVERSE_IR_INSNS(i, b, {
+		if (!need[i->dst]) {
+		    ir_remove_insn(b, i);
+		}
+	    });
+    }
+}
+
+/* 値を使わなくても除けない命令 */
+int
+is_root(IR_Insn *i)
+{
+    if (i->op == IR_CALL) {
+	return 1;
+    }
+    /* 0や-1で割る（INT_MIN / -1）かもしれない除算 */
+    return i->op == IR_DIV
+	&& (i->b.kind != IR_CONST || i->b.val == 0 || i->b.val == -1);
+}
+
+void
+need_opd(SSA *s, char *need, IR_Opd o)
+{
+    if (o.kind != IR_VAR || need[o.val]) {
+	return;
+    }
+    need[o.val] = 1;
+    if (s->nwork == s->size_work) {
+	s->size_work = (s->size_work == 0) ? 64 : s->size_work*2;
+	s->work = xrealloc_tag(s->work, s->size_work*sizeof(int), ALLOC_IR);
+    }
+    s->work[s->nwork++] = o.val;
+}
+
+/*
+ * 8. SSA形式から戻す
+ * 先行pからの値のコピーは、pの後続が1つならpの末尾、そうでなければ
+ * （1.で辺を分けてあるので）ブロックの先行はpだけなので、phiの後に置く
+ */
+void
+leave_ssa(SSA *s)
+{
+    IR_Func *fn = s->fn;
+    IR_Block *b, *p;
+    IR_Insn *i, *body;
+    IR_Opd  *src;
+    int  *dst, n, j, size = 0;
+
+    dst = NULL;
+    src = NULL;
+    for (b = fn->entry; b != NULL; b = b->next) {
+	if (b->first == NULL || b->first->op != IR_PHI) {
+	    continue;
+	}
+	for (n = 0, i = b->first; i != NULL && i->op == IR_PHI; i = i->next) {
+	    n++;
+	}
+	body = i;
+	if (n > size) {
+	    size = n;
+	    dst = xrealloc_tag(dst, size*sizeof(int), ALLOC_IR);
+	    src = xrealloc_tag(src, size*sizeof(IR_Opd), ALLOC_IR);
+	}
+	for (j = 0; j < b->npred; j++) {
+	    p = b->pred[j];
+	    for (n = 0, i = b->first; i != body; i = i->next, n++) {
+		dst[n] = i->dst;
+		src[n] = i->arg[j];
+	    }
+	    if (p->term == IR_JUMP) {
+		emit_copies(s, p, NULL, dst, src, n);
+	    } else if (b->npred == 1) {
+		emit_copies(s, b, body, dst, src, n);
+	    } else {
+		errexit("Critical edge", __FILE__, __LINE__);
+	    }
+	}
+	TRAVERSE_IR_INSNS(i, b, {
+		if (i->op == IR_PHI) {
+		    ir_remove_insn(b, i);
+		}
+	    });
+    }
+    xfree(dst);
+    xfree(src);
+    xfree(s->work);
+}
+
+/*
+ * 同時に行うコピー dst[k] = src[k] を、ブロックbの命令beforeの前に順に置く
+ * 他のコピーが読む変数に書くものは後回しにし、残りが循環するだけになったら
+ * 1つを一時変数に退避して循環を切る
+ */
+void
+emit_copies(SSA *s, IR_Block *b, IR_Insn *before, int *dst, IR_Opd *src, int n)
+{
+    IR_Func *fn = s->fn;
+    int  k, j, t;
+
+    for (k = 0; k < n; ) {
+	if (src[k].kind == IR_VAR && src[k].val == dst[k]) {
+	    dst[k] = dst[--n];
+	    src[k] = src[n];
+	} else {
+	    k++;
+	}
+    }
+    while (n > 0) {
+	for (k = 0; k < n; k++) {
+	    for (j = 0; j < n; j++) {
+		if (j != k && src[j].kind == IR_VAR && src[j].val == dst[k]) {
+		    break;
+		}
+	    }
+	    if (j == n) {
+		break;
+	    }
+	}
+	if (k == n) {
+	    t = ir_new_temp(fn);
+	    ir_insert_insn(fn, b, before, IR_MOV, t, ir_opd(IR_VAR, dst[0]), ir_opd(IR_NONE, 0));
+	    for (j = 0; j < n; j++) {
+		if (src[j].kind == IR_VAR && src[j].val == dst[0]) {
+		    src[j].val = t;
+		}
+	    }
+	    continue;
+	}
+	ir_insert_insn(fn, b, before, IR_MOV, dst[k], src[k], ir_opd(IR_NONE, 0));
+	dst[k] = dst[--n];
+	src[k] = src[n];
+    }
+}
@@ -0,0 +1,196 @@
+/*
+    Tiny Language Compiler (tlc)
+
+    段階毎のコンパイル時間と使用メモリの計測（--time-report）
+
+    2016年 木村啓二
+*/
+
+#include  <stdio.h>
+#include  <string.h>
+#include  <sys/resource.h>
+#include  <time.h>
+#include  "compiler.h"
+#include  "stats.h"
+
+static const char *phase_name[NUM_PHASES] = {
+    "other",
+    "parse",
+    "resolve",
+    "optimize",
+    "assign_memory",
+    "assign_regs",
+    "dump",
+    "gen_code",
+};
+
+static long peak_rss(void);
+static void report_text(Compiler *cc, Emit *e);
+static void report_json(Compiler *cc, Emit *e);
+static void emit_json_str(Emit *e, const char *s);
+
+double
+stats_now(void)
+{
+    struct timespec  ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec*1e-9;
+}
+
+double
+stats_cpu_now(void)
+{
+    struct timespec  ts;
+
+    clock_gettime(CLOCK_THREAD_CPUTIME_ID, &ts);
+    return ts.tv_sec + ts.tv_nsec*1e-9;
+}
+
+/* プロセス全体の最大常駐量（KB）。-jで同時にコンパイルする他のファイルの分も含む */
+long
+peak_rss(void)
+{
+    struct rusage  ru;
+
+    if (getrusage(RUSAGE_SELF, &ru) < 0) {
+	return 0;
+    }
+#ifdef __APPLE__
+    return ru.ru_maxrss / 1024;		/* byte単位 */
+#else
+    return ru.ru_maxrss;
+#endif
+}
+
+void
+stats_begin(Compiler *cc)
+{
+    CompileStats *s = &cc->stats;
+
+    memset(s, 0, sizeof(CompileStats));
+    s->phase = PHASE_OTHER;
+    s->start = stats_now();
+    emit_count_insns(&cc->out);
+}
+
+int
+stats_phase(Compiler *cc, int phase)
+{
+    CompileStats *s = &cc->stats;
+    double  t;
+    int  prev;
+
+    if (cc->opt->time_report == TIME_REPORT_NONE) {
+	return phase;
+    }
+    t = stats_now();
+    prev = s->phase;
+    s->time[prev] += t - s->start;
+    s->arena[prev] += s->arena_bytes - s->arena_mark;
+    s->peak_rss[prev] = peak_rss();
+    s->phase = phase;
+    s->start = t;
+    s->arena_mark = s->arena_bytes;
+    return prev;
+}
+
+void
+stats_report(Compiler *cc)
+{
+    Emit  *e = &cc->err;
+
+    stats_phase(cc, PHASE_OTHER);
+    if (cc->opt->time_report == TIME_REPORT_JSON) {
+	report_json(cc, e);
+    } else {
+	report_text(cc, e);
+    }
+    emit_flush(e);
+}
+
+void
+report_text(Compiler *cc, Emit *e)
+{
+    CompileStats *s = &cc->stats;
+    char  line[128];
+    double  total = 0;
+    size_t  arena = 0;
+    int  i;
+
+    emit_str(e, "time report: ");
+    emit_str(e, cc->in_file);
+    emit_str(e, "\n  phase            time(ms)   arena(KB)  peak RSS(KB)\n");
+    for (i = 0; i < NUM_PHASES; i++) {
+	snprintf(line, sizeof(line), "  %-14s %10.3f %11lu %13ld\n", phase_name[i],
+		 s->time[i]*1e3, (unsigned long)(s->arena[i]/1024), s->peak_rss[i]);
+	emit_str(e, line);
+	if (i == PHASE_ASSIGN_REGS) {
+	    /* 関数毎のCPU時間の合計なので、-jでは段階の時間を超えうる */
+	    snprintf(line, sizeof(line), "    pass 1 (cpu) %10.3f\n    pass 2 (cpu) %10.3f\n",
+		     s->regs_pass[0]*1e3, s->regs_pass[1]*1e3);
+	    emit_str(e, line);
+	}
+	total += s->time[i];
+	arena += s->arena[i];
+    }
+    snprintf(line, sizeof(line), "  %-14s %10.3f %11lu %13ld\n", "total",
+	     total*1e3, (unsigned long)(arena/1024), peak_rss());
+    emit_str(e, line);
+    snprintf(line, sizeof(line),
+	     "  ast nodes %ld, list cells %ld, symbols %ld, labels %d, instructions %ld\n",
+	     s->ast_nodes, s->list_cells, s->symbols, cc->cg.local_label,
+	     emit_insns(&cc->out));
+    emit_str(e, line);
+}
+
+/* {"report":"time","file":..,"phases":{"parse":{"ms":..,"arena_bytes":..,"peak_rss_kb":..},..},
+    "assign_regs_pass_cpu_ms":[..,..],"total_ms":..,"counts":{..}} */
+void
+report_json(Compiler *cc, Emit *e)
+{
+    CompileStats *s = &cc->stats;
+    char  buf[256];
+    double  total = 0;
+    int  i;
+
+    EMIT_LIT(e, "{\"report\":\"time\",\"file\":");
+    emit_json_str(e, cc->in_file);
+    EMIT_LIT(e, ",\"phases\":{");
+    for (i = 0; i < NUM_PHASES; i++) {
+	snprintf(buf, sizeof(buf),
+		 "%s\"%s\":{\"ms\":%.3f,\"arena_bytes\":%lu,\"peak_rss_kb\":%ld}",
+		 (i > 0) ? "," : "", phase_name[i], s->time[i]*1e3,
+		 (unsigned long)s->arena[i], s->peak_rss[i]);
+	emit_str(e, buf);
+	total += s->time[i];
+    }
+    snprintf(buf, sizeof(buf),
+	     "},\"assign_regs_pass_cpu_ms\":[%.3f,%.3f],\"total_ms\":%.3f,\"peak_rss_kb\":%ld,"
+	     "\"counts\":{\"ast_nodes\":%ld,\"list_cells\":%ld,\"symbols\":%ld,"
+	     "\"labels\":%d,\"instructions\":%ld}}\n",
+	     s->regs_pass[0]*1e3, s->regs_pass[1]*1e3, total*1e3, peak_rss(),
+	     s->ast_nodes, s->list_cells, s->symbols, cc->cg.local_label,
+	     emit_insns(&cc->out));
+    emit_str(e, buf);
+}
+
+void
+emit_json_str(Emit *e, const char *s)
+{
+    char  buf[8];
+
+    emit_char(e, '"');
+    for (; *s != '\0'; s++) {
+	if (*s == '"' || *s == '\\') {
+	    emit_char(e, '\\');
+	    emit_char(e, *s);
+	} else if ((unsigned char)*s < 0x20) {
+	    snprintf(buf, sizeof(buf), "\\u%04x", *s);
+	    emit_str(e, buf);
+	} else {
+	    emit_char(e, *s);
+	}
+    }
+    emit_char(e, '"');
+}
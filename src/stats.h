@@ -0,0 +1,66 @@
+/*
+    Tiny Language Compiler (tlc)
+
+    段階毎のコンパイル時間と使用メモリの計測（--time-report）
+
+    2016年 木村啓二
+*/
+
+#ifndef  STATS_H
+#define  STATS_H
+
+#include  <stddef.h>
+
+/* 報告の形式（--time-report=text|json） */
+enum {
+    TIME_REPORT_NONE,
+    TIME_REPORT_TEXT,
+    TIME_REPORT_JSON		/* 1つの翻訳単位を1行のJSONで出力 */
+};
+
+/* 計測する段階。どの段階にも入らない準備や後始末はPHASE_OTHER */
+enum {
+    PHASE_OTHER,
+    PHASE_PARSE,		/* 字句解析・構文解析（名前の解決を除く） */
+    PHASE_RESOLVE,		/* 名前の解決（check_exp） */
+    PHASE_OPTIMIZE,		/* ASTの最適化（-O2） */
+    PHASE_ASSIGN_MEMORY,
+    PHASE_ASSIGN_REGS,
+    PHASE_DUMP,
+    PHASE_GEN_CODE,
+    NUM_PHASES
+};
+
+/*
+ * 段階を切り替えるたびに、それまでの段階に経過時間と領域の確保量を足し、
+ * その時点の最大常駐量を記録する
+ * 逐次コンパイル（--stream）では段階が関数毎に入れ子になるが、
+ * 切り替えた時の段階に戻すことで各段階の合計が求まる
+ */
+typedef struct CompileStats {
+    int  phase;			/* 計測中の段階 */
+    double  start;		/* phaseに入った時刻（秒） */
+    size_t  arena_bytes;	/* 領域に確保したチャンクの合計 */
+    size_t  arena_mark;		/* phaseに入った時のarena_bytes */
+    double  time[NUM_PHASES];
+    size_t  arena[NUM_PHASES];	/* 領域に確保したチャンク（mallocの分は含まない） */
+    long  peak_rss[NUM_PHASES];	/* 段階を終えた時点の最大常駐量（KB） */
+    double  regs_pass[2];	/* レジスタ割り付けの各パスのCPU時間（関数毎・スレッド毎の合計） */
+    long  ast_nodes, list_cells, symbols;
+} CompileStats;
+
+struct Compiler;
+
+/* 単調増加する時計（秒） */
+extern double  stats_now(void);
+/* 呼び出したスレッドのCPU時間（秒） */
+extern double  stats_cpu_now(void);
+/* 計測を始める（PHASE_OTHERに入る） */
+extern void  stats_begin(struct Compiler *cc);
+/* phaseに切り替え、それまでの段階を返す
+   計測しない時は何もせずphaseを返す */
+extern int  stats_phase(struct Compiler *cc, int phase);
+/* 計測を終え、cc->errに報告する */
+extern void  stats_report(struct Compiler *cc);
+
+#endif	/* STATS_H */
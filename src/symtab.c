@@ -6,117 +6,209 @@
     2016年 木村啓二
 */
 
+#include  <stdint.h>
 #include  <stdio.h>
 #include  <stdlib.h>
 #include  <string.h>
 #include  "ast.h"
-#include  "util.h"
+#include  "compiler.h"
 #include  "symtab.h"
+#include  "util.h"
 
-/* 現在処理関数のシンボルテーブル */
-SymTab current_symtab;
+#define INDEX_MIN_SIZE 16
 
-/* 各関数のシンボルテーブルを納める領域のポインタ */
-SymTab **symtab_array;
+static unsigned int hash_ident(const char *ident);
+static SymTab **probe_index(SymIndex *x, const char *ident);
+static void grow_index(SymIndex *x);
 
-/* 関数名のテーブルの先頭（先頭はダミー） */
-SymTab func_symtab;
+unsigned int
+hash_ident(const char *ident)
+{
+    /* 下位ビットは整列のため偏るので、積の上位ビットを使う */
+    return (unsigned int)(((uintptr_t)ident * 0x9E3779B97F4A7C15ull) >> 32);
+}
 
-/* 登録済み関数idの最大値 */
-int  max_id;
+/* identの入るべきスロットを返す
+   登録済みならそのエントリーを指すスロット、なければ空きスロット */
+SymTab**
+probe_index(SymIndex *x, const char *ident)
+{
+    unsigned int  mask, i;
 
-/* symtab_arrayのサイズ */
-int  size_symtab_array;
+    mask = x->size-1;
+    for (i = hash_ident(ident) & mask; x->slot[i] != NULL; i = (i+1) & mask) {
+	if (x->slot[i]->ident == ident) {
+	    break;
+	}
+    }
+    return &x->slot[i];
+}
+
+/* 充填率が1/2を超えないように表を拡張する */
+void
+grow_index(SymIndex *x)
+{
+    int  i, osize;
+    SymTab **oslot;
+
+    osize = x->size;
+    oslot = x->slot;
+    x->size = (osize == 0) ? INDEX_MIN_SIZE : osize*2;
+    x->slot = xcalloc_tag(x->size, sizeof(SymTab*), ALLOC_SYMTAB);
+    for (i = 0; i < osize; i++) {
+	if (oslot[i] != NULL) {
+	    *probe_index(x, oslot[i]->ident) = oslot[i];
+	}
+    }
+    xfree(oslot);
+}
 
 /* 変数identを型typeで現在処理関数のシンボルテーブルに追加する
+   identはintern()で得た文字列でなければならない
    既に登録済みなら0を返す */
 int
-append_sym(int type, int symkind, char *ident)
+append_sym(Compiler *cc, int type, int symkind, char *ident)
 {
-    int  ok = 1;
-    SymTab *t = NULL;
+    SymTab *t, *h = NULL, **p;
+    SymIndex *x = NULL;
+    Arena  *a = NULL;
 
     if (symkind == SYM_NONE) {
 	errexit("Illegal symbol kind.\n", __FILE__, __LINE__);
     } else if (symkind == SYM_FUNC) {
-	t = &func_symtab;
+	h = &cc->func_symtab; x = &cc->func_index; a = &cc->unit_arena;
     } else {
-	t = &current_symtab;
+	h = &cc->current_symtab; x = &cc->current_index; a = &cc->func_arena;
     }
-    for ( ; t->next != NULL; t = t->next) {
-	if (strcmp(ident, t->next->ident) == 0) {
-	    ok = 0;
-	    break;
-	}
+    if ((x->count+1)*2 > x->size) {
+	grow_index(x);
     }
-    if (ok) {
-	t->next = xcalloc(1, sizeof(SymTab));
-	t->next->type = type;
-	t->next->kind = symkind;
-	t->next->entry = t->entry+1;
-	if ((t->next->ident = strdup(ident)) == NULL) {
-	    fprintf(stderr, "Not enough memory for strdup.\n");
-	    abort();
-	}
+    p = probe_index(x, ident);
+    if (*p != NULL) {
+	return 0;
     }
-    return ok;
+    if (x->tail == NULL) {
+	x->tail = h;
+    }
+    t = arena_alloc(a, sizeof(SymTab), ALLOC_SYMTAB);
+    t->type = type;
+    t->kind = symkind;
+    t->entry = x->tail->entry+1;
+    t->ident = ident;
+    x->tail->next = t;
+    x->tail = t;
+    x->count++;
+    cc->stats.symbols++;
+    *p = t;
+
+    return 1;
 }
 
 /* idで識別される関数のシンボルテーブルより変数identを探す
+   identはintern()で得た文字列でなければならない
    idが0の時は現在処理関数
    存在したらそのエントリーのポインタを返す。なければNULL */
 SymTab*
-lookup_sym(int id, int symkind, char *ident)
+lookup_sym(Compiler *cc, int id, int symkind, char *ident)
 {
-    SymTab *t;
+    SymIndex *x = NULL;
     if (symkind == SYM_NONE) {
 	errexit("Illegal symbol kind.\n", __FILE__, __LINE__);
     }
     if (id == 0) {
 	if (symkind == SYM_FUNC) {
-	    t = func_symtab.next;
+	    x = &cc->func_index;
 	} else {
-	    t = current_symtab.next;
+	    x = &cc->current_index;
 	}
-    } else if (id <= max_id) {
+    } else if (id <= cc->max_id) {
 	if (symkind == SYM_FUNC) {
 	    errexit("Illegal symbol kind (for functions).\n",
 		    __FILE__, __LINE__);
 	}
-	t = symtab_array[id];
+	x = &cc->index_array[id];
     } else {
-	fprintf(stderr, "Illegal function id(%d).\n", id);
-	abort();
+	errexit("Illegal function id.", __FILE__, __LINE__);
     }
-    for (; t != NULL; t = t->next) {
-	if (strcmp(t->ident, ident) == 0) {
-	    break;
-	}
+    if (x->count == 0) {
+	return NULL;
     }
-    return t;
+    return *probe_index(x, ident);
 }
 
-/* 現在処理関数をid(1以上)で識別される関数のシンボルテーブルとして登録する */
+/* 現在処理関数をid(1以上)で識別される関数のシンボルテーブルとして登録する
+   現在処理関数の領域(func_arena)もidの関数のものとして引き取る */
 #define CHUNK 10
 
 void
-commit_current_symtab(int id)
+commit_current_symtab(Compiler *cc, int id)
 {
     if (id == 0) {
-	fprintf(stderr, "Illegal id number.\n");
-	abort();
+	errexit("Illegal id number.", __FILE__, __LINE__);
     }
-    if (id >= size_symtab_array) {
-	size_symtab_array
-	    = (id > size_symtab_array+CHUNK) ? id : size_symtab_array+CHUNK;
-	symtab_array
-	    = xrealloc(symtab_array, size_symtab_array*sizeof(SymTab*));
+    if (id >= cc->size_symtab_array) {
+	cc->size_symtab_array
+	    = (id > cc->size_symtab_array+CHUNK) ? id : cc->size_symtab_array+CHUNK;
+	cc->symtab_array
+	    = xrealloc_tag(cc->symtab_array, cc->size_symtab_array*sizeof(SymTab*), ALLOC_SYMTAB);
+	cc->index_array
+	    = xrealloc_tag(cc->index_array, cc->size_symtab_array*sizeof(SymIndex), ALLOC_SYMTAB);
+	cc->arena_array
+	    = xrealloc_tag(cc->arena_array, cc->size_symtab_array*sizeof(Arena), ALLOC_SYMTAB);
+	cc->ir_array
+	    = xrealloc_tag(cc->ir_array, cc->size_symtab_array*sizeof(struct IR_Func*), ALLOC_SYMTAB);
     }
-    if (max_id < id) {
-	max_id = id;
+    if (cc->max_id < id) {
+	cc->max_id = id;
+    }
+    cc->symtab_array[id] = cc->current_symtab.next;
+    cc->index_array[id] = cc->current_index;
+    cc->arena_array[id] = cc->func_arena;
+    cc->ir_array[id] = NULL;
+    cc->current_symtab.next = NULL;
+    memset(&cc->current_index, 0, sizeof(cc->current_index));
+    memset(&cc->func_arena, 0, sizeof(cc->func_arena));
+    cc->func_arena.pool = cc->arena_pool;
+    cc->func_arena.allocated = &cc->stats.arena_bytes;
+}
+
+/* idの関数のASTとシンボルテーブル（とIR）を一括して解放する */
+void
+release_symtab(Compiler *cc, int id)
+{
+    if (id <= 0 || id > cc->max_id) {
+	errexit("Illegal function id.", __FILE__, __LINE__);
     }
-    symtab_array[id] = current_symtab.next;
-    current_symtab.next = NULL;
+    xfree(cc->index_array[id].slot);
+    memset(&cc->index_array[id], 0, sizeof(SymIndex));
+    cc->symtab_array[id] = NULL;
+    cc->ir_array[id] = NULL;
+    arena_free(&cc->arena_array[id]);
+}
+
+/* 残っているシンボルテーブルと索引を全て解放する */
+void
+free_symtab(Compiler *cc)
+{
+    int  i;
+
+    for (i = 1; i <= cc->max_id; i++) {
+	release_symtab(cc, i);
+    }
+    xfree(cc->current_index.slot);
+    xfree(cc->func_index.slot);
+    xfree(cc->symtab_array);
+    xfree(cc->index_array);
+    xfree(cc->arena_array);
+    xfree(cc->ir_array);
+    cc->current_symtab.next = cc->func_symtab.next = NULL;
+    memset(&cc->current_index, 0, sizeof(SymIndex));
+    memset(&cc->func_index, 0, sizeof(SymIndex));
+    cc->symtab_array = NULL;
+    cc->index_array = NULL;
+    cc->arena_array = NULL;
+    cc->ir_array = NULL;
+    cc->max_id = cc->size_symtab_array = 0;
 }
 
 /* tlcにおけるx86 (32bit)スタックレイアウトメモ
@@ -154,63 +246,155 @@ commit_current_symtab(int id)
   上記の整列補正のためのpad数計算はコード生成側(cg.c)で行う
 */
 int
-get_frame_size(int id)
+get_frame_size(Compiler *cc, int id)
 {
     int  maxo;
     SymTab *t;
     if (id == 0) {
-	t = current_symtab.next;
-    } else if (id <= max_id) {
-	t = symtab_array[id];
+	t = cc->current_symtab.next;
+    } else if (id <= cc->max_id) {
+	t = cc->symtab_array[id];
     } else {
-	fprintf(stderr, "Illegal function id(%d).\n", id);
-	abort();
+	errexit("Illegal function id.", __FILE__, __LINE__);
     }
     maxo = 0;
     for (; t != NULL; t = t->next) {
-	if (t->kind == SYM_AUTOVAR && maxo < -t->offset) {
+	if ((t->kind == SYM_AUTOVAR || t->kind == SYM_SPILL) && maxo < -t->offset) {
 	    maxo = -t->offset;
 	}
     }
     return maxo;
 }
 
+/* 退避領域は名前で探すことはないので、索引には登録しない
+   並列処理中でも、領域は関数毎のもの(cc->arena_array[id])から確保する */
+int
+append_spill_slot(Compiler *cc, int id)
+{
+    static char  name[] = "(spill)";
+    SymTab *t, **p;
+    int  entry = 0;
+
+    if (id <= 0 || id > cc->max_id) {
+	errexit("Illegal function id.", __FILE__, __LINE__);
+    }
+    for (p = &cc->symtab_array[id]; *p != NULL; p = &(*p)->next) {
+	entry = (*p)->entry;
+    }
+    t = arena_alloc(&cc->arena_array[id], sizeof(SymTab), ALLOC_SYMTAB);
+    t->type = TYPE_INT;
+    t->kind = SYM_SPILL;
+    t->entry = entry+1;
+    t->offset = -(get_frame_size(cc, id)+4);
+    t->ident = name;
+    *p = t;
+    return t->offset;
+}
+
 void
-assign_memory(void)
+assign_memory(Compiler *cc)
 {
     int i;
+
+    for (i = 1; i <= cc->max_id; i++) {
+	assign_memory_func(cc, i);
+    }
+}
+
+/* idの関数の仮引数・自動変数にスタックフレーム中のオフセットを割り付ける
+   オフセットは関数毎に数え直す */
+void
+assign_memory_func(Compiler *cc, int id)
+{
     int id_arg, id_var;
     SymTab *t;
 
+    if (id <= 0 || id > cc->max_id) {
+	errexit("Illegal function id.", __FILE__, __LINE__);
+    }
     id_arg = 1; id_var = 0;
-    for (i = 1; i <= max_id; i++) {
-	for (t = symtab_array[i]; t != NULL; t = t->next) {
-	    /* 変数のサイズはint 4byteで固定 */
-	    if (t->kind == SYM_ARG) {
-		t->offset = (++id_arg)*4;
-	    } else if (t->kind == SYM_AUTOVAR) {
-		t->offset = (++id_var)*(-4);
-	    }
+    for (t = cc->symtab_array[id]; t != NULL; t = t->next) {
+	/* 変数のサイズはint 4byteで固定 */
+	if (t->kind == SYM_ARG) {
+	    t->offset = (++id_arg)*4;
+	} else if (t->kind == SYM_AUTOVAR) {
+	    t->offset = (++id_var)*(-4);
 	}
     }
 }
 
+/*
+ * シンボルテーブルの出力
+ * JSON形式では {"dump":"symtab","functab":[...],"symtab":[{"id":..,"syms":[...]}]}
+ * レジスタに置かれた変数（-O2）にはそのレジスタも出力する
+ */
 void
-dump_symtab(void)
+dump_symtab(Compiler *cc, Emit *out, int format)
 {
     int i;
     SymTab  *t;
 
-    fputs("FuncTab\n", stderr);
-    for (t = func_symtab.next; t != NULL; t = t->next) {
-	fprintf(stderr, " %s #%d\n", t->ident, t->entry);
+    if (format == DUMP_FORMAT_JSON) {
+	EMIT_LIT(out, "{\"dump\":\"symtab\",\"functab\":[");
+	for (t = cc->func_symtab.next; t != NULL; t = t->next) {
+	    EMIT_LIT(out, "{\"name\":\"");
+	    emit_str(out, t->ident);
+	    EMIT_LIT(out, "\",\"entry\":");
+	    emit_int(out, t->entry);
+	    emit_str(out, t->next != NULL ? "}," : "}");
+	}
+	EMIT_LIT(out, "],\"symtab\":[");
+	for (i = 1; i <= cc->max_id; i++) {
+	    EMIT_LIT(out, "{\"id\":");
+	    emit_int(out, i);
+	    EMIT_LIT(out, ",\"syms\":[");
+	    for (t = cc->symtab_array[i]; t != NULL; t = t->next) {
+		EMIT_LIT(out, "{\"name\":\"");
+		emit_str(out, t->ident);
+		EMIT_LIT(out, "\",\"entry\":");
+		emit_int(out, t->entry);
+		EMIT_LIT(out, ",\"offset\":");
+		emit_int(out, t->offset);
+		if (t->reg != 0) {
+		    EMIT_LIT(out, ",\"reg\":\"");
+		    emit_reg(out, t->reg);
+		    emit_char(out, '"');
+		}
+		emit_str(out, t->next != NULL ? "}," : "}");
+	    }
+	    emit_str(out, i < cc->max_id ? "]}," : "]}");
+	}
+	EMIT_LIT(out, "]}\n");
+	return;
     }
-    fputs("\nSymTab\n", stderr);
-    for (i = 1; i <= max_id; i++) {
-	fprintf(stderr, "id(%d)\n", i);
-	for (t = symtab_array[i]; t != NULL; t = t->next) {
-	    fprintf(stderr, " %s #%d, offset(%d)\n", t->ident, t->entry, t->offset);
+
+    EMIT_LIT(out, "FuncTab\n");
+    for (t = cc->func_symtab.next; t != NULL; t = t->next) {
+	emit_char(out, ' ');
+	emit_str(out, t->ident);
+	EMIT_LIT(out, " #");
+	emit_int(out, t->entry);
+	emit_char(out, '\n');
+    }
+    EMIT_LIT(out, "\nSymTab\n");
+    for (i = 1; i <= cc->max_id; i++) {
+	EMIT_LIT(out, "id(");
+	emit_int(out, i);
+	EMIT_LIT(out, ")\n");
+	for (t = cc->symtab_array[i]; t != NULL; t = t->next) {
+	    emit_char(out, ' ');
+	    emit_str(out, t->ident);
+	    EMIT_LIT(out, " #");
+	    emit_int(out, t->entry);
+	    EMIT_LIT(out, ", offset(");
+	    emit_int(out, t->offset);
+	    emit_char(out, ')');
+	    if (t->reg != 0) {
+		EMIT_LIT(out, ", reg(");
+		emit_reg(out, t->reg);
+		emit_char(out, ')');
+	    }
+	    emit_char(out, '\n');
 	}
     }
 }
-
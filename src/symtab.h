@@ -9,13 +9,16 @@
 #ifndef  SYMTAB_H
 #define  SYMTAB_H
 
+#include  "dump.h"
+
 /* 変数の種別 */
 enum {
     SYM_NONE,
     SYM_FUNC,			/* 関数   */
     SYM_VAR,			/* 変数全般（仮引数+自動変数） */
     SYM_ARG,			/* 仮引数 */
-    SYM_AUTOVAR			/* 自動変数 */
+    SYM_AUTOVAR,		/* 自動変数 */
+    SYM_SPILL			/* 式の途中の値の退避領域（cg.c） */
 };
 
 typedef struct SymTab {
@@ -23,28 +26,62 @@ typedef struct SymTab {
     int  kind;    /* 変数種別 */
     int  offset;  /* メモリ領域（現在はスタックフレーム）中のオフセット */
     int  type;	  /* 変数型（現在はintのみ) */
-    char  *ident; /* 変数名 */
+    int  reg;	  /* 置かれたレジスタ（-O2のregalloc.c）。0ならメモリ */
+    char  *ident; /* 変数名（intern済み） */
     struct SymTab *next;
 } SymTab;
 
+/*
+ * シンボルテーブルの索引
+ * 名前をキーとするオープンアドレス法（線形探索）のハッシュ表
+ * 名前はintern済みなので、ハッシュ値の計算も比較もポインタで行う
+ * 登録順はSymTabのnextによるリストで保持する（entry番号とオフセットのため）
+ */
+typedef struct SymIndex {
+    SymTab **slot;
+    int  size;			/* slotの数（2のべき乗） */
+    int  count;			/* 登録数 */
+    SymTab  *tail;		/* リストの末尾 */
+} SymIndex;
+
+/* シンボルテーブルの状態はCompiler(compiler.h)が持つ */
+struct Compiler;
+
 /* 変数identを型typeで現在処理関数のシンボルテーブルに追加する
+   identはintern()で得た文字列でなければならない
    既に登録済みなら0を返す */
-extern  int  append_sym(int type, int symkind, char *ident);
+extern  int  append_sym(struct Compiler *cc, int type, int symkind, char *ident);
 
 /* idで識別される関数のシンボルテーブルより変数identを探す
+   identはintern()で得た文字列でなければならない
    idが0の時は現在処理関数
    存在したらそのエントリーのポインタを返す。なければNULL */
-extern  SymTab  *lookup_sym(int id, int symkind, char *ident);
+extern  SymTab  *lookup_sym(struct Compiler *cc, int id, int symkind, char *ident);
 
-/* 現在処理関数をid(1以上)で識別される関数のシンボルテーブルとして登録する */
-extern  void commit_current_symtab(int id);
+/* 現在処理関数をid(1以上)で識別される関数のシンボルテーブルとして登録する
+   現在処理関数の領域(cc->func_arena)もidの関数のものとして引き取る */
+extern  void commit_current_symtab(struct Compiler *cc, int id);
+
+/* idの関数のASTとシンボルテーブルを一括して解放する
+   以降そのASTとシンボルテーブルを参照してはならない */
+extern  void release_symtab(struct Compiler *cc, int id);
 
 /* 読み出された関数で必要とするスタックフレームのサイズを返す */
-extern  int get_frame_size(int id);
+extern  int get_frame_size(struct Compiler *cc, int id);
+
+/* idの関数のスタックフレームの末尾に退避領域を1つ追加し、そのオフセットを返す
+   以降のget_frame_sizeはこの領域も含めた大きさになる */
+extern  int append_spill_slot(struct Compiler *cc, int id);
 
 /* メモリの割り付け */
-extern  void assign_memory(void);
+extern  void assign_memory(struct Compiler *cc);
+/* idの関数だけのメモリの割り付け（逐次コンパイル用） */
+extern  void assign_memory_func(struct Compiler *cc, int id);
+
+/* 残っているシンボルテーブルと索引を全て解放する */
+extern  void free_symtab(struct Compiler *cc);
 
-extern  void dump_symtab(void);
+/* シンボルテーブルを出力する */
+extern  void dump_symtab(struct Compiler *cc, Emit *out, int format);
 
 #endif	/* SYMTAB_H */
@@ -0,0 +1,48 @@
+#! /bin/sh
+# 確保の記録（--alloc-report）を付けても同じ診断メッセージ・アセンブリになり、
+# 終了時には全て解放されている（生存量が0）ことを確かめる
+# srcディレクトリで make alloccheck から実行する
+
+TLC=../../../../tlc
+TMP=test/alloc/tmp
+
+rm -rf $TMP
+mkdir -p $TMP/off $TMP/on
+
+status=0
+for opt in "-O0" "-O1" "--stream" "-j4" "--parser=rd" "--dump=symtab,ast-reg"
+do
+    for f in test/*.c test/parser/*.c
+    do
+	base=`basename ${f} .c`
+	src=../../../../${f}
+	rm -f $TMP/off/${base}.s $TMP/on/${base}.s
+	(cd $TMP/off && $TLC $opt $src > ${base}.log 2>&1)
+	(cd $TMP/on && $TLC $opt --alloc-report $src > ${base}.log 2>&1)
+	# 記録は最後に書き出される
+	if ! sed '/^alloc report$/,$d' $TMP/on/${base}.log | cmp -s - $TMP/off/${base}.log; then
+	    echo "The log of ${base}.c differs with \"$opt --alloc-report\"."
+	    status=1
+	fi
+	if [ -f $TMP/off/${base}.s -o -f $TMP/on/${base}.s ]; then
+	    if ! cmp -s $TMP/off/${base}.s $TMP/on/${base}.s; then
+		echo "The asm-file of ${base}.c differs with \"$opt --alloc-report\"."
+		status=1
+	    fi
+	fi
+	if ! grep -q "^  total  *[0-9]*  *[0-9]*  *[0-9]*  *[0-9]*  *0 " $TMP/on/${base}.log; then
+	    echo "Some memory of ${base}.c is not freed with \"$opt\"."
+	    status=1
+	fi
+    done
+done
+# 全てのファイルをまとめて-jでコンパイルし、JSONの形式も確かめる
+(cd $TMP/on && $TLC -j4 --alloc-report=json ../../../*.c > all.log 2> all.rep)
+if ! grep -q '"total":{[^}]*"live_bytes":0,' $TMP/on/all.rep; then
+    echo "Some memory is not freed with \"-j4 --alloc-report=json\"."
+    status=1
+fi
+if [ $status -eq 0 ]; then
+    rm -rf $TMP
+fi
+exit $status
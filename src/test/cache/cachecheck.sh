@@ -0,0 +1,40 @@
+#! /bin/sh
+# 関数毎のキャッシュを使っても使わなくても同じアセンブリになることを確かめる
+# 1回目はキャッシュに保存し、2回目はキャッシュから読み出す
+# srcディレクトリで make cachecheck から実行する
+
+TLC=../../../../tlc
+TMP=test/cache/tmp
+CACHE=../dir
+
+rm -rf $TMP
+mkdir -p $TMP/plain $TMP/store $TMP/load $TMP/dir
+
+status=0
+for f in test/*.c
+do
+    base=`basename ${f} .c`
+    src=../../../../${f}
+    (cd $TMP/plain && $TLC $src > /dev/null 2>&1)
+    if [ ! -f $TMP/plain/${base}.s ]; then
+	continue
+    fi
+    (cd $TMP/store && $TLC --cache-dir=$CACHE $src > /dev/null 2>&1)
+    (cd $TMP/load && $TLC --cache-dir=$CACHE $src > ${base}.log 2>&1)
+    if ! cmp -s $TMP/plain/${base}.s $TMP/store/${base}.s; then
+	echo "The asm-file of ${base}.c differs when stored to the cache."
+	status=1
+    fi
+    if ! cmp -s $TMP/plain/${base}.s $TMP/load/${base}.s; then
+	echo "The asm-file of ${base}.c differs when loaded from the cache."
+	status=1
+    fi
+    if grep -q " [1-9][0-9]* misses" $TMP/load/${base}.log; then
+	echo "Some functions of ${base}.c were not found in the cache."
+	status=1
+    fi
+done
+if [ $status -eq 0 ]; then
+    rm -rf $TMP
+fi
+exit $status
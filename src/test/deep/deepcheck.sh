@@ -0,0 +1,48 @@
+#! /bin/sh
+# 左に深い長い式（a + b + a + ...）をCのスタックを小さくしてもコンパイルできることを確かめる
+# 名前の解決・レジスタ割り付け・コード生成・ダンプのいずれも式の深さだけ再帰しないこと
+# srcディレクトリで make deepcheck から実行する
+
+TLC=../../../tlc
+TMP=test/deep/tmp
+TERMS=100000
+
+rm -rf $TMP
+mkdir -p $TMP
+
+awk -v n=$TERMS 'BEGIN {
+    print "main()\n{\n    int a, b;\n    a = 1;\n    b = 2;"
+    printf "    a = a"
+    for (i = 1; i < n; i++) {
+	printf " %s %s", (i % 3 == 2) ? "-" : "+", (i % 2) ? "b" : "a"
+    }
+    print ";\n    if (a + b + a + b < a - b - a - b) {\n\tput_int(a);\n    }\n}"
+}' > $TMP/deep.c
+
+status=0
+# 8MBのスタックでは足りても1MBでは落ちるくらいの深さ
+ulimit -s 1024
+for opt in "" "--parser=rd" "--stream" "-j 2" "--dump=ast-reg" "--dump=ast,ast-reg --dump-format=json" \
+	   "--backend=ir" "--backend=ir --dump=ir --dump-format=json"
+do
+    rm -f $TMP/deep.s
+    if ! (cd $TMP && $TLC $opt deep.c > deep.log 2>&1); then
+	echo "Failed to compile the deep expression with \"$opt\"."
+	status=1
+	continue
+    fi
+    # 項の数-1の二項演算と、比較の左右の3つずつ
+    # IRからのコードは変数をメモリから直接足し引きする（$の即値は%espの増減）
+    case "$opt" in
+    *backend=ir*)	n=`grep -c "^	\(addl\|subl\)	[^$]" $TMP/deep.s` ;;
+    *)			n=`grep -c "^	\(addl\|subl\)	%" $TMP/deep.s` ;;
+    esac
+    if [ "$n" -ne `expr $TERMS - 1 + 6` ]; then
+	echo "Unexpected number of operations ($n) with \"$opt\"."
+	status=1
+    fi
+done
+if [ $status -eq 0 ]; then
+    rm -rf $TMP
+fi
+exit $status
@@ -0,0 +1,36 @@
+#! /bin/sh
+# 構文解析しながらの直接のコード生成（-O0）が、ASTからのコード生成（-O1）と
+# 同じ診断メッセージになり、生成したプログラムが同じ結果を出力することを確かめる
+# -O1はdivのコードを生成できず、実引数の中の関数呼び出しも正しく扱えないので
+# （tl_gram.yの制限事項）、そういうプログラムはtest/directの*.outに期待する出力を置いてある
+# srcディレクトリで make directcheck から実行する
+
+TMP=test/direct/tmp
+. test/runlib.sh
+
+setup_dirs O0 O1 rd
+for f in test/*.c test/parser/*.c test/direct/*.c
+do
+    base=`basename ${f} .c`
+    src=../../../../${f}
+    compile O0 $base $src -O0
+    compile O1 $base $src -O1
+    compile rd $base $src -O0 --parser=rd
+    if ! grep -q "div is not" $TMP/O1/${base}.log; then
+	same_log $base O0 O1 "-O0"
+    fi
+    same_log $base O0 rd "-O0 --parser=rd"
+    same_asm $base O0 rd "-O0 --parser=rd"
+    if [ $run -eq 0 -o ! -f $TMP/O0/${base}.s ]; then
+	continue
+    fi
+    expect=test/direct/${base}.out
+    if [ ! -f $expect ]; then
+	[ -f $TMP/O1/${base}.s ] || continue
+	run_prog $base O1
+	expect=$TMP/O1/${base}.out
+    fi
+    run_prog $base O0
+    same_out $base $expect O0 "-O0"
+done
+finish
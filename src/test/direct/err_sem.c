@@ -0,0 +1,15 @@
+f(int a, int b, int a)
+{
+    int x, y, x;
+    u = v + w;
+    x = f(p, q = r);
+    if (s < 0) return t;
+    return a;
+}
+
+main()
+{
+    int z;
+    z = y;
+    return z;
+}
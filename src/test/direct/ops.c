@@ -0,0 +1,40 @@
+add3(int a, int b, int c)
+{
+    return a*100 + b*10 + c;
+}
+
+fib(int n)
+{
+    if (n < 2) return n;
+    return fib(n-1) + fib(n-2);
+}
+
+sum(int n)
+{
+    int i, s;
+    s = 0;
+    for (i = 1; i <= n; i = i + 1) s = s + i;
+    return s;
+}
+
+main()
+{
+    int x, y, z;
+    x = 7; y = -3;
+    put_int(x / 2);
+    put_int(y / 2);
+    put_int(100 / x / 2);
+    put_int(1 + add3(1, add3(2, 3, 4) - 230, fib(10)) * 2);
+    put_int(add3(x = 1, y = 2, z = x + y));
+    put_int((x < y) + (x == 1) * 10 + (y != 2) * 100);
+    z = 0;
+    while (z < 3) { put_int(z); z = z + 1; }
+    do z = z - 1; while (z > 0);
+    put_int(z);
+    if (x) put_int(11); else put_int(22);
+    if (x - 1) put_int(33); else put_int(44);
+    if (x >= 1) if (y > 5) put_int(55); else put_int(66);
+    put_int(sum(100));
+    put_int(-(x + y) * -2);
+    return 0;
+}
@@ -1,6 +1,7 @@
 #! /bin/sh
 
 TLC=../tlc
+TLCFLAGS=--dump=symtab,ast-reg
 CC=gcc
 CFLAGS=-m32
 TESTDIR=./
@@ -27,7 +28,7 @@ do
     base=`basename ${f} .c`
     log=${base}.c.log
     asm=${base}.s
-    ../$TLC $f > ${log} 2>&1
+    ../$TLC $TLCFLAGS $f > ${log} 2>&1
     $CC $CFLAGS ${asm} -o ${base}
     diff ../${target}/$log $log > ${log}.diff 2>&1
     diff ../${target}/$asm $asm > ${asm}.diff 2>&1
@@ -0,0 +1,49 @@
+#! /bin/sh
+# 関数定義の境界で分けて並列に構文解析しても（-j）、逐次の場合と同じ
+# 関数id・関数名の表・診断メッセージ・アセンブリになることを確かめる
+# 分けられる大きさのプログラムをtlgenで作り、途中の関数にエラーを入れたものも試す
+# srcディレクトリで make frontcheck から実行する
+
+TLC=../../../../tlc
+TMP=test/front/tmp
+
+rm -rf $TMP
+mkdir -p $TMP/j1 $TMP/j4
+
+./tlgen -f 200 -s 60 > $TMP/ok.c
+# 100番目の関数で未宣言の変数を使い、150番目の関数で構文エラーにする
+awk '/return v0;/ { n++
+    if (n == 100) { print "    return zz;"; next }
+    if (n == 150) { print "    v0 = ;" }
+} { print }' $TMP/ok.c > $TMP/err.c
+# 未宣言の変数だけ（構文解析は最後まで続く）
+awk '/return v0;/ { n++
+    if (n == 50 || n == 180) { print "    return zz;"; next }
+} { print }' $TMP/ok.c > $TMP/sem.c
+
+status=0
+for base in ok err sem
+do
+    for opt in "--dump=symtab" "--dump=symtab,ast --parser=rd" "--dump=ast-reg --dump-format=json" ""
+    do
+	for j in 1 4
+	do
+	    rm -f $TMP/j$j/${base}.s
+	    (cd $TMP/j$j && $TLC -j $j $opt ../${base}.c > ${base}.log 2>&1)
+	done
+	if ! cmp -s $TMP/j1/${base}.log $TMP/j4/${base}.log; then
+	    echo "The log of ${base}.c differs with \"$opt\"."
+	    status=1
+	fi
+	if [ -f $TMP/j1/${base}.s -o -f $TMP/j4/${base}.s ]; then
+	    if ! cmp -s $TMP/j1/${base}.s $TMP/j4/${base}.s; then
+		echo "The asm-file of ${base}.c differs with \"$opt\"."
+		status=1
+	    fi
+	fi
+    done
+done
+if [ $status -eq 0 ]; then
+    rm -rf $TMP
+fi
+exit $status
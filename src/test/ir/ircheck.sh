@@ -0,0 +1,64 @@
+#! /bin/sh
+# 3番地コードのIRからのコード生成（--backend=ir）を確かめる
+# テストのプログラムと深さDEPTHの完全2分木の式を-O1, -O2でコンパイルし、
+# -O0（構文解析しながらの直接のコード生成）と同じ診断メッセージ・実行結果になること
+# IRは-O0と同じ順に式を評価し、divも扱えるので、全てのプログラムを比べる
+# --stream、-j、--cache-dir（2回目はキャッシュから）でも同じアセンブリになること
+# test/irの*.irと同じIRのダンプ（-O1 --dump=ir）に、*.O2.irがあれば
+# それと同じSSA形式での最適化の後のダンプ（-O2 --dump=ir）になることも確かめる
+# srcディレクトリで make ircheck から実行する
+
+TMP=test/ir/tmp
+DEPTH=8
+. test/runlib.sh
+
+setup_dirs src O0 O1 O2 stream jobs cache
+gen_tree $DEPTH 1 > $TMP/src/tree.c
+cp test/*.c test/parser/*.c test/direct/*.c test/opt/*.c test/spill/*.c test/ir/*.c $TMP/src
+
+for f in $TMP/src/*.c
+do
+    base=`basename ${f} .c`
+    src=../src/${base}.c
+    compile O0 $base $src -O0
+    compile O1 $base $src -O1 --backend=ir
+    compile O2 $base $src -O2 --backend=ir
+    compile stream $base $src -O2 --backend=ir --stream
+    compile jobs $base $src -O2 --backend=ir -j4
+    compile cache $base $src -O2 --backend=ir --cache-dir=dir
+    (cd $TMP/cache && $TLC -O2 --backend=ir -j4 --cache-dir=dir $src 2>&1 \
+	| grep -v '^cache:' > ${base}.log)
+    for d in O1 O2
+    do
+	same_log $base O0 $d $d
+    done
+    for d in stream jobs cache
+    do
+	same_log $base O2 $d $d
+	same_asm $base O2 $d $d
+    done
+    if [ $run -eq 0 -o ! -f $TMP/O0/${base}.s ]; then
+	continue
+    fi
+    for d in O0 O1 O2
+    do
+	run_prog $base $d
+    done
+    for d in O1 O2
+    do
+	same_out $base $TMP/O0/${base}.out $d $d
+    done
+done
+
+for f in test/ir/*.c
+do
+    base=`basename ${f} .c`
+    (cd $TMP && ../../../tlc -O1 --backend=ir --dump=ir ../${base}.c > ${base}.ir 2>&1)
+    cmp -s test/ir/${base}.ir $TMP/${base}.ir || fail "The IR of ${base}.c differs."
+    if [ -f test/ir/${base}.O2.ir ]; then
+	(cd $TMP && ../../../tlc -O2 --backend=ir --dump=ir ../${base}.c > ${base}.O2.ir 2>&1)
+	cmp -s test/ir/${base}.O2.ir $TMP/${base}.O2.ir \
+	    || fail "The IR of ${base}.c with -O2 differs."
+    fi
+done
+finish
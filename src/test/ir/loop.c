@@ -0,0 +1,30 @@
+gcd(int a, int b)
+{
+    int t;
+    while (b != 0) {
+	t = a - a / b * b;
+	a = b;
+	b = t;
+    }
+    return a;
+}
+
+main()
+{
+    int i, s;
+    s = 0;
+    for (i = 1; i <= 10; i = i + 1) {
+	if (i - i / 2 * 2 == 0) {
+	    s = s + gcd(i * 6, 4);
+	} else {
+	    s = s - (i < 5);
+	}
+    }
+    do {
+	s = s - 7;
+    } while (s > 0);
+    put_int(s);
+    put_int(gcd(s, 3) + gcd(12, 18) * gcd(7, 5));
+    return s;
+    put_int(0);
+}
@@ -0,0 +1,45 @@
+swap(int a, int b, int n)
+{
+    int i, t;
+    i = 0;
+    while (i < n) {
+	t = a;
+	a = b;
+	b = t;
+	i = i + 1;
+    }
+    return a * 10 + b;
+}
+
+div(int d)
+{
+    int y;
+    y = 7 / d;
+    y = 7 / 2;
+    return 1;
+}
+
+main()
+{
+    int x, y, z, k;
+    x = 4;
+    y = x * 3;
+    if (y > 10) {
+	z = y - 2;
+    } else {
+	z = div(2);
+    }
+    k = 0;
+    while (k < z) {
+	if (x == 4) {
+	    k = k + 1;
+	} else {
+	    k = k + 100;
+	    put_int(k);
+	}
+    }
+    x = z;
+    put_int(x + k + div(3));
+    put_int(swap(1, 2, 3));
+    put_int(swap(1, 2, 4));
+}
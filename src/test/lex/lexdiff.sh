@@ -0,0 +1,26 @@
+#! /bin/sh
+# tl_lex.l(flex)とscan.c(SIMD)のトークン列を比べる
+# srcディレクトリで make lexcheck から実行する
+
+FLEX=./tokdump_flex
+SIMD=./tokdump_simd
+TMP=test/lex/tmp
+
+if [ ! -d $TMP ]; then
+    mkdir $TMP
+fi
+
+status=0
+for f in test/*.c test/lex/*.tl
+do
+    base=`basename ${f}`
+    $FLEX $f > $TMP/${base}.flex 2>&1
+    $SIMD $f > $TMP/${base}.simd 2>&1
+    if cmp -s $TMP/${base}.flex $TMP/${base}.simd; then
+	rm -f $TMP/${base}.flex $TMP/${base}.simd
+    else
+	echo "The tokens of ${base} differ."
+	status=1
+    fi
+done
+exit $status
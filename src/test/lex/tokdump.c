@@ -0,0 +1,67 @@
+/*
+    Tiny Language Compiler (tlc)
+
+    字句解析部の試験用: トークン列を1行に1個ずつ出力する
+    tl_lex.lとscan.cのどちらとも結合でき、出力を比べて差を調べる
+
+    2016年 木村啓二
+*/
+
+#include  <stdarg.h>
+#include  <stdio.h>
+#include  <stdlib.h>
+#include  <string.h>
+
+#include  "../../compiler.h"
+#include  "../../tl_gram.h"
+
+/* 字句解析部が使うcompiler.cの関数の代わり */
+void
+diag(Compiler *cc, const char *fmt, ...)
+{
+    va_list  ap;
+
+    va_start(ap, fmt);
+    vfprintf(stderr, fmt, ap);
+    va_end(ap);
+}
+
+void
+fatal(Compiler *cc)
+{
+    exit(-1);
+}
+
+int
+main(int argc, char *argv[])
+{
+    Compiler  cc;
+    YYSTYPE  lval;
+    int  tok;
+
+    if (argc != 2) {
+	fprintf(stderr, "usage: %s file\n", argv[0]);
+	exit(-1);
+    }
+    memset(&cc, 0, sizeof(cc));
+    if (open_source(&cc.src, argv[1]) < 0) {
+	fprintf(stderr, "Can't open the input file %s.\n", argv[1]);
+	exit(-1);
+    }
+    lex_init(&cc);
+
+    while ((tok = lex_token(&lval, &cc)) != 0) {
+	printf("%d %d", lex_lineno(&cc), tok);
+	if (tok == TOKEN_ID)
+	    printf(" %s", lval.y_str);
+	else if (tok == TOKEN_CONST_INT)
+	    printf(" %d", lval.y_int);
+	printf("\n");
+    }
+    printf("%d EOF\n", lex_lineno(&cc));
+
+    lex_destroy(&cc);
+    close_source(&cc.src);
+    intern_free(&cc.names);
+    return 0;
+}
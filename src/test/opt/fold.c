@@ -0,0 +1,96 @@
+sq(int a)
+{
+    return a*a;
+}
+
+side(int a)
+{
+    put_int(a);
+    return a;
+}
+
+f(int x)
+{
+    return x*3-1;
+}
+
+h(int a)
+{
+    int c;
+    c = 1;
+    return ((c - 8) * (c - f(a)));
+}
+
+main()
+{
+    int x, y, z, i, s, n;
+    x = 3;
+    y = x + 1;
+    put_int(y * 2 - 1);
+    if (1 < 2) {
+	put_int(10);
+    } else {
+	put_int(20);
+    }
+    if (x == 4) put_int(30);
+    z = 0;
+    while (z > 0) {
+	put_int(40);
+	z = z - 1;
+    }
+    s = 0;
+    for (i = 0; i < 5; i = i + 1) {
+	s = s + i * x;
+    }
+    put_int(s);
+    put_int(x);
+    n = 10;
+    do {
+	n = n - 3;
+    } while (n > 0);
+    put_int(n);
+    do {
+	put_int(50 + x);
+    } while (0);
+    y = side(7) * 0;
+    put_int(y);
+    y = x * 0;
+    put_int(y);
+    put_int(sq(x + 0) + 0 * 1);
+    x = (y = 2) + x;
+    put_int(x);
+    put_int(y);
+    x = x + 1;
+    x = x * x;
+    put_int(x);
+    put_int(-(-5) + +3);
+    put_int(2147483647 + 1);
+    put_int(-2147483647 - 2 + 0);
+    put_int((1 < 2) + (3 >= 3) + (4 != 4) + (5 == 5) + (6 <= 5) + (7 > 6));
+    if (x) {
+	z = 1;
+    } else {
+	z = 1;
+    }
+    put_int(z + 1);
+    if (s > 100) {
+	z = 2;
+    } else {
+	z = 3;
+    }
+    put_int(z);
+    for (i = 0; 0; i = i + 1) {
+	put_int(60);
+    }
+    put_int(i);
+    put_int(h(2));
+    i = 0;
+    while (i < 3) {
+	i = i + 1;
+	if (i == 2) {
+	    return 7;
+	}
+    }
+    put_int(99);
+    return 0;
+}
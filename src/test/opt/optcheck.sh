@@ -0,0 +1,45 @@
+#! /bin/sh
+# ASTの上での最適化（-O2）をしても-O0と同じ診断メッセージになり、
+# 生成したプログラムが同じ結果を出力することを確かめる
+# -O2のコード生成は-O1と同じなので、畳み込めないdivは-O1と同じくエラーになる
+# -O1で正しく扱えない式を含むプログラムは、test/optの*.outに期待する出力を置いてある
+# --stream、-jでも同じアセンブリになることも確かめる
+# srcディレクトリで make optcheck から実行する
+
+TMP=test/opt/tmp
+. test/runlib.sh
+
+setup_dirs O0 O2 stream jobs
+for f in test/*.c test/parser/*.c test/direct/*.c test/opt/*.c
+do
+    base=`basename ${f} .c`
+    src=../../../../${f}
+    compile O0 $base $src -O0
+    compile O2 $base $src -O2
+    compile stream $base $src -O2 --stream
+    compile jobs $base $src -O2 -j4
+    if ! grep -q "div is not" $TMP/O2/${base}.log; then
+	same_log $base O0 O2 "-O2"
+    fi
+    for d in stream jobs
+    do
+	same_log $base O2 $d "-O2 ($d)"
+	same_asm $base O2 $d "-O2 ($d)"
+    done
+    if [ $run -eq 0 -o ! -f $TMP/O2/${base}.s ]; then
+	continue
+    fi
+    # test/directに*.outがあるのは-O1のコード生成で正しく扱えないもの
+    if [ -f test/direct/${base}.out ]; then
+	continue
+    fi
+    expect=test/opt/${base}.out
+    if [ ! -f $expect ]; then
+	[ -f $TMP/O0/${base}.s ] || continue
+	run_prog $base O0
+	expect=$TMP/O0/${base}.out
+    fi
+    run_prog $base O2
+    same_out $base $expect O2 "-O2"
+done
+finish
@@ -0,0 +1,48 @@
+mix(int a, int b, int c)
+{
+    int i, t;
+    t = 0;
+    for (i = 0; i < a; i = i + 1) {
+	t = t * b + c;
+	c = c - 1;
+    }
+    return t;
+}
+
+count(int n)
+{
+    int k;
+    k = 0;
+    while (n > 1) {
+	n = n - 2;
+	k = k + 1;
+    }
+    return k;
+}
+
+main()
+{
+    int i, j, k, s, t, u, v, w;
+    s = 0; t = 1; u = 2; v = 3; w = 0;
+    for (i = 0; i < 10; i = i + 1) {
+	for (j = 0; j < 10; j = j + 1) {
+	    s = s + i * j;
+	    t = t + s - j;
+	    k = mix(3, i, j);
+	    u = u + k;
+	}
+	v = v * 2 - i;
+	w = count(v);
+	put_int(w);
+    }
+    put_int(s);
+    put_int(t);
+    put_int(u);
+    put_int(v);
+    k = mix(4, 5, 6);
+    put_int(k);
+    i = count(101);
+    put_int(i);
+    put_int(j);
+    return 0;
+}
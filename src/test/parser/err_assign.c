@@ -0,0 +1,9 @@
+main()
+{
+    int a, b;
+    a = b = 1;
+}
+
+f(int a,)
+{
+}
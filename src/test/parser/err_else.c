@@ -0,0 +1,5 @@
+main()
+{
+    int a;
+    if (a) else a = 1;
+}
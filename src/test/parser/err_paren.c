@@ -0,0 +1,5 @@
+main()
+{
+    int a;
+    a = (1 + 2;
+}
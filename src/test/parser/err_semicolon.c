@@ -0,0 +1,6 @@
+main()
+{
+    int a;
+    a = 1
+    put_int(a);
+}
@@ -0,0 +1,40 @@
+#! /bin/sh
+# 手書きの構文解析部（--parser=rd）がbisonの構文解析部と同じASTを作り、
+# 同じ診断メッセージ・アセンブリになることを確かめる
+# test/parserには構文エラーのあるファイルも置いてある
+# srcディレクトリで make parsercheck から実行する
+
+TLC=../../../../tlc
+TMP=test/parser/tmp
+
+rm -rf $TMP
+mkdir -p $TMP/bison $TMP/rd
+
+status=0
+for f in test/*.c test/parser/*.c
+do
+    base=`basename ${f} .c`
+    src=../../../../${f}
+    for opt in "--dump=symtab,ast" "--dump=ast,ast-reg --dump-format=json" "--stream"
+    do
+	for parser in bison rd
+	do
+	    rm -f $TMP/$parser/${base}.s
+	    (cd $TMP/$parser && $TLC --parser=$parser $opt $src > ${base}.log 2>&1)
+	done
+	if ! cmp -s $TMP/bison/${base}.log $TMP/rd/${base}.log; then
+	    echo "The dump of ${base}.c differs with \"$opt\"."
+	    status=1
+	fi
+	if [ -f $TMP/bison/${base}.s -o -f $TMP/rd/${base}.s ]; then
+	    if ! cmp -s $TMP/bison/${base}.s $TMP/rd/${base}.s; then
+		echo "The asm-file of ${base}.c differs with \"$opt\"."
+		status=1
+	    fi
+	fi
+    done
+done
+if [ $status -eq 0 ]; then
+    rm -rf $TMP
+fi
+exit $status
@@ -0,0 +1,32 @@
+f(int a, int b)
+{
+    return a - b * 2;
+}
+
+g()
+{
+    return;
+}
+
+main()
+{
+    int a, b, c;
+    a = 1; b = 2;
+    c = - a * - - b + a * (b - a) - - 3;
+    c = a < b == b > a != a <= -b;
+    c = a + b + c - a * b * c - (a - (b - c));
+    c = f(a + 1, f(b, c)) * - f(1, 2);
+    if (a < b)
+	if (b < c)
+	    put_int(a);
+	else
+	    put_int(b);
+    for (a = 0; a < 3; a = a + 1) {
+	b = b + a;
+    }
+    do b = b - 1; while (b > 0);
+    while (a) a = a - 1;
+    ;
+    {}
+    put_int(c);
+}
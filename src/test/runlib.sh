@@ -0,0 +1,106 @@
+# 生成したプログラムを実行して比べるcheckスクリプトが共通に使う手順
+# srcディレクトリで実行するスクリプトから、TMP（作業用ディレクトリ）を設定して
+# . test/runlib.sh として読み込む
+# コンパイルは$TMP/<名前>のディレクトリ毎に行い、<名前>同士で結果を比べる
+#
+# 実行は$ASMCC（アセンブリをリンクするコマンド）でリンクできる時だけ行う
+# リンクできなければ失敗にする。SKIP_RUN=1なら実行を飛ばしたことを表示して続ける
+
+TLC=../../../../tlc
+ASMCC=${ASMCC:-gcc -m32}
+status=0
+run=1
+
+# setup_dirs name... : $TMPを作り直して$TMP/nameを作り、リンクできるか調べる
+setup_dirs()
+{
+    rm -rf $TMP
+    for d in "$@"
+    do
+	mkdir -p $TMP/$d
+    done
+    echo 'main() { return 0; }' > $TMP/link.c
+    if ! (cd $TMP && ../../../tlc link.c && $ASMCC link.s -o link) > /dev/null 2>&1; then
+	if [ "$SKIP_RUN" != 1 ]; then
+	    echo "Can't link the asm-files with \"$ASMCC\"."
+	    echo "Set ASMCC to a command that can, or SKIP_RUN=1 to skip running the programs."
+	    exit 1
+	fi
+	echo "SKIPPED: the programs are not run (can't link with \"$ASMCC\")."
+	run=0
+    fi
+}
+
+# gen_tree depth div : 深さdepthの完全2分木の式を使うプログラムを出力する
+# 葉は変数と定数、節は+, -, *を順に使い、divが1なら定数での/も混ぜる
+gen_tree()
+{
+    awk -v depth=$1 -v div=$2 'function tree(d, k) {
+	    if (d == 0) {
+		return (k % 3 == 2) ? (k % 7) : substr("abcd", k % 4 + 1, 1)
+	    }
+	    if (div && k % 4 == 3) {
+		return "(" tree(d-1, 2*k) " / " (k % 5 + 1) ")"
+	    }
+	    return "(" tree(d-1, 2*k) " " substr("+-*", k % 3 + 1, 1) " " tree(d-1, 2*k+1) ")"
+	}
+	BEGIN {
+	    print "main()\n{\n    int a, b, c, d;\n    a = 3;\n    b = -2;\n    c = 5;\n    d = 7;"
+	    print "    a = " tree(depth, 1) ";\n    put_int(a);"
+	    print "    if (" tree(depth-2, 2) " < " tree(depth-2, 3) ") {\n\tput_int(1);\n    }\n}"
+	}'
+}
+
+# compile name base src option... : $TMP/nameで src をコンパイルし、出力をbase.logに入れる
+compile()
+{
+    d=$1
+    base=$2
+    src=$3
+    shift 3
+    rm -f $TMP/$d/$base.s
+    (cd $TMP/$d && $TLC "$@" $src > $base.log 2>&1)
+}
+
+# fail message : 失敗を表示する
+fail()
+{
+    echo "$1"
+    status=1
+}
+
+# same_log base name1 name2 what : 診断メッセージが同じか
+same_log()
+{
+    cmp -s $TMP/$2/$1.log $TMP/$3/$1.log || fail "The log of $1.c differs with $4."
+}
+
+# same_asm base name1 name2 what : どちらかでアセンブリができたなら同じか
+same_asm()
+{
+    if [ -f $TMP/$2/$1.s -o -f $TMP/$3/$1.s ]; then
+	cmp -s $TMP/$2/$1.s $TMP/$3/$1.s || fail "The asm-file of $1.c differs with $4."
+    fi
+}
+
+# run_prog base name : $TMP/name/base.sをリンクして実行し、出力をbase.outに入れる
+run_prog()
+{
+    $ASMCC $TMP/$2/$1.s -o $TMP/$2/$1
+    $TMP/$2/$1 > $TMP/$2/$1.out
+}
+
+# same_out base expect name what : 実行結果が期待する出力のファイルexpectと同じか
+same_out()
+{
+    cmp -s $2 $TMP/$3/$1.out || fail "The output of $1.c differs with $4."
+}
+
+# finish : 全て通れば$TMPを消して終わる
+finish()
+{
+    if [ $status -eq 0 ]; then
+	rm -rf $TMP
+    fi
+    exit $status
+}
@@ -0,0 +1,75 @@
+#! /bin/sh
+# サーバにコンパイルさせても、自分でコンパイルした時と同じアセンブリと
+# 診断メッセージになることを確かめる
+# batchは全てのファイルを1回の--connectで同時に頼み、singleは1つずつ頼む
+# singleはbatchで温まったサーバの状態を使う
+# srcディレクトリで make servercheck から実行する
+
+TLC=../../../../tlc
+TMP=test/server/tmp
+SOCK=$TMP/tlc.sock
+
+rm -rf $TMP
+mkdir -p $TMP/plain $TMP/batch $TMP/single
+
+./tlc --server=$SOCK -j 4 &
+server=$!
+i=0
+while [ ! -S $SOCK ] && [ $i -lt 50 ]; do
+    sleep 0.1
+    i=`expr $i + 1`
+done
+
+srcs=
+for f in test/*.c
+do
+    srcs="$srcs ../../../../${f}"
+done
+(cd $TMP/batch && $TLC --connect=../tlc.sock -j 8 $srcs > /dev/null 2>&1)
+
+status=0
+for f in test/*.c
+do
+    base=`basename ${f} .c`
+    src=../../../../${f}
+    (cd $TMP/plain && $TLC --dump=symtab $src > ${base}.log 2>&1)
+    (cd $TMP/single && $TLC --connect=../tlc.sock --dump=symtab $src > ${base}.log 2>&1)
+    for dir in batch single
+    do
+	if [ -f $TMP/plain/${base}.s ]; then
+	    if ! cmp -s $TMP/plain/${base}.s $TMP/$dir/${base}.s; then
+		echo "The asm-file of ${base}.c differs when compiled by the server ($dir)."
+		status=1
+	    fi
+	elif [ -f $TMP/$dir/${base}.s ]; then
+	    echo "The asm-file of ${base}.c was made by the server ($dir)."
+	    status=1
+	fi
+    done
+    if ! cmp -s $TMP/plain/${base}.log $TMP/single/${base}.log; then
+	echo "The messages for ${base}.c differ when compiled by the server."
+	status=1
+    fi
+done
+
+# 上限を超えるソースはエラーになり、サーバはその後も要求を受け付ける
+head -c 17000000 /dev/zero | tr '\0' ' ' > $TMP/single/large.c
+if (cd $TMP/single && $TLC --connect=../tlc.sock large.c > large.log 2>&1); then
+    echo "The server accepted a too large source."
+    status=1
+fi
+if ! kill -0 $server 2>/dev/null; then
+    echo "The server stopped after a too large source."
+    status=1
+fi
+
+kill $server
+wait $server 2>/dev/null
+if [ -e $SOCK ]; then
+    echo "The server did not remove its socket."
+    status=1
+fi
+if [ $status -eq 0 ]; then
+    rm -rf $TMP
+fi
+exit $status
@@ -0,0 +1,13 @@
+main()
+{
+    int a, b, c, d, e, x;
+    a = 1;
+    b = 2;
+    c = 3;
+    d = 4;
+    e = 5;
+    x = (a+b)+((c+d)+e);
+    put_int(x);
+    x = (a*b) - (c - (d*e));
+    put_int(x);
+}
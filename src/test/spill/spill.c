@@ -0,0 +1,50 @@
+inc(int x)
+{
+    return x + 1;
+}
+
+four(int a, int b, int c, int d)
+{
+    return ((a + b) * (c + d) - (b + c) * (d + a))
+	* ((a - d) * (b - c) - (c * d) * (a + b));
+}
+
+order(int a, int b, int c, int d)
+{
+    int  r;
+    r = 0;
+    if (((a + b) * (c + d) - (b + c) * (d + a))
+	< ((a - d) * (b - c) - (c * d) * (a + b))) {
+	r = r + 1;
+    }
+    if (((a + b) * (c + d) - (b + c) * (d + a))
+	>= ((a - d) * (b - c) - (c * d) * (a + b))) {
+	r = r + 10;
+    }
+    while (((a * b) - (c * d)) - ((a - b) * ((c - d) * (a + c))) > 0) {
+	a = a - 1;
+	r = r + 100;
+    }
+    return r;
+}
+
+main()
+{
+    int  a, b, c, d, e;
+    a = 1; b = 2; c = 3; d = 4; e = 5;
+    put_int(four(a, b, c, d));
+    put_int(four(d, c, b, a));
+    put_int(order(a, b, c, d));
+    put_int(order(7, -3, 2, 9));
+    e = inc(a) * inc(b) - (inc(c) - (inc(d) - (inc(e) - inc(a) * inc(b))));
+    put_int(e);
+    e = ((a + 1) - (b + 2)) - ((c + 3) - ((d + 4) - ((a + 5) - (b + 6))));
+    put_int(e);
+    e = 1000 - (a - (b - (c - ((a + b) * (c + d) - (b + c) * (d + a)))));
+    put_int(e);
+    e = (((a + b) + (c + d)) + ((a + c) + (b + d)))
+	+ (((a + d) + (b + c)) + ((a + a) + (b + b)))
+	- ((((a * b) + (c * d)) + ((a * c) + (b * d)))
+	   + (((a * d) + (b * c)) + ((a * a) + (b * b))));
+    put_int(e);
+}
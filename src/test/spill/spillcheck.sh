@@ -0,0 +1,54 @@
+#! /bin/sh
+# 3つのレジスタに収まらない式を、途中の値を退避してコンパイルできることを確かめる
+# test/spillのプログラムと、深さDEPTHの完全2分木の式を-O1, -O2でコンパイルし、
+# -O0（構文解析しながらの直接のコード生成。レジスタを割り付けない）と
+# 同じ診断メッセージ・実行結果になることを確かめる
+# --stream、-jでも-O1と同じアセンブリになることも確かめる
+# test/spillに<名前>.O1.sがあれば、-O1のアセンブリがそれと同じか確かめる
+# （レジスタに収まる式は、退避を入れる前と同じ順に評価する）
+# srcディレクトリで make spillcheck から実行する
+
+TMP=test/spill/tmp
+DEPTH=10
+. test/runlib.sh
+
+setup_dirs src O0 O1 O2 stream jobs
+gen_tree $DEPTH 0 > $TMP/src/tree.c
+cp test/spill/*.c $TMP/src
+
+for f in $TMP/src/*.c
+do
+    base=`basename ${f} .c`
+    src=../src/${base}.c
+    compile O0 $base $src -O0
+    compile O1 $base $src -O1
+    compile O2 $base $src -O2
+    compile stream $base $src -O1 --stream
+    compile jobs $base $src -O1 -j4
+    for d in O1 O2 stream jobs
+    do
+	same_log $base O0 $d $d
+	[ -f $TMP/$d/${base}.s ] || fail "Failed to compile ${base}.c with $d."
+    done
+    for d in stream jobs
+    do
+	cmp -s $TMP/O1/${base}.s $TMP/$d/${base}.s \
+	    || fail "The asm-file of ${base}.c differs with -O1 ($d)."
+    done
+    if [ -f test/spill/${base}.O1.s ]; then
+	cmp -s test/spill/${base}.O1.s $TMP/O1/${base}.s \
+	    || fail "The asm-file of ${base}.c differs from ${base}.O1.s."
+    fi
+    if [ $run -eq 0 ]; then
+	continue
+    fi
+    for d in O0 O1 O2
+    do
+	run_prog $base $d
+    done
+    for d in O1 O2
+    do
+	same_out $base $TMP/O0/${base}.out $d $d
+    done
+done
+finish
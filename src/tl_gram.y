@@ -13,17 +13,22 @@
    スタック操作が含まれるためである。
    これを正しく処理するためにはどのような操作が必要か?
  */
+%define api.pure full
+%parse-param {Compiler *cc}
+%lex-param {Compiler *cc}
+
+%code requires {
+#include  "compiler.h"
+}
+
 %{
 
 #include  <stdio.h>
 
 #include  "ast.h"
+#include  "compiler.h"
 #include  "parse_action.h"
 
-extern int  yylex(void);
-extern int  yyerror(const char*);
-extern int  yylineno;
-
 %}
 
 %union {
@@ -75,11 +80,12 @@ extern int  yylineno;
 %type <y_AST_Node> relational_expression
 %type <y_AST_Node> equality_expression
 %type <y_AST_Node> assignment_expression
-%type <y_AST_Node> identifier_list
+%type <y_AST_List> identifier_list
 %type <y_AST_Node> statement
 %type <y_AST_Node> compound_statement
 %type <y_AST_Node> expression_statement
 %type <y_AST_Node> if_statement
+%type <y_AST_Node> else_part
 %type <y_AST_Node> iteration_statement
 %type <y_AST_Node> return_statement
 %type <y_AST_Node> declaration
@@ -91,6 +97,10 @@ extern int  yylineno;
 %type <y_AST_Node> block_item
 %type <y_AST_List> block_item_list
 
+%code {
+static int  yylex(YYSTYPE *lval, Compiler *cc);
+}
+
 %start file
 %%
 expression
@@ -99,13 +109,13 @@ expression
 
 identifier
 	: TOKEN_ID
-	{ $$ = act_ID($1); }
+	{ $$ = act_ID(cc, $1); }
 
 primary_expression
 	: identifier
-	{ $$ = $1; }
+	{ $$ = act_ident_exp(cc, $1); }
 	| TOKEN_CONST_INT
-	{ $$ = act_const_int($1); }
+	{ $$ = act_const_int(cc, $1); }
 	| TOKEN_LPAREN expression TOKEN_RPAREN
 	{ $$ = $2; }
 
@@ -113,85 +123,85 @@ postfix_expression
 	: primary_expression
 	{ $$ = $1; }
 	| identifier TOKEN_LPAREN argument_expression_list TOKEN_RPAREN
-	{ $$ = act_postfix_func($1, $3); }
+	{ $$ = act_postfix_func(cc, $1, $3); }
 	| identifier TOKEN_LPAREN TOKEN_RPAREN
-	{ $$ = act_postfix_func($1, NULL); }
+	{ $$ = act_postfix_func(cc, $1, NULL); }
 	
 argument_expression_list
 	: assignment_expression
-	{ $$ = act_argument_list(NULL, $1); }
+	{ $$ = act_argument_list(cc, NULL, $1); }
 	| argument_expression_list TOKEN_COMMA assignment_expression
-	{ $$ = act_argument_list($1, $3); }
+	{ $$ = act_argument_list(cc, $1, $3); }
 
 unary_expression
 	: postfix_expression
 	{ $$ = $1; }
 	| TOKEN_PLUS unary_expression
-	{ $$ = act_unary_expr(AST_EXP_UNARY_PLUS, $2); }
+	{ $$ = act_unary_expr(cc, AST_EXP_UNARY_PLUS, $2); }
 	| TOKEN_MINUS unary_expression
-	{ $$ = act_unary_expr(AST_EXP_UNARY_MINUS, $2); }
+	{ $$ = act_unary_expr(cc, AST_EXP_UNARY_MINUS, $2); }
 
 multiplicative_expression
 	: unary_expression
 	{ $$ = $1; }
 	| multiplicative_expression TOKEN_ASTERISK unary_expression
-	{ $$ = act_expr_n2(AST_EXP_MUL, $1, $3); }
+	{ $$ = act_expr_n2(cc, AST_EXP_MUL, $1, $3); }
 	| multiplicative_expression TOKEN_SLASH unary_expression
-	{ $$ = act_expr_n2(AST_EXP_DIV, $1, $3); }
+	{ $$ = act_expr_n2(cc, AST_EXP_DIV, $1, $3); }
 
 additive_expression
 	: multiplicative_expression
 	{ $$ =$1; }
 	| additive_expression TOKEN_PLUS  multiplicative_expression
-	{ $$ = act_expr_n2(AST_EXP_ADD, $1, $3); }
+	{ $$ = act_expr_n2(cc, AST_EXP_ADD, $1, $3); }
 	| additive_expression TOKEN_MINUS multiplicative_expression
-	{ $$ = act_expr_n2(AST_EXP_SUB, $1, $3); }
+	{ $$ = act_expr_n2(cc, AST_EXP_SUB, $1, $3); }
 
 relational_expression
 	: additive_expression
 	{ $$ = $1; }
 	| relational_expression TOKEN_LT additive_expression
-	{ $$ = act_expr_n2(AST_EXP_LT, $1, $3); }
+	{ $$ = act_expr_n2(cc, AST_EXP_LT, $1, $3); }
 	| relational_expression TOKEN_GT additive_expression
-	{ $$ = act_expr_n2(AST_EXP_GT, $1, $3); }
+	{ $$ = act_expr_n2(cc, AST_EXP_GT, $1, $3); }
 	| relational_expression TOKEN_LTE additive_expression
-	{ $$ = act_expr_n2(AST_EXP_LTE, $1, $3); }
+	{ $$ = act_expr_n2(cc, AST_EXP_LTE, $1, $3); }
 	| relational_expression TOKEN_GTE additive_expression
-	{ $$ = act_expr_n2(AST_EXP_GTE, $1, $3); }
+	{ $$ = act_expr_n2(cc, AST_EXP_GTE, $1, $3); }
 
 equality_expression
 	: relational_expression
 	{ $$ = $1; }
 	| equality_expression TOKEN_EQEQ relational_expression
-	{ $$ = act_expr_n2(AST_EXP_EQ, $1, $3); }
+	{ $$ = act_expr_n2(cc, AST_EXP_EQ, $1, $3); }
 	| equality_expression TOKEN_NE relational_expression
-	{ $$ = act_expr_n2(AST_EXP_NE, $1, $3); }
+	{ $$ = act_expr_n2(cc, AST_EXP_NE, $1, $3); }
 
 assignment_expression
 	: equality_expression
 	{ $$ = $1; }
 	| identifier TOKEN_EQ equality_expression
-	{ $$ = act_expr_n2(AST_EXP_ASGN, $1, $3); }
+	{ $$ = act_expr_n2(cc, AST_EXP_ASGN, $1, $3); }
 
 declaration
 	: TOKEN_INT identifier_list TOKEN_SEMICOLON
-	{ $$ = act_dec_int($2); }
+	{ $$ = act_dec_int(cc, $2); }
 
 identifier_list
 	: identifier
-	{ $$ = $1; }
+	{ $$ = act_ident_list(cc, NULL, $1); }
 	| identifier_list TOKEN_COMMA identifier
-	{ $$ = act_ident_list($1, $3); }
+	{ $$ = act_ident_list(cc, $1, $3); }
 
 parameter_list
 	: parameter_declaration
-	{ $$ = act_param_list(NULL, $1); }
+	{ $$ = act_param_list(cc, NULL, $1); }
 	| parameter_list TOKEN_COMMA parameter_declaration
-	{ $$ = act_param_list($1, $3); }
+	{ $$ = act_param_list(cc, $1, $3); }
 
 parameter_declaration
 	: TOKEN_INT identifier
-	{ $$ = act_param_dec($2); }
+	{ $$ = act_param_dec(cc, $2); }
 
 statement
 	: compound_statement
@@ -207,15 +217,15 @@ statement
 
 compound_statement
 	: TOKEN_LBRACE block_item_list TOKEN_RBRACE
-	{ $$ = act_compound_stm($2); }
+	{ $$ = act_compound_stm(cc, $2); }
 	| TOKEN_LBRACE TOKEN_RBRACE
-	{ $$ = act_compound_stm(NULL); }
+	{ $$ = act_compound_stm(cc, NULL); }
 
 block_item_list
 	: block_item
-	{ $$ = act_block_item($1); }
+	{ $$ = act_block_item(cc, $1); }
 	| block_item_list block_item
-	{ $$ = act_block_item_list($1, $2); }
+	{ $$ = act_block_item_list(cc, $1, $2); }
 
 block_item
 	: declaration
@@ -225,60 +235,103 @@ block_item
 
 expression_statement
 	: expression TOKEN_SEMICOLON
-	{ $$ = act_exp_stm($1); }
+	{ $$ = act_exp_stm(cc, $1); }
 	| TOKEN_SEMICOLON
-	{ $$ = act_exp_stm(NULL); }
+	{ $$ = act_exp_stm(cc, NULL); }
 
+/* 途中のアクションは、-O0で分岐命令とラベルを出力する位置 */
 if_statement
-	: TOKEN_IF TOKEN_LPAREN expression TOKEN_RPAREN statement
-	{ $$ = act_if_stm($3, $5, NULL); }
-	| TOKEN_IF TOKEN_LPAREN expression TOKEN_RPAREN statement TOKEN_ELSE statement
-	{ $$ = act_if_stm($3, $5, $7); }
+	: TOKEN_IF TOKEN_LPAREN expression TOKEN_RPAREN
+	{ act_if_cond(cc, $3); }
+	  statement else_part
+	{ $$ = act_if_stm(cc, $3, $6, $7); }
+
+else_part
+	: %empty
+	{ $$ = NULL; }
+	| TOKEN_ELSE
+	{ act_else(cc); }
+	  statement
+	{ $$ = $3; }
 
 iteration_statement
-	: TOKEN_WHILE TOKEN_LPAREN expression TOKEN_RPAREN statement
-	{ $$ = act_while_stm($3, $5); }
-	| TOKEN_FOR TOKEN_LPAREN expression TOKEN_SEMICOLON expression TOKEN_SEMICOLON expression TOKEN_RPAREN statement
-	{ $$ = act_for_stm($3, $5, $7, $9); }
-	| TOKEN_DO statement TOKEN_WHILE TOKEN_LPAREN expression TOKEN_RPAREN
-	{ $$ = act_dowhile_stm($2, $5); }
+	: TOKEN_WHILE
+	{ act_loop_begin(cc); }
+	  TOKEN_LPAREN expression TOKEN_RPAREN
+	{ act_while_cond(cc, $4); }
+	  statement
+	{ $$ = act_while_stm(cc, $4, $7); }
+	| TOKEN_FOR TOKEN_LPAREN expression TOKEN_SEMICOLON
+	{ act_for_init(cc, $3); }
+	  expression TOKEN_SEMICOLON
+	{ act_for_cond(cc, $6); }
+	  expression TOKEN_RPAREN
+	{ act_for_step(cc, $9); }
+	  statement
+	{ $$ = act_for_stm(cc, $3, $6, $9, $12); }
+	| TOKEN_DO
+	{ act_loop_begin(cc); }
+	  statement TOKEN_WHILE TOKEN_LPAREN expression TOKEN_RPAREN
+	{ $$ = act_dowhile_stm(cc, $3, $6); }
 /** REPORT3
     このあたりにdo-while文のルールを追加する
  */
 
 return_statement
 	: TOKEN_RETURN expression TOKEN_SEMICOLON
-	{ $$ = act_return_stm($2); }
+	{ $$ = act_return_stm(cc, $2); }
 	| TOKEN_RETURN TOKEN_SEMICOLON
-	{ $$ = act_return_stm(NULL); }
+	{ $$ = act_return_stm(cc, NULL); }
 
 translation_unit
 	: external_declaration
-	{ $$ = act_unit_list(NULL, $1); }
+	{ $$ = act_unit_list(cc, NULL, $1); }
 	| translation_unit external_declaration
-	{ $$ = act_unit_list($1, $2); }
+	{ $$ = act_unit_list(cc, $1, $2); }
 
 external_declaration
 	: function_definition
 	{ $$ = $1; }
 
 function_definition
-	: identifier TOKEN_LPAREN parameter_list TOKEN_RPAREN compound_statement
-	{ $$ = act_function_def($1, $3, $5); }
-	| identifier TOKEN_LPAREN TOKEN_RPAREN compound_statement
-	{ $$ = act_function_def($1, NULL, $4); }
+	: identifier TOKEN_LPAREN parameter_list TOKEN_RPAREN
+	{ act_function_begin(cc, $1); }
+	  compound_statement
+	{ $$ = act_function_def(cc, $1, $3, $6); }
+	| identifier TOKEN_LPAREN TOKEN_RPAREN
+	{ act_function_begin(cc, $1); }
+	  compound_statement
+	{ $$ = act_function_def(cc, $1, NULL, $5); }
 
 file
 	: translation_unit
-	{ AST_root = $1; }
+	{ cc->ast_root = $1; }
 
 %%
 
-extern int yynerrs;
+/* 関数毎のキャッシュを使う時は、読んだトークンをハッシュ値に加えていく */
+int
+yylex(YYSTYPE *lval, Compiler *cc)
+{
+    int  tok = lex_token(lval, cc);
+
+    if (cc->cache.dir != NULL) {
+	cache_token(cc, tok, lval);
+    }
+    return tok;
+}
 
+/* 純粋な構文解析器のyynerrsはyyparseの局所変数なので、
+   意味解析のエラーと合わせてcc->nerrsで数える */
 int
-yyerror(const char *mes)
+yyerror(Compiler *cc, const char *mes)
 {
-    fprintf(stderr, "[error %d] line %d: %s\n", yynerrs, yylineno, mes);
+    if (cc->chunk != NULL) {
+	/* エラーの番号は前の部分のエラーの数が決まってから付ける */
+	front_syntax_error(cc, mes);
+	return 0;
+    }
+    cc->nerrs++;
+    diag(cc, "[error %d] line %d: %s\n", cc->nerrs, lex_lineno(cc), mes);
     return 0;
 }
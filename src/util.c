@@ -6,58 +6,619 @@
     2016年 木村啓二
 */
 
+#include  <errno.h>
+#include  <pthread.h>
+#include  <stdint.h>
 #include  <stdio.h>
+#include  <string.h>
+#include  <unistd.h>
 #include  "util.h"
 
+/*
+ * 確保の記録
+ * 記録中にx*allocで確保した領域の前には、大きさと用途（AllocHead）を置く
+ * ALLOC_HEADはmallocの返す番地の整列を崩さない大きさにしておく
+ */
+#define  ALLOC_HEAD  16
+/* 大きさの区分。8以下, 16以下, ..., 1M以下, それ以上 */
+#define  ALLOC_CLASSES  19
+#define  ALLOC_MIN_CLASS  8
+
+typedef struct AllocHead {
+    size_t  size;
+    int  tag;
+} AllocHead;
+
+typedef struct AllocCount {
+    long  count;
+    size_t  bytes;		/* 要求された大きさの合計 */
+} AllocCount;
+
+typedef struct AllocStats {
+    AllocCount  heap;		/* x*alloc（xreallocも1回と数える） */
+    AllocCount  arena;		/* arena_alloc */
+    size_t  live, peak;		/* x*allocで確保して解放していない大きさ */
+} AllocStats;
+
+/* プロセス全体で1つ。スレッド間ではprof_lockで守る */
+static pthread_mutex_t  prof_lock = PTHREAD_MUTEX_INITIALIZER;
+static struct {
+    int  on;
+    AllocStats  tag[NUM_ALLOC_TAGS];
+    AllocStats  total;
+    AllocCount  heap_class[ALLOC_CLASSES];
+    AllocCount  arena_class[ALLOC_CLASSES];
+} prof;
+
+/* 続行できないエラーの抜け出し先。スレッド毎に持つ */
+static __thread struct {
+    void  (*fn)(void *arg, const char *mes);
+    void  *arg;
+} escape;
+
+static const char *alloc_tag_name[NUM_ALLOC_TAGS] = {
+    "other", "ast_node", "ast_list", "symtab", "label", "ident",
+    "arena_chunk", "source", "output", "cache", "ir"
+};
+
+static int  size_class(size_t size);
+static void count_heap(int tag, size_t size, size_t old, int old_tag);
+static void count_arena(int tag, size_t size);
+static void *set_head(void *base, size_t size, int tag);
+static void no_room(const char *what) __attribute__((noreturn));
+static void run_escape(const char *mes);
+static void write_str(int fd, const char *s);
+
+int
+size_class(size_t size)
+{
+    size_t  max = ALLOC_MIN_CLASS;
+    int  c = 0;
+
+    while (c < ALLOC_CLASSES-1 && size > max) {
+	max <<= 1;
+	c++;
+    }
+    return c;
+}
+
+/* old_tagの大きさoldの領域（oldが0なら無し）を、tagの大きさsizeの領域にした */
+void
+count_heap(int tag, size_t size, size_t old, int old_tag)
+{
+    AllocStats *t = &prof.tag[tag];
+    AllocCount *c = &prof.heap_class[size_class(size)];
+
+    pthread_mutex_lock(&prof_lock);
+    t->heap.count++;
+    t->heap.bytes += size;
+    prof.total.heap.count++;
+    prof.total.heap.bytes += size;
+    c->count++;
+    c->bytes += size;
+    prof.tag[old_tag].live -= old;
+    prof.total.live -= old;
+    t->live += size;
+    prof.total.live += size;
+    if (t->peak < t->live) {
+	t->peak = t->live;
+    }
+    if (prof.total.peak < prof.total.live) {
+	prof.total.peak = prof.total.live;
+    }
+    pthread_mutex_unlock(&prof_lock);
+}
+
+void
+count_arena(int tag, size_t size)
+{
+    AllocCount *c = &prof.arena_class[size_class(size)];
+
+    pthread_mutex_lock(&prof_lock);
+    prof.tag[tag].arena.count++;
+    prof.tag[tag].arena.bytes += size;
+    prof.total.arena.count++;
+    prof.total.arena.bytes += size;
+    c->count++;
+    c->bytes += size;
+    pthread_mutex_unlock(&prof_lock);
+}
+
+/* 管理情報を書き込み、利用者に返す番地を返す */
 void*
-xmalloc(size_t size)
+set_head(void *base, size_t size, int tag)
 {
-    void  *p;
+    AllocHead *h = base;
+
+    h->size = size;
+    h->tag = tag;
+    return (char*)base+ALLOC_HEAD;
+}
 
-    if ((p = malloc(size)) == NULL) {
-	fprintf(stderr, "No room for calloc.\n");
-	abort();
+void
+no_room(const char *what)
+{
+    char  mes[64];
+
+    snprintf(mes, sizeof(mes), "No room for %s.", what);
+    run_escape(mes);
+    fprintf(stderr, "%s\n", mes);
+    abort();
+}
+
+/* 抜け出し先があれば呼ぶ。その中でまた失敗したらプロセスを終了するよう、先に解除する */
+void
+run_escape(const char *mes)
+{
+    void  (*fn)(void *arg, const char *mes) = escape.fn;
+
+    if (fn != NULL) {
+	escape.fn = NULL;
+	fn(escape.arg, mes);
     }
+}
+
+void
+set_fatal_escape(void (*fn)(void *arg, const char *mes), void *arg)
+{
+    escape.fn = fn;
+    escape.arg = arg;
+}
 
-    return  p;
+void
+write_str(int fd, const char *s)
+{
+    write_all(fd, s, strlen(s));
+}
+
+void
+alloc_profile_begin(void)
+{
+    prof.on = 1;
+}
+
+void*
+xmalloc(size_t size)
+{
+    return xmalloc_tag(size, ALLOC_OTHER);
 }
 
 void*
 xcalloc(size_t count, size_t size)
+{
+    return xcalloc_tag(count, size, ALLOC_OTHER);
+}
+
+void*
+xrealloc(void *p, size_t size)
+{
+    return xrealloc_tag(p, size, ALLOC_OTHER);
+}
+
+void*
+xmalloc_tag(size_t size, int tag)
 {
     void  *p;
 
-    if ((p = calloc(count, size)) == NULL) {
-	fprintf(stderr, "No room for calloc.\n");
-	abort();
+    if (!prof.on) {
+	if ((p = malloc(size)) == NULL) {
+	    no_room("malloc");
+	}
+	return p;
     }
+    if ((p = malloc(ALLOC_HEAD+size)) == NULL) {
+	no_room("malloc");
+    }
+    count_heap(tag, size, 0, tag);
+    return set_head(p, size, tag);
+}
 
-    return p;
+void*
+xcalloc_tag(size_t count, size_t size, int tag)
+{
+    void  *p;
+
+    if (!prof.on) {
+	if ((p = calloc(count, size)) == NULL) {
+	    no_room("calloc");
+	}
+	return p;
+    }
+    if (size != 0 && count > (SIZE_MAX-ALLOC_HEAD)/size) {
+	no_room("calloc");
+    }
+    size *= count;
+    if ((p = calloc(1, ALLOC_HEAD+size)) == NULL) {
+	no_room("calloc");
+    }
+    count_heap(tag, size, 0, tag);
+    return set_head(p, size, tag);
 }
 
 void*
-xrealloc(void *p, size_t size)
+xrealloc_tag(void *p, size_t size, int tag)
 {
+    AllocHead  h = { 0, tag };
     void *np;
 
-    if ((np = realloc(p, size)) == NULL) {
-	fprintf(stderr, "No room for realloc.\n");
-	abort();
+    if (!prof.on) {
+	if ((np = realloc(p, size)) == NULL) {
+	    no_room("realloc");
+	}
+	return np;
     }
-
-    return np;
+    if (p != NULL) {
+	p = (char*)p-ALLOC_HEAD;
+	h = *(AllocHead*)p;
+    }
+    if ((np = realloc(p, ALLOC_HEAD+size)) == NULL) {
+	no_room("realloc");
+    }
+    count_heap(tag, size, h.size, h.tag);
+    return set_head(np, size, tag);
 }
 
 void
 xfree(void *ptr)
 {
+    AllocHead *h;
+
+    if (prof.on && ptr != NULL) {
+	h = (AllocHead*)((char*)ptr-ALLOC_HEAD);
+	pthread_mutex_lock(&prof_lock);
+	prof.tag[h->tag].live -= h->size;
+	prof.total.live -= h->size;
+	pthread_mutex_unlock(&prof_lock);
+	ptr = h;
+    }
     free(ptr);
 }
 
+/*
+ * 記録の書き出し
+ * 領域（arena_alloc）から確保したものは、領域のチャンク（arena_chunk）の中にある
+ */
+void
+alloc_report(int fd, int json)
+{
+    char  buf[256];
+    AllocStats *t;
+    AllocCount *h, *a;
+    size_t  max;
+    int  i, n;
+
+    pthread_mutex_lock(&prof_lock);
+    if (json) {
+	/* {"report":"alloc","tags":{"ast_node":{"heap_count":..,"heap_bytes":..,
+	    "arena_count":..,"arena_bytes":..,"live_bytes":..,"peak_bytes":..},..},
+	    "total":{..},"size_classes":[{"max_bytes":8,"heap_count":..,..},..]} */
+	write_str(fd, "{\"report\":\"alloc\",\"tags\":{");
+	for (i = 0; i <= NUM_ALLOC_TAGS; i++) {
+	    t = (i < NUM_ALLOC_TAGS) ? &prof.tag[i] : &prof.total;
+	    n = snprintf(buf, sizeof(buf),
+			 "%s\"%s\":{\"heap_count\":%ld,\"heap_bytes\":%lu,"
+			 "\"arena_count\":%ld,\"arena_bytes\":%lu,"
+			 "\"live_bytes\":%lu,\"peak_bytes\":%lu}",
+			 (i == 0) ? "" : (i < NUM_ALLOC_TAGS) ? "," : "},",
+			 (i < NUM_ALLOC_TAGS) ? alloc_tag_name[i] : "total",
+			 t->heap.count, (unsigned long)t->heap.bytes,
+			 t->arena.count, (unsigned long)t->arena.bytes,
+			 (unsigned long)t->live, (unsigned long)t->peak);
+	    write_all(fd, buf, n);
+	}
+	write_str(fd, ",\"size_classes\":[");
+	for (i = 0, max = ALLOC_MIN_CLASS; i < ALLOC_CLASSES; i++, max <<= 1) {
+	    h = &prof.heap_class[i];
+	    a = &prof.arena_class[i];
+	    n = snprintf(buf, sizeof(buf) - 32, "%s{\"max_bytes\":", (i > 0) ? "," : "");
+	    n += (i < ALLOC_CLASSES-1) ? snprintf(buf+n, 32, "%lu", (unsigned long)max)
+				       : snprintf(buf+n, 32, "null");
+	    n += snprintf(buf+n, sizeof(buf)-n,
+			  ",\"heap_count\":%ld,\"heap_bytes\":%lu,"
+			  "\"arena_count\":%ld,\"arena_bytes\":%lu}",
+			  h->count, (unsigned long)h->bytes, a->count, (unsigned long)a->bytes);
+	    write_all(fd, buf, n);
+	}
+	write_str(fd, "]}\n");
+	pthread_mutex_unlock(&prof_lock);
+	return;
+    }
+
+    n = snprintf(buf, sizeof(buf),
+		 "alloc report\n"
+		 "  tag           heap count   heap bytes  arena count  arena bytes"
+		 "   live bytes   peak bytes\n");
+    write_all(fd, buf, n);
+    for (i = 0; i <= NUM_ALLOC_TAGS; i++) {
+	t = (i < NUM_ALLOC_TAGS) ? &prof.tag[i] : &prof.total;
+	n = snprintf(buf, sizeof(buf), "  %-12s %11ld %12lu %12ld %12lu %12lu %12lu\n",
+		     (i < NUM_ALLOC_TAGS) ? alloc_tag_name[i] : "total",
+		     t->heap.count, (unsigned long)t->heap.bytes,
+		     t->arena.count, (unsigned long)t->arena.bytes,
+		     (unsigned long)t->live, (unsigned long)t->peak);
+	write_all(fd, buf, n);
+    }
+    n = snprintf(buf, sizeof(buf),
+		 "  size class    heap count   heap bytes  arena count  arena bytes\n");
+    write_all(fd, buf, n);
+    for (i = 0, max = ALLOC_MIN_CLASS; i < ALLOC_CLASSES; i++, max <<= 1) {
+	h = &prof.heap_class[i];
+	a = &prof.arena_class[i];
+	if (h->count == 0 && a->count == 0) {
+	    continue;
+	}
+	if (i < ALLOC_CLASSES-1) {
+	    n = snprintf(buf, sizeof(buf), "  <= %-9lu", (unsigned long)max);
+	} else {
+	    n = snprintf(buf, sizeof(buf), "  >  %-9lu", (unsigned long)(max >> 1));
+	}
+	n += snprintf(buf+n, sizeof(buf)-n, " %11ld %12lu %12ld %12lu\n",
+		      h->count, (unsigned long)h->bytes, a->count, (unsigned long)a->bytes);
+	write_all(fd, buf, n);
+    }
+    pthread_mutex_unlock(&prof_lock);
+}
+
 void
 errexit(const char *mes, const char *file, int line)
 {
-    fprintf(stderr, "%s (%s : %d)\n", mes, file, line);
+    char  buf[256];
+    size_t  n;
+
+    /* メッセージの末尾の改行は除く */
+    n = strlen(mes);
+    if (n > 0 && mes[n-1] == '\n') {
+	n--;
+    }
+    snprintf(buf, sizeof(buf), "%.*s (%s : %d)", (int)n, mes, file, line);
+    run_escape(buf);
+    fprintf(stderr, "%s\n", buf);
     exit(-1);
 }
 
+
+/* nバイトを読み切る。途中でEOFになったりエラーになったら-1を返す */
+int
+read_all(int fd, void *buf, size_t n)
+{
+    char  *p = buf;
+    ssize_t  r;
+
+    while (n > 0) {
+	if ((r = read(fd, p, n)) <= 0) {
+	    if (r < 0 && errno == EINTR) {
+		continue;
+	    }
+	    return -1;
+	}
+	p += r;
+	n -= r;
+    }
+    return 0;
+}
+
+int
+write_all(int fd, const void *buf, size_t n)
+{
+    const char  *p = buf;
+    ssize_t  w;
+
+    while (n > 0) {
+	if ((w = write(fd, p, n)) < 0) {
+	    if (errno == EINTR) {
+		continue;
+	    }
+	    return -1;
+	}
+	p += w;
+	n -= w;
+    }
+    return 0;
+}
+
+
+/*
+ * 領域（アリーナ）
+ */
+
+#define  ARENA_CHUNK_SIZE  (64*1024)
+#define  ARENA_ALIGN       8
+
+typedef struct ArenaChunk {
+    struct ArenaChunk *next;
+    size_t  size;
+} ArenaChunk;
+
+/* チャンクの管理情報の後ろから確保を始める */
+#define  CHUNK_HEAD  ((sizeof(ArenaChunk)+ARENA_ALIGN-1) & ~(size_t)(ARENA_ALIGN-1))
+
+static ArenaChunk *pool_get(ArenaPool *pool);
+static int  pool_put(ArenaPool *pool, ArenaChunk *c);
+
+/* 溜めてあるチャンクを1つ取り出し、0クリアして返す。無ければNULL */
+ArenaChunk*
+pool_get(ArenaPool *pool)
+{
+    ArenaChunk  *c;
+
+    if (pool == NULL) {
+	return NULL;
+    }
+    pthread_mutex_lock(&pool->lock);
+    if ((c = pool->free) != NULL) {
+	pool->free = c->next;
+	pool->count--;
+    }
+    pthread_mutex_unlock(&pool->lock);
+    if (c != NULL) {
+	memset(c, 0, ARENA_CHUNK_SIZE);
+    }
+    return c;
+}
+
+/* 標準の大きさのチャンクcをpoolに戻す。戻せなければ0を返す */
+int
+pool_put(ArenaPool *pool, ArenaChunk *c)
+{
+    int  ok = 0;
+
+    if (pool == NULL || c->size != ARENA_CHUNK_SIZE) {
+	return 0;
+    }
+    pthread_mutex_lock(&pool->lock);
+    if (pool->count < pool->max) {
+	c->next = pool->free;
+	pool->free = c;
+	pool->count++;
+	ok = 1;
+    }
+    pthread_mutex_unlock(&pool->lock);
+    return ok;
+}
+
+void*
+arena_alloc(Arena *a, size_t size, int tag)
+{
+    void  *p;
+    size_t  csize;
+    ArenaChunk  *c;
+
+    if (prof.on) {
+	count_arena(tag, size);
+    }
+    size = (size+ARENA_ALIGN-1) & ~(size_t)(ARENA_ALIGN-1);
+    if (a->ptr == NULL || (size_t)(a->end-a->ptr) < size) {
+	/* 大きな要求はそれ専用のチャンクにする */
+	csize = size > ARENA_CHUNK_SIZE/4 ? CHUNK_HEAD+size : ARENA_CHUNK_SIZE;
+	if (csize != ARENA_CHUNK_SIZE || (c = pool_get(a->pool)) == NULL) {
+	    c = xcalloc_tag(1, csize, ALLOC_ARENA);
+	}
+	c->size = csize;
+	c->next = a->chunk;
+	if (a->allocated != NULL) {
+	    *a->allocated += csize;
+	}
+	a->chunk = c;
+	if (csize == ARENA_CHUNK_SIZE || a->ptr == NULL) {
+	    a->ptr = (char*)c+CHUNK_HEAD;
+	    a->end = (char*)c+csize;
+	} else {
+	    /* 使用中のチャンクの残りはそのまま使い続ける */
+	    return (char*)c+CHUNK_HEAD;
+	}
+    }
+    p = a->ptr;
+    a->ptr += size;
+    return p;
+}
+
+char*
+arena_strdup(Arena *a, const char *s)
+{
+    size_t  len = strlen(s)+1;
+
+    return memcpy(arena_alloc(a, len, ALLOC_OTHER), s, len);
+}
+
+void
+arena_free(Arena *a)
+{
+    ArenaChunk  *c, *next;
+
+    for (c = a->chunk; c != NULL; c = next) {
+	next = c->next;
+	if (!pool_put(a->pool, c)) {
+	    xfree(c);
+	}
+    }
+    a->chunk = NULL;
+    a->ptr = a->end = NULL;
+}
+
+void
+arena_pool_init(ArenaPool *pool, int max)
+{
+    pool->free = NULL;
+    pool->count = 0;
+    pool->max = max;
+    pthread_mutex_init(&pool->lock, NULL);
+}
+
+void
+arena_pool_free(ArenaPool *pool)
+{
+    ArenaChunk  *c, *next;
+
+    for (c = pool->free; c != NULL; c = next) {
+	next = c->next;
+	xfree(c);
+    }
+    pool->free = NULL;
+    pool->count = 0;
+    pthread_mutex_destroy(&pool->lock);
+}
+
+
+/*
+ * 並列処理
+ */
+typedef struct ParallelFor {
+    void  (*fn)(void *arg, int i);
+    void  *arg;
+    int  n;
+    int  next;			/* 次に処理するi */
+    pthread_mutex_t  lock;
+} ParallelFor;
+
+static void *
+parallel_worker(void *arg)
+{
+    ParallelFor *p = arg;
+    int  i;
+
+    for (;;) {
+	pthread_mutex_lock(&p->lock);
+	i = p->next++;
+	pthread_mutex_unlock(&p->lock);
+	if (i >= p->n) {
+	    break;
+	}
+	p->fn(p->arg, i);
+    }
+    return NULL;
+}
+
+void
+parallel_for(int n, int njobs, void (*fn)(void *arg, int i), void *arg)
+{
+    ParallelFor  p;
+    pthread_t  *th;
+    int  i, nth;
+
+    if (njobs > n) {
+	njobs = n;
+    }
+    if (njobs <= 1) {
+	for (i = 0; i < n; i++) {
+	    fn(arg, i);
+	}
+	return;
+    }
+    p.fn = fn;
+    p.arg = arg;
+    p.n = n;
+    p.next = 0;
+    pthread_mutex_init(&p.lock, NULL);
+    th = xmalloc((njobs-1)*sizeof(pthread_t));
+    for (nth = 0; nth < njobs-1; nth++) {
+	if (pthread_create(&th[nth], NULL, parallel_worker, &p) != 0) {
+	    break;		/* 作れた分だけで処理する */
+	}
+    }
+    parallel_worker(&p);
+    for (i = 0; i < nth; i++) {
+	pthread_join(th[i], NULL);
+    }
+    xfree(th);
+    pthread_mutex_destroy(&p.lock);
+}
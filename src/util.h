@@ -9,13 +9,100 @@
 #ifndef  UTIL_H
 #define  UTIL_H
 
+#include  <pthread.h>
 #include  <stdlib.h>
 
+/* 確保の用途（--alloc-report） */
+enum {
+    ALLOC_OTHER,		/* 以下のどれでもない */
+    ALLOC_AST_NODE,
+    ALLOC_AST_LIST,		/* ASTの並び（文・実引数・仮引数） */
+    ALLOC_SYMTAB,		/* シンボルテーブルとその索引 */
+    ALLOC_LABEL,		/* 置く前のラベル（direct.c） */
+    ALLOC_IDENT,		/* 識別子の文字列とその表 */
+    ALLOC_ARENA,		/* 領域のチャンク */
+    ALLOC_SOURCE,		/* ソース */
+    ALLOC_OUTPUT,		/* アセンブリ・診断メッセージのバッファ */
+    ALLOC_CACHE,		/* 関数毎のアセンブリのキャッシュ */
+    ALLOC_IR,			/* 中間表現と、そのレジスタ割り付けの作業（--backend=ir） */
+    NUM_ALLOC_TAGS
+};
+
+/* tagは確保の用途（ALLOC_*）。tagの無いものはALLOC_OTHER */
 extern void *xmalloc(size_t size);
 extern void *xcalloc(size_t count, size_t size);
 extern void *xrealloc(void *p, size_t size);
+extern void *xmalloc_tag(size_t size, int tag);
+extern void *xcalloc_tag(size_t count, size_t size, int tag);
+extern void *xrealloc_tag(void *p, size_t size, int tag);
 extern void xfree(void *ptr);
 
-extern void errexit(const char *mes, const char *file, int line);
+/*
+ * 確保の記録（--alloc-report）
+ * alloc_profile_beginの後は、x*allocとarena_allocの確保を用途毎に数える
+ * x*allocで確保したものは、解放していない大きさ（生存量）とその最大値も数える
+ * xfreeで大きさが分かるよう、記録中は確保した領域の前に大きさを置くので、
+ * alloc_profile_beginは最初の確保より前に呼ぶこと
+ */
+extern void alloc_profile_begin(void);
+/* 記録をfdに書き出す。jsonが0でなければ1行のJSONにする */
+extern void alloc_report(int fd, int json);
+
+/*
+ * 続行できないエラー（errexitと確保の失敗）
+ * 呼んだスレッドに抜け出し先が設定されていれば、それを1度だけ呼ぶ
+ * 抜け出し先は戻ってはならない。設定されていなければプロセスを終了する
+ */
+extern void errexit(const char *mes, const char *file, int line) __attribute__((noreturn));
+/* このスレッドの抜け出し先をescape(arg, メッセージ)にする。NULLなら解除する */
+extern void set_fatal_escape(void (*escape)(void *arg, const char *mes), void *arg);
+
+/* fdとの間でちょうどnバイトを読み書きする。できなければ-1を返す */
+extern int read_all(int fd, void *buf, size_t n);
+extern int write_all(int fd, const void *buf, size_t n);
+
+/*
+ * 領域（アリーナ）
+ * 大きなチャンクからポインタを進めるだけで確保し、個別には解放しない
+ * 不要になった時点でarena_freeにより一括で解放する
+ */
+typedef struct Arena {
+    struct ArenaChunk *chunk;	/* 使用中のチャンク（リストの先頭） */
+    char  *ptr;			/* 次に確保する番地 */
+    char  *end;			/* 使用中のチャンクの末尾 */
+    struct ArenaPool *pool;	/* 解放したチャンクの戻し先（NULLならfreeする） */
+    size_t  *allocated;		/* 確保したチャンクの大きさを足していく先（NULLなら数えない） */
+} Arena;
+
+/*
+ * 解放されたチャンクの溜め置き
+ * 何度もコンパイルするプロセス（--server）では、チャンクをfreeせずにここへ戻し、
+ * 次の確保で使い回す。複数のスレッドの領域が共有してよい
+ */
+typedef struct ArenaPool {
+    struct ArenaChunk *free;	/* 空きチャンクのリスト */
+    int  count;			/* 空きチャンクの数 */
+    int  max;			/* これを超えて溜めない */
+    pthread_mutex_t  lock;
+} ArenaPool;
+
+/* 領域aからtag（ALLOC_*）の用途でsizeバイトを確保する。確保した領域は0クリアされている */
+extern void *arena_alloc(Arena *a, size_t size, int tag);
+extern char *arena_strdup(Arena *a, const char *s);
+/* 領域aから確保した全てを解放する */
+extern void arena_free(Arena *a);
+
+/* 最大maxチャンクを溜めておくpoolを用意する */
+extern void arena_pool_init(ArenaPool *pool, int max);
+/* poolに溜まったチャンクを全て解放する */
+extern void arena_pool_free(ArenaPool *pool);
+
+/*
+ * 並列処理
+ * fn(arg, i)をi = 0, 1, ..., n-1について1回ずつ呼ぶ
+ * njobs個のスレッド（呼び出したスレッドを含む）が小さいiから順に取り合って処理し、
+ * 全て終わってから戻る。njobsが1以下なら呼び出したスレッドだけで順に処理する
+ */
+extern void parallel_for(int n, int njobs, void (*fn)(void *arg, int i), void *arg);
 
 #endif	/* UTIL_H */